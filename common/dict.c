@@ -289,3 +289,24 @@ const char **dict_keys(DICT *dict)
   /* done */
   return values;
 }
+
+void dict_loop_first(DICT *dict, DICT_LOOP *loop)
+{
+  loop->idx = 0;
+  loop->entry = dict->table[0];
+}
+
+const char *dict_loop_next(DICT *dict, DICT_LOOP *loop)
+{
+  const struct dict_entry *entry;
+  /* find the next non-empty linked list in the hashtable */
+  while (loop->entry == NULL)
+  {
+    if (loop->idx + 1 >= dict->size)
+      return NULL;
+    loop->entry = dict->table[++loop->idx];
+  }
+  entry = (const struct dict_entry *)loop->entry;
+  loop->entry = entry->next;
+  return entry->key;
+}
@@ -68,4 +68,18 @@ void dict_free(DICT *dict);
 const char **dict_keys(DICT *dict)
   MUST_USE;
 
+/* The position of a loop over the keys of a dictionary. */
+typedef struct dict_loop {
+  int idx;
+  const void *entry;
+} DICT_LOOP;
+
+/* Start a loop over the keys of the dictionary. */
+void dict_loop_first(DICT *dict, DICT_LOOP *loop);
+
+/* Return the next key of the loop or NULL if all keys have been
+   returned. Unlike dict_keys() this does not copy the keys. The
+   dictionary should not be modified during the loop. */
+const char *dict_loop_next(DICT *dict, DICT_LOOP *loop);
+
 #endif /* COMMON__DICT_H */
@@ -0,0 +1,117 @@
+/*
+   nslcd-cache.h - layout of the shared memory cache of NSS lookups
+
+   Copyright (C) 2026 Arthur de Jong
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301 USA
+*/
+
+#ifndef COMMON__NSLCD_CACHE_H
+#define COMMON__NSLCD_CACHE_H 1
+
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif /* HAVE_STDINT_H */
+
+/*
+   nslcd publishes responses to passwd, group and initgroups lookups in a
+   file that the NSS module maps read-only so that these lookups can be
+   answered without connecting to nslcd.
+
+   The file consists of a header followed by numslots slots of slotsize
+   bytes each. A request is identified by the action and the value of the
+   request parameter (the name or the uid_t or gid_t in host byte order)
+   and is stored in one of SHMCACHE_WAYS consecutive slots, starting at the
+   slot selected by the hash of the action and key. The data of a slot
+   holds the key followed by the complete response (including the version
+   and action header and the NSLCD_RESULT_END marker).
+
+   Each slot is protected by a sequence counter that is odd while nslcd is
+   updating the slot. A reader copies the slot and only uses the copy if
+   the counter was even and did not change while copying. nslcd clears the
+   valid field in the header when it no longer maintains the file.
+
+   Responses that contain password hashes for root (passwd lookups by a
+   privileged caller) are never published.
+*/
+
+/* identifies the file format */
+#define SHMCACHE_MAGIC 0x6e6c6331
+
+/* the default dimensions of the cache */
+#define SHMCACHE_NUMSLOTS 4096
+#define SHMCACHE_SLOTSIZE 1024
+
+/* the number of slots that are tried for a single key */
+#define SHMCACHE_WAYS 4
+
+/* the size that is reserved for the header */
+#define SHMCACHE_HEADERSIZE 64
+
+struct shmcache_header {
+  uint32_t magic;
+  uint32_t numslots;
+  uint32_t slotsize;
+  volatile uint32_t valid;
+};
+
+struct shmcache_slot {
+  volatile uint32_t seq;
+  int32_t action;
+  uint32_t hash;
+  uint32_t keylen;
+  uint32_t datalen;
+  uint32_t reserved;
+  int64_t expires;
+  uint8_t data[8];
+};
+
+/* the number of bytes in a slot that can hold the key and response */
+#define SHMCACHE_DATASIZE(header)                                           \
+  ((header)->slotsize - offsetof(struct shmcache_slot, data))
+
+/* the total size of the file */
+#define SHMCACHE_FILESIZE(numslots, slotsize)                               \
+  (SHMCACHE_HEADERSIZE + (size_t)(numslots) * (size_t)(slotsize))
+
+/* return the slot with the specified index */
+#define SHMCACHE_SLOT(header, idx)                                          \
+  ((struct shmcache_slot *)((uint8_t *)(header) + SHMCACHE_HEADERSIZE +     \
+                            (size_t)(idx) * (header)->slotsize))
+
+/* a full memory barrier, the cache is not used if this is not available */
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+#define SHMCACHE_BARRIER() __sync_synchronize()
+#else /* not HAVE___SYNC_LOCK_TEST_AND_SET */
+#define SHMCACHE_BARRIER() do { } while (0)
+#endif /* not HAVE___SYNC_LOCK_TEST_AND_SET */
+
+/* calculate the hash of the action and key (FNV-1a) */
+static inline uint32_t shmcache_hash(int32_t action, const void *key,
+                                     size_t keylen)
+{
+  const uint8_t *ptr = (const uint8_t *)key;
+  uint32_t hash = 2166136261U;
+  size_t i;
+  for (i = 0; i < sizeof(int32_t); i++)
+    hash = (hash ^ ((uint32_t)action >> (i * 8) & 0xff)) * 16777619U;
+  for (i = 0; i < keylen; i++)
+    hash = (hash ^ ptr[i]) * 16777619U;
+  return hash;
+}
+
+#endif /* not COMMON__NSLCD_CACHE_H */
@@ -34,9 +34,13 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include "nslcd.h"
 #include "nslcd-prot.h"
+#include "nslcd-cache.h"
 #include "compat/socket.h"
 
 /* read timeout is 60 seconds because looking up stuff may take some time
@@ -50,12 +54,38 @@
 #define WRITEBUFFER_MINSIZE 32
 #define WRITEBUFFER_MAXSIZE 32
 
+/* the number of connections that are kept for reuse */
+#define KEEP_CONNECTIONS 4
+
 /* Note that the READBUFFER_MAXSIZE should be large enough to hold any single
    result entity as defined in nslcd.h because the get*ent() functions expect
    to be able to tio_reset() the stream to re-read the current entity.
    Since group entities can grow arbitrarily large, this setting limits the
    number of users that can be put in a group. */
 
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+/* Connections to the server that can be used for another request. Each
+   entry is protected by a lock that is only tried (never waited for) so
+   this is safe in threads and signal handlers. The process and effective
+   user are recorded to not reuse connections after fork() or setuid()
+   because the server determines the credentials on connect(). The device
+   and inode of the socket are recorded to detect that the application
+   closed the file descriptor or used dup2() to replace it. */
+static volatile int keep_lock[KEEP_CONNECTIONS];
+static TFILE *keep_fp[KEEP_CONNECTIONS];
+static pid_t keep_pid[KEEP_CONNECTIONS];
+static uid_t keep_uid[KEEP_CONNECTIONS];
+static dev_t keep_dev[KEEP_CONNECTIONS];
+static ino_t keep_ino[KEEP_CONNECTIONS];
+
+/* The mapping of the shared memory cache that is maintained by nslcd. A
+   mapping is never unmapped because other threads may still be reading
+   from it, a new one is made when nslcd is restarted. Opening the file is
+   tried at most once every second. */
+static struct shmcache_header *volatile shmcache = NULL;
+static volatile time_t shmcache_retry = 0;
+#endif /* HAVE___SYNC_LOCK_TEST_AND_SET */
+
 /* returns a socket to the server or NULL on error (see errno),
    socket should be closed with fclose() */
 TFILE *nslcd_client_open()
@@ -93,3 +123,229 @@ TFILE *nslcd_client_open()
   /* return the stream */
   return fp;
 }
+
+/* read a single 32-bit integer from the stream */
+static int client_readint32(TFILE *fp, int32_t *value)
+{
+  if (tio_read(fp, value, sizeof(int32_t)))
+    return -1;
+  *value = (int32_t)ntohl(*value);
+  return 0;
+}
+
+int nslcd_client_handles(int32_t action)
+{
+  TFILE *fp;
+  int32_t request[3];
+  int32_t version, reqaction, code, len;
+  char actions[1024];
+  char name[12];
+  if ((fp = nslcd_client_open()) == NULL)
+    return -1;
+  /* ask for the requests that older versions may not handle */
+  request[0] = htonl(NSLCD_VERSION);
+  request[1] = htonl(NSLCD_ACTION_CONFIG_GET);
+  request[2] = htonl(NSLCD_CONFIG_ACTIONS);
+  if ((tio_write(fp, request, sizeof(request))) || (tio_flush(fp)) ||
+      (client_readint32(fp, &version)) ||
+      (version != (int32_t)NSLCD_VERSION) ||
+      (client_readint32(fp, &reqaction)) ||
+      (reqaction != (int32_t)NSLCD_ACTION_CONFIG_GET) ||
+      (client_readint32(fp, &code)) ||
+      (code != (int32_t)NSLCD_RESULT_BEGIN) ||
+      (client_readint32(fp, &len)))
+  {
+    (void)tio_close(fp);
+    return -1;
+  }
+  /* older versions of nslcd do not know the option and return no value */
+  if (len == (int32_t)NSLCD_RESULT_END)
+  {
+    nslcd_client_keep(fp);
+    return 0;
+  }
+  if ((len < 0) || (len >= (int32_t)sizeof(actions)) ||
+      (tio_read(fp, actions, (size_t)len)) ||
+      (client_readint32(fp, &code)) || (code != (int32_t)NSLCD_RESULT_END))
+  {
+    (void)tio_close(fp);
+    return -1;
+  }
+  nslcd_client_keep(fp);
+  actions[len] = '\0';
+  snprintf(name, sizeof(name), "0x%08x", (unsigned int)action);
+  return strstr(actions, name) != NULL;
+}
+
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+/* return the current mapping of the shared memory cache or NULL if the
+   cache is not available */
+static struct shmcache_header *shmcache_get(void)
+{
+  struct shmcache_header *header = shmcache;
+  struct stat st;
+  time_t now;
+  void *map;
+  int fd;
+  if ((header != NULL) && (header->valid))
+    return header;
+  /* do not try to open the file too often */
+  now = time(NULL);
+  if (now < shmcache_retry)
+    return NULL;
+  shmcache_retry = now + 1;
+  /* map the file */
+  if ((fd = open(NSLCD_CACHEFILE, O_RDONLY)) < 0)
+    return NULL;
+  if ((fstat(fd, &st)) || (st.st_size < SHMCACHE_HEADERSIZE))
+  {
+    (void)close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  (void)close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+  /* check the file format */
+  header = (struct shmcache_header *)map;
+  if ((header->magic != SHMCACHE_MAGIC) || (!header->valid) ||
+      (header->slotsize <= offsetof(struct shmcache_slot, data)) ||
+      (header->numslots < SHMCACHE_WAYS) ||
+      ((size_t)st.st_size <
+       SHMCACHE_FILESIZE(header->numslots, header->slotsize)))
+  {
+    (void)munmap(map, (size_t)st.st_size);
+    return NULL;
+  }
+  shmcache = header;
+  return header;
+}
+#endif /* HAVE___SYNC_LOCK_TEST_AND_SET */
+
+TFILE *nslcd_client_cached(int32_t action, const void *key, size_t keylen)
+{
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+  struct shmcache_header *header;
+  struct shmcache_slot *slot;
+  uint32_t hash, seq, datalen;
+  int64_t expires;
+  uint8_t *data;
+  int32_t tmp[2];
+  TFILE *fp;
+  int i;
+  /* passwd responses for root contain password hashes and are not shared */
+  if (((action >> 16) == (NSLCD_ACTION_PASSWD_BYNAME >> 16)) &&
+      (geteuid() == 0))
+    return NULL;
+  if ((header = shmcache_get()) == NULL)
+    return NULL;
+  hash = shmcache_hash(action, key, keylen);
+  for (i = 0; i < SHMCACHE_WAYS; i++)
+  {
+    slot = SHMCACHE_SLOT(header, (hash + i) % header->numslots);
+    seq = slot->seq;
+    if (seq & 1)
+      continue;
+    SHMCACHE_BARRIER();
+    datalen = slot->datalen;
+    expires = slot->expires;
+    if ((slot->hash != hash) || (slot->action != action) ||
+        (slot->keylen != keylen) ||
+        (keylen + datalen > SHMCACHE_DATASIZE(header)) ||
+        (datalen < 3 * sizeof(int32_t)) ||
+        (memcmp(slot->data, key, keylen) != 0))
+      continue;
+    /* copy the response and check that the slot was not changed */
+    if ((data = (uint8_t *)malloc(datalen)) == NULL)
+      return NULL;
+    memcpy(data, slot->data + keylen, datalen);
+    SHMCACHE_BARRIER();
+    if ((slot->seq != seq) || (expires <= (int64_t)time(NULL)))
+    {
+      free(data);
+      return NULL;
+    }
+    /* check and skip the response header */
+    memcpy(tmp, data, sizeof(tmp));
+    if (((int32_t)ntohl(tmp[0]) != (int32_t)NSLCD_VERSION) ||
+        ((int32_t)ntohl(tmp[1]) != action) ||
+        ((fp = tio_memopen(data, datalen)) == NULL))
+    {
+      free(data);
+      return NULL;
+    }
+    (void)tio_skip(fp, sizeof(tmp));
+    return fp;
+  }
+#endif /* HAVE___SYNC_LOCK_TEST_AND_SET */
+  return NULL;
+}
+
+TFILE *nslcd_client_kept(void)
+{
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+  int i;
+  int ours;
+  TFILE *fp;
+  dev_t dev;
+  ino_t ino;
+  struct stat st;
+  pid_t pid = getpid();
+  uid_t uid = geteuid();
+  for (i = 0; i < KEEP_CONNECTIONS; i++)
+  {
+    if (__sync_lock_test_and_set(&keep_lock[i], 1))
+      continue;
+    fp = keep_fp[i];
+    keep_fp[i] = NULL;
+    ours = (keep_pid[i] == pid) && (keep_uid[i] == uid);
+    dev = keep_dev[i];
+    ino = keep_ino[i];
+    __sync_lock_release(&keep_lock[i]);
+    if (fp == NULL)
+      continue;
+    /* if the file descriptor is no longer our socket it belongs to the
+       application and should not be touched */
+    if ((fstat(tio_fileno(fp), &st) != 0) || (!S_ISSOCK(st.st_mode)) ||
+        (st.st_dev != dev) || (st.st_ino != ino))
+    {
+      tio_free(fp);
+      continue;
+    }
+    /* only use the connection if it is ours and the server did not
+       close it (an older server closes it after every request) */
+    if ((ours) && (!tio_readable(fp)))
+      return fp;
+    (void)tio_close(fp);
+  }
+#endif /* HAVE___SYNC_LOCK_TEST_AND_SET */
+  return NULL;
+}
+
+void nslcd_client_keep(TFILE *fp)
+{
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+  int i;
+  struct stat st;
+  if (fstat(tio_fileno(fp), &st) == 0)
+  {
+    for (i = 0; i < KEEP_CONNECTIONS; i++)
+    {
+      if (__sync_lock_test_and_set(&keep_lock[i], 1))
+        continue;
+      if (keep_fp[i] == NULL)
+      {
+        keep_fp[i] = fp;
+        keep_pid[i] = getpid();
+        keep_uid[i] = geteuid();
+        keep_dev[i] = st.st_dev;
+        keep_ino[i] = st.st_ino;
+        __sync_lock_release(&keep_lock[i]);
+        return;
+      }
+      __sync_lock_release(&keep_lock[i]);
+    }
+  }
+#endif /* HAVE___SYNC_LOCK_TEST_AND_SET */
+  (void)tio_close(fp);
+}
@@ -34,7 +34,10 @@
      ERROR_OUT_WRITEERROR(fp)
      ERROR_OUT_READERROR(fp)
      ERROR_OUT_BUFERROR(fp)
-     ERROR_OUT_NOSUCCESS(fp) */
+     ERROR_OUT_NOSUCCESS(fp)
+     ERROR_OUT_TRYAGAIN(fp)
+   ERROR_OUT_WRITEERROR(fp) may also continue without returning if the
+   error will be detected by a later read operation. */
 
 
 /* Debugging macros that can be used to enable detailed protocol logging,
@@ -335,10 +338,36 @@ static void debug_dump(const void *ptr, size_t size)
 TFILE *nslcd_client_open(void)
   MUST_USE;
 
+/* ask the server whether it handles the request (one of the requests
+   listed for NSLCD_CONFIG_ACTIONS), returns 1 if it does, 0 if it does not
+   and -1 if the server could not be asked */
+int nslcd_client_handles(int32_t action);
+
+/* returns a socket to the server that was kept by nslcd_client_keep()
+   after an earlier request or NULL if there is none, the server may still
+   close the socket before answering a request */
+TFILE *nslcd_client_kept(void)
+  MUST_USE;
+
+/* keep the socket to the server so it can be used for another request,
+   the response to the request should have been read completely, if the
+   socket cannot be kept it is closed */
+void nslcd_client_keep(TFILE *fp);
+
+/* returns a stream with the response to the request identified by the
+   action and key from the shared memory cache that is maintained by nslcd
+   (positioned after the response header) or NULL if it is not found */
+TFILE *nslcd_client_cached(int32_t action, const void *key, size_t keylen)
+  MUST_USE;
+
 /* generic request code */
 #define NSLCD_REQUEST(fp, action, writefn)                                  \
+  NSLCD_REQUEST_OPEN(fp, nslcd_client_open(), action, writefn)
+
+/* generic request code that uses openfn to get a client socket */
+#define NSLCD_REQUEST_OPEN(fp, openfn, action, writefn)                     \
   /* open a client socket */                                                \
-  if ((fp = nslcd_client_open()) == NULL)                                   \
+  if ((fp = openfn) == NULL)                                                \
   {                                                                         \
     ERROR_OUT_OPENERROR;                                                    \
   }                                                                         \
@@ -373,6 +402,10 @@ TFILE *nslcd_client_open(void)
 #define READ_RESPONSE_CODE(fp)                                              \
   READ(fp, &tmpint32, sizeof(int32_t));                                     \
   tmpint32 = ntohl(tmpint32);                                               \
+  if (tmpint32 == (int32_t)NSLCD_RESULT_TRYAGAIN)                           \
+  {                                                                         \
+    ERROR_OUT_TRYAGAIN(fp);                                                 \
+  }                                                                         \
   if (tmpint32 != (int32_t)NSLCD_RESULT_BEGIN)                              \
   {                                                                         \
     ERROR_OUT_NOSUCCESS(fp);                                                \
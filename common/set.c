@@ -73,3 +73,13 @@ const char **set_tolist(SET *set)
 {
   return dict_keys((DICT *)set);
 }
+
+void set_loop_first(SET *set, SET_LOOP *loop)
+{
+  dict_loop_first((DICT *)set, loop);
+}
+
+const char *set_loop_next(SET *set, SET_LOOP *loop)
+{
+  return dict_loop_next((DICT *)set, loop);
+}
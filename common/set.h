@@ -24,6 +24,7 @@
 #define COMMON__SET_H
 
 #include "compat/attrs.h"
+#include "dict.h"
 
 /*
    These functions provide a set of strings in an unordered
@@ -61,4 +62,14 @@ void set_free(SET *set);
 const char **set_tolist(SET *set)
   MUST_USE;
 
+/* The position of a loop over the values of a set. */
+typedef DICT_LOOP SET_LOOP;
+
+/* Start a loop over the values of the set. */
+void set_loop_first(SET *set, SET_LOOP *loop);
+
+/* Return the next value of the loop or NULL if all values have been
+   returned. The set should not be modified during the loop. */
+const char *set_loop_next(SET *set, SET_LOOP *loop);
+
 #endif /* COMMON__SET_H */
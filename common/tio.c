@@ -68,6 +68,8 @@ struct tio_fileinfo {
   int readtimeout;
   int writetimeout;
   int read_resettable; /* whether the tio_reset() function can be called */
+  struct tio_buffer record; /* copy of written data (see tio_record()) */
+  int recording; /* 1 if recording, -1 if the record buffer overflowed */
 #ifdef DEBUG_TIO_STATS
   /* this is used to collect statistics on the use of the streams
      and can be used to tune the buffer sizes */
@@ -145,6 +147,41 @@ TFILE *tio_fdopen(int fd, int readtimeout, int writetimeout,
   fp->readtimeout = readtimeout;
   fp->writetimeout = writetimeout;
   fp->read_resettable = 0;
+  fp->record.buffer = NULL;
+  fp->recording = 0;
+#ifdef DEBUG_TIO_STATS
+  fp->byteswritten = 0;
+  fp->bytesread = 0;
+#endif /* DEBUG_TIO_STATS */
+  return fp;
+}
+
+/* open a new TFILE that reads from the buffer */
+TFILE *tio_memopen(void *buf, size_t len)
+{
+  struct tio_fileinfo *fp;
+  fp = (struct tio_fileinfo *)malloc(sizeof(struct tio_fileinfo));
+  if (fp == NULL)
+    return NULL;
+  fp->fd = -1;
+  /* the read buffer is the passed buffer */
+  fp->readbuffer.buffer = (uint8_t *)buf;
+  fp->readbuffer.size = len;
+  fp->readbuffer.maxsize = len;
+  fp->readbuffer.start = 0;
+  fp->readbuffer.len = len;
+  /* there is no write buffer */
+  fp->writebuffer.buffer = NULL;
+  fp->writebuffer.size = 0;
+  fp->writebuffer.maxsize = 0;
+  fp->writebuffer.start = 0;
+  fp->writebuffer.len = 0;
+  /* reading beyond the buffer fails immediately */
+  fp->readtimeout = 0;
+  fp->writetimeout = 0;
+  fp->read_resettable = 0;
+  fp->record.buffer = NULL;
+  fp->recording = 0;
 #ifdef DEBUG_TIO_STATS
   fp->byteswritten = 0;
   fp->bytesread = 0;
@@ -290,6 +327,23 @@ int tio_skip(TFILE *fp, size_t count)
   return tio_read(fp, NULL, count);
 }
 
+/* Check whether data (or end-of-file) can be read without blocking. */
+int tio_readable(TFILE *fp)
+{
+  struct pollfd fds[1];
+  int rv;
+  /* check if we have any buffered data */
+  if (fp->readbuffer.len > 0)
+    return 1;
+  /* check if there is data (or end-of-file) on the file descriptor */
+  fds[0].fd = fp->fd;
+  fds[0].events = POLLIN;
+  do
+    rv = poll(fds, 1, 0);
+  while ((rv < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+  return rv != 0;
+}
+
 /* Read all available data from the stream and empty the read buffer. */
 int tio_skipall(TFILE *fp, int timeout)
 {
@@ -416,12 +470,45 @@ static int tio_flush_nonblock(TFILE *fp)
   return tio_writebuf(fp);
 }
 
+/* add the data to the record buffer, growing it as needed */
+static void tio_record_add(TFILE *fp, const void *buf, size_t count)
+{
+  uint8_t *tmp;
+  size_t newsz;
+  if (fp->record.len + count > fp->record.size)
+  {
+    newsz = fp->record.size;
+    while (newsz < fp->record.len + count)
+      newsz *= 2;
+    if (newsz > fp->record.maxsize)
+      newsz = fp->record.maxsize;
+    tmp = NULL;
+    if (fp->record.len + count <= newsz)
+      tmp = realloc(fp->record.buffer, newsz);
+    if (tmp == NULL)
+    {
+      /* give up recording */
+      free(fp->record.buffer);
+      fp->record.buffer = NULL;
+      fp->recording = -1;
+      return;
+    }
+    fp->record.buffer = tmp;
+    fp->record.size = newsz;
+  }
+  memcpy(fp->record.buffer + fp->record.len, buf, count);
+  fp->record.len += count;
+}
+
 int tio_write(TFILE *fp, const void *buf, size_t count)
 {
   size_t fr;
   uint8_t *tmp;
   size_t newsz;
   const uint8_t *ptr = (const uint8_t *)buf;
+  /* keep a copy of the data if requested */
+  if (fp->recording > 0)
+    tio_record_add(fp, buf, count);
   /* keep filling the buffer until we have buffered everything */
   while (count > 0)
   {
@@ -482,17 +569,39 @@ int tio_close(TFILE *fp)
           (unsigned long)fp->bytesread, (unsigned long)fp->byteswritten);
 #endif /* DEBUG_TIO_STATS */
   /* close file descriptor */
-  if (close(fp->fd))
+  if ((fp->fd >= 0) && (close(fp->fd)))
     retv = -1;
+  tio_free(fp);
+  /* return the result of the earlier operations */
+  return retv;
+}
+
+void tio_free(TFILE *fp)
+{
   /* free any allocated buffers */
-  memset(fp->readbuffer.buffer, 0, fp->readbuffer.size);
-  memset(fp->writebuffer.buffer, 0, fp->writebuffer.size);
+  if (fp->readbuffer.buffer != NULL)
+    memset(fp->readbuffer.buffer, 0, fp->readbuffer.size);
+  if (fp->writebuffer.buffer != NULL)
+    memset(fp->writebuffer.buffer, 0, fp->writebuffer.size);
   free(fp->readbuffer.buffer);
   free(fp->writebuffer.buffer);
+  if (fp->record.buffer != NULL)
+  {
+    memset(fp->record.buffer, 0, fp->record.size);
+    free(fp->record.buffer);
+  }
   /* free the tio struct itself */
   free(fp);
-  /* return the result of the earlier operations */
-  return retv;
+}
+
+int tio_fileno(TFILE *fp)
+{
+  return fp->fd;
+}
+
+void tio_setreadtimeout(TFILE *fp, int readtimeout)
+{
+  fp->readtimeout = readtimeout;
 }
 
 void tio_mark(TFILE *fp)
@@ -518,3 +627,38 @@ int tio_reset(TFILE *fp)
   fp->readbuffer.start = 0;
   return 0;
 }
+
+void tio_record(TFILE *fp, size_t maxsize)
+{
+  /* throw away any previous recording */
+  if (fp->record.buffer != NULL)
+    free(fp->record.buffer);
+  fp->record.buffer = NULL;
+  fp->recording = 0;
+  /* allocate a (small) initial buffer */
+  fp->record.size = (maxsize < 256) ? maxsize : 256;
+  if (fp->record.size == 0)
+    fp->record.size = 1;
+  fp->record.maxsize = maxsize;
+  fp->record.start = 0;
+  fp->record.len = 0;
+  fp->record.buffer = (uint8_t *)malloc(fp->record.size);
+  fp->recording = (fp->record.buffer != NULL) ? 1 : -1;
+}
+
+void *tio_record_stop(TFILE *fp, size_t *len)
+{
+  void *buffer = fp->record.buffer;
+  int recording = fp->recording;
+  fp->record.buffer = NULL;
+  fp->recording = 0;
+  if (recording <= 0)
+  {
+    if (buffer != NULL)
+      free(buffer);
+    return NULL;
+  }
+  *len = fp->record.len;
+  return buffer;
+}
+
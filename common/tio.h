@@ -52,6 +52,12 @@ TFILE *tio_fdopen(int fd, int readtimeout, int writetimeout,
                   size_t initwritesize, size_t maxwritesize)
   LIKE_MALLOC MUST_USE;
 
+/* Open a new TFILE that reads the data in the buffer. The buffer should
+   have been allocated with malloc() and is freed by tio_close(). Reading
+   past the end of the buffer and writing to the stream fail. */
+TFILE *tio_memopen(void *buf, size_t len)
+  LIKE_MALLOC MUST_USE;
+
 /* Read the specified number of bytes from the stream. */
 int tio_read(TFILE *fp, void *buf, size_t count);
 
@@ -61,6 +67,11 @@ int tio_skip(TFILE *fp, size_t count);
 /* Read all available data from the stream and empty the read buffer. */
 int tio_skipall(TFILE *fp, int timeout);
 
+/* Check whether data can be read from the stream without blocking, this
+   also returns non-zero if the other end closed the connection or an
+   error occurred. */
+int tio_readable(TFILE *fp);
+
 /* Write the specified buffer to the stream. */
 int tio_write(TFILE *fp, const void *buf, size_t count);
 
@@ -70,6 +81,17 @@ int tio_flush(TFILE *fp);
 /* Flush the streams and closes the underlying file descriptor. */
 int tio_close(TFILE *fp);
 
+/* Free the stream without flushing it or closing the underlying file
+   descriptor, for when the descriptor may no longer belong to the
+   stream. */
+void tio_free(TFILE *fp);
+
+/* Return the file descriptor that is used by the stream. */
+int tio_fileno(TFILE *fp);
+
+/* Change the timeout (in milliseconds) of further read operations. */
+void tio_setreadtimeout(TFILE *fp, int readtimeout);
+
 /* Store the current position in the stream so that we can jump back to it
    with the tio_reset() function. */
 void tio_mark(TFILE *fp);
@@ -80,4 +102,15 @@ void tio_mark(TFILE *fp);
    were full). */
 int tio_reset(TFILE *fp);
 
+/* Start keeping a copy of all data that is written to the stream from now
+   on. At most maxsize bytes are kept. Any earlier recording is discarded. */
+void tio_record(TFILE *fp, size_t maxsize);
+
+/* Stop keeping a copy of written data and return the data that was written
+   since tio_record() was called. The length is stored in len. This returns
+   NULL if more than maxsize bytes were written or recording failed. The
+   caller should free() the returned buffer. */
+void *tio_record_stop(TFILE *fp, size_t *len)
+  MUST_USE;
+
 #endif /* COMMON__TIO_H */
@@ -26,8 +26,13 @@
 /*
    The protocol used between the nslcd client and server is a simple binary
    protocol. It is request/response based where the client initiates a
-   connection, does a single request and closes the connection again. Any
-   mangled or not understood messages will be silently ignored by the server.
+   connection, does a request and reads the response. After the complete
+   response has been read the client may send another request over the same
+   connection or close the connection. The server may close connections that
+   are idle (older servers close the connection after every request) so
+   clients should check that the connection is still open before reusing it.
+   Any mangled or not understood messages will be silently ignored by the
+   server.
 
    A request looks like:
      INT32  NSLCD_VERSION
@@ -46,7 +51,9 @@
    value. After the last returned result the server sends
    NSLCD_RESULT_END. If some error occurs (e.g. LDAP server unavailable,
    error in the request, etc) the server terminates the connection to signal
-   an error condition (breaking the protocol).
+   an error condition (breaking the protocol). If the server is too busy to
+   handle the request it may send NSLCD_RESULT_TRYAGAIN instead of any
+   results after which the connection is closed.
 
    These are the available basic data types:
      INT32  - 32-bit integer value
@@ -55,12 +62,19 @@
               null-terminated) the string itself is assumed to be UTF-8
      STRINGLIST - a 32-bit number noting the number of strings followed by
                   the strings one at a time
+     STRINGCHUNKS - a list of strings that is sent in parts so the sender
+                  does not need to know the number of strings in advance,
+                  each part is a 32-bit number noting the number of strings
+                  (at most NSLCD_CHUNK_MAXSTRINGS) followed by the strings
+                  and the list is terminated by a part with 0 strings
 
    Furthermore the ADDRESS compound data type is defined as:
      INT32  type of address: e.g. AF_INET or AF_INET6
      INT32  length of address
      RAW    the address itself
    With the ADDRESSLIST using the same construct as with STRINGLIST.
+   Similarly an INT32LIST is a 32-bit number noting the number of values
+   followed by the INT32 values one at a time.
 
    The protocol uses network byte order for all types.
 */
@@ -69,6 +83,14 @@
    updated with major backwards-incompatible changes. */
 #define NSLCD_VERSION 0x00000002
 
+/* The maximum number of keys that may be passed in a single batch lookup
+   request (the NSLCD_ACTION_*_BYNAMES and NSLCD_ACTION_*_BY*IDS requests
+   below). The server terminates the connection if more keys are passed. */
+#define NSLCD_BATCH_MAXKEYS 1024
+
+/* The maximum number of strings in a single part of a STRINGCHUNKS list. */
+#define NSLCD_CHUNK_MAXSTRINGS 1024
+
 /* Get a NSLCD configuration option. There is one request parameter:
     INT32   NSLCD_CONFIG_*
   the result value is:
@@ -79,6 +101,13 @@
    modification through PAM is prohibited */
 #define NSLCD_CONFIG_PAM_PASSWORD_PROHIBIT_MESSAGE 1
 
+/* return the requests that older versions of nslcd may not handle but
+   this version does as a space-separated list of hexadecimal request
+   codes (e.g. "0x00040011 0x00040012"), older versions of nslcd do not
+   know this option and return no value (NSLCD_RESULT_END follows
+   NSLCD_RESULT_BEGIN directly) */
+#define NSLCD_CONFIG_ACTIONS 2
+
 /* Email alias (/etc/aliases) NSS requests. The result values for a
    single entry are:
      STRING      alias name
@@ -100,11 +129,25 @@
      STRING       group password
      INT32        group id
      STRINGLIST   members (usernames) of the group
-     (not that the BYMEMER call returns an emtpy members list) */
+     (not that the BYMEMER call returns an emtpy members list)
+   The BYNAMES and BYGIDS requests take a STRINGLIST of group names or
+   an INT32LIST of group ids respectively and return all matching
+   entries in a single response (in no particular order).
+   The *_CHUNKED requests are the same as the corresponding requests
+   without the suffix but return the members as STRINGCHUNKS so that large
+   groups can be streamed.
+   The BYMEMBER_GIDS request takes the same parameter as BYMEMBER but only
+   returns a single INT32 group id for each entry. */
 #define NSLCD_ACTION_GROUP_BYNAME      0x00040001
 #define NSLCD_ACTION_GROUP_BYGID       0x00040002
+#define NSLCD_ACTION_GROUP_BYNAMES     0x00040003
+#define NSLCD_ACTION_GROUP_BYGIDS      0x00040004
 #define NSLCD_ACTION_GROUP_BYMEMBER    0x00040006
+#define NSLCD_ACTION_GROUP_BYMEMBER_GIDS  0x00040007
 #define NSLCD_ACTION_GROUP_ALL         0x00040008
+#define NSLCD_ACTION_GROUP_BYNAME_CHUNKED 0x00040011
+#define NSLCD_ACTION_GROUP_BYGID_CHUNKED  0x00040012
+#define NSLCD_ACTION_GROUP_ALL_CHUNKED    0x00040018
 
 /* Hostname (/etc/hosts) lookup NSS requests. The result values
    for an entry are:
@@ -152,9 +195,14 @@
      INT32        group id
      STRING       gecos information
      STRING       home directory
-     STRING       login shell */
+     STRING       login shell
+   The BYNAMES and BYUIDS requests take a STRINGLIST of user names or an
+   INT32LIST of user ids respectively and return all matching entries in
+   a single response (in no particular order). */
 #define NSLCD_ACTION_PASSWD_BYNAME     0x00080001
 #define NSLCD_ACTION_PASSWD_BYUID      0x00080002
+#define NSLCD_ACTION_PASSWD_BYNAMES    0x00080003
+#define NSLCD_ACTION_PASSWD_BYUIDS     0x00080004
 #define NSLCD_ACTION_PASSWD_ALL        0x00080008
 
 /* Protocol information requests. Result values are:
@@ -282,8 +330,9 @@
 #define NSLCD_USERMOD_SHELL      8 /* login shell */
 
 /* Request result codes. */
-#define NSLCD_RESULT_BEGIN 1
-#define NSLCD_RESULT_END   2
+#define NSLCD_RESULT_BEGIN    1
+#define NSLCD_RESULT_END      2
+#define NSLCD_RESULT_TRYAGAIN 3
 
 /* Partial list of PAM result codes. */
 #define NSLCD_PAM_SUCCESS             0 /* everything ok */
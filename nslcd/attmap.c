@@ -176,6 +176,8 @@ const char **attmap_get_var(enum ldap_map_selector map, const char *name)
     if (strcasecmp(name, "gecos") == 0)             return &attmap_passwd_gecos;
     if (strcasecmp(name, "homeDirectory") == 0)     return &attmap_passwd_homeDirectory;
     if (strcasecmp(name, "loginShell") == 0)        return &attmap_passwd_loginShell;
+    if (strcasecmp(name, "memberOf") == 0)          return &attmap_passwd_memberOf;
+    if (strcasecmp(name, "tokenGroups") == 0)       return &attmap_passwd_tokenGroups;
   }
   else if (map == LM_PROTOCOLS)
   {
@@ -223,6 +225,8 @@ const char *attmap_set_mapping(const char **var, const char *value)
         (var != &attmap_passwd_gecos) &&
         (var != &attmap_passwd_homeDirectory) &&
         (var != &attmap_passwd_loginShell) &&
+        (var != &attmap_passwd_memberOf) &&
+        (var != &attmap_passwd_tokenGroups) &&
         (var != &attmap_shadow_userPassword) &&
         (var != &attmap_shadow_shadowLastChange) &&
         (var != &attmap_shadow_shadowMin) &&
@@ -235,6 +239,12 @@ const char *attmap_set_mapping(const char **var, const char *value)
     /* the member attribute may only be set to an empty string */
     if ((var == &attmap_group_member) && (strcmp(value, "\"\"") != 0))
       return NULL;
+    /* the memberOf and tokenGroups attributes may only be set to an empty
+       string */
+    if (((var == &attmap_passwd_memberOf) ||
+         (var == &attmap_passwd_tokenGroups)) &&
+        (strcmp(value, "\"\"") != 0))
+      return NULL;
   }
   /* check if the value will be changed */
   if ((*var == NULL) || (strcmp(*var, value) != 0))
@@ -0,0 +1,623 @@
+/*
+   cache.c - response cache for NSS lookups
+
+   Copyright (C) 2026 Arthur de Jong
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301 USA
+*/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif /* HAVE_STDINT_H */
+
+#include "nslcd.h"
+#include "common.h"
+#include "log.h"
+#include "cfg.h"
+#include "common/dict.h"
+#include "common/nslcd-cache.h"
+
+/* the maximum size of a single response that is kept in the cache */
+#define CACHE_MAXRESPONSE (64 * 1024)
+
+/* the number of entries per map after which expired entries are purged,
+   no new entries are added if the map remains full after purging */
+#define CACHE_MAXENTRIES 4096
+
+/* the size of a response without any entries
+   (version, action and NSLCD_RESULT_END) */
+#define EMPTY_RESPONSE_LEN (3 * sizeof(int32_t))
+
+/* the cached response, data contains the serialised response as it is
+   sent to the client (including the header and end marker) */
+struct cache_entry {
+  time_t expires;
+  size_t len;
+  void *data;
+};
+
+/* the cached responses of a single map */
+struct cache_map {
+  pthread_rwlock_t lock;
+  DICT *entries;
+  int numentries;
+};
+
+static struct cache_map cache_maps[LM_NONE];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/* a request that is being handled, identical requests that arrive in the
+   meantime wait for the response instead of doing the same search */
+struct cache_flight {
+  struct cache_flight *next;
+  char *key;
+  TFILE *leader;  /* the stream of the handling request, NULL when done */
+  void *data;     /* the response or NULL if it is not available */
+  size_t len;
+  int refs;       /* the number of requests that use this struct */
+};
+
+/* the requests that are in progress, this list is short (at most one
+   request per worker thread) */
+static struct cache_flight *cache_flights = NULL;
+static pthread_mutex_t cache_flights_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_flights_cond = PTHREAD_COND_INITIALIZER;
+
+/* the shared memory cache that is read by the NSS module, updates are
+   serialised with the mutex (readers use the sequence counters) */
+static struct shmcache_header *shmcache = NULL;
+static pthread_mutex_t shmcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_init(void)
+{
+  int i;
+  for (i = 0; i < LM_NONE; i++)
+  {
+    pthread_rwlock_init(&cache_maps[i].lock, NULL);
+    cache_maps[i].entries = NULL;
+    cache_maps[i].numentries = 0;
+  }
+}
+
+/* find the map that the responses to the action belong to */
+static enum ldap_map_selector action2map(int32_t action)
+{
+  switch (action >> 16)
+  {
+    case NSLCD_ACTION_ALIAS_BYNAME >> 16:    return LM_ALIASES;
+    case NSLCD_ACTION_ETHER_BYNAME >> 16:    return LM_ETHERS;
+    case NSLCD_ACTION_GROUP_BYNAME >> 16:    return LM_GROUP;
+    case NSLCD_ACTION_HOST_BYNAME >> 16:     return LM_HOSTS;
+    case NSLCD_ACTION_NETGROUP_BYNAME >> 16: return LM_NETGROUP;
+    case NSLCD_ACTION_NETWORK_BYNAME >> 16:  return LM_NETWORKS;
+    case NSLCD_ACTION_PASSWD_BYNAME >> 16:   return LM_PASSWD;
+    case NSLCD_ACTION_PROTOCOL_BYNAME >> 16: return LM_PROTOCOLS;
+    case NSLCD_ACTION_RPC_BYNAME >> 16:      return LM_RPC;
+    case NSLCD_ACTION_SERVICE_BYNAME >> 16:  return LM_SERVICES;
+    case NSLCD_ACTION_SHADOW_BYNAME >> 16:   return LM_SHADOW;
+    default:                                 return LM_NONE;
+  }
+}
+
+/* return the map for the action if caching is enabled for it */
+static enum ldap_map_selector cache_map(int32_t action)
+{
+  enum ldap_map_selector map = action2map(action);
+  if ((map == LM_NONE) ||
+      ((nslcd_cfg->cache_positive[map] == 0) &&
+       (nslcd_cfg->cache_negative[map] == 0)))
+    return LM_NONE;
+  return map;
+}
+
+/* build the key that is used to store the response */
+static int cache_mkkey(char *buffer, size_t buflen, int32_t action,
+                       int privileged, const char *key)
+{
+  return mysnprintf(buffer, buflen, "%08x%c%s", (unsigned int)action,
+                    privileged ? 'p' : 'u', key);
+}
+
+static void cache_entry_free(struct cache_entry *entry)
+{
+  memset(entry->data, 0, entry->len);
+  free(entry->data);
+  free(entry);
+}
+
+/* remove expired entries from the map, the caller should hold the write
+   lock on the map */
+static void cache_purge(struct cache_map *cmap, time_t now)
+{
+  DICT *entries;
+  const char **keys;
+  struct cache_entry *entry;
+  int i;
+  entries = dict_new();
+  keys = dict_keys(cmap->entries);
+  if ((entries == NULL) || (keys == NULL))
+  {
+    log_log(LOG_CRIT, "cache_purge(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  cmap->numentries = 0;
+  for (i = 0; keys[i] != NULL; i++)
+  {
+    entry = dict_get(cmap->entries, keys[i]);
+    if (entry == NULL)
+      continue;
+    if ((entry->expires <= now) || dict_put(entries, keys[i], entry))
+      cache_entry_free(entry);
+    else
+      cmap->numentries++;
+  }
+  free(keys);
+  dict_free(cmap->entries);
+  cmap->entries = entries;
+}
+
+/* mark the shared memory cache file as no longer maintained so that any
+   NSS modules that have it mapped stop using it */
+static void shmcache_disable(void)
+{
+  struct shmcache_header header;
+  int fd;
+  if ((fd = open(NSLCD_CACHEFILE, O_RDWR)) < 0)
+    return;
+  if ((read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)) &&
+      (header.magic == SHMCACHE_MAGIC) && (header.valid))
+  {
+    header.valid = 0;
+    if ((lseek(fd, 0, SEEK_SET) != 0) ||
+        (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)))
+      log_log(LOG_WARNING, "cannot update %s: %s", NSLCD_CACHEFILE,
+              strerror(errno));
+  }
+  (void)close(fd);
+}
+
+int cache_shm_open(void)
+{
+  size_t size;
+  void *map;
+  int fd;
+  /* clear any cache that is left from an earlier run */
+  shmcache_disable();
+  if (unlink(NSLCD_CACHEFILE) < 0)
+    log_log(LOG_DEBUG, "unlink() of " NSLCD_CACHEFILE " failed (ignored): %s",
+            strerror(errno));
+#ifndef HAVE___SYNC_LOCK_TEST_AND_SET
+  /* the NSS module cannot read the cache safely */
+  return 0;
+#endif /* not HAVE___SYNC_LOCK_TEST_AND_SET */
+  /* only maintain the cache if passwd or group responses are cached */
+  if ((nslcd_cfg->cache_positive[LM_PASSWD] == 0) &&
+      (nslcd_cfg->cache_negative[LM_PASSWD] == 0) &&
+      (nslcd_cfg->cache_positive[LM_GROUP] == 0) &&
+      (nslcd_cfg->cache_negative[LM_GROUP] == 0))
+    return 0;
+  /* create the file */
+  size = SHMCACHE_FILESIZE(SHMCACHE_NUMSLOTS, SHMCACHE_SLOTSIZE);
+  fd = open(NSLCD_CACHEFILE, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+  {
+    log_log(LOG_ERR, "cannot create %s: %s", NSLCD_CACHEFILE,
+            strerror(errno));
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)size) < 0)
+  {
+    log_log(LOG_ERR, "ftruncate() of %s failed: %s", NSLCD_CACHEFILE,
+            strerror(errno));
+    (void)close(fd);
+    (void)unlink(NSLCD_CACHEFILE);
+    return -1;
+  }
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  (void)close(fd);
+  if (map == MAP_FAILED)
+  {
+    log_log(LOG_ERR, "mmap() of %s failed: %s", NSLCD_CACHEFILE,
+            strerror(errno));
+    (void)unlink(NSLCD_CACHEFILE);
+    return -1;
+  }
+  /* the file is zero-filled so only the header needs to be set up */
+  shmcache = (struct shmcache_header *)map;
+  shmcache->magic = SHMCACHE_MAGIC;
+  shmcache->numslots = SHMCACHE_NUMSLOTS;
+  shmcache->slotsize = SHMCACHE_SLOTSIZE;
+  SHMCACHE_BARRIER();
+  shmcache->valid = 1;
+  log_log(LOG_DEBUG, "shared cache %s created", NSLCD_CACHEFILE);
+  return 0;
+}
+
+void cache_shm_close(void)
+{
+  if (shmcache == NULL)
+    return;
+  pthread_mutex_lock(&shmcache_mutex);
+  shmcache->valid = 0;
+  SHMCACHE_BARRIER();
+  pthread_mutex_unlock(&shmcache_mutex);
+  if (unlink(NSLCD_CACHEFILE) < 0)
+    log_log(LOG_DEBUG, "unlink() of " NSLCD_CACHEFILE " failed (ignored): %s",
+            strerror(errno));
+}
+
+/* write the response to the slot, the caller should hold the mutex */
+static void shmcache_write(struct shmcache_slot *slot, int32_t action,
+                           uint32_t hash, const void *key, size_t keylen,
+                           const void *data, size_t len, time_t expires)
+{
+  slot->seq++;
+  SHMCACHE_BARRIER();
+  slot->action = action;
+  slot->hash = hash;
+  slot->keylen = (uint32_t)keylen;
+  slot->datalen = (uint32_t)len;
+  slot->expires = (int64_t)expires;
+  memcpy(slot->data, key, keylen);
+  memcpy(slot->data + keylen, data, len);
+  SHMCACHE_BARRIER();
+  slot->seq++;
+}
+
+/* publish the response in the shared memory cache, an existing slot for
+   the key is replaced, otherwise an expired slot or the slot that expires
+   first is used */
+static void shmcache_put(int32_t action, const void *key, size_t keylen,
+                         const void *data, size_t len, time_t now,
+                         time_t expires)
+{
+  struct shmcache_slot *slot, *victim = NULL;
+  uint32_t hash;
+  int i;
+  if ((shmcache == NULL) || (keylen + len > SHMCACHE_DATASIZE(shmcache)))
+    return;
+  hash = shmcache_hash(action, key, keylen);
+  pthread_mutex_lock(&shmcache_mutex);
+  for (i = 0; i < SHMCACHE_WAYS; i++)
+  {
+    slot = SHMCACHE_SLOT(shmcache, (hash + i) % shmcache->numslots);
+    if ((slot->hash == hash) && (slot->action == action) &&
+        (slot->keylen == keylen) && (memcmp(slot->data, key, keylen) == 0))
+    {
+      victim = slot;
+      break;
+    }
+    if ((victim == NULL) || ((victim->expires > (int64_t)now) &&
+                             (slot->expires < victim->expires)))
+      victim = slot;
+  }
+  shmcache_write(victim, action, hash, key, keylen, data, len, expires);
+  pthread_mutex_unlock(&shmcache_mutex);
+}
+
+/* remove all responses for the map from the shared memory cache */
+static void shmcache_invalidate(enum ldap_map_selector map)
+{
+  struct shmcache_slot *slot;
+  uint32_t i;
+  if (shmcache == NULL)
+    return;
+  pthread_mutex_lock(&shmcache_mutex);
+  for (i = 0; i < shmcache->numslots; i++)
+  {
+    slot = SHMCACHE_SLOT(shmcache, i);
+    if ((slot->expires != 0) && (action2map(slot->action) == map))
+    {
+      slot->seq++;
+      SHMCACHE_BARRIER();
+      slot->action = 0;
+      slot->expires = 0;
+      SHMCACHE_BARRIER();
+      slot->seq++;
+    }
+  }
+  pthread_mutex_unlock(&shmcache_mutex);
+}
+
+static void cache_flight_unref(struct cache_flight *flight)
+{
+  if (--flight->refs > 0)
+    return;
+  if (flight->data != NULL)
+  {
+    memset(flight->data, 0, flight->len);
+    free(flight->data);
+  }
+  free(flight->key);
+  free(flight);
+}
+
+/* wait for an identical request that is in progress and write its
+   response, if there is no such request the stream is registered as
+   handling the request, returns 1 if the response was written, 0 if the
+   request should be handled and -1 on write errors */
+static int cache_flight_join(TFILE *fp, const char *key)
+{
+  struct cache_flight *flight;
+  int rc = 0;
+  pthread_mutex_lock(&cache_flights_mutex);
+  for (flight = cache_flights; flight != NULL; flight = flight->next)
+    if (strcmp(flight->key, key) == 0)
+      break;
+  if (flight == NULL)
+  {
+    /* we will be handling the request */
+    flight = (struct cache_flight *)malloc(sizeof(struct cache_flight));
+    if ((flight == NULL) || ((flight->key = strdup(key)) == NULL))
+    {
+      log_log(LOG_CRIT, "cache_flight_join(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    flight->leader = fp;
+    flight->data = NULL;
+    flight->len = 0;
+    flight->refs = 1;
+    flight->next = cache_flights;
+    cache_flights = flight;
+    pthread_mutex_unlock(&cache_flights_mutex);
+    return 0;
+  }
+  /* wait for the other request to complete */
+  log_log(LOG_DEBUG, "waiting for identical request in progress");
+  flight->refs++;
+  while (flight->leader != NULL)
+    pthread_cond_wait(&cache_flights_cond, &cache_flights_mutex);
+  pthread_mutex_unlock(&cache_flights_mutex);
+  /* the data is not changed once the leader is done */
+  if (flight->data != NULL)
+  {
+    rc = (tio_write(fp, flight->data, flight->len) == 0) ? 1 : -1;
+    log_log(LOG_DEBUG, "response shared with identical request");
+  }
+  pthread_mutex_lock(&cache_flights_mutex);
+  cache_flight_unref(flight);
+  pthread_mutex_unlock(&cache_flights_mutex);
+  return rc;
+}
+
+/* complete the request that is handled on the stream (if any) and wake
+   up the waiting requests, data is copied if it is not NULL */
+static void cache_flight_done(TFILE *fp, const void *data, size_t len)
+{
+  struct cache_flight **prev, *flight;
+  pthread_mutex_lock(&cache_flights_mutex);
+  for (prev = &cache_flights; (flight = *prev) != NULL; prev = &flight->next)
+    if (flight->leader == fp)
+      break;
+  if (flight == NULL)
+  {
+    pthread_mutex_unlock(&cache_flights_mutex);
+    return;
+  }
+  *prev = flight->next;
+  if ((data != NULL) && (flight->refs > 1))
+  {
+    flight->data = malloc(len);
+    if (flight->data == NULL)
+    {
+      log_log(LOG_CRIT, "cache_flight_done(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(flight->data, data, len);
+    flight->len = len;
+  }
+  flight->leader = NULL;
+  pthread_cond_broadcast(&cache_flights_cond);
+  cache_flight_unref(flight);
+  pthread_mutex_unlock(&cache_flights_mutex);
+}
+
+/* write any cached response (even if it has expired), nothing is written
+   if no response is available so the caller can decide what to tell the
+   client */
+static int cache_get_stale(TFILE *fp, int32_t action, const char *key)
+{
+  enum ldap_map_selector map = action2map(action);
+  struct cache_map *cmap;
+  struct cache_entry *entry;
+  int rc;
+  if (map != LM_NONE)
+  {
+    pthread_once(&cache_once, cache_init);
+    cmap = &cache_maps[map];
+    pthread_rwlock_rdlock(&cmap->lock);
+    entry = (cmap->entries != NULL) ? dict_get(cmap->entries, key) : NULL;
+    if (entry != NULL)
+    {
+      rc = tio_write(fp, entry->data, entry->len);
+      pthread_rwlock_unlock(&cmap->lock);
+      log_log(LOG_DEBUG, "overloaded, response found in cache");
+      return (rc == 0) ? 1 : -1;
+    }
+    pthread_rwlock_unlock(&cmap->lock);
+  }
+  log_log(LOG_DEBUG, "overloaded, response not in cache");
+  return -1;
+}
+
+int cache_get(TFILE *fp, int32_t action, int privileged, const char *key,
+              int overloaded)
+{
+  enum ldap_map_selector map;
+  struct cache_map *cmap;
+  struct cache_entry *entry;
+  char buffer[BUFLEN_FILTER + 16];
+  int rc, coalesce;
+  if (overloaded)
+  {
+    if (cache_mkkey(buffer, sizeof(buffer), action, privileged, key))
+      buffer[0] = '\0';
+    return cache_get_stale(fp, action, buffer);
+  }
+  /* check whether caching is enabled for this request, identical lookups
+     (not enumerations) are coalesced regardless */
+  map = cache_map(action);
+  coalesce = (action2map(action) != LM_NONE) && (!ACTION_IS_ENUMERATION(action));
+  if (((map == LM_NONE) && (!coalesce)) ||
+      cache_mkkey(buffer, sizeof(buffer), action, privileged, key))
+    return 0;
+  if (map != LM_NONE)
+  {
+    pthread_once(&cache_once, cache_init);
+    cmap = &cache_maps[map];
+    /* look up the response and write it to the client */
+    pthread_rwlock_rdlock(&cmap->lock);
+    entry = (cmap->entries != NULL) ? dict_get(cmap->entries, buffer) : NULL;
+    if ((entry != NULL) && (entry->expires > time(NULL)))
+    {
+      rc = tio_write(fp, entry->data, entry->len);
+      pthread_rwlock_unlock(&cmap->lock);
+      log_log(LOG_DEBUG, "response found in cache");
+      return (rc == 0) ? 1 : -1;
+    }
+    pthread_rwlock_unlock(&cmap->lock);
+  }
+  /* use the response of an identical request that is in progress */
+  if ((coalesce) && ((rc = cache_flight_join(fp, buffer)) != 0))
+    return rc;
+  /* keep a copy of the response that is sent so it can be cached */
+  tio_record(fp, CACHE_MAXRESPONSE);
+  return 0;
+}
+
+void cache_put(TFILE *fp, int32_t action, int privileged, const char *key,
+               const void *shmkey, size_t shmkeylen)
+{
+  enum ldap_map_selector map;
+  struct cache_map *cmap;
+  struct cache_entry *entry, *old;
+  char buffer[BUFLEN_FILTER + 16];
+  void *data;
+  size_t len;
+  time_t now, ttl;
+  /* get the response that was sent and pass it to waiting requests */
+  data = tio_record_stop(fp, &len);
+  cache_flight_done(fp, data, len);
+  if (data == NULL)
+    return;
+  map = cache_map(action);
+  if (map == LM_NONE)
+  {
+    free(data);
+    return;
+  }
+  ttl = (len <= EMPTY_RESPONSE_LEN) ? nslcd_cfg->cache_negative[map] :
+                                      nslcd_cfg->cache_positive[map];
+  if ((ttl <= 0) ||
+      cache_mkkey(buffer, sizeof(buffer), action, privileged, key))
+  {
+    free(data);
+    return;
+  }
+  /* build the cache entry */
+  entry = (struct cache_entry *)malloc(sizeof(struct cache_entry));
+  if (entry == NULL)
+  {
+    log_log(LOG_CRIT, "cache_put(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  now = time(NULL);
+  entry->expires = now + ttl;
+  entry->len = len;
+  entry->data = data;
+  /* responses for privileged callers may contain password hashes */
+  if ((shmkey != NULL) && (!privileged))
+    shmcache_put(action, shmkey, shmkeylen, data, len, now, entry->expires);
+  /* store the entry */
+  cmap = &cache_maps[map];
+  pthread_rwlock_wrlock(&cmap->lock);
+  if (cmap->entries == NULL)
+  {
+    cmap->entries = dict_new();
+    if (cmap->entries == NULL)
+    {
+      log_log(LOG_CRIT, "cache_put(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+  }
+  old = dict_get(cmap->entries, buffer);
+  if ((old == NULL) && (cmap->numentries >= CACHE_MAXENTRIES))
+    cache_purge(cmap, now);
+  if (((old == NULL) && (cmap->numentries >= CACHE_MAXENTRIES)) ||
+      dict_put(cmap->entries, buffer, entry))
+    cache_entry_free(entry);
+  else if (old != NULL)
+    cache_entry_free(old);
+  else
+    cmap->numentries++;
+  pthread_rwlock_unlock(&cmap->lock);
+}
+
+void cache_release(TFILE *fp)
+{
+  cache_flight_done(fp, NULL, 0);
+}
+
+void cache_invalidate(enum ldap_map_selector map)
+{
+  struct cache_map *cmap;
+  const char **keys;
+  struct cache_entry *entry;
+  int i;
+  /* LM_NONE is used to signal all maps configured in reconnect_invalidate */
+  if (map == LM_NONE)
+  {
+    for (map = 0; map < LM_NONE ; map++)
+      if (nslcd_cfg->reconnect_invalidate[map])
+        cache_invalidate(map);
+    return;
+  }
+  shmcache_invalidate(map);
+  if (map == LM_GROUP)
+    group_graph_invalidate();
+  pthread_once(&cache_once, cache_init);
+  cmap = &cache_maps[map];
+  pthread_rwlock_wrlock(&cmap->lock);
+  if (cmap->entries != NULL)
+  {
+    keys = dict_keys(cmap->entries);
+    if (keys == NULL)
+    {
+      log_log(LOG_CRIT, "cache_invalidate(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; keys[i] != NULL; i++)
+      if ((entry = dict_get(cmap->entries, keys[i])) != NULL)
+        cache_entry_free(entry);
+    free(keys);
+    dict_free(cmap->entries);
+    cmap->entries = NULL;
+    cmap->numentries = 0;
+  }
+  pthread_rwlock_unlock(&cmap->lock);
+}
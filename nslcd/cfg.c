@@ -651,6 +651,59 @@ static const char *print_map(enum ldap_map_selector map)
   }
 }
 
+static enum nslcd_request_class parse_request_class(const char *value)
+{
+  if ((strcasecmp(value, "authentication") == 0) ||
+      (strcasecmp(value, "pam") == 0))
+    return RC_AUTHENTICATION;
+  else if (strcasecmp(value, "lookup") == 0)
+    return RC_LOOKUP;
+  else if (strcasecmp(value, "initgroups") == 0)
+    return RC_INITGROUPS;
+  else if (strcasecmp(value, "enumeration") == 0)
+    return RC_ENUMERATION;
+  return RC_NONE;
+}
+
+static const char *print_request_class(enum nslcd_request_class rclass)
+{
+  switch (rclass)
+  {
+    case RC_AUTHENTICATION: return "authentication";
+    case RC_LOOKUP:         return "lookup";
+    case RC_INITGROUPS:     return "initgroups";
+    case RC_ENUMERATION:    return "enumeration";
+    case RC_NONE:
+    default:                return "???";
+  }
+}
+
+static void handle_request_limit(const char *filename, int lnr,
+                                 const char *keyword, char *line,
+                                 struct ldap_config *cfg)
+{
+  char token[32];
+  enum nslcd_request_class rclass;
+  int value;
+  check_argumentcount(filename, lnr, keyword,
+                      get_token(&line, token, sizeof(token)) != NULL);
+  rclass = parse_request_class(token);
+  if (rclass == RC_NONE)
+  {
+    log_log(LOG_ERR, "%s:%d: unknown request class: '%s'",
+            filename, lnr, token);
+    exit(EXIT_FAILURE);
+  }
+  value = get_int(filename, lnr, keyword, &line);
+  get_eol(filename, lnr, keyword, &line);
+  if (value < 0)
+  {
+    log_log(LOG_ERR, "%s:%d: %s: invalid limit", filename, lnr, keyword);
+    exit(EXIT_FAILURE);
+  }
+  cfg->request_limit[rclass] = value;
+}
+
 static void handle_base(const char *filename, int lnr,
                         const char *keyword, char *line,
                         struct ldap_config *cfg)
@@ -769,6 +822,41 @@ static void handle_deref(const char *filename, int lnr,
   }
 }
 
+static void handle_uri_selection(const char *filename, int lnr,
+                                 const char *keyword, char *line,
+                                 struct ldap_config *cfg)
+{
+  char token[32];
+  check_argumentcount(filename, lnr, keyword,
+                      get_token(&line, token, sizeof(token)) != NULL);
+  get_eol(filename, lnr, keyword, &line);
+  if (strcasecmp(token, "failover") == 0)
+    cfg->uri_selection = URI_FAILOVER;
+  else if (strcasecmp(token, "round_robin") == 0)
+    cfg->uri_selection = URI_ROUND_ROBIN;
+  else if (strcasecmp(token, "least_outstanding") == 0)
+    cfg->uri_selection = URI_LEAST_OUTSTANDING;
+  else if (strcasecmp(token, "lowest_latency") == 0)
+    cfg->uri_selection = URI_LOWEST_LATENCY;
+  else
+  {
+    log_log(LOG_ERR, "%s:%d: wrong argument: '%s'", filename, lnr, token);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static const char *print_uri_selection(enum ldap_uri_selection selection)
+{
+  switch (selection)
+  {
+    case URI_FAILOVER:          return "failover";
+    case URI_ROUND_ROBIN:       return "round_robin";
+    case URI_LEAST_OUTSTANDING: return "least_outstanding";
+    case URI_LOWEST_LATENCY:    return "lowest_latency";
+    default:                    return "???";
+  }
+}
+
 static const char *print_deref(int deref)
 {
   switch (deref)
@@ -1178,6 +1266,7 @@ static void handle_cache(const char *filename, int lnr,
 {
   char cache[16];
   time_t value1, value2;
+  enum ldap_map_selector map;
   /* get cache map and values */
   check_argumentcount(filename, lnr, keyword,
                       get_token(&line, cache, sizeof(cache)) != NULL);
@@ -1193,6 +1282,13 @@ static void handle_cache(const char *filename, int lnr,
     cfg->cache_dn2uid_positive = value1;
     cfg->cache_dn2uid_negative = value2;
   }
+  else if (strcasecmp(cache, "nested_groups") == 0)
+    cfg->cache_nested_groups = value1;
+  else if (((map = parse_map(cache)) != LM_NONE) && (map != LM_NFSIDMAP))
+  {
+    cfg->cache_positive[map] = value1;
+    cfg->cache_negative[map] = value2;
+  }
   else
   {
     log_log(LOG_ERR, "%s:%d: unknown cache: '%s'", filename, lnr, cache);
@@ -1200,6 +1296,29 @@ static void handle_cache(const char *filename, int lnr,
   }
 }
 
+static void handle_cache_size(const char *filename, int lnr,
+                              const char *keyword, char *line,
+                              struct ldap_config *cfg)
+{
+  char cache[16];
+  int value;
+  check_argumentcount(filename, lnr, keyword,
+                      get_token(&line, cache, sizeof(cache)) != NULL);
+  value = get_int(filename, lnr, keyword, &line);
+  get_eol(filename, lnr, keyword, &line);
+  if (strcasecmp(cache, "dn2uid") != 0)
+  {
+    log_log(LOG_ERR, "%s:%d: unknown cache: '%s'", filename, lnr, cache);
+    exit(EXIT_FAILURE);
+  }
+  if (value < 1)
+  {
+    log_log(LOG_ERR, "%s:%d: %s: value out of range", filename, lnr, keyword);
+    exit(EXIT_FAILURE);
+  }
+  cfg->cache_dn2uid_size = value;
+}
+
 /* This function tries to get the LDAP search base from the LDAP server.
    Note that this returns a string that has been allocated with strdup().
    For this to work the myldap module needs enough configuration information
@@ -1258,6 +1377,13 @@ static void cfg_defaults(struct ldap_config *cfg)
   int i;
   memset(cfg, 0, sizeof(struct ldap_config));
   cfg->threads = 5;
+  cfg->threads_max = 5;
+  cfg->thread_idle_timelimit = 60;
+  for (i = 0; i < RC_NONE; i++)
+    cfg->request_limit[i] = 0;
+  cfg->pam_reserved_threads = 0;
+  cfg->queue_limit = 0;
+  cfg->queue_timelimit = 0;
   cfg->uidname = NULL;
   cfg->uid = NOUID;
   cfg->gid = NOGID;
@@ -1266,7 +1392,11 @@ static void cfg_defaults(struct ldap_config *cfg)
     cfg->uris[i].uri = NULL;
     cfg->uris[i].firstfail = 0;
     cfg->uris[i].lastfail = 0;
+    cfg->uris[i].srtt = 0;
+    cfg->uris[i].srtt_time = 0;
+    cfg->uris[i].outstanding = 0;
   }
+  cfg->uri_selection = URI_FAILOVER;
 #ifdef LDAP_VERSION3
   cfg->ldap_version = LDAP_VERSION3;
 #else /* LDAP_VERSION3 */
@@ -1293,10 +1423,16 @@ static void cfg_defaults(struct ldap_config *cfg)
   cfg->pam_authc_ppolicy = 1;
 #endif
   cfg->bind_timelimit = 10;
+  cfg->connect_stagger = 0;
   cfg->timelimit = LDAP_NO_LIMIT;
+  cfg->hedge_percentile = 0;
   cfg->idle_timelimit = 0;
+  cfg->shared_connections = 0;
+  cfg->pool_min = 0;
+  cfg->pool_max = 0;
   cfg->reconnect_sleeptime = 1;
   cfg->reconnect_retrytime = 10;
+  cfg->health_check_interval = 0;
 #ifdef LDAP_OPT_X_TLS
   cfg->ssl = SSL_OFF;
 #endif /* LDAP_OPT_X_TLS */
@@ -1306,7 +1442,9 @@ static void cfg_defaults(struct ldap_config *cfg)
   cfg->nss_uid_offset = 0;
   cfg->nss_gid_offset = 0;
   cfg->nss_nested_groups = 0;
+  cfg->nss_nested_groups_depth = 0;
   cfg->nss_getgrent_skipmembers = 0;
+  cfg->nss_getgrent_prefetchusers = 0;
   cfg->nss_disable_enumeration = 0;
   cfg->validnames_str = NULL;
   handle_validnames(__FILE__, __LINE__, "",
@@ -1321,6 +1459,13 @@ static void cfg_defaults(struct ldap_config *cfg)
     cfg->reconnect_invalidate[i] = 0;
   cfg->cache_dn2uid_positive = 15 * TIME_MINUTES;
   cfg->cache_dn2uid_negative = 15 * TIME_MINUTES;
+  cfg->cache_dn2uid_size = 65536;
+  cfg->cache_nested_groups = 15 * TIME_MINUTES;
+  for (i = 0; i < LM_NONE; i++)
+  {
+    cfg->cache_positive[i] = 0;
+    cfg->cache_negative[i] = 0;
+  }
 }
 
 static void cfg_read(const char *filename, struct ldap_config *cfg)
@@ -1370,6 +1515,52 @@ static void cfg_read(const char *filename, struct ldap_config *cfg)
     if (strcasecmp(keyword, "threads") == 0)
     {
       cfg->threads = get_int(filename, lnr, keyword, &line);
+      if ((line != NULL) && (*line != '\0'))
+        cfg->threads_max = get_int(filename, lnr, keyword, &line);
+      else
+        cfg->threads_max = cfg->threads;
+      get_eol(filename, lnr, keyword, &line);
+      if ((cfg->threads < 1) || (cfg->threads_max < cfg->threads))
+      {
+        log_log(LOG_ERR, "%s:%d: %s: invalid number of threads",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcasecmp(keyword, "thread_idle_timelimit") == 0)
+    {
+      cfg->thread_idle_timelimit = get_time(filename, lnr, keyword, &line);
+      get_eol(filename, lnr, keyword, &line);
+    }
+    else if (strcasecmp(keyword, "request_limit") == 0)
+    {
+      handle_request_limit(filename, lnr, keyword, line, cfg);
+    }
+    else if (strcasecmp(keyword, "pam_reserved_threads") == 0)
+    {
+      cfg->pam_reserved_threads = get_int(filename, lnr, keyword, &line);
+      get_eol(filename, lnr, keyword, &line);
+      if (cfg->pam_reserved_threads < 0)
+      {
+        log_log(LOG_ERR, "%s:%d: %s: invalid number of threads",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcasecmp(keyword, "queue_limit") == 0)
+    {
+      cfg->queue_limit = get_int(filename, lnr, keyword, &line);
+      get_eol(filename, lnr, keyword, &line);
+      if (cfg->queue_limit < 0)
+      {
+        log_log(LOG_ERR, "%s:%d: %s: invalid number of connections",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcasecmp(keyword, "queue_timelimit") == 0)
+    {
+      cfg->queue_timelimit = get_time(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
     else if (strcasecmp(keyword, "uid") == 0)
@@ -1434,6 +1625,10 @@ static void cfg_read(const char *filename, struct ldap_config *cfg)
           add_uri(filename, lnr, cfg, token);
       }
     }
+    else if (strcasecmp(keyword, "uri_selection") == 0)
+    {
+      handle_uri_selection(filename, lnr, keyword, line, cfg);
+    }
     else if (strcasecmp(keyword, "ldap_version") == 0)
     {
       cfg->ldap_version = get_int(filename, lnr, keyword, &line);
@@ -1547,16 +1742,55 @@ static void cfg_read(const char *filename, struct ldap_config *cfg)
       cfg->bind_timelimit = get_int(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
+    else if (strcasecmp(keyword, "connect_stagger") == 0)
+    {
+      cfg->connect_stagger = get_int(filename, lnr, keyword, &line);
+      get_eol(filename, lnr, keyword, &line);
+    }
     else if (strcasecmp(keyword, "timelimit") == 0)
     {
       cfg->timelimit = get_int(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
+    else if (strcasecmp(keyword, "hedge_percentile") == 0)
+    {
+      cfg->hedge_percentile = get_int(filename, lnr, keyword, &line);
+      if ((cfg->hedge_percentile < 0) || (cfg->hedge_percentile > 100))
+      {
+        log_log(LOG_ERR, "%s:%d: %s: value must be between 0 and 100",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+      get_eol(filename, lnr, keyword, &line);
+    }
     else if (strcasecmp(keyword, "idle_timelimit") == 0)
     {
       cfg->idle_timelimit = get_int(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
+    else if (strcasecmp(keyword, "shared_connections") == 0)
+    {
+      cfg->shared_connections = get_int(filename, lnr, keyword, &line);
+      if (cfg->shared_connections < 0)
+      {
+        log_log(LOG_ERR, "%s:%d: %s: invalid number of connections",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+      get_eol(filename, lnr, keyword, &line);
+    }
+    else if (strcasecmp(keyword, "connection_pool") == 0)
+    {
+      cfg->pool_min = get_int(filename, lnr, keyword, &line);
+      cfg->pool_max = get_int(filename, lnr, keyword, &line);
+      if ((cfg->pool_min < 0) || (cfg->pool_max < cfg->pool_min))
+      {
+        log_log(LOG_ERR, "%s:%d: %s: invalid minimum and maximum",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+      get_eol(filename, lnr, keyword, &line);
+    }
     else if (!strcasecmp(keyword, "reconnect_sleeptime"))
     {
       cfg->reconnect_sleeptime = get_int(filename, lnr, keyword, &line);
@@ -1567,6 +1801,11 @@ static void cfg_read(const char *filename, struct ldap_config *cfg)
       cfg->reconnect_retrytime = get_int(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
+    else if (strcasecmp(keyword, "health_check_interval") == 0)
+    {
+      cfg->health_check_interval = get_int(filename, lnr, keyword, &line);
+      get_eol(filename, lnr, keyword, &line);
+    }
 #ifdef LDAP_OPT_X_TLS
     /* SSL/TLS options */
     else if (strcasecmp(keyword, "ssl") == 0)
@@ -1711,11 +1950,27 @@ static void cfg_read(const char *filename, struct ldap_config *cfg)
       cfg->nss_nested_groups = get_boolean(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
+    else if (strcasecmp(keyword, "nss_nested_groups_depth") == 0)
+    {
+      cfg->nss_nested_groups_depth = get_int(filename, lnr, keyword, &line);
+      if (cfg->nss_nested_groups_depth < 0)
+      {
+        log_log(LOG_ERR, "%s:%d: %s: value out of range",
+                filename, lnr, keyword);
+        exit(EXIT_FAILURE);
+      }
+      get_eol(filename, lnr, keyword, &line);
+    }
     else if (strcasecmp(keyword, "nss_getgrent_skipmembers") == 0)
     {
       cfg->nss_getgrent_skipmembers = get_boolean(filename, lnr, keyword, &line);
       get_eol(filename, lnr, keyword, &line);
     }
+    else if (strcasecmp(keyword, "nss_getgrent_prefetchusers") == 0)
+    {
+      cfg->nss_getgrent_prefetchusers = get_boolean(filename, lnr, keyword, &line);
+      get_eol(filename, lnr, keyword, &line);
+    }
     else if (strcasecmp(keyword, "nss_disable_enumeration") == 0)
     {
       cfg->nss_disable_enumeration = get_boolean(filename, lnr, keyword, &line);
@@ -1750,6 +2005,10 @@ static void cfg_read(const char *filename, struct ldap_config *cfg)
     {
       handle_cache(filename, lnr, keyword, line, cfg);
     }
+    else if (strcasecmp(keyword, "cache_size") == 0)
+    {
+      handle_cache_size(filename, lnr, keyword, line, cfg);
+    }
 #ifdef ENABLE_CONFIGFILE_CHECKING
     /* fallthrough */
     else
@@ -1830,7 +2089,27 @@ static void cfg_dump(void)
   const char **strp;
   char buffer[1024];
   int *scopep;
-  log_log(LOG_DEBUG, "CFG: threads %d", nslcd_cfg->threads);
+  if (nslcd_cfg->threads_max != nslcd_cfg->threads)
+    log_log(LOG_DEBUG, "CFG: threads %d %d", nslcd_cfg->threads,
+            nslcd_cfg->threads_max);
+  else
+    log_log(LOG_DEBUG, "CFG: threads %d", nslcd_cfg->threads);
+  print_time(nslcd_cfg->thread_idle_timelimit, buffer, sizeof(buffer));
+  log_log(LOG_DEBUG, "CFG: thread_idle_timelimit %s", buffer);
+  for (i = 0; i < RC_NONE; i++)
+    if (nslcd_cfg->request_limit[i] > 0)
+      log_log(LOG_DEBUG, "CFG: request_limit %s %d",
+              print_request_class(i), nslcd_cfg->request_limit[i]);
+  if (nslcd_cfg->pam_reserved_threads > 0)
+    log_log(LOG_DEBUG, "CFG: pam_reserved_threads %d",
+            nslcd_cfg->pam_reserved_threads);
+  if (nslcd_cfg->queue_limit > 0)
+    log_log(LOG_DEBUG, "CFG: queue_limit %d", nslcd_cfg->queue_limit);
+  if (nslcd_cfg->queue_timelimit > 0)
+  {
+    print_time(nslcd_cfg->queue_timelimit, buffer, sizeof(buffer));
+    log_log(LOG_DEBUG, "CFG: queue_timelimit %s", buffer);
+  }
   if (nslcd_cfg->uidname != NULL)
     log_log(LOG_DEBUG, "CFG: uid %s", nslcd_cfg->uidname);
   else if (nslcd_cfg->uid != NOUID)
@@ -1845,6 +2124,7 @@ static void cfg_dump(void)
   for (i = 0; i < (NSS_LDAP_CONFIG_MAX_URIS + 1); i++)
     if (nslcd_cfg->uris[i].uri != NULL)
       log_log(LOG_DEBUG, "CFG: uri %s", nslcd_cfg->uris[i].uri);
+  log_log(LOG_DEBUG, "CFG: uri_selection %s", print_uri_selection(nslcd_cfg->uri_selection));
   log_log(LOG_DEBUG, "CFG: ldap_version %d", nslcd_cfg->ldap_version);
   if (nslcd_cfg->binddn != NULL)
     log_log(LOG_DEBUG, "CFG: binddn %s", nslcd_cfg->binddn);
@@ -1944,10 +2224,15 @@ static void cfg_dump(void)
   log_log(LOG_DEBUG, "CFG: pam_authc_ppolicy %s", print_boolean(nslcd_cfg->pam_authc_ppolicy));
 #endif
   log_log(LOG_DEBUG, "CFG: bind_timelimit %d", nslcd_cfg->bind_timelimit);
+  log_log(LOG_DEBUG, "CFG: connect_stagger %d", nslcd_cfg->connect_stagger);
   log_log(LOG_DEBUG, "CFG: timelimit %d", nslcd_cfg->timelimit);
+  log_log(LOG_DEBUG, "CFG: hedge_percentile %d", nslcd_cfg->hedge_percentile);
   log_log(LOG_DEBUG, "CFG: idle_timelimit %d", nslcd_cfg->idle_timelimit);
+  log_log(LOG_DEBUG, "CFG: shared_connections %d", nslcd_cfg->shared_connections);
+  log_log(LOG_DEBUG, "CFG: connection_pool %d %d", nslcd_cfg->pool_min, nslcd_cfg->pool_max);
   log_log(LOG_DEBUG, "CFG: reconnect_sleeptime %d", nslcd_cfg->reconnect_sleeptime);
   log_log(LOG_DEBUG, "CFG: reconnect_retrytime %d", nslcd_cfg->reconnect_retrytime);
+  log_log(LOG_DEBUG, "CFG: health_check_interval %d", nslcd_cfg->health_check_interval);
 #ifdef LDAP_OPT_X_TLS
   log_log(LOG_DEBUG, "CFG: ssl %s", print_ssl(nslcd_cfg->ssl));
   rc = ldap_get_option(NULL, LDAP_OPT_X_TLS_REQUIRE_CERT, &i);
@@ -2012,7 +2297,9 @@ static void cfg_dump(void)
   log_log(LOG_DEBUG, "CFG: nss_uid_offset %lu", (unsigned long int)nslcd_cfg->nss_uid_offset);
   log_log(LOG_DEBUG, "CFG: nss_gid_offset %lu", (unsigned long int)nslcd_cfg->nss_gid_offset);
   log_log(LOG_DEBUG, "CFG: nss_nested_groups %s", print_boolean(nslcd_cfg->nss_nested_groups));
+  log_log(LOG_DEBUG, "CFG: nss_nested_groups_depth %d", nslcd_cfg->nss_nested_groups_depth);
   log_log(LOG_DEBUG, "CFG: nss_getgrent_skipmembers %s", print_boolean(nslcd_cfg->nss_getgrent_skipmembers));
+  log_log(LOG_DEBUG, "CFG: nss_getgrent_prefetchusers %s", print_boolean(nslcd_cfg->nss_getgrent_prefetchusers));
   log_log(LOG_DEBUG, "CFG: nss_disable_enumeration %s", print_boolean(nslcd_cfg->nss_disable_enumeration));
   log_log(LOG_DEBUG, "CFG: validnames %s", nslcd_cfg->validnames_str);
   log_log(LOG_DEBUG, "CFG: ignorecase %s", print_boolean(nslcd_cfg->ignorecase));
@@ -2036,6 +2323,16 @@ static void cfg_dump(void)
   print_time(nslcd_cfg->cache_dn2uid_positive, buffer, sizeof(buffer) / 2);
   print_time(nslcd_cfg->cache_dn2uid_positive, buffer + (sizeof(buffer) / 2), sizeof(buffer) / 2);
   log_log(LOG_DEBUG, "CFG: cache dn2uid %s %s", buffer, buffer + (sizeof(buffer) / 2));
+  log_log(LOG_DEBUG, "CFG: cache_size dn2uid %d", nslcd_cfg->cache_dn2uid_size);
+  print_time(nslcd_cfg->cache_nested_groups, buffer, sizeof(buffer));
+  log_log(LOG_DEBUG, "CFG: cache nested_groups %s", buffer);
+  for (i = 0; i < LM_NONE; i++)
+    if ((nslcd_cfg->cache_positive[i] != 0) || (nslcd_cfg->cache_negative[i] != 0))
+    {
+      print_time(nslcd_cfg->cache_positive[i], buffer, sizeof(buffer) / 2);
+      print_time(nslcd_cfg->cache_negative[i], buffer + (sizeof(buffer) / 2), sizeof(buffer) / 2);
+      log_log(LOG_DEBUG, "CFG: cache %s %s %s", print_map(i), buffer, buffer + (sizeof(buffer) / 2));
+    }
 }
 
 void cfg_init(const char *fname)
@@ -2069,6 +2366,12 @@ void cfg_init(const char *fname)
     log_log(LOG_ERR, "no URIs defined in config");
     exit(EXIT_FAILURE);
   }
+  /* the reserved threads should leave threads for other requests */
+  if (nslcd_cfg->pam_reserved_threads >= nslcd_cfg->threads_max)
+  {
+    log_log(LOG_ERR, "pam_reserved_threads should be lower than the maximum number of threads");
+    exit(EXIT_FAILURE);
+  }
   /* if ssl is on each URI should start with ldaps */
 #ifdef LDAP_OPT_X_TLS
   if (nslcd_cfg->ssl == SSL_LDAPS)
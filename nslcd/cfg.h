@@ -55,6 +55,14 @@ enum ldap_ssl_options {
   SSL_START_TLS
 };
 
+/* the ways in which the LDAP server to connect to is picked */
+enum ldap_uri_selection {
+  URI_FAILOVER,          /* the first available server */
+  URI_ROUND_ROBIN,       /* the next available server in turn */
+  URI_LEAST_OUTSTANDING, /* the server with the fewest running searches */
+  URI_LOWEST_LATENCY     /* the server that answers searches the fastest */
+};
+
 /* selectors for different maps */
 enum ldap_map_selector {
   LM_ALIASES,
@@ -72,21 +80,43 @@ enum ldap_map_selector {
   LM_NONE
 };
 
+/* classes of requests that are scheduled separately */
+enum nslcd_request_class {
+  RC_AUTHENTICATION, /* PAM and user modification requests */
+  RC_LOOKUP,         /* lookups by name or number */
+  RC_INITGROUPS,     /* group membership lookups */
+  RC_ENUMERATION,    /* requests for all entries in a map */
+  RC_NONE
+};
+
 struct myldap_uri {
   char *uri;
   /* time of first failed operation */
   time_t firstfail;
   /* time of last failed operation */
   time_t lastfail;
+  /* smoothed response time of searches in microseconds (0 if unknown) */
+  long srtt;
+  /* time of the last response time sample */
+  time_t srtt_time;
+  /* the number of searches that are in progress */
+  int outstanding;
 };
 
 struct ldap_config {
   int threads;    /* the number of threads to start */
+  int threads_max;  /* the maximum number of threads to run */
+  int thread_idle_timelimit;  /* time after which idle extra threads stop */
+  int request_limit[RC_NONE];  /* maximum number of concurrent requests */
+  int pam_reserved_threads;  /* threads that are kept for authentication */
+  int queue_limit;  /* queued connections after which requests are shed */
+  int queue_timelimit;  /* queue wait time after which requests are shed */
   char *uidname;  /* the user name specified in the uid option */
   uid_t uid;      /* the user id nslcd should be run as */
   gid_t gid;      /* the group id nslcd should be run as */
 
   struct myldap_uri uris[NSS_LDAP_CONFIG_MAX_URIS + 1]; /* NULL terminated list of URIs */
+  enum ldap_uri_selection uri_selection; /* how to pick a server from uris */
   int ldap_version;   /* LDAP protocol version */
   char *binddn;       /* bind DN */
   char *bindpw;       /* bind cred */
@@ -111,10 +141,16 @@ struct ldap_config {
   int pam_authc_ppolicy;    /* whether to send password policy controls on bind */
 #endif
   int bind_timelimit;       /* bind timelimit */
+  int connect_stagger;      /* milliseconds before also connecting to the next server */
   int timelimit;            /* search timelimit */
+  int hedge_percentile;     /* percentile of response times after which lookups are hedged */
   int idle_timelimit;       /* idle timeout */
+  int shared_connections;   /* number of connections shared between threads */
+  int pool_min;             /* number of idle pooled connections kept per server */
+  int pool_max;             /* maximum number of pooled connections per server */
   int reconnect_sleeptime;  /* seconds to sleep; doubled until max */
   int reconnect_retrytime;  /* maximum seconds to sleep */
+  int health_check_interval; /* seconds between probes of failing servers */
 
 #ifdef LDAP_OPT_X_TLS
   /* SSL enabled */
@@ -127,7 +163,9 @@ struct ldap_config {
   uid_t nss_uid_offset; /* offset for uids retrieved from LDAP to avoid local uid clashes */
   gid_t nss_gid_offset; /* offset for gids retrieved from LDAP to avoid local gid clashes */
   int nss_nested_groups; /* whether to expand nested groups */
+  int nss_nested_groups_depth; /* the maximum nesting level that is followed */
   int nss_getgrent_skipmembers;  /* whether to skip member lookups */
+  int nss_getgrent_prefetchusers; /* whether to find all users before enumerating groups */
   int nss_disable_enumeration;  /* enumeration turned on or off */
   regex_t validnames; /* the regular expression to determine valid names */
   char *validnames_str; /* string version of validnames regexp */
@@ -139,6 +177,10 @@ struct ldap_config {
 
   time_t cache_dn2uid_positive;
   time_t cache_dn2uid_negative;
+  int cache_dn2uid_size;  /* the maximum number of cached DN to uid lookups */
+  time_t cache_nested_groups; /* time to keep parent and member groups */
+  time_t cache_positive[LM_NONE]; /* time to keep responses in the cache */
+  time_t cache_negative[LM_NONE]; /* time to keep empty responses */
 };
 
 /* this is a pointer to the global configuration, it should be available
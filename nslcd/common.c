@@ -36,12 +36,14 @@
 #include <regex.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <ctype.h>
 
 #include "nslcd.h"
 #include "common.h"
 #include "log.h"
 #include "attmap.h"
 #include "cfg.h"
+#include "common/set.h"
 
 /* simple wrapper around snptintf() to return non-zero in case
    of any failure (but always keep string 0-terminated) */
@@ -274,6 +276,77 @@ int read_address(TFILE *fp, char *addr, int *addrlen, int *af)
   return 0;
 }
 
+static int read_batch_names_set(TFILE *fp, SET *set)
+{
+  int32_t tmpint32, num;
+  char name[BUFLEN_NAME];
+  int i;
+  READ_INT32(fp, num);
+  if ((num < 0) || (num > NSLCD_BATCH_MAXKEYS))
+  {
+    log_log(LOG_WARNING, "incorrect number of batch keys: %d", (int)num);
+    return -1;
+  }
+  for (i = 0; i < num; i++)
+  {
+    READ_STRING(fp, name);
+    if (!isvalidname(name))
+      log_log(LOG_DEBUG, "\"%s\": denied by validnames option", name);
+    else if (set_add(set, name))
+    {
+      log_log(LOG_CRIT, "read_batch_names(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return 0;
+}
+
+int read_batch_names(TFILE *fp, const char ***names)
+{
+  SET *set;
+  int rc;
+  set = set_new();
+  if (set == NULL)
+  {
+    log_log(LOG_CRIT, "read_batch_names(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  rc = read_batch_names_set(fp, set);
+  if (rc == 0)
+  {
+    *names = set_tolist(set);
+    if (*names == NULL)
+    {
+      log_log(LOG_CRIT, "read_batch_names(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+  }
+  set_free(set);
+  return rc;
+}
+
+int read_batch_ids(TFILE *fp, unsigned long int *ids, int *numids)
+{
+  int32_t tmpint32, num, id;
+  int i, j;
+  READ_INT32(fp, num);
+  if ((num < 0) || (num > NSLCD_BATCH_MAXKEYS))
+  {
+    log_log(LOG_WARNING, "incorrect number of batch keys: %d", (int)num);
+    return -1;
+  }
+  *numids = 0;
+  for (i = 0; i < num; i++)
+  {
+    READ_INT32(fp, id);
+    for (j = 0; (j < *numids) && (ids[j] != (unsigned long int)(uint32_t)id); j++)
+      /* nothing */ ;
+    if (j == *numids)
+      ids[(*numids)++] = (unsigned long int)(uint32_t)id;
+  }
+  return 0;
+}
+
 /* convert the provided string representation of a sid
    (e.g. S-1-5-21-1936905831-823966427-12391542-23578)
    to a format that can be used to search the objectSid property with */
@@ -338,6 +411,36 @@ unsigned long int binsid2id(const char *binsid)
          ((((unsigned long int)binsid[i + 3]) & 0xff) << 24);
 }
 
+int dn2key(const char *dn, char *buffer, size_t buflen)
+{
+  size_t i;
+  for (i = 0; dn[i] != '\0'; i++)
+  {
+    if (i + 1 >= buflen)
+      return -1;
+    buffer[i] = tolower((unsigned char)dn[i]);
+  }
+  buffer[i] = '\0';
+  return 0;
+}
+
+int isdninbases(const char *dn, const char **bases)
+{
+  size_t dnlen, len;
+  int i;
+  dnlen = strlen(dn);
+  for (i = 0; (i < NSS_LDAP_CONFIG_MAX_BASES) && (bases[i] != NULL); i++)
+  {
+    len = strlen(bases[i]);
+    if ((len == 0) ||
+        ((len == dnlen) && (strcasecmp(dn, bases[i]) == 0)) ||
+        ((len < dnlen) && (dn[dnlen - len - 1] == ',') &&
+         (strcasecmp(dn + dnlen - len, bases[i]) == 0)))
+      return 1;
+  }
+  return 0;
+}
+
 #ifdef WANT_STRTOUI
 /* provide a strtoui() implementation, similar to strtoul() but returning
    an range-checked unsigned int instead */
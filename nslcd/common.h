@@ -34,6 +34,8 @@
 #include "nslcd.h"
 #include "common/nslcd-prot.h"
 #include "common/tio.h"
+#include "common/set.h"
+#include "common/dict.h"
 #include "compat/attrs.h"
 #include "myldap.h"
 #include "cfg.h"
@@ -98,6 +100,16 @@ int read_address(TFILE *fp, char *addr, int *addrlen, int *af);
   if (read_address(fp, addr, &(len), &(af)))                                \
     return -1;
 
+/* read the list of names of a batch lookup request from the stream,
+   duplicate and invalid names are skipped, the returned list should be
+   freed by the caller with a single call to free() */
+int read_batch_names(TFILE *fp, const char ***names);
+
+/* read the list of numeric ids of a batch lookup request from the stream
+   into ids (which should fit NSLCD_BATCH_MAXKEYS values), duplicate ids
+   are skipped */
+int read_batch_ids(TFILE *fp, unsigned long int *ids, int *numids);
+
 /* convert the provided string representation of a sid
    (e.g. S-1-5-21-1936905831-823966427-12391542-23578)
    to a format that can be used to search the objectSid property with */
@@ -109,6 +121,13 @@ MUST_USE unsigned long int binsid2id(const char *binsid);
 /* checks to see if the specified string is a valid user or group name */
 MUST_USE int isvalidname(const char *name);
 
+/* copy the DN in lower case into the buffer for use as a key in
+   case-insensitive lookups, returns -1 if the buffer is too small */
+int dn2key(const char *dn, char *buffer, size_t buflen);
+
+/* check whether the DN is (below) one of the search bases */
+MUST_USE int isdninbases(const char *dn, const char **bases);
+
 /* Perform an LDAP lookup to translate the DN into a uid.
    This function either returns NULL or a strdup()ed string. */
 MUST_USE char *lookup_dn2uid(MYLDAP_SESSION *session, const char *dn,
@@ -118,6 +137,27 @@ MUST_USE char *lookup_dn2uid(MYLDAP_SESSION *session, const char *dn,
 MUST_USE char *dn2uid(MYLDAP_SESSION *session, const char *dn, char *buf,
                       size_t buflen);
 
+/* transform a number of DNs into uids like dn2uid() but with as few
+   LDAP searches as possible, the uids are added to uids and the DNs that
+   are not users to others (if it is not NULL), if usermap (from
+   dn2uid_sweep()) is not NULL the DNs in it are not searched for */
+void dn2uids(MYLDAP_SESSION *session, const char **dns, int numdns,
+             SET *uids, SET *others, DICT *usermap);
+
+/* find all users with a single (paged) search of the passwd search bases
+   and return a map of their DNs (as keys from dn2key()) to their user
+   names, returns NULL on errors */
+DICT *dn2uid_sweep(MYLDAP_SESSION *session);
+
+/* free the map that was returned by dn2uid_sweep() */
+void dn2uid_sweep_free(DICT *usermap);
+
+/* log the size and hit rate of the dn2uid cache */
+void dn2uid_log_statistics(void);
+
+/* empty the cache of parent and member groups of nested groups */
+void group_graph_invalidate(void);
+
 /* use the user id to lookup an LDAP entry */
 MYLDAP_ENTRY *uid2entry(MYLDAP_SESSION *session, const char *uid, int *rcp);
 
@@ -150,6 +190,42 @@ int invalidator_start(void);
 /* signal invalidator to invalidate the selected external cache */
 void invalidator_do(enum ldap_map_selector map);
 
+/* check the response cache for the request that is identified by the
+   action, whether the caller is privileged and the key (usually the search
+   filter), returns 1 if the cached response was written to the stream, 0
+   if the response is not in the cache (after which the response written to
+   the stream is recorded for cache_put()) and -1 on write errors, if an
+   identical request is being handled this waits for its response,
+   handlers are called without a session when nslcd is overloaded in which
+   case overloaded should be set: an expired response is also used and if
+   none is available nothing is written and -1 is returned */
+int cache_get(TFILE *fp, int32_t action, int privileged, const char *key,
+              int overloaded);
+
+/* store the response that was written since cache_get() in the cache,
+   if shmkey is not NULL the response is also published in the shared
+   memory cache under the value of the request parameter */
+void cache_put(TFILE *fp, int32_t action, int privileged, const char *key,
+               const void *shmkey, size_t shmkeylen);
+
+/* wake up any requests that wait for the response to the request that was
+   handled on the stream, this should be called after every request */
+void cache_release(TFILE *fp);
+
+/* set up the shared memory cache that is read by the NSS module (only if
+   the passwd or group map is cached) */
+int cache_shm_open(void);
+
+/* signal users of the shared memory cache that it is no longer updated */
+void cache_shm_close(void);
+
+/* clear the response cache for the map (LM_NONE clears all maps that are
+   configured with reconnect_invalidate) */
+void cache_invalidate(enum ldap_map_selector map);
+
+/* whether the action enumerates all entries of a map */
+#define ACTION_IS_ENUMERATION(action) (((action) & 0x000f) == 0x0008)
+
 /* common buffer lengths */
 #define BUFLEN_NAME         256  /* user, group names and such */
 #define BUFLEN_SAFENAME     300  /* escaped name */
@@ -216,8 +292,14 @@ int nslcd_ether_byether(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_ether_all(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_group_byname(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_group_bygid(TFILE *fp, MYLDAP_SESSION *session);
+int nslcd_group_byname_chunked(TFILE *fp, MYLDAP_SESSION *session);
+int nslcd_group_bygid_chunked(TFILE *fp, MYLDAP_SESSION *session);
+int nslcd_group_bynames(TFILE *fp, MYLDAP_SESSION *session);
+int nslcd_group_bygids(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_group_bymember(TFILE *fp, MYLDAP_SESSION *session);
+int nslcd_group_bymember_gids(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_group_all(TFILE *fp, MYLDAP_SESSION *session);
+int nslcd_group_all_chunked(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_host_byname(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_host_byaddr(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_host_all(TFILE *fp, MYLDAP_SESSION *session);
@@ -228,6 +310,8 @@ int nslcd_network_byaddr(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_network_all(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_passwd_byname(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
 int nslcd_passwd_byuid(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
+int nslcd_passwd_bynames(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
+int nslcd_passwd_byuids(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
 int nslcd_passwd_all(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
 int nslcd_protocol_byname(TFILE *fp, MYLDAP_SESSION *session);
 int nslcd_protocol_bynumber(TFILE *fp, MYLDAP_SESSION *session);
@@ -250,11 +334,13 @@ int nslcd_usermod(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
 /* macros for generating service handling code */
 #define NSLCD_HANDLE(db, fn, action, readfn, mkfilter, writefn)             \
   int nslcd_##db##_##fn(TFILE *fp, MYLDAP_SESSION *session)                 \
-  NSLCD_HANDLE_BODY(db, fn, action, readfn, mkfilter, writefn)
+  NSLCD_HANDLE_BODY(db, fn, action, 0, readfn, mkfilter, writefn)
 #define NSLCD_HANDLE_UID(db, fn, action, readfn, mkfilter, writefn)         \
   int nslcd_##db##_##fn(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid) \
-  NSLCD_HANDLE_BODY(db, fn, action, readfn, mkfilter, writefn)
-#define NSLCD_HANDLE_BODY(db, fn, action, readfn, mkfilter, writefn)        \
+  NSLCD_HANDLE_BODY(db, fn, action, (calleruid == 0), readfn, mkfilter,     \
+                    writefn)
+#define NSLCD_HANDLE_BODY(db, fn, action, privileged, readfn, mkfilter,     \
+                          writefn)                                          \
   {                                                                         \
     /* define common variables */                                           \
     int32_t tmpint32;                                                       \
@@ -262,11 +348,11 @@ int nslcd_usermod(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
     MYLDAP_ENTRY *entry;                                                    \
     const char *base;                                                       \
     int rc, i;                                                              \
+    /* readfn may set this to publish the response in the shared cache */   \
+    const void *shmkey = NULL;                                              \
+    size_t shmkeylen = 0;                                                   \
     /* read request parameters */                                           \
     readfn;                                                                 \
-    /* write the response header */                                         \
-    WRITE_INT32(fp, NSLCD_VERSION);                                         \
-    WRITE_INT32(fp, action);                                                \
     /* prepare the search filter */                                         \
     if (mkfilter)                                                           \
     {                                                                       \
@@ -274,6 +360,13 @@ int nslcd_usermod(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
               "(): filter buffer too small");                               \
       return -1;                                                            \
     }                                                                       \
+    /* the filter identifies the request in the response cache */           \
+    rc = cache_get(fp, action, privileged, filter, (session == NULL));      \
+    if (rc != 0)                                                            \
+      return (rc > 0) ? 0 : -1;                                             \
+    /* write the response header */                                         \
+    WRITE_INT32(fp, NSLCD_VERSION);                                         \
+    WRITE_INT32(fp, action);                                                \
     /* perform a search for each search base */                             \
     for (i = 0; (base = db##_bases[i]) != NULL; i++)                        \
     {                                                                       \
@@ -289,11 +382,12 @@ int nslcd_usermod(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid);
           return -1;                                                        \
       }                                                                     \
     }                                                                       \
+    /* on errors the connection is closed to signal the client */           \
+    if (rc != LDAP_SUCCESS)                                                 \
+      return -1;                                                            \
     /* write the final result code */                                       \
-    if (rc == LDAP_SUCCESS)                                                 \
-    {                                                                       \
-      WRITE_INT32(fp, NSLCD_RESULT_END);                                    \
-    }                                                                       \
+    WRITE_INT32(fp, NSLCD_RESULT_END);                                      \
+    cache_put(fp, action, privileged, filter, shmkey, shmkeylen);           \
     return 0;                                                               \
   }
 
@@ -33,10 +33,27 @@
 #include "log.h"
 #include "cfg.h"
 
+/* the requests that older versions of nslcd may not handle */
+static const int32_t config_actions[] = {
+  NSLCD_ACTION_GROUP_BYNAMES,
+  NSLCD_ACTION_GROUP_BYGIDS,
+  NSLCD_ACTION_GROUP_BYMEMBER_GIDS,
+  NSLCD_ACTION_GROUP_BYNAME_CHUNKED,
+  NSLCD_ACTION_GROUP_BYGID_CHUNKED,
+  NSLCD_ACTION_GROUP_ALL_CHUNKED,
+  NSLCD_ACTION_PASSWD_BYNAMES,
+  NSLCD_ACTION_PASSWD_BYUIDS
+};
+
+#define NUM_CONFIG_ACTIONS \
+  (sizeof(config_actions) / sizeof(config_actions[0]))
+
 int nslcd_config_get(TFILE *fp, MYLDAP_SESSION UNUSED(*session))
 {
   int32_t tmpint32;
   int32_t cfgopt;
+  char actions[NUM_CONFIG_ACTIONS * 11 + 1];
+  size_t i;
   /* read request parameters */
   READ_INT32(fp, cfgopt);
   /* log call */
@@ -52,6 +69,13 @@ int nslcd_config_get(TFILE *fp, MYLDAP_SESSION UNUSED(*session))
     case NSLCD_CONFIG_PAM_PASSWORD_PROHIBIT_MESSAGE:
       WRITE_STRING(fp, nslcd_cfg->pam_password_prohibit_message);
       break;
+    case NSLCD_CONFIG_ACTIONS:
+      for (i = 0; i < NUM_CONFIG_ACTIONS; i++)
+        snprintf(actions + i * 11, 12, "0x%08x ",
+                 (unsigned int)config_actions[i]);
+      actions[NUM_CONFIG_ACTIONS * 11 - 1] = '\0';
+      WRITE_STRING(fp, actions);
+      break;
     default:
       /* all other config options are ignored */
       break;
@@ -29,10 +29,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
 /* for gid_t */
 #include <grp.h>
 
 #include "common/set.h"
+#include "common/dict.h"
 #include "common.h"
 #include "log.h"
 #include "myldap.h"
@@ -77,6 +81,12 @@ static char *builtinSid = NULL;
 const gid_t min_builtin_rid = 544;
 const gid_t max_builtin_rid = 552;
 
+/* the binary SID prefixes of the above for tokenGroups lookups */
+static char gidsidbin[64];
+static size_t gidsidlen = 0;
+static char builtinsidbin[64];
+static size_t builtinsidlen = 0;
+
 /* default values for attributes */
 static const char *default_group_userPassword = "*"; /* unmatchable */
 
@@ -86,6 +96,18 @@ static const char **group_attrs = NULL;
 /* the attribute list for bymember searches (without member attributes) */
 static const char **group_bymember_attrs = NULL;
 
+/* the attribute list for finding parent groups that are cached */
+static const char **group_nested_attrs = NULL;
+
+/* the attribute list for gid-only bymember searches (the names are only
+   used to check them against the validnames option) */
+static const char **group_gids_attrs = NULL;
+
+/* the ways in which a group entry can be written */
+#define GROUP_FORMAT_LIST    0 /* with the members as STRINGLIST */
+#define GROUP_FORMAT_CHUNKED 1 /* with the members as STRINGCHUNKS */
+#define GROUP_FORMAT_GIDS    2 /* only the group id */
+
 /* create a search filter for searching a group entry
    by name, return -1 on errors */
 static int mkfilter_group_byname(const char *name,
@@ -103,9 +125,9 @@ static int mkfilter_group_byname(const char *name,
                     group_filter, attmap_group_cn, safename);
 }
 
-/* create a search filter for searching a group entry
-   by gid, return -1 on errors */
-static int mkfilter_group_bygid(gid_t gid, char *buffer, size_t buflen)
+/* create a filter term that matches the gidNumber attribute with
+   the specified gid, return -1 on errors */
+static int mkterm_group_bygid(gid_t gid, char *buffer, size_t buflen)
 {
   gid -= nslcd_cfg->nss_gid_offset;
   /* if searching for a Windows domain SID */
@@ -113,20 +135,92 @@ static int mkfilter_group_bygid(gid_t gid, char *buffer, size_t buflen)
   {
     /* the given gid is a BUILTIN gid, the SID prefix is not the domain SID */
     if ((gid >= min_builtin_rid) && (gid <= max_builtin_rid))
-      return mysnprintf(buffer, buflen, "(&%s(%s=%s\\%02x\\%02x\\%02x\\%02x))",
-                        group_filter, attmap_group_gidNumber, builtinSid,
+      return mysnprintf(buffer, buflen, "(%s=%s\\%02x\\%02x\\%02x\\%02x)",
+                        attmap_group_gidNumber, builtinSid,
                         (int)(gid & 0xff), (int)((gid >> 8) & 0xff),
                         (int)((gid >> 16) & 0xff), (int)((gid >> 24) & 0xff));
-    return mysnprintf(buffer, buflen, "(&%s(%s=%s\\%02x\\%02x\\%02x\\%02x))",
-                      group_filter, attmap_group_gidNumber, gidSid,
+    return mysnprintf(buffer, buflen, "(%s=%s\\%02x\\%02x\\%02x\\%02x)",
+                      attmap_group_gidNumber, gidSid,
                       (int)(gid & 0xff), (int)((gid >> 8) & 0xff),
                       (int)((gid >> 16) & 0xff), (int)((gid >> 24) & 0xff));
   }
   else
   {
-    return mysnprintf(buffer, buflen, "(&%s(%s=%lu))",
-                      group_filter, attmap_group_gidNumber, (unsigned long int)gid);
+    return mysnprintf(buffer, buflen, "(%s=%lu)",
+                      attmap_group_gidNumber, (unsigned long int)gid);
+  }
+}
+
+/* create a search filter for searching a group entry
+   by gid, return -1 on errors */
+static int mkfilter_group_bygid(gid_t gid, char *buffer, size_t buflen)
+{
+  char term[BUFLEN_SAFENAME];
+  if (mkterm_group_bygid(gid, term, sizeof(term)))
+    return -1;
+  return mysnprintf(buffer, buflen, "(&%s%s)", group_filter, term);
+}
+
+/* create a search filter for searching a number of group entries
+   by name, return the number of names that fit in the filter or
+   -1 on errors */
+static int mkfilter_group_bynames(const char **names,
+                                  char *buffer, size_t buflen)
+{
+  char safename[BUFLEN_SAFENAME];
+  size_t len;
+  int i;
+  if (mysnprintf(buffer, buflen, "(&%s(|", group_filter))
+    return -1;
+  for (i = 0; names[i] != NULL; i++)
+  {
+    /* escape attribute */
+    if (myldap_escape(names[i], safename, sizeof(safename)))
+    {
+      log_log(LOG_ERR, "mkfilter_group_bynames(): safename buffer too small");
+      return -1;
+    }
+    /* add the term while leaving room for closing the filter */
+    len = strlen(buffer);
+    if ((len + 3 > buflen) ||
+        mysnprintf(buffer + len, buflen - len - 2, "(%s=%s)",
+                   attmap_group_cn, safename))
+    {
+      buffer[len] = '\0';
+      break;
+    }
+  }
+  if (i == 0)
+    return -1;
+  strcat(buffer, "))");
+  return i;
+}
+
+/* create a search filter for searching a number of group entries
+   by gid, return the number of gids that fit in the filter or -1 on
+   errors */
+static int mkfilter_group_bygids(const gid_t *gids, int numgids,
+                                 char *buffer, size_t buflen)
+{
+  size_t len;
+  int i;
+  if (mysnprintf(buffer, buflen, "(&%s(|", group_filter))
+    return -1;
+  for (i = 0; i < numgids; i++)
+  {
+    /* add the term while leaving room for closing the filter */
+    len = strlen(buffer);
+    if ((len + 3 > buflen) ||
+        mkterm_group_bygid(gids[i], buffer + len, buflen - len - 2))
+    {
+      buffer[len] = '\0';
+      break;
+    }
   }
+  if (i == 0)
+    return -1;
+  strcat(buffer, "))");
+  return i;
 }
 
 /* create a search filter for searching a group entry
@@ -162,20 +256,57 @@ static int mkfilter_group_bymember(MYLDAP_SESSION *session,
                     attmap_group_member, safedn);
 }
 
-static int mkfilter_group_bymemberdn(const char *dn,
-                                     char *buffer, size_t buflen)
+/* create a search filter for searching the groups that have one of the
+   DNs as member, return the number of DNs that fit in the filter or -1 on
+   errors */
+static int mkfilter_group_bymemberdns(const char **dns, int numdns,
+                                      char *buffer, size_t buflen)
 {
   char safedn[BUFLEN_SAFEDN];
-  /* escape DN */
-  if (myldap_escape(dn, safedn, sizeof(safedn)))
+  size_t len;
+  int i;
+  if (mysnprintf(buffer, buflen, "(&%s(|", group_filter))
+    return -1;
+  for (i = 0; i < numdns; i++)
   {
-    log_log(LOG_ERR, "mkfilter_group_bymemberdn(): safedn buffer too small");
+    /* escape DN */
+    if (myldap_escape(dns[i], safedn, sizeof(safedn)))
+    {
+      log_log(LOG_ERR, "mkfilter_group_bymemberdns(): safedn buffer too small");
+      break;
+    }
+    /* add the term while leaving room for closing the filter */
+    len = strlen(buffer);
+    if ((len + 3 > buflen) ||
+        mysnprintf(buffer + len, buflen - len - 2, "(%s=%s)",
+                   attmap_group_member, safedn))
+    {
+      buffer[len] = '\0';
+      break;
+    }
+  }
+  if (i == 0)
     return -1;
+  strcat(buffer, "))");
+  return i;
+}
+
+/* convert the search string that was built with sid2search() back into
+   the binary SID prefix, returns the number of bytes */
+static size_t sidsearch2bin(const char *search, char *buffer, size_t buflen)
+{
+  char hex[3];
+  size_t len = 0;
+  while ((search[0] == '\\') && (search[1] != '\0') && (search[2] != '\0') &&
+         (len < buflen))
+  {
+    hex[0] = search[1];
+    hex[1] = search[2];
+    hex[2] = '\0';
+    buffer[len++] = (char)strtoul(hex, NULL, 16);
+    search += 3;
   }
-  return mysnprintf(buffer, buflen,
-                    "(&%s(%s=%s))",
-                    group_filter,
-                    attmap_group_member, safedn);
+  return len;
 }
 
 void group_init(void)
@@ -194,8 +325,17 @@ void group_init(void)
   {
     gidSid = sid2search(attmap_group_gidNumber + 10);
     builtinSid = sid2search("S-1-5-32");
+    gidsidlen = sidsearch2bin(gidSid, gidsidbin, sizeof(gidsidbin));
+    builtinsidlen = sidsearch2bin(builtinSid, builtinsidbin,
+                                  sizeof(builtinsidbin));
     attmap_group_gidNumber = strndup(attmap_group_gidNumber, 9);
   }
+  /* tokenGroups can only be used with group ids from SIDs */
+  if ((gidSid == NULL) && (strcmp(attmap_passwd_tokenGroups, "\"\"") != 0))
+  {
+    log_log(LOG_WARNING, "ignoring tokenGroups mapping because gidNumber is not mapped to objectSid");
+    attmap_passwd_tokenGroups = "\"\"";
+  }
   /* set up attribute list */
   set = set_new();
   attmap_add_attributes(set, attmap_group_cn);
@@ -225,22 +365,122 @@ void group_init(void)
     exit(EXIT_FAILURE);
   }
   set_free(set);
+  /* set up the attribute list for nested group searches */
+  set = set_new();
+  attmap_add_attributes(set, attmap_group_cn);
+  attmap_add_attributes(set, attmap_group_userPassword);
+  attmap_add_attributes(set, attmap_group_gidNumber);
+  attmap_add_attributes(set, attmap_group_memberUid);
+  attmap_add_attributes(set, attmap_group_member);
+  group_nested_attrs = set_tolist(set);
+  if (group_nested_attrs == NULL)
+  {
+    log_log(LOG_CRIT, "malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  set_free(set);
+  /* set up the attribute list for gid-only searches */
+  set = set_new();
+  attmap_add_attributes(set, attmap_group_cn);
+  attmap_add_attributes(set, attmap_group_gidNumber);
+  group_gids_attrs = set_tolist(set);
+  if (group_gids_attrs == NULL)
+  {
+    log_log(LOG_CRIT, "malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  set_free(set);
+}
+
+/* write the members (may be NULL) as a STRINGLIST or as STRINGCHUNKS,
+   the members are written directly from the set without copying them */
+static int write_members(TFILE *fp, SET *members, int chunked)
+{
+  int32_t tmpint32;
+  SET_LOOP loop;
+  const char *chunk[NSLCD_CHUNK_MAXSTRINGS];
+  const char *member;
+  int32_t num;
+  int i;
+  if (!chunked)
+  {
+    /* the number of members is written first */
+    num = 0;
+    if (members != NULL)
+    {
+      set_loop_first(members, &loop);
+      while (set_loop_next(members, &loop) != NULL)
+        num++;
+    }
+    WRITE_INT32(fp, num);
+    if (num > 0)
+    {
+      set_loop_first(members, &loop);
+      while ((member = set_loop_next(members, &loop)) != NULL)
+      {
+        WRITE_STRING(fp, member);
+      }
+    }
+    return 0;
+  }
+  /* write the members in parts of at most NSLCD_CHUNK_MAXSTRINGS */
+  if (members != NULL)
+  {
+    set_loop_first(members, &loop);
+    do
+    {
+      for (num = 0; (num < NSLCD_CHUNK_MAXSTRINGS) &&
+                    ((chunk[num] = set_loop_next(members, &loop)) != NULL);
+           num++)
+        /* nothing */ ;
+      if (num > 0)
+      {
+        WRITE_INT32(fp, num);
+        for (i = 0; i < num; i++)
+        {
+          WRITE_STRING(fp, chunk[i]);
+        }
+      }
+    }
+    while (num == NSLCD_CHUNK_MAXSTRINGS);
+  }
+  /* an empty part terminates the list */
+  WRITE_INT32(fp, 0);
+  return 0;
 }
 
-static int do_write_group(TFILE *fp, MYLDAP_ENTRY *entry,
+static int do_write_group(TFILE *fp, const char *dn,
                           const char **names, gid_t gids[], int numgids,
-                          const char *passwd, const char **members,
+                          const char *passwd, SET *members, int format,
                           const char *reqname)
 {
-  int32_t tmpint32, tmp2int32, tmp3int32;
+  int32_t tmpint32;
   int i, j;
+  /* only write the gids once if any of the names is valid */
+  if (format == GROUP_FORMAT_GIDS)
+  {
+    for (i = 0; (names[i] != NULL) && (!isvalidname(names[i])); i++)
+      /* nothing */ ;
+    if (names[i] == NULL)
+    {
+      log_log(LOG_WARNING, "%s: %s: denied by validnames option",
+              dn, attmap_group_cn);
+      return 0;
+    }
+    for (j = 0; j < numgids; j++)
+    {
+      WRITE_INT32(fp, NSLCD_RESULT_BEGIN);
+      WRITE_INT32(fp, gids[j]);
+    }
+    return 0;
+  }
   /* write entries for all names and gids */
   for (i = 0; names[i] != NULL; i++)
   {
     if (!isvalidname(names[i]))
     {
       log_log(LOG_WARNING, "%s: %s: denied by validnames option",
-              myldap_get_dn(entry), attmap_group_cn);
+              dn, attmap_group_cn);
     }
     else if ((reqname == NULL) || (STR_CMP(reqname, names[i]) == 0))
     {
@@ -250,20 +490,69 @@ static int do_write_group(TFILE *fp, MYLDAP_ENTRY *entry,
         WRITE_STRING(fp, names[i]);
         WRITE_STRING(fp, passwd);
         WRITE_INT32(fp, gids[j]);
-        WRITE_STRINGLIST(fp, members);
+        if (write_members(fp, members, format == GROUP_FORMAT_CHUNKED))
+          return -1;
       }
     }
   }
   return 0;
 }
 
+/* add the DNs that were not seen before to the subgroups */
+static void addsubgroups(const char **dns, SET *seen, SET *subgroups)
+{
+  int i;
+  for (i = 0; dns[i] != NULL; i++)
+  {
+    if ((seen == NULL) || (!set_contains(seen, dns[i])))
+    {
+      if (seen != NULL)
+        set_add(seen, dns[i]);
+      if (subgroups != NULL)
+        set_add(subgroups, dns[i]);
+    }
+  }
+}
+
+/* add the users of the member DNs to the members, the DNs that are not
+   users are added to the subgroups (usermap is passed to dn2uids()) */
+static void addmemberdns(MYLDAP_SESSION *session, DICT *usermap,
+                         const char **values,
+                         SET *members, SET *seen, SET *subgroups)
+{
+  int i, num;
+  const char **dns;
+  for (num = 0; values[num] != NULL; num++)
+    /* nothing */ ;
+  dns = (const char **)malloc((num + 1) * sizeof(const char *));
+  if (dns == NULL)
+  {
+    log_log(LOG_CRIT, "addmemberdns(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0, num = 0; values[i] != NULL; i++)
+  {
+    if ((seen == NULL) || (!set_contains(seen, values[i])))
+    {
+      if (seen != NULL)
+        set_add(seen, values[i]);
+      dns[num++] = values[i];
+    }
+  }
+  /* transform the DNs into uids (dn2uids() already checks validity),
+     the DNs that are not users are handled as nested groups */
+  dn2uids(session, dns, num, members, subgroups, usermap);
+  free(dns);
+}
+
 static void getmembers(MYLDAP_ENTRY *entry, MYLDAP_SESSION *session,
+                       DICT *usermap,
                        SET *members, SET *seen, SET *subgroups)
 {
-  char buf[BUFLEN_NAME];
   int i;
   const char **values;
   const char ***derefs;
+  MYLDAP_VALUES *memberdns;
   /* add the memberUid values */
   values = myldap_get_values(entry, attmap_group_memberUid);
   if (values != NULL)
@@ -284,214 +573,1176 @@ static void getmembers(MYLDAP_ENTRY *entry, MYLDAP_SESSION *session,
     for (i = 0; derefs[0][i] != NULL; i++)
       set_add(members, derefs[0][i]);
     /* add non-deref'd attribute values as subgroups */
-    for (i = 0; derefs[1][i] != NULL; i++)
-    {
-      if ((seen == NULL) || (!set_contains(seen, derefs[1][i])))
-      {
-        if (seen != NULL)
-          set_add(seen, derefs[1][i]);
-        if (subgroups != NULL)
-          set_add(subgroups, derefs[1][i]);
-      }
-    }
+    addsubgroups(derefs[1], seen, subgroups);
     return; /* no need to parse the member attribute ourselves */
   }
-  /* add the member values */
-  values = myldap_get_values(entry, attmap_group_member);
-  if (values != NULL)
-    for (i = 0; values[i] != NULL; i++)
-    {
-      if ((seen == NULL) || (!set_contains(seen, values[i])))
-      {
-        if (seen != NULL)
-          set_add(seen, values[i]);
-        /* transform the DN into a uid (dn2uid() already checks validity) */
-        if (dn2uid(session, values[i], buf, sizeof(buf)) != NULL)
-          set_add(members, buf);
-        /* wasn't a UID - try handling it as a nested group */
-        else if (subgroups != NULL)
-          set_add(subgroups, values[i]);
-      }
-    }
+  /* add the member values, handling each range of values as it arrives */
+  memberdns = myldap_values_open(entry, attmap_group_member);
+  while ((values = myldap_values_next(memberdns)) != NULL)
+    addmemberdns(session, usermap, values, members, seen, subgroups);
+  myldap_values_close(memberdns);
 }
 
 /* the maximum number of gidNumber attributes per entry */
 #define MAXGIDS_PER_ENTRY 5
 
-static int write_group(TFILE *fp, MYLDAP_ENTRY *entry, const char *reqname,
-                       const gid_t *reqgid, int wantmembers,
-                       MYLDAP_SESSION *session)
+/* get the group ids of the entry, returns the number of group ids or 0 if
+   the entry does not have valid group ids */
+static int getgids(MYLDAP_ENTRY *entry, gid_t gids[])
 {
-  const char **names, **gidvalues;
-  const char *passwd;
-  const char **members = NULL;
-  SET *set, *seen=NULL, *subgroups=NULL;
-  gid_t gids[MAXGIDS_PER_ENTRY];
-  int numgids;
+  const char **gidvalues;
   char *tmp;
-  char passbuffer[BUFLEN_PASSWORDHASH];
-  MYLDAP_SEARCH *search;
-  MYLDAP_ENTRY *entry2;
-  int rc;
-  /* get group name (cn) */
-  names = myldap_get_values(entry, attmap_group_cn);
-  if ((names == NULL) || (names[0] == NULL))
+  int numgids;
+  gidvalues = myldap_get_values_len(entry, attmap_group_gidNumber, NULL);
+  if ((gidvalues == NULL) || (gidvalues[0] == NULL))
   {
     log_log(LOG_WARNING, "%s: %s: missing",
-            myldap_get_dn(entry), attmap_group_cn);
+            myldap_get_dn(entry), attmap_group_gidNumber);
     return 0;
   }
-  /* get the group id(s) */
-  if (reqgid != NULL)
-  {
-    gids[0] = *reqgid;
-    numgids = 1;
-  }
-  else
-  {
-    gidvalues = myldap_get_values_len(entry, attmap_group_gidNumber);
-    if ((gidvalues == NULL) || (gidvalues[0] == NULL))
-    {
-      log_log(LOG_WARNING, "%s: %s: missing",
-              myldap_get_dn(entry), attmap_group_gidNumber);
-      return 0;
-    }
-    for (numgids = 0; (numgids < MAXGIDS_PER_ENTRY) && (gidvalues[numgids] != NULL); numgids++)
-    {
-      if (gidSid != NULL)
-        gids[numgids] = (gid_t)binsid2id(gidvalues[numgids]);
-      else
-      {
-        errno = 0;
-        gids[numgids] = strtogid(gidvalues[numgids], &tmp, 10);
-        if ((*(gidvalues[numgids]) == '\0') || (*tmp != '\0'))
-        {
-          log_log(LOG_WARNING, "%s: %s: non-numeric",
-                  myldap_get_dn(entry), attmap_group_gidNumber);
-          return 0;
-        }
-        else if ((errno != 0) || (strchr(gidvalues[numgids], '-') != NULL))
-        {
-          log_log(LOG_WARNING, "%s: %s: out of range",
-                  myldap_get_dn(entry), attmap_group_gidNumber);
-          return 0;
-        }
-      }
-      gids[numgids] += nslcd_cfg->nss_gid_offset;
-    }
-  }
-  /* get group passwd (userPassword) (use only first entry) */
-  passwd = get_userpassword(entry, attmap_group_userPassword,
-                            passbuffer, sizeof(passbuffer));
-  if (passwd == NULL)
-    passwd = default_group_userPassword;
-  /* get group members (memberUid&member) */
-  if (wantmembers)
+  for (numgids = 0; (numgids < MAXGIDS_PER_ENTRY) && (gidvalues[numgids] != NULL); numgids++)
   {
-    set = set_new();
-    if (set != NULL)
+    if (gidSid != NULL)
+      gids[numgids] = (gid_t)binsid2id(gidvalues[numgids]);
+    else
     {
-      if (nslcd_cfg->nss_nested_groups)
+      errno = 0;
+      gids[numgids] = strtogid(gidvalues[numgids], &tmp, 10);
+      if ((*(gidvalues[numgids]) == '\0') || (*tmp != '\0'))
       {
-        seen = set_new();
-        subgroups = set_new();
+        log_log(LOG_WARNING, "%s: %s: non-numeric",
+                myldap_get_dn(entry), attmap_group_gidNumber);
+        return 0;
       }
-      /* collect the members from this group */
-      getmembers(entry, session, set, seen, subgroups);
-      /* add the members of any nested groups */
-      if (subgroups != NULL)
+      else if ((errno != 0) || (strchr(gidvalues[numgids], '-') != NULL))
       {
-        while ((tmp = set_pop(subgroups)) != NULL)
-        {
-          search = myldap_search(session, tmp, LDAP_SCOPE_BASE, group_filter, group_attrs, NULL);
-          if (search != NULL)
-            while ((entry2 = myldap_get_entry(search, NULL)) != NULL)
-              getmembers(entry2, session, set, seen, subgroups);
-          free(tmp);
-        }
+        log_log(LOG_WARNING, "%s: %s: out of range",
+                myldap_get_dn(entry), attmap_group_gidNumber);
+        return 0;
       }
-      members = set_tolist(set);
-      set_free(set);
-      if (seen != NULL)
-        set_free(seen);
-      if (subgroups != NULL)
-        set_free(subgroups);
     }
+    gids[numgids] += nslcd_cfg->nss_gid_offset;
   }
-  /* write entries (split to a separate function so we can ensure the call
-     to free() below in case a write fails) */
-  rc = do_write_group(fp, entry, names, gids, numgids, passwd, members,
-                      reqname);
-  /* free and return */
-  if (members != NULL)
-    free(members);
-  return rc;
+  return numgids;
 }
 
-NSLCD_HANDLE(
-  group, byname, NSLCD_ACTION_GROUP_BYNAME,
-  char name[BUFLEN_NAME];
-  char filter[BUFLEN_FILTER];
-  READ_STRING(fp, name);
-  log_setrequest("group=\"%s\"", name);
-  if (!isvalidname(name))
-  {
-    log_log(LOG_WARNING, "request denied by validnames option");
-    return -1;
-  },
-  mkfilter_group_byname(name, filter, sizeof(filter)),
-  write_group(fp, entry, name, NULL, 1, session)
-)
+/* the maximum number of groups that are kept in the nested group cache */
+#define GROUP_GRAPH_MAXENTRIES 65536
 
-NSLCD_HANDLE(
-  group, bygid, NSLCD_ACTION_GROUP_BYGID,
-  gid_t gid;
-  char filter[BUFLEN_FILTER];
-  READ_INT32(fp, gid);
-  log_setrequest("group=%lu", (unsigned long int)gid);,
-  mkfilter_group_bygid(gid, filter, sizeof(filter)),
-  write_group(fp, entry, NULL, &gid, 1, session)
-)
+/* a group in the nested group cache, the lists are allocated as a single
+   block and the node is freed when the last reference is released */
+struct group_node {
+  int refs;
+  time_t expires;
+  char *dn;
+  const char **names;
+  char *passwd;
+  gid_t gids[MAXGIDS_PER_ENTRY];
+  int numgids;
+  int hasmembers;          /* whether the member attributes were retrieved */
+  const char **uids;       /* memberUid values and dereferenced members */
+  const char **dns;        /* member DNs that may be users or groups */
+  const char **subgroups;  /* member DNs that are not users */
+};
 
-int nslcd_group_bymember(TFILE *fp, MYLDAP_SESSION *session)
+/* the information in the nested group cache for a single DN */
+struct group_graph_entry {
+  struct group_node *node;  /* the group or NULL if it is not known */
+  const char **parents;     /* the parent groups or NULL if not known */
+  time_t parents_expires;
+  time_t notgroup_expires;  /* the DN is not a group until this time */
+};
+
+/* the nested group cache, indexed by the lower case DN, the mutex also
+   protects the reference counts of the nodes */
+static DICT *group_graph = NULL;
+static int group_graph_num = 0;
+static pthread_mutex_t group_graph_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* copy the list of strings into a single block of memory */
+static const char **group_copylist(const char **values)
 {
-  /* define common variables */
-  int32_t tmpint32;
-  MYLDAP_SEARCH *search;
-  MYLDAP_ENTRY *entry;
-  const char *dn;
-  const char *base;
-  int rc, i;
-  char name[BUFLEN_NAME];
-  char filter[BUFLEN_FILTER];
-  SET *seen=NULL, *tocheck=NULL;
-  /* read request parameters */
-  READ_STRING(fp, name);
-  log_setrequest("group/member=\"%s\"", name);
-  /* validate request */
-  if (!isvalidname(name))
+  const char **list;
+  char *buf;
+  size_t sz = 0;
+  int i, num;
+  for (num = 0; (values != NULL) && (values[num] != NULL); num++)
+    sz += strlen(values[num]) + 1;
+  list = (const char **)malloc((num + 1) * sizeof(char *) + sz);
+  if (list == NULL)
   {
-    log_log(LOG_WARNING, "request denied by validnames option");
-    return -1;
+    log_log(LOG_CRIT, "group_copylist(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
   }
-  if ((nslcd_cfg->nss_initgroups_ignoreusers != NULL) &&
-      set_contains(nslcd_cfg->nss_initgroups_ignoreusers, name))
+  buf = (char *)(list + num + 1);
+  for (i = 0; i < num; i++)
   {
-    log_log(LOG_DEBUG, "ignored group member");
-    /* just end the request, returning no results */
-    WRITE_INT32(fp, NSLCD_VERSION);
-    WRITE_INT32(fp, NSLCD_ACTION_GROUP_BYMEMBER);
-    WRITE_INT32(fp, NSLCD_RESULT_END);
-    return 0;
+    strcpy(buf, values[i]);
+    list[i] = buf;
+    buf += strlen(buf) + 1;
   }
-  /* write the response header */
-  WRITE_INT32(fp, NSLCD_VERSION);
-  WRITE_INT32(fp, NSLCD_ACTION_GROUP_BYMEMBER);
-  /* prepare the search filter */
-  if (mkfilter_group_bymember(session, name, filter, sizeof(filter)))
-  {
-    log_log(LOG_WARNING, "nslcd_group_bymember(): filter buffer too small");
-    return -1;
+  list[num] = NULL;
+  return list;
+}
+
+/* build a nested group cache node from the entry, returns NULL if the
+   entry is not a valid group, hasmembers indicates whether the member
+   attributes were requested */
+static struct group_node *group_node_new(MYLDAP_ENTRY *entry, int hasmembers)
+{
+  struct group_node *node;
+  const char **names, **values;
+  const char ***derefs = NULL;
+  const char *passwd;
+  char passbuffer[BUFLEN_PASSWORDHASH];
+  SET *set;
+  int i;
+  names = myldap_get_values(entry, attmap_group_cn);
+  if ((names == NULL) || (names[0] == NULL))
+    return NULL;
+  node = (struct group_node *)malloc(sizeof(struct group_node));
+  if (node == NULL)
+  {
+    log_log(LOG_CRIT, "group_node_new(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  node->numgids = getgids(entry, node->gids);
+  if (node->numgids == 0)
+  {
+    free(node);
+    return NULL;
+  }
+  passwd = get_userpassword(entry, attmap_group_userPassword,
+                            passbuffer, sizeof(passbuffer));
+  if (passwd == NULL)
+    passwd = default_group_userPassword;
+  node->refs = 1;
+  node->expires = 0;
+  node->hasmembers = hasmembers;
+  node->dn = strdup(myldap_get_dn(entry));
+  node->passwd = strdup(passwd);
+  set = set_new();
+  if ((node->dn == NULL) || (node->passwd == NULL) || (set == NULL))
+  {
+    log_log(LOG_CRIT, "group_node_new(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  node->names = group_copylist(names);
+  /* collect the members in the same way as getmembers() */
+  values = hasmembers ? myldap_get_values(entry, attmap_group_memberUid) : NULL;
+  if (values != NULL)
+    for (i = 0; values[i] != NULL; i++)
+      if (isvalidname(values[i]))
+        set_add(set, values[i]);
+  values = NULL;
+  if (hasmembers && (strcasecmp(attmap_group_member, "\"\"") != 0))
+  {
+    derefs = myldap_get_deref_values(entry, attmap_group_member, attmap_passwd_uid);
+    if (derefs != NULL)
+      for (i = 0; derefs[0][i] != NULL; i++)
+        set_add(set, derefs[0][i]);
+    else
+      values = myldap_get_values(entry, attmap_group_member);
+  }
+  node->uids = set_tolist(set);
+  if (node->uids == NULL)
+  {
+    log_log(LOG_CRIT, "group_node_new(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  set_free(set);
+  node->dns = group_copylist(values);
+  node->subgroups = group_copylist((derefs != NULL) ? derefs[1] : NULL);
+  return node;
+}
+
+/* drop a reference to the node, the caller should hold the mutex */
+static void group_node_unref(struct group_node *node)
+{
+  if (--node->refs > 0)
+    return;
+  memset(node->passwd, 0, strlen(node->passwd));
+  free(node->dn);
+  free(node->names);
+  free(node->passwd);
+  free(node->uids);
+  free(node->dns);
+  free(node->subgroups);
+  free(node);
+}
+
+static void group_node_release(struct group_node *node)
+{
+  pthread_mutex_lock(&group_graph_mutex);
+  group_node_unref(node);
+  pthread_mutex_unlock(&group_graph_mutex);
+}
+
+/* free the cache entry, the caller should hold the mutex */
+static void group_graph_entry_free(struct group_graph_entry *entry)
+{
+  if (entry->node != NULL)
+    group_node_unref(entry->node);
+  if (entry->parents != NULL)
+    free(entry->parents);
+  free(entry);
+}
+
+/* free the expired parts of the cache entry, returns non-zero if nothing
+   remains of the entry, the caller should hold the mutex */
+static int group_graph_expire(struct group_graph_entry *entry, time_t now)
+{
+  if ((entry->node != NULL) && (entry->node->expires <= now))
+  {
+    group_node_unref(entry->node);
+    entry->node = NULL;
+  }
+  if ((entry->parents != NULL) && (entry->parents_expires <= now))
+  {
+    free(entry->parents);
+    entry->parents = NULL;
+  }
+  return (entry->node == NULL) && (entry->parents == NULL) &&
+         (entry->notgroup_expires <= now);
+}
+
+/* remove expired information from the nested group cache, the caller
+   should hold the mutex */
+static void group_graph_purge(time_t now)
+{
+  DICT *entries;
+  const char **keys;
+  struct group_graph_entry *entry;
+  int i;
+  entries = dict_new();
+  keys = dict_keys(group_graph);
+  if ((entries == NULL) || (keys == NULL))
+  {
+    log_log(LOG_CRIT, "group_graph_purge(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  group_graph_num = 0;
+  for (i = 0; keys[i] != NULL; i++)
+  {
+    entry = dict_get(group_graph, keys[i]);
+    if (entry == NULL)
+      continue;
+    if (group_graph_expire(entry, now) || dict_put(entries, keys[i], entry))
+      group_graph_entry_free(entry);
+    else
+      group_graph_num++;
+  }
+  free(keys);
+  dict_free(group_graph);
+  group_graph = entries;
+}
+
+/* find the cache entry for the DN, optionally creating a new one (NULL is
+   returned if the cache is full), the caller should hold the mutex */
+static struct group_graph_entry *group_graph_find(const char *dn, int create)
+{
+  char key[BUFLEN_DN];
+  struct group_graph_entry *entry;
+  if (dn2key(dn, key, sizeof(key)))
+    return NULL;
+  if (group_graph == NULL)
+  {
+    if (!create)
+      return NULL;
+    group_graph = dict_new();
+    if (group_graph == NULL)
+    {
+      log_log(LOG_CRIT, "group_graph_find(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+  }
+  entry = dict_get(group_graph, key);
+  if ((entry != NULL) || (!create))
+    return entry;
+  if (group_graph_num >= GROUP_GRAPH_MAXENTRIES)
+    group_graph_purge(time(NULL));
+  if (group_graph_num >= GROUP_GRAPH_MAXENTRIES)
+    return NULL;
+  entry = (struct group_graph_entry *)malloc(sizeof(struct group_graph_entry));
+  if (entry == NULL)
+  {
+    log_log(LOG_CRIT, "group_graph_find(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  entry->node = NULL;
+  entry->parents = NULL;
+  entry->parents_expires = 0;
+  entry->notgroup_expires = 0;
+  if (dict_put(group_graph, key, entry))
+  {
+    free(entry);
+    return NULL;
+  }
+  group_graph_num++;
+  return entry;
+}
+
+/* get the group from the nested group cache, the returned node should be
+   released with group_node_release() */
+static struct group_node *group_graph_get(const char *dn)
+{
+  struct group_graph_entry *entry;
+  struct group_node *node = NULL;
+  pthread_mutex_lock(&group_graph_mutex);
+  entry = group_graph_find(dn, 0);
+  if ((entry != NULL) && (entry->node != NULL) &&
+      (entry->node->expires > time(NULL)))
+  {
+    node = entry->node;
+    node->refs++;
+  }
+  pthread_mutex_unlock(&group_graph_mutex);
+  return node;
+}
+
+/* store the group in the nested group cache, a group with members is
+   not replaced by one without */
+static void group_graph_put(struct group_node *node)
+{
+  struct group_graph_entry *entry;
+  time_t now = time(NULL);
+  pthread_mutex_lock(&group_graph_mutex);
+  entry = group_graph_find(node->dn, 1);
+  if ((entry != NULL) &&
+      ((entry->node == NULL) || (node->hasmembers) ||
+       (!entry->node->hasmembers) || (entry->node->expires <= now)))
+  {
+    if (entry->node != NULL)
+      group_node_unref(entry->node);
+    node->expires = now + nslcd_cfg->cache_nested_groups;
+    node->refs++;
+    entry->node = node;
+    entry->notgroup_expires = 0;
+  }
+  pthread_mutex_unlock(&group_graph_mutex);
+}
+
+/* remember that the DN is not a valid group */
+static void group_graph_putnotgroup(const char *dn)
+{
+  struct group_graph_entry *entry;
+  pthread_mutex_lock(&group_graph_mutex);
+  entry = group_graph_find(dn, 1);
+  if (entry != NULL)
+    entry->notgroup_expires = time(NULL) + nslcd_cfg->cache_nested_groups;
+  pthread_mutex_unlock(&group_graph_mutex);
+}
+
+/* check whether the DN is known not to be a valid group */
+static int group_graph_isnotgroup(const char *dn)
+{
+  struct group_graph_entry *entry;
+  int rc = 0;
+  pthread_mutex_lock(&group_graph_mutex);
+  entry = group_graph_find(dn, 0);
+  if ((entry != NULL) && (entry->notgroup_expires > time(NULL)))
+    rc = 1;
+  pthread_mutex_unlock(&group_graph_mutex);
+  return rc;
+}
+
+/* add the cached parent groups of the group to the set, returns 0 if the
+   parent groups are not in the cache */
+static int group_graph_getparents(const char *dn, SET *parents)
+{
+  struct group_graph_entry *entry;
+  int i, rc = 0;
+  pthread_mutex_lock(&group_graph_mutex);
+  entry = group_graph_find(dn, 0);
+  if ((entry != NULL) && (entry->parents != NULL) &&
+      (entry->parents_expires > time(NULL)))
+  {
+    for (i = 0; entry->parents[i] != NULL; i++)
+      set_add(parents, entry->parents[i]);
+    rc = 1;
+  }
+  pthread_mutex_unlock(&group_graph_mutex);
+  return rc;
+}
+
+/* store the parent groups of the group in the nested group cache */
+static void group_graph_putparents(const char *dn, SET *parents)
+{
+  struct group_graph_entry *entry;
+  const char **list;
+  list = set_tolist(parents);
+  if (list == NULL)
+  {
+    log_log(LOG_CRIT, "group_graph_putparents(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&group_graph_mutex);
+  entry = group_graph_find(dn, 1);
+  if (entry != NULL)
+  {
+    if (entry->parents != NULL)
+      free(entry->parents);
+    entry->parents = list;
+    entry->parents_expires = time(NULL) + nslcd_cfg->cache_nested_groups;
+    list = NULL;
+  }
+  pthread_mutex_unlock(&group_graph_mutex);
+  if (list != NULL)
+    free(list);
+}
+
+void group_graph_invalidate(void)
+{
+  const char **keys;
+  struct group_graph_entry *entry;
+  int i;
+  pthread_mutex_lock(&group_graph_mutex);
+  if (group_graph != NULL)
+  {
+    keys = dict_keys(group_graph);
+    if (keys == NULL)
+    {
+      log_log(LOG_CRIT, "group_graph_invalidate(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; keys[i] != NULL; i++)
+      if ((entry = dict_get(group_graph, keys[i])) != NULL)
+        group_graph_entry_free(entry);
+    free(keys);
+    dict_free(group_graph);
+    group_graph = NULL;
+    group_graph_num = 0;
+  }
+  pthread_mutex_unlock(&group_graph_mutex);
+}
+
+/* add the members of the cached group in the same way as getmembers() */
+static void getmembers_node(struct group_node *node, MYLDAP_SESSION *session,
+                            DICT *usermap,
+                            SET *members, SET *seen, SET *subgroups)
+{
+  int i;
+  for (i = 0; node->uids[i] != NULL; i++)
+    set_add(members, node->uids[i]);
+  addsubgroups(node->subgroups, seen, subgroups);
+  addmemberdns(session, usermap, node->dns, members, seen, subgroups);
+}
+
+/* add the members of the nested group, using the nested group cache if
+   possible */
+static void getmembers_subgroup(const char *dn, MYLDAP_SESSION *session,
+                                DICT *usermap,
+                                SET *members, SET *seen, SET *subgroups)
+{
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  struct group_node *node;
+  if ((nslcd_cfg->cache_nested_groups > 0) &&
+      ((node = group_graph_get(dn)) != NULL))
+  {
+    if (node->hasmembers)
+    {
+      getmembers_node(node, session, usermap, members, seen, subgroups);
+      group_node_release(node);
+      return;
+    }
+    group_node_release(node);
+  }
+  search = myldap_search(session, dn, LDAP_SCOPE_BASE, group_filter, group_attrs, NULL);
+  if (search == NULL)
+    return;
+  while ((entry = myldap_get_entry(search, NULL)) != NULL)
+  {
+    if ((nslcd_cfg->cache_nested_groups > 0) &&
+        ((node = group_node_new(entry, 1)) != NULL))
+    {
+      group_graph_put(node);
+      getmembers_node(node, session, usermap, members, seen, subgroups);
+      group_node_release(node);
+    }
+    else
+      getmembers(entry, session, usermap, members, seen, subgroups);
+  }
+}
+
+/* write the group entry, usermap is used for resolving member DNs during
+   enumeration (may be NULL), format is one of the GROUP_FORMAT_* values */
+static int write_group(TFILE *fp, MYLDAP_ENTRY *entry, const char *reqname,
+                       const gid_t *reqgid, int wantmembers, int format,
+                       MYLDAP_SESSION *session, DICT *usermap)
+{
+  const char **names;
+  const char *passwd;
+  SET *set = NULL, *seen = NULL, *subgroups = NULL;
+  gid_t gids[MAXGIDS_PER_ENTRY];
+  int numgids;
+  char *tmp;
+  char passbuffer[BUFLEN_PASSWORDHASH];
+  int rc;
+  /* get group name (cn) */
+  names = myldap_get_values(entry, attmap_group_cn);
+  if ((names == NULL) || (names[0] == NULL))
+  {
+    log_log(LOG_WARNING, "%s: %s: missing",
+            myldap_get_dn(entry), attmap_group_cn);
+    return 0;
+  }
+  /* get the group id(s) */
+  if (reqgid != NULL)
+  {
+    gids[0] = *reqgid;
+    numgids = 1;
+  }
+  else
+  {
+    numgids = getgids(entry, gids);
+    if (numgids == 0)
+      return 0;
+  }
+  /* nothing else is needed if only the gids are written */
+  if (format == GROUP_FORMAT_GIDS)
+    return do_write_group(fp, myldap_get_dn(entry), names, gids, numgids,
+                          NULL, NULL, format, NULL);
+  /* get group passwd (userPassword) (use only first entry) */
+  passwd = get_userpassword(entry, attmap_group_userPassword,
+                            passbuffer, sizeof(passbuffer));
+  if (passwd == NULL)
+    passwd = default_group_userPassword;
+  /* get group members (memberUid&member) */
+  if (wantmembers)
+  {
+    set = set_new();
+    if (set != NULL)
+    {
+      if (nslcd_cfg->nss_nested_groups)
+      {
+        seen = set_new();
+        subgroups = set_new();
+      }
+      /* collect the members from this group */
+      getmembers(entry, session, usermap, set, seen, subgroups);
+      /* add the members of any nested groups */
+      if (subgroups != NULL)
+      {
+        while ((tmp = set_pop(subgroups)) != NULL)
+        {
+          getmembers_subgroup(tmp, session, usermap, set, seen, subgroups);
+          free(tmp);
+        }
+      }
+      if (seen != NULL)
+        set_free(seen);
+      if (subgroups != NULL)
+        set_free(subgroups);
+    }
+  }
+  /* write entries (split to a separate function so we can ensure the call
+     to set_free() below in case a write fails) */
+  rc = do_write_group(fp, myldap_get_dn(entry), names, gids, numgids, passwd,
+                      set, format, reqname);
+  /* free and return */
+  if (set != NULL)
+    set_free(set);
+  return rc;
+}
+
+NSLCD_HANDLE(
+  group, byname, NSLCD_ACTION_GROUP_BYNAME,
+  char name[BUFLEN_NAME];
+  char filter[BUFLEN_FILTER];
+  READ_STRING(fp, name);
+  log_setrequest("group=\"%s\"", name);
+  if (!isvalidname(name))
+  {
+    log_log(LOG_WARNING, "request denied by validnames option");
+    return -1;
+  }
+  shmkey = name;
+  shmkeylen = strlen(name);,
+  mkfilter_group_byname(name, filter, sizeof(filter)),
+  write_group(fp, entry, name, NULL, 1, GROUP_FORMAT_LIST, session, NULL)
+)
+
+NSLCD_HANDLE(
+  group, byname_chunked, NSLCD_ACTION_GROUP_BYNAME_CHUNKED,
+  char name[BUFLEN_NAME];
+  char filter[BUFLEN_FILTER];
+  READ_STRING(fp, name);
+  log_setrequest("group=\"%s\"", name);
+  if (!isvalidname(name))
+  {
+    log_log(LOG_WARNING, "request denied by validnames option");
+    return -1;
+  }
+  shmkey = name;
+  shmkeylen = strlen(name);,
+  mkfilter_group_byname(name, filter, sizeof(filter)),
+  write_group(fp, entry, name, NULL, 1, GROUP_FORMAT_CHUNKED, session, NULL)
+)
+
+NSLCD_HANDLE(
+  group, bygid, NSLCD_ACTION_GROUP_BYGID,
+  gid_t gid;
+  char filter[BUFLEN_FILTER];
+  READ_INT32(fp, gid);
+  log_setrequest("group=%lu", (unsigned long int)gid);
+  shmkey = &gid;
+  shmkeylen = sizeof(gid_t);,
+  mkfilter_group_bygid(gid, filter, sizeof(filter)),
+  write_group(fp, entry, NULL, &gid, 1, GROUP_FORMAT_LIST, session, NULL)
+)
+
+NSLCD_HANDLE(
+  group, bygid_chunked, NSLCD_ACTION_GROUP_BYGID_CHUNKED,
+  gid_t gid;
+  char filter[BUFLEN_FILTER];
+  READ_INT32(fp, gid);
+  log_setrequest("group=%lu", (unsigned long int)gid);
+  shmkey = &gid;
+  shmkeylen = sizeof(gid_t);,
+  mkfilter_group_bygid(gid, filter, sizeof(filter)),
+  write_group(fp, entry, NULL, &gid, 1, GROUP_FORMAT_CHUNKED, session, NULL)
+)
+
+/* write the cached parent groups of the DNs, the DNs of which the parent
+   groups are not (completely) cached are moved to the front of the list,
+   returns the number of these DNs or -1 on write errors */
+static int write_cached_parents(TFILE *fp, const char **dns, int numdns,
+                                SET *seen, SET *tocheck, int *numgroups,
+                                int format)
+{
+  SET *parents;
+  struct group_node *node;
+  char *dn;
+  int i, rc, missing = 0, nummissing = 0;
+  for (i = 0; i < numdns; i++)
+  {
+    parents = set_new();
+    if (parents == NULL)
+    {
+      log_log(LOG_CRIT, "write_cached_parents(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    missing = !group_graph_getparents(dns[i], parents);
+    while ((!missing) && ((dn = set_pop(parents)) != NULL))
+    {
+      if (!set_contains(seen, dn))
+      {
+        node = group_graph_get(dn);
+        if (node == NULL)
+          missing = 1;
+        else
+        {
+          set_add(seen, dn);
+          set_add(tocheck, dn);
+          (*numgroups)++;
+          rc = do_write_group(fp, node->dn, node->names, node->gids,
+                              node->numgids, node->passwd, NULL, format,
+                              NULL);
+          group_node_release(node);
+          if (rc)
+          {
+            free(dn);
+            set_free(parents);
+            return -1;
+          }
+        }
+      }
+      free(dn);
+    }
+    set_free(parents);
+    if (missing)
+      dns[nummissing++] = dns[i];
+  }
+  return nummissing;
+}
+
+/* record the entry as parent group of the DNs in the dict that it has as
+   member, returns 0 if none of its member values matched a DN in the dict
+   (e.g. because the server returned it with a different spelling) */
+static int addparent(DICT *parents, MYLDAP_ENTRY *entry)
+{
+  MYLDAP_VALUES *memberdns;
+  const char **values;
+  char key[BUFLEN_DN];
+  SET *set;
+  int i, found = 0;
+  memberdns = myldap_values_open(entry, attmap_group_member);
+  while ((values = myldap_values_next(memberdns)) != NULL)
+    for (i = 0; values[i] != NULL; i++)
+      if ((dn2key(values[i], key, sizeof(key)) == 0) &&
+          ((set = dict_get(parents, key)) != NULL))
+      {
+        set_add(set, myldap_get_dn(entry));
+        found = 1;
+      }
+  myldap_values_close(memberdns);
+  return found;
+}
+
+/* the number of searches that are in progress at the same time while
+   expanding nested groups (the session allows a few more searches) */
+#define NESTED_GROUP_SEARCHES 3
+
+/* write the groups that (indirectly) have one of the groups in tocheck as
+   member, the nesting is followed level by level with combined filters for
+   all groups in a level (or only the groups of which the parent groups
+   are not cached), tocheck is freed, returns -1 on write errors */
+static int write_parent_groups(TFILE *fp, MYLDAP_SESSION *session,
+                               SET *seen, SET *tocheck, int format)
+{
+  MYLDAP_SEARCH *searches[NESTED_GROUP_SEARCHES];
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  struct group_node *node;
+  DICT *parents = NULL;
+  SET *set;
+  char filter[BUFLEN_FILTER];
+  char key[BUFLEN_DN];
+  const char **dns;
+  const char **attrs;
+  const char *dn;
+  struct timespec start, end;
+  int usecache = (nslcd_cfg->cache_nested_groups > 0);
+  int numdns, pos, n = 0, base = 0, first, num, i, complete, lrc;
+  int depth = 0, numsearches = 0, numgroups = 0, numcached = 0, rc = 0;
+  if (usecache)
+    attrs = group_nested_attrs;
+  else if (format == GROUP_FORMAT_GIDS)
+    attrs = group_gids_attrs;
+  else
+    attrs = group_bymember_attrs;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (rc == 0)
+  {
+    /* get the groups that were found in the previous level */
+    dns = set_tolist(tocheck);
+    if (dns == NULL)
+    {
+      log_log(LOG_CRIT, "write_parent_groups(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    set_free(tocheck);
+    tocheck = NULL;
+    for (numdns = 0; dns[numdns] != NULL; numdns++)
+      /* nothing */ ;
+    if (numdns == 0)
+    {
+      free(dns);
+      break;
+    }
+    if ((nslcd_cfg->nss_nested_groups_depth > 0) &&
+        (depth >= nslcd_cfg->nss_nested_groups_depth))
+    {
+      log_log(LOG_DEBUG, "nested groups: depth limit of %d reached",
+              nslcd_cfg->nss_nested_groups_depth);
+      free(dns);
+      break;
+    }
+    depth++;
+    tocheck = set_new();
+    if (tocheck == NULL)
+    {
+      log_log(LOG_CRIT, "write_parent_groups(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    /* write the parent groups that are in the cache and prepare for
+       recording the parent groups of the remaining groups */
+    if (usecache)
+    {
+      i = numgroups;
+      numdns = write_cached_parents(fp, dns, numdns, seen, tocheck,
+                                    &numgroups, format);
+      if (numdns < 0)
+      {
+        free(dns);
+        rc = -1;
+        break;
+      }
+      numcached += numgroups - i;
+      parents = dict_new();
+      if (parents == NULL)
+      {
+        log_log(LOG_CRIT, "write_parent_groups(): malloc() failed to allocate memory");
+        exit(EXIT_FAILURE);
+      }
+      for (i = 0; i < numdns; i++)
+        if ((dn2key(dns[i], key, sizeof(key)) == 0) &&
+            (dict_get(parents, key) == NULL))
+        {
+          if ((set = set_new()) == NULL)
+          {
+            log_log(LOG_CRIT, "write_parent_groups(): malloc() failed to allocate memory");
+            exit(EXIT_FAILURE);
+          }
+          if (dict_put(parents, key, set))
+            set_free(set);
+        }
+    }
+    /* search all bases with filters for as many DNs as possible while
+       keeping a few searches in progress */
+    pos = 0;
+    first = 0;
+    num = 0;
+    complete = 1;
+    while (((pos < numdns) || (num > 0)) && (rc == 0))
+    {
+      /* start new searches while there is room */
+      while ((pos < numdns) && (num < NESTED_GROUP_SEARCHES))
+      {
+        if (base == 0)
+        {
+          n = mkfilter_group_bymemberdns(dns + pos, numdns - pos, filter,
+                                         sizeof(filter));
+          if (n <= 0)
+          {
+            log_log(LOG_WARNING, "%s: filter buffer too small", dns[pos]);
+            complete = 0;
+            pos++;
+            continue;
+          }
+        }
+        search = myldap_search(session, group_bases[base], group_scope,
+                               filter, attrs, NULL);
+        numsearches++;
+        if (search != NULL)
+          searches[(first + num++) % NESTED_GROUP_SEARCHES] = search;
+        else
+          complete = 0;
+        /* continue with the next search base or the next DNs */
+        if (group_bases[++base] == NULL)
+        {
+          base = 0;
+          pos += n;
+        }
+      }
+      if (num == 0)
+        continue;
+      /* handle the results of the oldest search */
+      search = searches[first];
+      first = (first + 1) % NESTED_GROUP_SEARCHES;
+      num--;
+      lrc = LDAP_SUCCESS;
+      while ((entry = myldap_get_entry(search, &lrc)) != NULL)
+      {
+        /* remember the group and which groups it has as member */
+        if (usecache)
+        {
+          /* the parents of this level are incomplete if the entry cannot
+             be matched to the group it was found for */
+          if (!addparent(parents, entry))
+          {
+            log_log(LOG_DEBUG, "nested groups: %s does not list a searched "
+                    "group as member, not caching parent groups",
+                    myldap_get_dn(entry));
+            complete = 0;
+          }
+          if ((node = group_node_new(entry, 1)) != NULL)
+          {
+            group_graph_put(node);
+            group_node_release(node);
+          }
+        }
+        dn = myldap_get_dn(entry);
+        if (!set_contains(seen, dn))
+        {
+          set_add(seen, dn);
+          set_add(tocheck, dn);
+          numgroups++;
+          if (write_group(fp, entry, NULL, NULL, 0, format, session, NULL))
+          {
+            myldap_search_close(search);
+            rc = -1;
+            break;
+          }
+        }
+      }
+      if ((rc == 0) && (lrc != LDAP_SUCCESS))
+        complete = 0;
+    }
+    /* clean up searches that are still in progress after errors */
+    for (i = 0; i < num; i++)
+      myldap_search_close(searches[(first + i) % NESTED_GROUP_SEARCHES]);
+    /* store the parent groups if all searches completed */
+    if (parents != NULL)
+    {
+      for (i = 0; i < numdns; i++)
+        if ((dn2key(dns[i], key, sizeof(key)) == 0) &&
+            ((set = dict_get(parents, key)) != NULL))
+        {
+          if ((rc == 0) && complete)
+            group_graph_putparents(dns[i], set);
+          set_free(set);
+          dict_put(parents, key, NULL);
+        }
+      dict_free(parents);
+      parents = NULL;
+    }
+    free(dns);
+  }
+  if (tocheck != NULL)
+    set_free(tocheck);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  log_log(LOG_DEBUG, "nested groups: %d groups (%d cached) in %d levels "
+          "found with %d searches in %ld ms", numgroups, numcached, depth,
+          numsearches, (long)((end.tv_sec - start.tv_sec) * 1000 +
+                              (end.tv_nsec - start.tv_nsec) / 1000000));
+  return rc;
+}
+
+/* add the group to seen and tocheck, returns 0 if it was seen before */
+static int addseen(SET *seen, SET *tocheck, const char *dn)
+{
+  if (seen == NULL)
+    return 1;
+  if (set_contains(seen, dn))
+    return 0;
+  set_add(seen, dn);
+  set_add(tocheck, dn);
+  return 1;
+}
+
+/* write the groups that are listed in the memberOf attribute of the user
+   entry, the groups are looked up in the nested group cache or with base
+   searches and added to seen and tocheck (if these are not NULL),
+   returns an LDAP result code or -1 on write errors */
+static int write_groups_bymemberof(TFILE *fp, MYLDAP_SESSION *session,
+                                   const char *name, SET *seen, SET *tocheck,
+                                   int format)
+{
+  MYLDAP_SEARCH *searches[NESTED_GROUP_SEARCHES];
+  int searchdns[NESTED_GROUP_SEARCHES];
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  struct group_node *node;
+  const char **values, **dns;
+  const char **attrs;
+  int usecache = (nslcd_cfg->cache_nested_groups > 0);
+  int i, numdns, pos, first, num, found, rc = LDAP_SUCCESS;
+  /* the cache needs complete entries */
+  attrs = ((format == GROUP_FORMAT_GIDS) && (!usecache)) ?
+          group_gids_attrs : group_bymember_attrs;
+  /* get the user entry */
+  entry = uid2entry(session, name, &rc);
+  if (entry == NULL)
+    return (rc == LDAP_NO_SUCH_OBJECT) ? LDAP_SUCCESS : rc;
+  values = myldap_get_values(entry, attmap_passwd_memberOf);
+  if (values == NULL)
+    return LDAP_SUCCESS;
+  dns = group_copylist(values);
+  /* write the groups that are in the cache */
+  for (i = 0, numdns = 0; dns[i] != NULL; i++)
+  {
+    if (!isdninbases(dns[i], group_bases))
+      continue;
+    if (usecache && group_graph_isnotgroup(dns[i]))
+      continue;
+    node = usecache ? group_graph_get(dns[i]) : NULL;
+    if (node == NULL)
+    {
+      dns[numdns++] = dns[i];
+      continue;
+    }
+    if (addseen(seen, tocheck, node->dn))
+      rc = do_write_group(fp, node->dn, node->names, node->gids,
+                          node->numgids, node->passwd, NULL, format, NULL);
+    group_node_release(node);
+    if (rc)
+    {
+      free(dns);
+      return -1;
+    }
+  }
+  log_log(LOG_DEBUG, "memberOf: %d groups not cached", numdns);
+  /* look up the remaining groups while keeping a few searches in
+     progress */
+  pos = 0;
+  first = 0;
+  num = 0;
+  while (((pos < numdns) || (num > 0)) && (rc == LDAP_SUCCESS))
+  {
+    while ((pos < numdns) && (num < NESTED_GROUP_SEARCHES))
+    {
+      search = myldap_search(session, dns[pos], LDAP_SCOPE_BASE,
+                             group_filter, attrs, NULL);
+      if (search != NULL)
+      {
+        searches[(first + num) % NESTED_GROUP_SEARCHES] = search;
+        searchdns[(first + num++) % NESTED_GROUP_SEARCHES] = pos;
+      }
+      pos++;
+    }
+    if (num == 0)
+      continue;
+    search = searches[first];
+    i = searchdns[first];
+    first = (first + 1) % NESTED_GROUP_SEARCHES;
+    num--;
+    found = 0;
+    while ((entry = myldap_get_entry(search, &rc)) != NULL)
+    {
+      if (usecache && ((node = group_node_new(entry, 0)) != NULL))
+      {
+        found = 1;
+        group_graph_put(node);
+        group_node_release(node);
+      }
+      if (addseen(seen, tocheck, myldap_get_dn(entry)) &&
+          write_group(fp, entry, NULL, NULL, 0, format, session, NULL))
+      {
+        myldap_search_close(search);
+        rc = -1;
+        break;
+      }
+    }
+    /* the DN does not exist or is not a group */
+    if (usecache && (!found) &&
+        ((rc == LDAP_SUCCESS) || (rc == LDAP_NO_SUCH_OBJECT)))
+      group_graph_putnotgroup(dns[i]);
+    /* groups that no longer exist are ignored */
+    if (rc == LDAP_NO_SUCH_OBJECT)
+      rc = LDAP_SUCCESS;
+  }
+  /* clean up searches that are still in progress after errors */
+  for (i = 0; i < num; i++)
+    myldap_search_close(searches[(first + i) % NESTED_GROUP_SEARCHES]);
+  free(dns);
+  return rc;
+}
+
+/* translate a binary SID of len bytes from the tokenGroups attribute into
+   a group id, returns 0 if the SID is not a group in the domain or a
+   BUILTIN group (the prefixes include the number of sub-authorities so
+   the RID follows the prefix) */
+static int tokengroup2gid(const char *binsid, size_t len, gid_t *gid)
+{
+  gid_t rid;
+  if ((gidsidlen > 0) && (len >= gidsidlen + 4) &&
+      (memcmp(binsid, gidsidbin, gidsidlen) == 0))
+  {
+    *gid = (gid_t)binsid2id(binsid) + nslcd_cfg->nss_gid_offset;
+    return 1;
+  }
+  if ((builtinsidlen > 0) && (len >= builtinsidlen + 4) &&
+      (memcmp(binsid, builtinsidbin, builtinsidlen) == 0))
+  {
+    rid = (gid_t)binsid2id(binsid);
+    if ((rid < min_builtin_rid) || (rid > max_builtin_rid))
+      return 0;
+    *gid = rid + nslcd_cfg->nss_gid_offset;
+    return 1;
+  }
+  return 0;
+}
+
+/* write the group ids that are listed in the tokenGroups attribute of the
+   user entry (only the group ids are known so this is only used for the
+   gid-only response), returns an LDAP result code or -1 on write errors */
+static int write_groups_bytokengroups(TFILE *fp, MYLDAP_SESSION *session,
+                                      const char *name)
+{
+  int32_t tmpint32;
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  const char *attrs[2];
+  const char **values;
+  const size_t *lengths;
+  char dn[BUFLEN_DN];
+  gid_t gid;
+  int i, rc = LDAP_SUCCESS;
+  /* find the user entry */
+  entry = uid2entry(session, name, &rc);
+  if (entry == NULL)
+    return (rc == LDAP_NO_SUCH_OBJECT) ? LDAP_SUCCESS : rc;
+  if (myldap_cpy_dn(entry, dn, sizeof(dn)) == NULL)
+    return LDAP_SUCCESS;
+  /* tokenGroups is a constructed attribute that is only returned with a
+     base search */
+  attrs[0] = attmap_passwd_tokenGroups;
+  attrs[1] = NULL;
+  search = myldap_search(session, dn, LDAP_SCOPE_BASE, "(objectClass=*)",
+                         attrs, &rc);
+  if (search == NULL)
+    return (rc != LDAP_SUCCESS) ? rc : LDAP_OPERATIONS_ERROR;
+  entry = myldap_get_entry(search, &rc);
+  if (entry == NULL)
+    return (rc == LDAP_NO_SUCH_OBJECT) ? LDAP_SUCCESS : rc;
+  values = myldap_get_values_len(entry, attmap_passwd_tokenGroups,
+                                 &lengths);
+  for (i = 0; (values != NULL) && (values[i] != NULL); i++)
+  {
+    if (!tokengroup2gid(values[i], lengths[i], &gid))
+      continue;
+    WRITE_INT32(fp, NSLCD_RESULT_BEGIN);
+    WRITE_INT32(fp, gid);
+  }
+  myldap_search_close(search);
+  return LDAP_SUCCESS;
+}
+
+/* write the groups of the user in response to the (gid-only) bymember
+   request */
+static int write_group_bymember(TFILE *fp, MYLDAP_SESSION *session,
+                                int32_t action, int format)
+{
+  /* define common variables */
+  int32_t tmpint32;
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  const char *dn;
+  const char *base;
+  const char **attrs;
+  int rc, i;
+  char name[BUFLEN_NAME];
+  char filter[BUFLEN_FILTER];
+  SET *seen=NULL, *tocheck=NULL;
+  int usememberof = (strcmp(attmap_passwd_memberOf, "\"\"") != 0);
+  /* read request parameters */
+  READ_STRING(fp, name);
+  log_setrequest("group/member=\"%s\"", name);
+  /* validate request */
+  if (!isvalidname(name))
+  {
+    log_log(LOG_WARNING, "request denied by validnames option");
+    return -1;
+  }
+  if ((nslcd_cfg->nss_initgroups_ignoreusers != NULL) &&
+      set_contains(nslcd_cfg->nss_initgroups_ignoreusers, name))
+  {
+    log_log(LOG_DEBUG, "ignored group member");
+    /* just end the request, returning no results */
+    WRITE_INT32(fp, NSLCD_VERSION);
+    WRITE_INT32(fp, action);
+    WRITE_INT32(fp, NSLCD_RESULT_END);
+    return 0;
+  }
+  /* check the response cache (by name because building the filter may
+     require an LDAP lookup) */
+  rc = cache_get(fp, action, 0, name, (session == NULL));
+  if (rc != 0)
+    return (rc > 0) ? 0 : -1;
+  /* write the response header */
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, action);
+  /* tokenGroups already lists all (nested) groups of the user but only
+     the group ids, the names are needed for the full group entries */
+  if ((format == GROUP_FORMAT_GIDS) &&
+      (strcmp(attmap_passwd_tokenGroups, "\"\"") != 0))
+  {
+    if (write_groups_bytokengroups(fp, session, name) != LDAP_SUCCESS)
+      return -1;
+    WRITE_INT32(fp, NSLCD_RESULT_END);
+    cache_put(fp, action, 0, name, name, strlen(name));
+    return 0;
+  }
+  attrs = (format == GROUP_FORMAT_GIDS) ? group_gids_attrs :
+          group_bymember_attrs;
+  /* prepare the search filter */
+  if ((!usememberof) &&
+      mkfilter_group_bymember(session, name, filter, sizeof(filter)))
+  {
+    log_log(LOG_WARNING, "nslcd_group_bymember(): filter buffer too small");
+    return -1;
   }
   if ((nslcd_cfg->nss_nested_groups) && (strcasecmp(attmap_group_member, "\"\"") != 0))
   {
@@ -508,12 +1759,14 @@ int nslcd_group_bymember(TFILE *fp, MYLDAP_SESSION *session)
       tocheck = NULL;
     }
   }
+  /* get the groups from the user entry if possible */
+  if (usememberof)
+    rc = write_groups_bymemberof(fp, session, name, seen, tocheck, format);
   /* perform a search for each search base */
-  for (i = 0; (base = group_bases[i]) != NULL; i++)
+  for (i = 0; (!usememberof) && ((base = group_bases[i]) != NULL); i++)
   {
     /* do the LDAP search */
-    search = myldap_search(session, base, group_scope, filter,
-                           group_bymember_attrs, NULL);
+    search = myldap_search(session, base, group_scope, filter, attrs, NULL);
     if (search == NULL)
     {
       if (seen != NULL)
@@ -533,7 +1786,7 @@ int nslcd_group_bymember(TFILE *fp, MYLDAP_SESSION *session)
           set_add(seen, dn);
           set_add(tocheck, dn);
         }
-        if (write_group(fp, entry, NULL, NULL, 0, session))
+        if (write_group(fp, entry, NULL, NULL, 0, format, session, NULL))
         {
           if (seen != NULL)
           {
@@ -545,60 +1798,226 @@ int nslcd_group_bymember(TFILE *fp, MYLDAP_SESSION *session)
       }
     }
   }
+  /* on errors the connection is closed to signal the client */
+  if (rc != LDAP_SUCCESS)
+  {
+    if (seen != NULL)
+    {
+      set_free(seen);
+      set_free(tocheck);
+    }
+    return -1;
+  }
   /* write possible parent groups */
   if (tocheck != NULL)
   {
-    while ((dn = set_pop(tocheck)) != NULL)
+    rc = write_parent_groups(fp, session, seen, tocheck, format);
+    set_free(seen);
+    if (rc != 0)
+      return -1;
+  }
+  /* write the final result code */
+  WRITE_INT32(fp, NSLCD_RESULT_END);
+  cache_put(fp, action, 0, name, name, strlen(name));
+  return 0;
+}
+
+int nslcd_group_bymember(TFILE *fp, MYLDAP_SESSION *session)
+{
+  return write_group_bymember(fp, session, NSLCD_ACTION_GROUP_BYMEMBER,
+                              GROUP_FORMAT_LIST);
+}
+
+int nslcd_group_bymember_gids(TFILE *fp, MYLDAP_SESSION *session)
+{
+  return write_group_bymember(fp, session, NSLCD_ACTION_GROUP_BYMEMBER_GIDS,
+                              GROUP_FORMAT_GIDS);
+}
+
+/* write all groups in response to the (chunked) enumeration request */
+static int write_group_all(TFILE *fp, MYLDAP_SESSION *session,
+                           int32_t action, int format)
+{
+  int32_t tmpint32;
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  DICT *usermap = NULL;
+  const char *base;
+  int rc, i;
+  log_setrequest("group(all)");
+  /* the filter identifies the request in the response cache */
+  rc = cache_get(fp, action, 0, group_filter, (session == NULL));
+  if (rc != 0)
+    return (rc > 0) ? 0 : -1;
+  /* write the response header */
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, action);
+  /* find all users first so that member DNs can be resolved in memory */
+  if ((nslcd_cfg->nss_getgrent_prefetchusers) &&
+      (!nslcd_cfg->nss_getgrent_skipmembers) &&
+      (strcasecmp(attmap_group_member, "\"\"") != 0))
+  {
+    usermap = dn2uid_sweep(session);
+    if (usermap == NULL)
+      log_log(LOG_WARNING, "finding all users failed, group members are resolved separately");
+  }
+  /* perform a search for each search base */
+  rc = LDAP_SUCCESS;
+  for (i = 0; (rc == LDAP_SUCCESS) && ((base = group_bases[i]) != NULL); i++)
+  {
+    search = myldap_search(session, base, group_scope, group_filter,
+                           group_attrs, NULL);
+    if (search == NULL)
+    {
+      rc = -1;
+      break;
+    }
+    while ((entry = myldap_get_entry(search, &rc)) != NULL)
     {
-      /* make filter for finding groups with our group as member */
-      if (mkfilter_group_bymemberdn(dn, filter, sizeof(filter)))
+      if (write_group(fp, entry, NULL, NULL, 1, format, session, usermap))
       {
-        log_log(LOG_WARNING, "nslcd_group_bymember(): filter buffer too small");
-        free((void *)dn);
-        set_free(seen);
-        set_free(tocheck);
-        return -1;
+        myldap_search_close(search);
+        rc = -1;
+        break;
+      }
+    }
+  }
+  if (usermap != NULL)
+    dn2uid_sweep_free(usermap);
+  /* on errors the connection is closed to signal the client */
+  if (rc != LDAP_SUCCESS)
+    return -1;
+  /* write the final result code */
+  WRITE_INT32(fp, NSLCD_RESULT_END);
+  cache_put(fp, action, 0, group_filter, NULL, 0);
+  return 0;
+}
+
+int nslcd_group_all(TFILE *fp, MYLDAP_SESSION *session)
+{
+  return write_group_all(fp, session, NSLCD_ACTION_GROUP_ALL,
+                         GROUP_FORMAT_LIST);
+}
+
+int nslcd_group_all_chunked(TFILE *fp, MYLDAP_SESSION *session)
+{
+  return write_group_all(fp, session, NSLCD_ACTION_GROUP_ALL_CHUNKED,
+                         GROUP_FORMAT_CHUNKED);
+}
+
+/* perform the searches for a single batch filter and write all entries,
+   if names is not NULL only entries for the listed names are written */
+static int group_batch_search(TFILE *fp, MYLDAP_SESSION *session,
+                              const char *filter, const char **names,
+                              int numnames)
+{
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  const char *base;
+  const char **groupnames;
+  int rc = LDAP_SUCCESS, i, j, k;
+  for (i = 0; (base = group_bases[i]) != NULL; i++)
+  {
+    search = myldap_search(session, base, group_scope, filter,
+                           group_attrs, NULL);
+    if (search == NULL)
+      return -1;
+    while ((entry = myldap_get_entry(search, &rc)) != NULL)
+    {
+      if (names == NULL)
+      {
+        if (write_group(fp, entry, NULL, NULL, 1, GROUP_FORMAT_LIST, session, NULL))
+          return -1;
+        continue;
       }
-      free((void *)dn);
-      /* do the LDAP searches */
-      for (i = 0; (base = group_bases[i]) != NULL; i++)
+      /* only write the group names that were requested */
+      groupnames = myldap_get_values(entry, attmap_group_cn);
+      if (groupnames == NULL)
+        continue;
+      for (j = 0; groupnames[j] != NULL; j++)
       {
-        search = myldap_search(session, base, group_scope, filter, group_bymember_attrs, NULL);
-        if (search != NULL)
-        {
-          while ((entry = myldap_get_entry(search, NULL)) != NULL)
-          {
-            dn = myldap_get_dn(entry);
-            if (!set_contains(seen, dn))
-            {
-              set_add(seen, dn);
-              set_add(tocheck, dn);
-              if (write_group(fp, entry, NULL, NULL, 0, session))
-              {
-                set_free(seen);
-                set_free(tocheck);
-                return -1;
-              }
-            }
-          }
-        }
+        for (k = 0; (k < numnames) && (STR_CMP(names[k], groupnames[j]) != 0); k++)
+          /* nothing */ ;
+        if ((k < numnames) &&
+            write_group(fp, entry, groupnames[j], NULL, 1, GROUP_FORMAT_LIST,
+                        session, NULL))
+          return -1;
       }
     }
-    set_free(seen);
-    set_free(tocheck);
   }
-  /* write the final result code */
-  if (rc == LDAP_SUCCESS)
+  return (rc == LDAP_SUCCESS) ? 0 : -1;
+}
+
+static int do_group_bynames(TFILE *fp, MYLDAP_SESSION *session,
+                            const char **names)
+{
+  int32_t tmpint32;
+  char filter[BUFLEN_FILTER];
+  int i, num;
+  /* write the response header */
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, NSLCD_ACTION_GROUP_BYNAMES);
+  /* do one search per base for as many names as fit in a filter */
+  for (i = 0; names[i] != NULL; i += num)
   {
-    WRITE_INT32(fp, NSLCD_RESULT_END);
+    num = mkfilter_group_bynames(names + i, filter, sizeof(filter));
+    if (num <= 0)
+    {
+      log_log(LOG_ERR, "nslcd_group_bynames(): filter buffer too small");
+      return -1;
+    }
+    if (group_batch_search(fp, session, filter, names + i, num))
+      return -1;
   }
+  /* write the final result code */
+  WRITE_INT32(fp, NSLCD_RESULT_END);
   return 0;
 }
 
-NSLCD_HANDLE(
-  group, all, NSLCD_ACTION_GROUP_ALL,
-  const char *filter;
-  log_setrequest("group(all)");,
-  (filter = group_filter, 0),
-  write_group(fp, entry, NULL, NULL, 1, session)
-)
+int nslcd_group_bynames(TFILE *fp, MYLDAP_SESSION *session)
+{
+  const char **names;
+  int num, rc;
+  /* read request parameters */
+  if (read_batch_names(fp, &names))
+    return -1;
+  for (num = 0; names[num] != NULL; num++)
+    /* nothing */ ;
+  log_setrequest("group(%d names)", num);
+  rc = do_group_bynames(fp, session, names);
+  free(names);
+  return rc;
+}
+
+int nslcd_group_bygids(TFILE *fp, MYLDAP_SESSION *session)
+{
+  int32_t tmpint32;
+  unsigned long int ids[NSLCD_BATCH_MAXKEYS];
+  gid_t gids[NSLCD_BATCH_MAXKEYS];
+  char filter[BUFLEN_FILTER];
+  int i, num, numgids;
+  /* read request parameters */
+  if (read_batch_ids(fp, ids, &numgids))
+    return -1;
+  log_setrequest("group(%d gids)", numgids);
+  for (i = 0; i < numgids; i++)
+    gids[i] = (gid_t)ids[i];
+  /* write the response header */
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, NSLCD_ACTION_GROUP_BYGIDS);
+  /* do one search per base for as many gids as fit in a filter */
+  for (i = 0; i < numgids; i += num)
+  {
+    num = mkfilter_group_bygids(gids + i, numgids - i, filter, sizeof(filter));
+    if (num <= 0)
+    {
+      log_log(LOG_ERR, "nslcd_group_bygids(): filter buffer too small");
+      return -1;
+    }
+    if (group_batch_search(fp, session, filter, NULL, 0))
+      return -1;
+  }
+  /* write the final result code */
+  WRITE_INT32(fp, NSLCD_RESULT_END);
+  return 0;
+}
@@ -45,6 +45,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <lber.h>
 #include <ldap.h>
 #ifdef HAVE_LDAP_SSL_H
@@ -103,6 +105,14 @@ struct ldap_session {
   int policy_response;
   /* the authentication message */
   char policy_message[BUFLEN_MESSAGE];
+  /* the shared connection that is used (ld refers to its connection) */
+  struct myldap_conn *conn;
+  /* whether searches may be hedged to another server */
+  int hedging;
+  /* the session that is used for sending hedged searches (may be NULL) */
+  MYLDAP_SESSION *hedge;
+  /* the pool the connection was borrowed from (NULL if not pooled) */
+  struct myldap_pool *pool;
 };
 
 /* A search description set as returned by myldap_search(). */
@@ -129,8 +139,126 @@ struct myldap_search {
   int may_retry_search;
   /* the number of results returned so far */
   int count;
+  /* the shared connection the search is registered with (if any) */
+  struct myldap_conn *conn;
+  /* the next search that is registered with the shared connection */
+  struct myldap_search *conn_next;
+  /* results received by the reader thread of the shared connection */
+  struct myldap_result *results;
+  struct myldap_result *results_last;
+  /* signalled when results are available */
+  pthread_cond_t cond;
+  /* a pipe that is also written to when results are available (-1 if
+     not used) */
+  int wakefd;
+  /* index into uris of the server the search is counted against or -1 */
+  int uri;
+  /* the time the search request was sent (zero if no result is expected
+     for timing the server) */
+  struct timespec sent;
 };
 
+/* A result that was received on a shared connection that was not yet
+   handled by the search. */
+struct myldap_result {
+  LDAPMessage *msg;
+  struct myldap_result *next;
+};
+
+/* A connection to an LDAP server that can be shared between sessions.
+   A reader thread receives all results from the connection and passes
+   them on to the registered searches based on the message id. */
+struct myldap_conn {
+  /* the session that holds the real connection */
+  MYLDAP_SESSION *session;
+  /* the number of sessions that use the connection */
+  int refcount;
+  /* set while the connection is being opened */
+  int opening;
+  /* set when the connection should no longer be used */
+  int failed;
+  /* protects failed, searches and the results of the searches */
+  pthread_mutex_t mutex;
+  /* signalled to wake up the reader thread */
+  pthread_cond_t cond;
+  /* the searches that expect results */
+  struct myldap_search *searches;
+  /* the time the last result was received (protected by mutex) */
+  time_t lastactivity;
+};
+
+/* the list of shared connections (shared_connections entries), the
+   refcount and opening fields of connections are protected by the
+   mutex */
+static struct myldap_conn **shared_conns = NULL;
+static pthread_mutex_t shared_conns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shared_conns_cond = PTHREAD_COND_INITIALIZER;
+
+/* an idle connection in the connection pool */
+struct myldap_pooled {
+  LDAP *ld;
+  /* index into uris of the server of the connection */
+  int uri;
+  /* timestamp of last activity */
+  time_t lastactivity;
+  struct myldap_pooled *next;
+};
+
+/* connections that are borrowed by sessions for the duration of a
+   request (when connection_pool is set) */
+struct myldap_pool {
+  /* idle connections, the most recently used first */
+  struct myldap_pooled *idle;
+  /* the number of open connections (idle and borrowed) per server */
+  int open[NSS_LDAP_CONFIG_MAX_URIS];
+};
+
+/* the pools of connections that bind with the configured credentials,
+   connections that bind as a user and connections for hedged searches,
+   the pools are protected by the mutex and the condition is signalled
+   when connections are returned or closed */
+#define POOL_SERVICE 0
+#define POOL_USER    1
+#define POOL_HEDGE   2
+static struct myldap_pool pools[3];
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pools_cond = PTHREAD_COND_INITIALIZER;
+
+/* the maximum number of connections per server for hedged searches, these
+   connections are opened in the background (protected by pools_mutex) */
+#define HEDGE_CONNS_MAX 8
+static int hedge_opening[NSS_LDAP_CONFIG_MAX_URIS];
+
+/* mutex for updating the times and counters in the uri */
+pthread_mutex_t uris_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the next server to use with round_robin uri_selection (protected by
+   uris_mutex) */
+static int uri_next = 0;
+
+/* the number of seconds without new samples after which the smoothed
+   response time of a server is halved */
+#define SRTT_AGE 30
+
+/* the number of recent response times that are kept for determining
+   when searches should be hedged */
+#define HEDGE_SAMPLES 128
+
+/* the minimum number of response times needed before hedging */
+#define HEDGE_MIN_SAMPLES 16
+
+/* the number of new response times after which the hedging delay is
+   determined again */
+#define HEDGE_RECALC_SAMPLES 8
+
+/* the recent response times in microseconds and the delay after which
+   searches are hedged (-1 if not yet known), protected by uris_mutex */
+static long hedge_samples[HEDGE_SAMPLES];
+static int hedge_numsamples = 0;
+static int hedge_nextsample = 0;
+static int hedge_newsamples = 0;
+static long hedge_delay_us = -1;
+
 /* The maximum number of calls to myldap_get_values() that may be
    done per returned entry. */
 #define MAX_ATTRIBUTES_PER_ENTRY 16
@@ -300,6 +428,17 @@ static MYLDAP_SEARCH *myldap_search_new(MYLDAP_SESSION *session,
   /* clear result entry */
   search->entry = NULL;
   search->count = 0;
+  /* not registered with a shared connection */
+  search->conn = NULL;
+  search->conn_next = NULL;
+  search->results = NULL;
+  search->results_last = NULL;
+  pthread_cond_init(&search->cond, NULL);
+  search->wakefd = -1;
+  /* not counted against a server */
+  search->uri = -1;
+  search->sent.tv_sec = 0;
+  search->sent.tv_nsec = 0;
   /* return the new search struct */
   return search;
 }
@@ -326,6 +465,10 @@ static MYLDAP_SESSION *myldap_session_new(void)
   session->bindpw[0] = '\0';
   session->policy_response = NSLCD_PAM_SUCCESS;
   session->policy_message[0] = '\0';
+  session->conn = NULL;
+  session->hedging = 0;
+  session->hedge = NULL;
+  session->pool = NULL;
   /* return the new session */
   return session;
 }
@@ -659,6 +802,22 @@ static int do_ppolicy_bind(MYLDAP_SESSION *session, LDAP *ld, const char *uri)
 }
 #endif /* no SASL, so no ppolicy */
 
+/* Bind with the binddn and bindpw that are set in the session on an
+   already set up connection. This returns an LDAP result code. */
+static int do_user_bind(MYLDAP_SESSION *session, LDAP *ld, const char *uri)
+{
+#if defined(HAVE_LDAP_SASL_BIND) && defined(LDAP_SASL_SIMPLE)
+  return do_ppolicy_bind(session, ld, uri);
+#else /* no SASL, so no ppolicy */
+  /* do a simple bind */
+  log_log(LOG_DEBUG, "ldap_simple_bind_s(\"%s\",%s) (uri=\"%s\")",
+          session->binddn,
+          (session->bindpw[0] != '\0') ? "\"***\"" : "\"\"",
+          uri);
+  return ldap_simple_bind_s(ld, session->binddn, session->bindpw);
+#endif
+}
+
 /* This function performs the authentication phase of opening a connection.
    The binddn and bindpw parameters may be used to override the authentication
    mechanism defined in the configuration.  This returns an LDAP result
@@ -688,18 +847,7 @@ static int do_bind(MYLDAP_SESSION *session, LDAP *ld, const char *uri)
 #endif /* LDAP_OPT_X_TLS */
   /* check if the binddn and bindpw are overwritten in the session */
   if (session->binddn[0] != '\0')
-  {
-#if defined(HAVE_LDAP_SASL_BIND) && defined(LDAP_SASL_SIMPLE)
-    return do_ppolicy_bind(session, ld, uri);
-#else /* no SASL, so no ppolicy */
-    /* do a simple bind */
-    log_log(LOG_DEBUG, "ldap_simple_bind_s(\"%s\",%s) (uri=\"%s\")",
-            session->binddn,
-            (session->bindpw[0] != '\0') ? "\"***\"" : "\"\"",
-            uri);
-    return ldap_simple_bind_s(ld, session->binddn, session->bindpw);
-#endif
-  }
+    return do_user_bind(session, ld, uri);
   /* perform SASL bind if requested and available on platform */
 #ifdef HAVE_LDAP_SASL_INTERACTIVE_BIND_S
   /* TODO: store this information in the session */
@@ -860,6 +1008,29 @@ static void disconnect_cb(LDAP UNUSED(*ld), Sockbuf UNUSED(*sb),
 }
 #endif /* LDAP_OPT_CONNECT_CB */
 
+/* Set the function that is called when chasing referrals to bind with
+   the credentials of the session. This function returns an LDAP status
+   code. */
+static int do_set_rebind(MYLDAP_SESSION *session)
+{
+  int rc = LDAP_SUCCESS;
+#ifdef HAVE_LDAP_SET_REBIND_PROC
+  /* the rebind function that is called when chasing referrals, see
+     http://publib.boulder.ibm.com/infocenter/iseries/v5r3/topic/apis/ldap_set_rebind_proc.htm
+     http://www.openldap.org/software/man.cgi?query=ldap_set_rebind_proc&manpath=OpenLDAP+2.4-Release */
+  /* TODO: probably only set this if we should chase referrals */
+  log_log(LOG_DEBUG, "ldap_set_rebind_proc()");
+#ifndef LDAP_SET_REBIND_PROC_RETURNS_VOID /* it returns int */
+  rc = ldap_set_rebind_proc(session->ld, do_rebind, session);
+  if (rc != LDAP_SUCCESS)
+    myldap_err(LOG_ERR, session->ld, rc, "ldap_set_rebind_proc() failed");
+#else /* ldap_set_rebind_proc() returns void */
+  ldap_set_rebind_proc(session->ld, do_rebind, session);
+#endif
+#endif /* HAVE_LDAP_SET_REBIND_PROC */
+  return rc;
+}
+
 /* This function sets a number of properties on the connection, based
    what is configured in the configfile. This function returns an
    LDAP status code. */
@@ -874,23 +1045,9 @@ static int do_set_options(MYLDAP_SESSION *session)
 #ifdef LDAP_OPT_X_TLS
   int i;
 #endif /* LDAP_OPT_X_TLS */
-#ifdef HAVE_LDAP_SET_REBIND_PROC
-  /* the rebind function that is called when chasing referrals, see
-     http://publib.boulder.ibm.com/infocenter/iseries/v5r3/topic/apis/ldap_set_rebind_proc.htm
-     http://www.openldap.org/software/man.cgi?query=ldap_set_rebind_proc&manpath=OpenLDAP+2.4-Release */
-  /* TODO: probably only set this if we should chase referrals */
-  log_log(LOG_DEBUG, "ldap_set_rebind_proc()");
-#ifndef LDAP_SET_REBIND_PROC_RETURNS_VOID /* it returns int */
-  rc = ldap_set_rebind_proc(session->ld, do_rebind, session);
+  rc = do_set_rebind(session);
   if (rc != LDAP_SUCCESS)
-  {
-    myldap_err(LOG_ERR, session->ld, rc, "ldap_set_rebind_proc() failed");
     return rc;
-  }
-#else /* ldap_set_rebind_proc() returns void */
-  ldap_set_rebind_proc(session->ld, do_rebind, session);
-#endif
-#endif /* HAVE_LDAP_SET_REBIND_PROC */
   /* set the protocol version to use */
   log_log(LOG_DEBUG, "ldap_set_option(LDAP_OPT_PROTOCOL_VERSION,%d)",
           nslcd_cfg->ldap_version);
@@ -957,12 +1114,344 @@ static int do_set_options(MYLDAP_SESSION *session)
   return LDAP_SUCCESS;
 }
 
+static int cmp_long(const void *a, const void *b)
+{
+  long la = *(const long *)a, lb = *(const long *)b;
+  return (la > lb) - (la < lb);
+}
+
+/* determine the delay after which searches are hedged from the recent
+   response times, should be called with uris_mutex held */
+static void hedge_recalc(void)
+{
+  long samples[HEDGE_SAMPLES];
+  memcpy(samples, hedge_samples, hedge_numsamples * sizeof(long));
+  qsort(samples, hedge_numsamples, sizeof(long), cmp_long);
+  hedge_delay_us = samples[((hedge_numsamples - 1) * nslcd_cfg->hedge_percentile) / 100];
+  hedge_newsamples = 0;
+}
+
+/* update the smoothed response time of the server with the time it took
+   to receive the first response to the search request */
+static void search_received(MYLDAP_SEARCH *search)
+{
+  struct timespec now;
+  long sample;
+  struct myldap_uri *uri;
+  time_t t;
+  if (((search->sent.tv_sec == 0) && (search->sent.tv_nsec == 0)) ||
+      (search->uri < 0))
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  sample = (now.tv_sec - search->sent.tv_sec) * 1000000L +
+           (now.tv_nsec - search->sent.tv_nsec) / 1000;
+  if (sample <= 0)
+    sample = 1;
+  search->sent.tv_sec = 0;
+  search->sent.tv_nsec = 0;
+  pthread_mutex_lock(&uris_mutex);
+  uri = &(nslcd_cfg->uris[search->uri]);
+  /* exponentially weighted moving average with a weight of 1/8, an old
+     value is replaced */
+  t = time(NULL);
+  if ((uri->srtt == 0) || (t >= (uri->srtt_time + SRTT_AGE)))
+    uri->srtt = sample;
+  else
+    uri->srtt += (sample - uri->srtt) / 8;
+  uri->srtt_time = t;
+  /* keep the sample for determining the hedging delay */
+  hedge_samples[hedge_nextsample] = sample;
+  hedge_nextsample = (hedge_nextsample + 1) % HEDGE_SAMPLES;
+  if (hedge_numsamples < HEDGE_SAMPLES)
+    hedge_numsamples++;
+  hedge_newsamples++;
+  if ((nslcd_cfg->hedge_percentile > 0) &&
+      (hedge_numsamples >= HEDGE_MIN_SAMPLES) &&
+      ((hedge_delay_us < 0) || (hedge_newsamples >= HEDGE_RECALC_SAMPLES)))
+    hedge_recalc();
+  pthread_mutex_unlock(&uris_mutex);
+}
+
+static void conn_cleanup(void *arg)
+{
+  pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/* wait for the condition (with the mutex held) until the specified time
+   (if not NULL), this returns the result of the pthread_cond_*wait() */
+static int conn_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                     const struct timespec *ts)
+{
+  int rc;
+  pthread_cleanup_push(conn_cleanup, mutex);
+  if (ts == NULL)
+    rc = pthread_cond_wait(cond, mutex);
+  else
+    rc = pthread_cond_timedwait(cond, mutex, ts);
+  pthread_cleanup_pop(0);
+  return rc;
+}
+
+/* flag the shared connection as failed, wake up any searches waiting
+   for results and ensure that no new sessions will use it */
+static void conn_fail(struct myldap_conn *conn)
+{
+  MYLDAP_SEARCH *search;
+  int i;
+  pthread_mutex_lock(&conn->mutex);
+  conn->failed = 1;
+  for (search = conn->searches; search != NULL; search = search->conn_next)
+    pthread_cond_signal(&search->cond);
+  pthread_mutex_unlock(&conn->mutex);
+  pthread_mutex_lock(&shared_conns_mutex);
+  for (i = 0; i < nslcd_cfg->shared_connections; i++)
+    if (shared_conns[i] == conn)
+      shared_conns[i] = NULL;
+  pthread_mutex_unlock(&shared_conns_mutex);
+}
+
+/* check whether the shared connection was flagged as failed */
+static int conn_failed(struct myldap_conn *conn)
+{
+  int failed;
+  pthread_mutex_lock(&conn->mutex);
+  failed = conn->failed;
+  pthread_mutex_unlock(&conn->mutex);
+  return failed;
+}
+
+/* stop receiving results for the search from the shared connection and
+   free any results that were not yet handled */
+static void conn_unregister(MYLDAP_SEARCH *search)
+{
+  struct myldap_conn *conn = search->conn;
+  MYLDAP_SEARCH **sp;
+  struct myldap_result *result;
+  pthread_mutex_lock(&conn->mutex);
+  for (sp = &conn->searches; *sp != NULL; sp = &((*sp)->conn_next))
+    if (*sp == search)
+    {
+      *sp = search->conn_next;
+      break;
+    }
+  while (search->results != NULL)
+  {
+    result = search->results;
+    search->results = result->next;
+    ldap_msgfree(result->msg);
+    free(result);
+  }
+  search->results_last = NULL;
+  search->conn_next = NULL;
+  search->conn = NULL;
+  pthread_mutex_unlock(&conn->mutex);
+}
+
+/* get the next result for the search from the shared connection, this
+   returns the same values as ldap_result() */
+static int conn_result(MYLDAP_SEARCH *search, struct timeval *tvp,
+                       LDAPMessage **msg)
+{
+  struct myldap_conn *conn = search->conn;
+  struct myldap_result *result;
+  struct timespec ts;
+  int rc;
+  if (tvp != NULL)
+  {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += tvp->tv_sec;
+    ts.tv_nsec += tvp->tv_usec * 1000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+  }
+  pthread_mutex_lock(&conn->mutex);
+  while ((search->results == NULL) && (!conn->failed))
+  {
+    if (conn_wait(&search->cond, &conn->mutex,
+                  (tvp != NULL) ? &ts : NULL) == ETIMEDOUT)
+      break;
+  }
+  result = search->results;
+  if (result != NULL)
+  {
+    search->results = result->next;
+    if (search->results == NULL)
+      search->results_last = NULL;
+    *msg = result->msg;
+    free(result);
+    rc = ldap_msgtype(*msg);
+  }
+  else if (conn->failed)
+    rc = -1;
+  else
+    rc = 0;
+  pthread_mutex_unlock(&conn->mutex);
+  return rc;
+}
+
+/* check whether any of the registered searches expect results,
+   should be called with the mutex held */
+static int conn_has_pending(struct myldap_conn *conn)
+{
+  MYLDAP_SEARCH *search;
+  for (search = conn->searches; search != NULL; search = search->conn_next)
+    if (search->msgid != -1)
+      return 1;
+  return 0;
+}
+
+/* the thread that reads all results from a shared connection and passes
+   them to the searches, the thread closes the connection once no
+   sessions use it anymore */
+static void *conn_reader(void *arg)
+{
+  struct myldap_conn *conn = (struct myldap_conn *)arg;
+  LDAP *ld = conn->session->ld;
+  MYLDAP_SEARCH *search;
+  struct myldap_result *result;
+  LDAPMessage *msg;
+  struct timeval tv;
+  struct timespec ts;
+  int refcount;
+  int rc;
+  int msgid;
+  while (1)
+  {
+    /* see if the connection is still in use */
+    pthread_mutex_lock(&shared_conns_mutex);
+    refcount = conn->refcount;
+    pthread_mutex_unlock(&shared_conns_mutex);
+    if (refcount == 0)
+      break;
+    /* only wait for results if there are searches that expect them */
+    pthread_mutex_lock(&conn->mutex);
+    if ((conn->failed) || (!conn_has_pending(conn)))
+    {
+      ts.tv_sec = time(NULL) + 1;
+      ts.tv_nsec = 0;
+      pthread_cond_timedwait(&conn->cond, &conn->mutex, &ts);
+      pthread_mutex_unlock(&conn->mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&conn->mutex);
+    /* get the next result (with a timeout to check the state regularly) */
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    msg = NULL;
+    rc = ldap_result(ld, LDAP_RES_ANY, LDAP_MSG_ONE, &tv, &msg);
+    if (rc == 0)
+      continue;
+    if (rc == -1)
+    {
+      if (ldap_get_option(ld, LDAP_OPT_ERROR_NUMBER, &rc) != LDAP_SUCCESS)
+        rc = LDAP_UNAVAILABLE;
+      myldap_err(LOG_ERR, ld, rc, "ldap_result() failed on shared connection");
+      if (msg != NULL)
+        ldap_msgfree(msg);
+      conn_fail(conn);
+      continue;
+    }
+    /* pass the result to the search with the message id */
+    msgid = ldap_msgid(msg);
+    pthread_mutex_lock(&conn->mutex);
+    time(&(conn->lastactivity));
+    for (search = conn->searches; search != NULL; search = search->conn_next)
+      if (search->msgid == msgid)
+        break;
+    if (search != NULL)
+    {
+      /* time the first response when it arrives */
+      search_received(search);
+      result = (struct myldap_result *)malloc(sizeof(struct myldap_result));
+      if (result == NULL)
+      {
+        log_log(LOG_CRIT, "conn_reader(): malloc() failed to allocate memory");
+        exit(EXIT_FAILURE);
+      }
+      result->msg = msg;
+      result->next = NULL;
+      if (search->results_last != NULL)
+        search->results_last->next = result;
+      else
+        search->results = result;
+      search->results_last = result;
+      pthread_cond_signal(&search->cond);
+      if (search->wakefd >= 0)
+        (void)write(search->wakefd, "", 1);
+      msg = NULL;
+    }
+    pthread_mutex_unlock(&conn->mutex);
+    /* ignore results of searches that are no longer registered */
+    if (msg != NULL)
+      ldap_msgfree(msg);
+  }
+  /* no sessions use the connection anymore */
+  log_log(LOG_DEBUG, "closing shared connection to %s",
+          nslcd_cfg->uris[conn->session->current_uri].uri);
+  myldap_session_close(conn->session);
+  pthread_mutex_destroy(&conn->mutex);
+  pthread_cond_destroy(&conn->cond);
+  free(conn);
+  return NULL;
+}
+
+/* stop using the shared connection and invalidate any running searches,
+   if failed is set the connection is flagged to not be used anymore */
+static void do_detach(MYLDAP_SESSION *session, int failed)
+{
+  struct myldap_conn *conn = session->conn;
+  MYLDAP_SEARCH *search;
+  int i;
+  for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
+  {
+    search = session->searches[i];
+    if (search != NULL)
+    {
+      if (search->conn != NULL)
+        conn_unregister(search);
+      if (search->msg != NULL)
+      {
+        ldap_msgfree(search->msg);
+        search->msg = NULL;
+      }
+      if ((search->msgid != -1) && (!failed))
+      {
+        log_log(LOG_DEBUG, "ldap_abandon()");
+        ldap_abandon(session->ld, search->msgid);
+      }
+      search->msgid = -1;
+      search->valid = 0;
+    }
+  }
+  if (failed)
+    conn_fail(conn);
+  session->ld = NULL;
+  session->conn = NULL;
+  /* the reader thread closes the connection when it is no longer used */
+  pthread_mutex_lock(&shared_conns_mutex);
+  conn->refcount--;
+  if (conn->refcount == 0)
+    for (i = 0; i < nslcd_cfg->shared_connections; i++)
+      if (shared_conns[i] == conn)
+        shared_conns[i] = NULL;
+  pthread_mutex_unlock(&shared_conns_mutex);
+}
+
 /* close the connection to the server and invalidate any running searches */
 static void do_close(MYLDAP_SESSION *session)
 {
   int i;
   int rc;
   time_t sec;
+  /* for shared connections, flag the connection as failed */
+  if (session->conn != NULL)
+  {
+    do_detach(session, 1);
+    return;
+  }
   /* if we had reachability problems with the server close the connection */
   if (session->ld != NULL)
   {
@@ -1010,12 +1499,170 @@ static void do_close(MYLDAP_SESSION *session)
     session->ld = NULL;
     if (rc != LDAP_SUCCESS)
       myldap_err(LOG_WARNING, session->ld, rc, "ldap_unbind() failed");
+    /* a pooled connection no longer counts against the pool */
+    if (session->pool != NULL)
+    {
+      pthread_mutex_lock(&pools_mutex);
+      session->pool->open[session->current_uri]--;
+      pthread_cond_broadcast(&pools_cond);
+      pthread_mutex_unlock(&pools_mutex);
+      session->pool = NULL;
+    }
+  }
+}
+
+/* check whether the server has been failing for longer than
+   reconnect_retrytime, should be called with uris_mutex held */
+static int uri_ishardfail(struct myldap_uri *uri)
+{
+  return (uri->lastfail > (uri->firstfail + nslcd_cfg->reconnect_retrytime));
+}
+
+/* check whether the server is in a hard fail state and has been retried
+   not long ago or is left for the prober to check, should be called with
+   uris_mutex held */
+static int uri_isfailing(struct myldap_uri *uri, time_t t)
+{
+  if (!uri_ishardfail(uri))
+    return 0;
+  if (nslcd_cfg->health_check_interval > 0)
+    return 1;
+  return (t < (uri->lastfail + nslcd_cfg->reconnect_retrytime));
+}
+
+/* check whether any of the servers is not in a hard fail state, should
+   be called with uris_mutex held */
+static int uri_anyok(void)
+{
+  int i;
+  for (i = 0; nslcd_cfg->uris[i].uri != NULL; i++)
+    if (!uri_ishardfail(&(nslcd_cfg->uris[i])))
+      return 1;
+  return 0;
+}
+
+/* return the smoothed response time of the server, which is halved for
+   every SRTT_AGE seconds without samples so that a server that was slow
+   for a while is eventually tried again, should be called with uris_mutex
+   held */
+static long uri_srtt(struct myldap_uri *uri, time_t t)
+{
+  long srtt = uri->srtt;
+  time_t age;
+  for (age = t - uri->srtt_time; (age >= SRTT_AGE) && (srtt > 1); age -= SRTT_AGE)
+    srtt /= 2;
+  return srtt;
+}
+
+/* pick the server to open a new connection to based on the uri_selection
+   option, current is returned if no server is available, should be
+   called with uris_mutex held */
+static int uri_select(int current)
+{
+  int i, k, num, best = -1;
+  time_t t;
+  if (nslcd_cfg->uri_selection == URI_FAILOVER)
+    return current;
+  for (num = 0; nslcd_cfg->uris[num].uri != NULL; num++)
+    /* nothing */ ;
+  if (num == 0)
+    return current;
+  t = time(NULL);
+  for (k = 0; k < num; k++)
+  {
+    i = (nslcd_cfg->uri_selection == URI_ROUND_ROBIN) ? (uri_next + k) % num : k;
+    if (uri_isfailing(&(nslcd_cfg->uris[i]), t))
+      continue;
+    if (best < 0)
+    {
+      best = i;
+      if (nslcd_cfg->uri_selection == URI_ROUND_ROBIN)
+        break;
+    }
+    else if ((nslcd_cfg->uri_selection == URI_LEAST_OUTSTANDING) &&
+             (nslcd_cfg->uris[i].outstanding < nslcd_cfg->uris[best].outstanding))
+      best = i;
+    /* servers without a response time yet are tried first */
+    else if ((nslcd_cfg->uri_selection == URI_LOWEST_LATENCY) &&
+             (uri_srtt(&(nslcd_cfg->uris[i]), t) <
+              uri_srtt(&(nslcd_cfg->uris[best]), t)))
+      best = i;
+  }
+  if (best < 0)
+    return current;
+  uri_next = (best + 1) % num;
+  return best;
+}
+
+/* check whether the server has become more than twice as slow as another
+   server that is available */
+static int uri_isslow(int current)
+{
+  int i, slow = 0;
+  time_t t = time(NULL);
+  pthread_mutex_lock(&uris_mutex);
+  for (i = 0; (!slow) && (nslcd_cfg->uris[i].uri != NULL); i++)
+    if ((i != current) && (nslcd_cfg->uris[i].srtt > 0) &&
+        ((uri_srtt(&(nslcd_cfg->uris[i]), t) * 2) <
+         uri_srtt(&(nslcd_cfg->uris[current]), t)) &&
+        (!uri_isfailing(&(nslcd_cfg->uris[i]), t)))
+      slow = 1;
+  pthread_mutex_unlock(&uris_mutex);
+  return slow;
+}
+
+/* count the search against the server of the session and record the time
+   the request was sent */
+static void search_sent(MYLDAP_SEARCH *search)
+{
+  pthread_mutex_lock(&uris_mutex);
+  if (search->uri != search->session->current_uri)
+  {
+    if (search->uri >= 0)
+      nslcd_cfg->uris[search->uri].outstanding--;
+    search->uri = search->session->current_uri;
+    nslcd_cfg->uris[search->uri].outstanding++;
   }
+  pthread_mutex_unlock(&uris_mutex);
+  clock_gettime(CLOCK_MONOTONIC, &(search->sent));
+}
+
+/* stop counting the search against the server */
+static void search_done(MYLDAP_SEARCH *search)
+{
+  if (search->uri < 0)
+    return;
+  pthread_mutex_lock(&uris_mutex);
+  nslcd_cfg->uris[search->uri].outstanding--;
+  pthread_mutex_unlock(&uris_mutex);
+  search->uri = -1;
+}
+
+/* check whether other searches are waiting for results on the connection
+   of the search */
+static int session_ispipelined(MYLDAP_SEARCH *search)
+{
+  int i;
+  for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
+    if ((search->session->searches[i] != NULL) &&
+        (search->session->searches[i] != search) &&
+        (search->session->searches[i]->msgid != -1))
+      return 1;
+  return 0;
 }
 
-void myldap_session_check(MYLDAP_SESSION *session)
+/* check whether any searches are running in the session */
+static int session_isbusy(MYLDAP_SESSION *session)
 {
   int i;
+  for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
+    if ((session->searches[i] != NULL) && (session->searches[i]->valid))
+      return 1;
+  return 0;
+}
+
+time_t myldap_session_check(MYLDAP_SESSION *session)
+{
   time_t current_time;
   int sd;
   int rc;
@@ -1026,10 +1673,19 @@ void myldap_session_check(MYLDAP_SESSION *session)
   {
     log_log(LOG_ERR, "myldap_session_check(): invalid parameter passed");
     errno = EINVAL;
-    return;
+    return 0;
   }
+  /* the connection for hedged searches may also time out */
+  if (session->hedge != NULL)
+    (void)myldap_session_check(session->hedge);
   if (session->ld != NULL)
   {
+    /* stop using shared connections that have failed */
+    if ((session->conn != NULL) && (conn_failed(session->conn)))
+    {
+      do_detach(session, 0);
+      return 0;
+    }
     rc = ldap_get_option(session->ld, LDAP_OPT_DESC, &sd);
     if (rc != LDAP_SUCCESS)
     {
@@ -1045,39 +1701,55 @@ void myldap_session_check(MYLDAP_SESSION *session)
         {
           log_log(LOG_DEBUG, "myldap_session_check(): connection reset by peer");
           do_close(session);
-          return;
+          return 0;
         }
       }
     }
+    /* move away from a server that has become slow while idle, the next
+       search will connect to the fastest server */
+    if ((nslcd_cfg->uri_selection == URI_LOWEST_LATENCY) &&
+        (session->binddn[0] == '\0') && (!session_isbusy(session)) &&
+        uri_isslow(session->current_uri))
+    {
+      log_log(LOG_DEBUG, "myldap_session_check(): %s has become slow",
+              nslcd_cfg->uris[session->current_uri].uri);
+      if (session->conn != NULL)
+        do_detach(session, 0);
+      else
+        do_close(session);
+      return 0;
+    }
     /* check if we should time out the connection */
     if (nslcd_cfg->idle_timelimit > 0)
     {
       /* if we have any running searches, don't time out */
-      for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
-        if ((session->searches[i] != NULL) && (session->searches[i]->valid))
-          return;
+      if (session_isbusy(session))
+        return 0;
       /* consider timeout (there are no running searches) */
       time(&current_time);
       if ((session->lastactivity + nslcd_cfg->idle_timelimit) < current_time)
       {
         log_log(LOG_DEBUG, "myldap_session_check(): idle_timelimit reached");
-        do_close(session);
+        if (session->conn != NULL)
+          do_detach(session, 0);
+        else
+          do_close(session);
         /* try to use the first URI from the list again */
         session->current_uri = 0;
+        return 0;
       }
+      /* the connection should be checked again when it would expire */
+      return session->lastactivity + nslcd_cfg->idle_timelimit + 1;
     }
   }
+  return 0;
 }
 
 /* This opens connection to an LDAP server, sets all connection options
    and binds to the server. This returns an LDAP status code. */
-static int do_open(MYLDAP_SESSION *session)
+static int do_connect(MYLDAP_SESSION *session)
 {
   int rc;
-  /* if the connection is still there (ie. ldap_unbind() wasn't
-     called) then we can return the cached connection */
-  if (session->ld != NULL)
-    return LDAP_SUCCESS;
   /* we should build a new session now */
   session->ld = NULL;
   session->lastactivity = 0;
@@ -1123,6 +1795,523 @@ static int do_open(MYLDAP_SESSION *session)
   return LDAP_SUCCESS;
 }
 
+/* the state of connecting to several servers at the same time */
+struct myldap_race {
+  /* protects the fields below */
+  pthread_mutex_t mutex;
+  /* signalled when an attempt finishes */
+  pthread_cond_t cond;
+  /* the number of threads that use this (the caller and running attempts) */
+  int refcount;
+  /* the number of attempts that did not finish yet */
+  int running;
+  /* set once the caller has stopped waiting */
+  int done;
+  /* the session of the first attempt that succeeded */
+  MYLDAP_SESSION *winner;
+  /* the result of the attempt to the first server */
+  int rc;
+};
+
+/* a single connection attempt that is part of the race */
+struct myldap_attempt {
+  struct myldap_race *race;
+  MYLDAP_SESSION *session;
+  int first;
+};
+
+/* release the race and free it if it is no longer used, should be called
+   with the race mutex held (it is released) */
+static void race_release(struct myldap_race *race)
+{
+  int refcount;
+  refcount = --race->refcount;
+  pthread_mutex_unlock(&race->mutex);
+  if (refcount == 0)
+  {
+    pthread_mutex_destroy(&race->mutex);
+    pthread_cond_destroy(&race->cond);
+    free(race);
+  }
+}
+
+/* the thread that connects to a single server, connections that are
+   not picked are closed again */
+static void *race_connect(void *arg)
+{
+  struct myldap_attempt *attempt = (struct myldap_attempt *)arg;
+  struct myldap_race *race = attempt->race;
+  MYLDAP_SESSION *session = attempt->session;
+  struct myldap_uri *uri = &(nslcd_cfg->uris[session->current_uri]);
+  time_t t;
+  int rc;
+  rc = do_connect(session);
+  /* update the time of failure */
+  if (rc != LDAP_SUCCESS)
+  {
+    pthread_mutex_lock(&uris_mutex);
+    t = time(NULL);
+    if (uri->firstfail == 0)
+      uri->firstfail = t;
+    uri->lastfail = t;
+    pthread_mutex_unlock(&uris_mutex);
+  }
+  pthread_mutex_lock(&race->mutex);
+  race->running--;
+  if (attempt->first)
+    race->rc = rc;
+  if ((rc == LDAP_SUCCESS) && (!race->done) && (race->winner == NULL))
+  {
+    race->winner = session;
+    session = NULL;
+  }
+  pthread_cond_signal(&race->cond);
+  race_release(race);
+  if (session != NULL)
+  {
+    if (rc == LDAP_SUCCESS)
+      log_log(LOG_DEBUG, "closing unused connection to %s", uri->uri);
+    myldap_session_close(session);
+  }
+  free(attempt);
+  return NULL;
+}
+
+/* start connecting to the server in a separate thread, should be called
+   with the race mutex held */
+static void race_start(struct myldap_race *race, int uri, int first)
+{
+  struct myldap_attempt *attempt;
+  pthread_t thread;
+  attempt = (struct myldap_attempt *)malloc(sizeof(struct myldap_attempt));
+  if (attempt == NULL)
+  {
+    log_log(LOG_CRIT, "race_start(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  attempt->race = race;
+  attempt->session = myldap_session_new();
+  attempt->session->current_uri = uri;
+  attempt->first = first;
+  if (pthread_create(&thread, NULL, race_connect, attempt))
+  {
+    log_log(LOG_ERR, "unable to start connect thread: %s", strerror(errno));
+    if (first)
+      race->rc = LDAP_LOCAL_ERROR;
+    myldap_session_close(attempt->session);
+    free(attempt);
+    return;
+  }
+  pthread_detach(thread);
+  race->refcount++;
+  race->running++;
+}
+
+/* Connect to the server of the session, but also start connecting to the
+   next servers if this takes longer than connect_stagger milliseconds.
+   The first connection that succeeds is used and current_uri is updated.
+   This returns an LDAP status code. */
+static int do_connect_staggered(MYLDAP_SESSION *session)
+{
+  struct myldap_race *race;
+  MYLDAP_SESSION *winner;
+  int uris[NSS_LDAP_CONFIG_MAX_URIS];
+  int i, num, next;
+  time_t t;
+  struct timespec ts;
+  int rc;
+  /* only connections that do not bind as the user are raced because a
+     user bind may count against the password policy on every server */
+  if ((nslcd_cfg->connect_stagger <= 0) || (session->binddn[0] != '\0'))
+    return do_connect(session);
+  /* the list of servers to try, starting with the current one */
+  uris[0] = session->current_uri;
+  num = 1;
+  pthread_mutex_lock(&uris_mutex);
+  t = time(NULL);
+  for (i = session->current_uri + 1; i != session->current_uri; i++)
+  {
+    if (nslcd_cfg->uris[i].uri == NULL)
+    {
+      i = -1;
+      continue;
+    }
+    if (!uri_isfailing(&(nslcd_cfg->uris[i]), t))
+      uris[num++] = i;
+  }
+  pthread_mutex_unlock(&uris_mutex);
+  if (num == 1)
+    return do_connect(session);
+  /* set up the race */
+  race = (struct myldap_race *)malloc(sizeof(struct myldap_race));
+  if (race == NULL)
+  {
+    log_log(LOG_CRIT, "do_connect_staggered(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&race->mutex, NULL);
+  pthread_cond_init(&race->cond, NULL);
+  race->refcount = 1;
+  race->running = 0;
+  race->done = 0;
+  race->winner = NULL;
+  race->rc = LDAP_UNAVAILABLE;
+  pthread_mutex_lock(&race->mutex);
+  race_start(race, uris[0], 1);
+  next = 1;
+  while (race->winner == NULL)
+  {
+    if (race->running == 0)
+    {
+      /* all attempts failed, start the next one straight away */
+      if (next >= num)
+        break;
+    }
+    else if (next >= num)
+    {
+      pthread_cond_wait(&race->cond, &race->mutex);
+      continue;
+    }
+    else
+    {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += nslcd_cfg->connect_stagger / 1000;
+      ts.tv_nsec += (nslcd_cfg->connect_stagger % 1000) * 1000000L;
+      if (ts.tv_nsec >= 1000000000L)
+      {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+      if (pthread_cond_timedwait(&race->cond, &race->mutex, &ts) != ETIMEDOUT)
+        continue;
+      if (race->winner != NULL)
+        break;
+      log_log(LOG_DEBUG, "no connection after %d ms, also trying %s",
+              nslcd_cfg->connect_stagger, nslcd_cfg->uris[uris[next]].uri);
+    }
+    race_start(race, uris[next++], 0);
+  }
+  /* stop waiting for the other attempts */
+  race->done = 1;
+  winner = race->winner;
+  rc = race->rc;
+  race_release(race);
+  if (winner == NULL)
+    return rc;
+  /* take over the connection */
+  session->ld = winner->ld;
+  session->current_uri = winner->current_uri;
+  session->lastactivity = winner->lastactivity;
+  winner->ld = NULL;
+  myldap_session_close(winner);
+  return do_set_rebind(session);
+}
+
+/* Let the session use a shared connection. A new connection is opened
+   if less than shared_connections connections are open, otherwise the
+   least used connection is picked. This returns an LDAP status code. */
+static int do_open_shared(MYLDAP_SESSION *session)
+{
+  struct myldap_conn *conn;
+  pthread_t thread;
+  int i, slot, opening;
+  int rc;
+  pthread_mutex_lock(&shared_conns_mutex);
+  if (shared_conns == NULL)
+  {
+    shared_conns = (struct myldap_conn **)malloc(nslcd_cfg->shared_connections *
+                                                 sizeof(struct myldap_conn *));
+    if (shared_conns == NULL)
+    {
+      log_log(LOG_CRIT, "do_open_shared(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nslcd_cfg->shared_connections; i++)
+      shared_conns[i] = NULL;
+  }
+  while (1)
+  {
+    conn = NULL;
+    slot = -1;
+    opening = 0;
+    for (i = 0; i < nslcd_cfg->shared_connections; i++)
+    {
+      if (shared_conns[i] == NULL)
+      {
+        if (slot < 0)
+          slot = i;
+      }
+      else if (shared_conns[i]->opening)
+        opening = 1;
+      else if ((conn == NULL) || (shared_conns[i]->refcount < conn->refcount))
+        conn = shared_conns[i];
+    }
+    /* only wait if all connections are being opened */
+    if ((slot >= 0) || (conn != NULL) || (!opening))
+      break;
+    pthread_cond_wait(&shared_conns_cond, &shared_conns_mutex);
+  }
+  /* use an existing connection if we cannot open a new one */
+  if (slot < 0)
+  {
+    conn->refcount++;
+    session->conn = conn;
+    session->ld = conn->session->ld;
+    session->current_uri = conn->session->current_uri;
+    pthread_mutex_unlock(&shared_conns_mutex);
+    time(&(session->lastactivity));
+    return LDAP_SUCCESS;
+  }
+  /* reserve the slot for a new connection */
+  conn = (struct myldap_conn *)malloc(sizeof(struct myldap_conn));
+  if (conn == NULL)
+  {
+    log_log(LOG_CRIT, "do_open_shared(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  conn->session = myldap_session_new();
+  conn->session->current_uri = session->current_uri;
+  conn->refcount = 1;
+  conn->opening = 1;
+  conn->failed = 0;
+  pthread_mutex_init(&conn->mutex, NULL);
+  pthread_cond_init(&conn->cond, NULL);
+  conn->searches = NULL;
+  time(&(conn->lastactivity));
+  shared_conns[slot] = conn;
+  pthread_mutex_unlock(&shared_conns_mutex);
+  /* open the connection and start the reader thread */
+  rc = do_connect_staggered(conn->session);
+  if (rc == LDAP_SUCCESS)
+  {
+    if (pthread_create(&thread, NULL, conn_reader, conn))
+    {
+      log_log(LOG_ERR, "unable to start reader thread: %s", strerror(errno));
+      do_close(conn->session);
+      rc = LDAP_LOCAL_ERROR;
+    }
+    else
+      pthread_detach(thread);
+  }
+  pthread_mutex_lock(&shared_conns_mutex);
+  conn->opening = 0;
+  if (rc != LDAP_SUCCESS)
+    shared_conns[slot] = NULL;
+  pthread_cond_broadcast(&shared_conns_cond);
+  pthread_mutex_unlock(&shared_conns_mutex);
+  if (rc != LDAP_SUCCESS)
+  {
+    myldap_session_close(conn->session);
+    pthread_mutex_destroy(&conn->mutex);
+    pthread_cond_destroy(&conn->cond);
+    free(conn);
+    return rc;
+  }
+  log_log(LOG_DEBUG, "opened shared connection to %s",
+          nslcd_cfg->uris[conn->session->current_uri].uri);
+  session->conn = conn;
+  session->ld = conn->session->ld;
+  session->current_uri = conn->session->current_uri;
+  time(&(session->lastactivity));
+  return LDAP_SUCCESS;
+}
+
+/* check whether the socket of an idle connection was closed by the peer,
+   nothing should be received on an idle connection so if the socket is
+   readable it either reached the end of the stream or the server sent a
+   notice of disconnection */
+static int ld_isclosed(LDAP *ld)
+{
+  struct pollfd pfd;
+  if (ldap_get_option(ld, LDAP_OPT_DESC, &(pfd.fd)) != LDAP_SUCCESS)
+    return 0;
+  pfd.events = POLLIN;
+#ifdef POLLRDHUP
+  pfd.events |= POLLRDHUP;
+#endif /* POLLRDHUP */
+  pfd.revents = 0;
+  if (poll(&pfd, 1, 0) <= 0)
+    return 0;
+  return (pfd.revents != 0);
+}
+
+/* return the connection of the session to the pool */
+static void pool_release(MYLDAP_SESSION *session)
+{
+  struct myldap_pooled *pooled;
+  pooled = (struct myldap_pooled *)malloc(sizeof(struct myldap_pooled));
+  if (pooled == NULL)
+  {
+    log_log(LOG_CRIT, "pool_release(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  pooled->ld = session->ld;
+  pooled->uri = session->current_uri;
+  pooled->lastactivity = session->lastactivity;
+  pthread_mutex_lock(&pools_mutex);
+  pooled->next = session->pool->idle;
+  session->pool->idle = pooled;
+  pthread_cond_signal(&pools_cond);
+  pthread_mutex_unlock(&pools_mutex);
+  session->ld = NULL;
+  session->pool = NULL;
+}
+
+/* Let the session borrow a connection to the current server from the
+   pool. An idle connection is used if there is one, otherwise a new
+   connection is opened if less than the maximum number of connections
+   to the server are open. If neither is possible this waits for a
+   connection to be returned. This returns an LDAP status code. */
+static int do_open_pooled(MYLDAP_SESSION *session)
+{
+  struct myldap_pool *pool;
+  struct myldap_pooled *pooled, **prev;
+  int uri;
+  int rc;
+  pool = &pools[(session->binddn[0] == '\0') ? POOL_SERVICE : POOL_USER];
+  while (1)
+  {
+    uri = session->current_uri;
+    pthread_mutex_lock(&pools_mutex);
+    while (1)
+    {
+      for (prev = &(pool->idle); (*prev != NULL) && ((*prev)->uri != uri); prev = &((*prev)->next))
+        /* nothing */ ;
+      pooled = *prev;
+      if (pooled != NULL)
+      {
+        *prev = pooled->next;
+        /* only use connections that are still open */
+        if (!ld_isclosed(pooled->ld))
+          break;
+        log_log(LOG_DEBUG, "do_open_pooled(): connection reset by peer");
+        pool->open[uri]--;
+        pthread_mutex_unlock(&pools_mutex);
+        (void)ldap_unbind(pooled->ld);
+        free(pooled);
+        pthread_mutex_lock(&pools_mutex);
+        continue;
+      }
+      if (pool->open[uri] < nslcd_cfg->pool_max)
+      {
+        pool->open[uri]++;
+        break;
+      }
+      log_log(LOG_DEBUG, "waiting for a pooled connection to %s",
+              nslcd_cfg->uris[uri].uri);
+      pthread_cond_wait(&pools_cond, &pools_mutex);
+    }
+    pthread_mutex_unlock(&pools_mutex);
+    if (pooled != NULL)
+      break;
+    /* open a new connection */
+    rc = do_connect_staggered(session);
+    pthread_mutex_lock(&pools_mutex);
+    pool->open[uri]--;
+    /* the connection may have been made to another server, which may
+       already have the maximum number of connections open */
+    if ((rc == LDAP_SUCCESS) && (session->current_uri != uri) &&
+        (pool->open[session->current_uri] >= nslcd_cfg->pool_max))
+    {
+      pthread_cond_broadcast(&pools_cond);
+      pthread_mutex_unlock(&pools_mutex);
+      log_log(LOG_DEBUG, "do_open_pooled(): no free pooled connection to %s",
+              nslcd_cfg->uris[session->current_uri].uri);
+      /* the connection was not counted so it is simply closed */
+      do_close(session);
+      continue;
+    }
+    if (rc == LDAP_SUCCESS)
+      pool->open[session->current_uri]++;
+    pthread_cond_broadcast(&pools_cond);
+    pthread_mutex_unlock(&pools_mutex);
+    if (rc == LDAP_SUCCESS)
+      session->pool = pool;
+    return rc;
+  }
+  /* use the idle connection, binding again as the user */
+  session->ld = pooled->ld;
+  session->pool = pool;
+  free(pooled);
+  time(&(session->lastactivity));
+  rc = do_set_rebind(session);
+  if ((rc == LDAP_SUCCESS) && (session->binddn[0] != '\0'))
+  {
+    rc = do_user_bind(session, session->ld, nslcd_cfg->uris[uri].uri);
+    /* a failed bind leaves the connection usable for other users */
+    if ((rc != LDAP_SUCCESS) && (rc != LDAP_SERVER_DOWN) &&
+        (rc != LDAP_UNAVAILABLE) && (rc != LDAP_CONNECT_ERROR))
+      pool_release(session);
+  }
+  return rc;
+}
+
+time_t myldap_pool_check(void)
+{
+  struct myldap_pooled *pooled, **prev, *closed = NULL;
+  time_t current_time, deadline = 0;
+  int i;
+  if (nslcd_cfg->idle_timelimit <= 0)
+    return 0;
+  time(&current_time);
+  pthread_mutex_lock(&pools_mutex);
+  for (i = 0; i < 3; i++)
+  {
+    prev = &(pools[i].idle);
+    while ((pooled = *prev) != NULL)
+    {
+      if ((i != POOL_HEDGE) &&
+          (pools[i].open[pooled->uri] <= nslcd_cfg->pool_min))
+        prev = &(pooled->next);
+      else if ((pooled->lastactivity + nslcd_cfg->idle_timelimit) < current_time)
+      {
+        /* move the connection to the list of connections to close */
+        *prev = pooled->next;
+        pools[i].open[pooled->uri]--;
+        pooled->next = closed;
+        closed = pooled;
+      }
+      else
+      {
+        if ((deadline == 0) ||
+            ((pooled->lastactivity + nslcd_cfg->idle_timelimit + 1) < deadline))
+          deadline = pooled->lastactivity + nslcd_cfg->idle_timelimit + 1;
+        prev = &(pooled->next);
+      }
+    }
+  }
+  if (closed != NULL)
+    pthread_cond_broadcast(&pools_cond);
+  pthread_mutex_unlock(&pools_mutex);
+  /* close the connections outside of the lock */
+  while ((pooled = closed) != NULL)
+  {
+    closed = pooled->next;
+    log_log(LOG_DEBUG, "closing idle pooled connection to %s",
+            nslcd_cfg->uris[pooled->uri].uri);
+    (void)ldap_unbind(pooled->ld);
+    free(pooled);
+  }
+  return deadline;
+}
+
+/* Ensure that the session has an open connection to the LDAP server. This
+   returns an LDAP status code. */
+static int do_open(MYLDAP_SESSION *session)
+{
+  /* if the connection is still there (ie. ldap_unbind() wasn't
+     called) then we can return the cached connection */
+  if (session->ld != NULL)
+    return LDAP_SUCCESS;
+  /* searches that don't bind as a user can use a shared connection */
+  if ((nslcd_cfg->shared_connections > 0) && (session->binddn[0] == '\0'))
+    return do_open_shared(session);
+  /* otherwise a connection may be borrowed from the pool */
+  if (nslcd_cfg->pool_max > 0)
+    return do_open_pooled(session);
+  return do_connect_staggered(session);
+}
+
 /* Perform a simple bind operation and return the ppolicy results. */
 int myldap_bind(MYLDAP_SESSION *session, const char *dn, const char *password,
                 int *response, const char **message)
@@ -1175,6 +2364,7 @@ static int do_try_search(MYLDAP_SEARCH *search)
   char *deref_attrs[2];
 #endif /* HAVE_LDAP_CREATE_DEREF_CONTROL */
   int msgid;
+  struct myldap_conn *conn;
   /* if we're using paging, build a page control */
   if ((nslcd_cfg->pagesize > 0) && (search->scope != LDAP_SCOPE_BASE))
   {
@@ -1228,11 +2418,34 @@ static int do_try_search(MYLDAP_SEARCH *search)
     if (ldap_set_option(search->session->ld, LDAP_OPT_ERROR_NUMBER, &rc) != LDAP_SUCCESS)
       log_log(LOG_WARNING, "failed to clear the error flag");
   }
+  /* register the search with the shared connection before performing
+     the search so the reader thread will not discard any results */
+  conn = search->session->conn;
+  if (conn != NULL)
+  {
+    pthread_mutex_lock(&conn->mutex);
+    if (search->conn == NULL)
+    {
+      search->conn = conn;
+      search->conn_next = conn->searches;
+      conn->searches = search;
+    }
+  }
   /* perform the search */
   rc = ldap_search_ext(search->session->ld, search->base, search->scope,
                        search->filter, (char **)(search->attrs),
                        0, serverctrls[0] == NULL ? NULL : serverctrls,
                        NULL, NULL, LDAP_NO_LIMIT, &msgid);
+  if (rc == LDAP_SUCCESS)
+  {
+    search->msgid = msgid;
+    search_sent(search);
+  }
+  if (conn != NULL)
+  {
+    pthread_cond_signal(&conn->cond);
+    pthread_mutex_unlock(&conn->mutex);
+  }
   /* free the controls if we had them */
   for (ctrlidx = 0; serverctrls[ctrlidx] != NULL; ctrlidx++)
     ldap_control_free(serverctrls[ctrlidx]);
@@ -1244,8 +2457,6 @@ static int do_try_search(MYLDAP_SEARCH *search)
   }
   /* update the last activity on the connection */
   time(&(search->session->lastactivity));
-  /* save msgid */
-  search->msgid = msgid;
   /* return the new search */
   return LDAP_SUCCESS;
 }
@@ -1273,6 +2484,20 @@ void myldap_session_cleanup(MYLDAP_SESSION *session)
       session->searches[i] = NULL;
     }
   }
+  /* also close searches that were moved to the hedge session (this
+     returns its connection to the pool) */
+  if (session->hedge != NULL)
+    myldap_session_cleanup(session->hedge);
+  session->hedging = 0;
+  /* give a borrowed connection back to the pool */
+  if ((session->pool != NULL) && (session->ld != NULL))
+    pool_release(session);
+}
+
+void myldap_session_hedge(MYLDAP_SESSION *session, int enable)
+{
+  if (session != NULL)
+    session->hedging = enable;
 }
 
 void myldap_session_close(MYLDAP_SESSION *session)
@@ -1285,16 +2510,19 @@ void myldap_session_close(MYLDAP_SESSION *session)
   }
   /* close pending searches */
   myldap_session_cleanup(session);
+  /* close the session used for hedged searches */
+  if (session->hedge != NULL)
+    myldap_session_close(session->hedge);
   /* close any open connections */
-  do_close(session);
+  if (session->conn != NULL)
+    do_detach(session, 0);
+  else
+    do_close(session);
   /* free allocated memory */
   memset(session->bindpw, 0, sizeof(session->bindpw));
   free(session);
 }
 
-/* mutex for updating the times in the uri */
-pthread_mutex_t uris_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 static int do_retry_search(MYLDAP_SEARCH *search)
 {
   int sleeptime = 0;
@@ -1309,6 +2537,14 @@ static int do_retry_search(MYLDAP_SEARCH *search)
   /* clear time stamps */
   for (start_uri = 0; start_uri < NSS_LDAP_CONFIG_MAX_URIS; start_uri++)
     dotry[start_uri] = 1;
+  /* pick the server for a new connection */
+  if ((search->session->ld == NULL) &&
+      (nslcd_cfg->uri_selection != URI_FAILOVER))
+  {
+    pthread_mutex_lock(&uris_mutex);
+    search->session->current_uri = uri_select(search->session->current_uri);
+    pthread_mutex_unlock(&uris_mutex);
+  }
   /* keep trying until we time out */
   endtime = time(NULL) + nslcd_cfg->reconnect_retrytime;
   while (1)
@@ -1323,7 +2559,7 @@ static int do_retry_search(MYLDAP_SEARCH *search)
       /* only try this URI if we should */
       if (!dotry[search->session->current_uri])
       { /* skip this URI */ }
-      else if ((current_uri->lastfail > (current_uri->firstfail + nslcd_cfg->reconnect_retrytime)) &&
+      else if (uri_ishardfail(current_uri) &&
                ((t = time(NULL)) < (current_uri->lastfail + nslcd_cfg->reconnect_retrytime)))
       {
         /* we are in a hard fail state and have retried not long ago */
@@ -1332,12 +2568,23 @@ static int do_retry_search(MYLDAP_SEARCH *search)
                 (int)(t - current_uri->firstfail));
         dotry[search->session->current_uri] = 0;
       }
+      else if ((nslcd_cfg->health_check_interval > 0) &&
+               uri_ishardfail(current_uri) &&
+               (search->session->ld == NULL) && (uri_anyok()))
+      {
+        /* the prober makes the server available again once it works */
+        log_log(LOG_DEBUG, "not trying server %s which has been failing for %d seconds",
+                current_uri->uri, (int)(time(NULL) - current_uri->firstfail));
+        dotry[search->session->current_uri] = 0;
+      }
       else
       {
         /* try to start the search */
         pthread_mutex_unlock(&uris_mutex);
         /* ensure that we have an open connection and start a search */
         rc = do_open(search->session);
+        /* another server may have answered first */
+        current_uri = &(nslcd_cfg->uris[search->session->current_uri]);
         /* perform the actual search, unless we were only binding */
         if ((rc == LDAP_SUCCESS) && (search->scope != MYLDAP_SCOPE_BINDONLY))
           rc = do_try_search(search);
@@ -1370,7 +2617,10 @@ static int do_retry_search(MYLDAP_SEARCH *search)
           search->valid = 1;
           /* signal external invalidation of configured caches */
           if (do_invalidate)
+          {
             invalidator_do(LM_NONE);
+            cache_invalidate(LM_NONE);
+          }
           return LDAP_SUCCESS;
         }
         /* close the current connection */
@@ -1441,7 +2691,257 @@ void myldap_immediate_reconnect(void)
       nslcd_cfg->uris[i].lastfail = t;
     }
   }
-  pthread_mutex_unlock(&uris_mutex);
+  pthread_mutex_unlock(&uris_mutex);
+}
+
+/* check the connection of the session by reading the root DSE, this
+   returns an LDAP status code */
+static int do_probe(MYLDAP_SESSION *session)
+{
+  static const char *attrs[] = { "objectClass", NULL };
+  MYLDAP_SEARCH *search;
+  int rc;
+  search = myldap_search_new(session, "", LDAP_SCOPE_BASE, "(objectClass=*)", attrs);
+  search->may_retry_search = 0;
+  session->searches[0] = search;
+  rc = do_try_search(search);
+  if (rc != LDAP_SUCCESS)
+  {
+    myldap_search_close(search);
+    return rc;
+  }
+  search->valid = 1;
+  if (myldap_get_entry(search, &rc) == NULL)
+    return (rc == LDAP_SUCCESS) ? LDAP_NO_SUCH_OBJECT : rc;
+  myldap_search_close(search);
+  return LDAP_SUCCESS;
+}
+
+/* try a failing server and make it available again if it works */
+static void probe_uri(int i)
+{
+  MYLDAP_SESSION *session;
+  struct myldap_uri *uri = &(nslcd_cfg->uris[i]);
+  int failing;
+  int rc;
+  pthread_mutex_lock(&uris_mutex);
+  failing = (uri->firstfail != 0);
+  pthread_mutex_unlock(&uris_mutex);
+  if (!failing)
+    return;
+  log_log(LOG_DEBUG, "checking LDAP server %s", uri->uri);
+  session = myldap_session_new();
+  session->current_uri = i;
+  rc = do_connect(session);
+  if (rc == LDAP_SUCCESS)
+    rc = do_probe(session);
+  myldap_session_close(session);
+  pthread_mutex_lock(&uris_mutex);
+  if (rc == LDAP_SUCCESS)
+  {
+    uri->firstfail = 0;
+    uri->lastfail = 0;
+  }
+  else if (uri->firstfail != 0)
+    uri->lastfail = time(NULL);
+  pthread_mutex_unlock(&uris_mutex);
+  if (rc != LDAP_SUCCESS)
+  {
+    log_log(LOG_DEBUG, "LDAP server %s is still unavailable: %s",
+            uri->uri, ldap_err2string(rc));
+    return;
+  }
+  log_log(LOG_INFO, "LDAP server %s is available again", uri->uri);
+  /* signal external invalidation of configured caches */
+  invalidator_do(LM_NONE);
+  cache_invalidate(LM_NONE);
+}
+
+/* read the root DSE over shared connections that have not received
+   anything for a while to keep them open */
+static void probe_conns(void)
+{
+  MYLDAP_SESSION *session;
+  struct myldap_conn *conn;
+  time_t t;
+  int i, idle;
+  int rc;
+  t = time(NULL) - nslcd_cfg->health_check_interval;
+  for (i = 0; i < nslcd_cfg->shared_connections; i++)
+  {
+    /* use the connection from a new session */
+    session = NULL;
+    pthread_mutex_lock(&shared_conns_mutex);
+    conn = (shared_conns != NULL) ? shared_conns[i] : NULL;
+    if ((conn != NULL) && (!conn->opening) && (conn->refcount > 0))
+    {
+      conn->refcount++;
+      session = myldap_session_new();
+      session->conn = conn;
+      session->ld = conn->session->ld;
+      session->current_uri = conn->session->current_uri;
+    }
+    pthread_mutex_unlock(&shared_conns_mutex);
+    if (session == NULL)
+      continue;
+    pthread_mutex_lock(&conn->mutex);
+    idle = (!conn->failed) && (conn->lastactivity < t);
+    pthread_mutex_unlock(&conn->mutex);
+    if (idle)
+    {
+      log_log(LOG_DEBUG, "sending keepalive to LDAP server %s",
+              nslcd_cfg->uris[session->current_uri].uri);
+      rc = do_probe(session);
+      if (rc != LDAP_SUCCESS)
+        log_log(LOG_WARNING, "keepalive to LDAP server %s failed: %s",
+                nslcd_cfg->uris[session->current_uri].uri, ldap_err2string(rc));
+    }
+    myldap_session_close(session);
+  }
+}
+
+/* read the root DSE over pooled connections that have been idle for a
+   while to keep them open, connections that fail are closed */
+static void probe_pool(void)
+{
+  MYLDAP_SESSION *session;
+  struct myldap_pooled *pooled, **prev, *probed;
+  time_t t, lastactivity;
+  int i;
+  int rc;
+  t = time(NULL) - nslcd_cfg->health_check_interval;
+  for (i = 0; i < 3; i++)
+  {
+    /* take the idle connections out of the pool */
+    probed = NULL;
+    pthread_mutex_lock(&pools_mutex);
+    prev = &(pools[i].idle);
+    while ((pooled = *prev) != NULL)
+    {
+      if (pooled->lastactivity < t)
+      {
+        *prev = pooled->next;
+        pooled->next = probed;
+        probed = pooled;
+      }
+      else
+        prev = &(pooled->next);
+    }
+    pthread_mutex_unlock(&pools_mutex);
+    while ((pooled = probed) != NULL)
+    {
+      probed = pooled->next;
+      /* use the connection from a new session */
+      session = myldap_session_new();
+      session->ld = pooled->ld;
+      session->pool = &pools[i];
+      session->current_uri = pooled->uri;
+      lastactivity = pooled->lastactivity;
+      free(pooled);
+      log_log(LOG_DEBUG, "sending keepalive to LDAP server %s",
+              nslcd_cfg->uris[session->current_uri].uri);
+      rc = do_probe(session);
+      if (rc != LDAP_SUCCESS)
+      {
+        log_log(LOG_WARNING, "keepalive to LDAP server %s failed: %s",
+                nslcd_cfg->uris[session->current_uri].uri, ldap_err2string(rc));
+        do_close(session);
+      }
+      /* the keepalive does not count as activity for idle_timelimit */
+      session->lastactivity = lastactivity;
+      /* this returns the connection to the pool */
+      myldap_session_close(session);
+    }
+  }
+}
+
+/* open connections to the servers that are in use until the pool holds
+   at least pool_min connections to each of them, with failover only the
+   first server that can be connected to is used */
+static void pool_fill(void)
+{
+  struct myldap_pool *pool = &pools[POOL_SERVICE];
+  MYLDAP_SESSION *session;
+  time_t t = time(NULL);
+  int i, open;
+  int rc;
+  for (i = 0; nslcd_cfg->uris[i].uri != NULL; i++)
+  {
+    pthread_mutex_lock(&uris_mutex);
+    rc = uri_isfailing(&(nslcd_cfg->uris[i]), t) ? LDAP_UNAVAILABLE : LDAP_SUCCESS;
+    pthread_mutex_unlock(&uris_mutex);
+    while (rc == LDAP_SUCCESS)
+    {
+      /* count the connection before opening it like do_open_pooled() */
+      pthread_mutex_lock(&pools_mutex);
+      open = (pool->open[i] < nslcd_cfg->pool_min);
+      if (open)
+        pool->open[i]++;
+      pthread_mutex_unlock(&pools_mutex);
+      if (!open)
+        break;
+      session = myldap_session_new();
+      session->current_uri = i;
+      rc = do_connect(session);
+      if (rc != LDAP_SUCCESS)
+      {
+        log_log(LOG_DEBUG, "failed to open pooled connection to %s: %s",
+                nslcd_cfg->uris[i].uri, ldap_err2string(rc));
+        pthread_mutex_lock(&pools_mutex);
+        pool->open[i]--;
+        pthread_cond_broadcast(&pools_cond);
+        pthread_mutex_unlock(&pools_mutex);
+      }
+      else
+      {
+        log_log(LOG_DEBUG, "opened pooled connection to %s",
+                nslcd_cfg->uris[i].uri);
+        session->pool = pool;
+      }
+      /* this returns the connection to the pool */
+      myldap_session_close(session);
+    }
+    if ((rc == LDAP_SUCCESS) && (nslcd_cfg->uri_selection == URI_FAILOVER))
+      break;
+  }
+}
+
+/* the thread that fills the connection pool, checks failing servers and
+   sends keepalives */
+static void *prober(void UNUSED(*arg))
+{
+  int fill, i;
+  fill = (nslcd_cfg->pool_min > 0) && (nslcd_cfg->shared_connections <= 0);
+  if (fill)
+    pool_fill();
+  while (nslcd_cfg->health_check_interval > 0)
+  {
+    (void)sleep(nslcd_cfg->health_check_interval);
+    for (i = 0; nslcd_cfg->uris[i].uri != NULL; i++)
+      probe_uri(i);
+    if (nslcd_cfg->shared_connections > 0)
+      probe_conns();
+    if (nslcd_cfg->pool_max > 0)
+      probe_pool();
+    if (fill)
+      pool_fill();
+  }
+  return NULL;
+}
+
+int myldap_prober_start(void)
+{
+  pthread_t thread;
+  if ((nslcd_cfg->health_check_interval <= 0) &&
+      ((nslcd_cfg->pool_min <= 0) || (nslcd_cfg->shared_connections > 0)))
+    return 0;
+  if (pthread_create(&thread, NULL, prober, NULL))
+  {
+    log_log(LOG_ERR, "unable to start prober thread: %s", strerror(errno));
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
 }
 
 MYLDAP_SEARCH *myldap_search(MYLDAP_SESSION *session,
@@ -1500,6 +3000,11 @@ void myldap_search_close(MYLDAP_SEARCH *search)
   int i;
   if (search == NULL)
     return;
+  /* stop receiving results from the shared connection */
+  if (search->conn != NULL)
+    conn_unregister(search);
+  /* the search is no longer in progress on the server */
+  search_done(search);
   /* free any messages */
   if (search->msg != NULL)
   {
@@ -1527,10 +3032,395 @@ void myldap_search_close(MYLDAP_SEARCH *search)
   /* free read messages */
   if (search->msg != NULL)
     ldap_msgfree(search->msg);
+  pthread_cond_destroy(&search->cond);
   /* free the storage we allocated */
   free(search);
 }
 
+/* get the next result message of the search, this returns the same values
+   as ldap_result() */
+static int search_result(MYLDAP_SEARCH *search, struct timeval *tvp,
+                         LDAPMessage **msg)
+{
+  if (search->conn != NULL)
+    return conn_result(search, tvp, msg);
+  return ldap_result(search->session->ld, search->msgid, LDAP_MSG_ONE, tvp,
+                     msg);
+}
+
+/* return the time in microseconds after which the search should be
+   hedged or -1 if it should not be hedged */
+static long hedge_delay(MYLDAP_SEARCH *search)
+{
+  long delay;
+  /* only hedge searches of lookups that have not returned anything yet */
+  if ((nslcd_cfg->hedge_percentile <= 0) || (!search->session->hedging) ||
+      (search->session->binddn[0] != '\0') || (search->count > 0) ||
+      (search->cookie != NULL) || (search->uri < 0) ||
+      ((search->sent.tv_sec == 0) && (search->sent.tv_nsec == 0)) ||
+      (nslcd_cfg->uris[1].uri == NULL))
+    return -1;
+  pthread_mutex_lock(&uris_mutex);
+  delay = hedge_delay_us;
+  pthread_mutex_unlock(&uris_mutex);
+  return delay;
+}
+
+/* open a connection for hedged searches in the background and add it
+   to the pool of idle hedge connections */
+static void *hedge_connect(void *arg)
+{
+  MYLDAP_SESSION *session = (MYLDAP_SESSION *)arg;
+  int uri = session->current_uri;
+  int rc;
+  rc = do_connect(session);
+  pthread_mutex_lock(&pools_mutex);
+  hedge_opening[uri] = 0;
+  if (rc != LDAP_SUCCESS)
+  {
+    pools[POOL_HEDGE].open[uri]--;
+    pthread_mutex_unlock(&pools_mutex);
+    log_log(LOG_DEBUG, "failed to open connection for hedged searches to %s",
+            nslcd_cfg->uris[uri].uri);
+  }
+  else
+  {
+    pthread_mutex_unlock(&pools_mutex);
+    log_log(LOG_DEBUG, "opened connection for hedged searches to %s",
+            nslcd_cfg->uris[uri].uri);
+    session->pool = &pools[POOL_HEDGE];
+    pool_release(session);
+  }
+  myldap_session_close(session);
+  return NULL;
+}
+
+/* let the hedge session borrow an idle connection to its current server,
+   if none is available a new connection is opened in the background (so
+   the search is not hedged this time), returns non-zero on success */
+static int hedge_borrow(MYLDAP_SESSION *hedge)
+{
+  struct myldap_pool *pool = &pools[POOL_HEDGE];
+  struct myldap_pooled *pooled, **prev;
+  MYLDAP_SESSION *session;
+  pthread_t thread;
+  int uri = hedge->current_uri;
+  pthread_mutex_lock(&pools_mutex);
+  while (1)
+  {
+    for (prev = &(pool->idle); (*prev != NULL) && ((*prev)->uri != uri); prev = &((*prev)->next))
+      /* nothing */ ;
+    pooled = *prev;
+    if (pooled == NULL)
+      break;
+    *prev = pooled->next;
+    /* only use connections that are still open */
+    if (!ld_isclosed(pooled->ld))
+    {
+      pthread_mutex_unlock(&pools_mutex);
+      hedge->ld = pooled->ld;
+      hedge->pool = pool;
+      time(&(hedge->lastactivity));
+      free(pooled);
+      return 1;
+    }
+    pool->open[uri]--;
+    pthread_mutex_unlock(&pools_mutex);
+    (void)ldap_unbind(pooled->ld);
+    free(pooled);
+    pthread_mutex_lock(&pools_mutex);
+  }
+  if ((hedge_opening[uri]) || (pool->open[uri] >= HEDGE_CONNS_MAX))
+  {
+    pthread_mutex_unlock(&pools_mutex);
+    return 0;
+  }
+  hedge_opening[uri] = 1;
+  pool->open[uri]++;
+  pthread_mutex_unlock(&pools_mutex);
+  session = myldap_session_new();
+  session->current_uri = uri;
+  if (pthread_create(&thread, NULL, hedge_connect, session))
+  {
+    log_log(LOG_ERR, "unable to start connection thread: %s", strerror(errno));
+    pthread_mutex_lock(&pools_mutex);
+    hedge_opening[uri] = 0;
+    pool->open[uri]--;
+    pthread_mutex_unlock(&pools_mutex);
+    myldap_session_close(session);
+    return 0;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+/* send the search to another server using the hedge session of the
+   search's session, returns NULL if that is not possible */
+static MYLDAP_SEARCH *hedge_start(MYLDAP_SEARCH *search)
+{
+  MYLDAP_SESSION *hedge;
+  MYLDAP_SEARCH *hsearch;
+  int i, uri = -1;
+  time_t t = time(NULL);
+  /* pick the fastest other server that is available */
+  pthread_mutex_lock(&uris_mutex);
+  for (i = 0; nslcd_cfg->uris[i].uri != NULL; i++)
+    if ((i != search->uri) && (!uri_isfailing(&(nslcd_cfg->uris[i]), t)) &&
+        ((uri < 0) || (uri_srtt(&(nslcd_cfg->uris[i]), t) <
+                       uri_srtt(&(nslcd_cfg->uris[uri]), t))))
+      uri = i;
+  pthread_mutex_unlock(&uris_mutex);
+  if (uri < 0)
+    return NULL;
+  if (search->session->hedge == NULL)
+    search->session->hedge = myldap_session_new();
+  hedge = search->session->hedge;
+  /* the hedge session may still have a connection to another server */
+  if ((hedge->ld != NULL) && (hedge->current_uri != uri))
+  {
+    if (session_isbusy(hedge))
+      return NULL;
+    pool_release(hedge);
+  }
+  hedge->current_uri = uri;
+  /* the hedge session borrows a connection for the duration of the
+     request (it is returned in myldap_session_cleanup()) */
+  if ((hedge->ld == NULL) && (!hedge_borrow(hedge)))
+    return NULL;
+  for (i = 0; (i < MAX_SEARCHES_IN_SESSION) && (hedge->searches[i] != NULL); i++)
+    /* nothing */ ;
+  if (i >= MAX_SEARCHES_IN_SESSION)
+    return NULL;
+  hsearch = myldap_search_new(hedge, search->base, search->scope,
+                              search->filter, (const char **)search->attrs);
+  hedge->searches[i] = hsearch;
+  if (do_try_search(hsearch) != LDAP_SUCCESS)
+  {
+    myldap_search_close(hsearch);
+    do_close(hedge);
+    return NULL;
+  }
+  log_log(LOG_DEBUG, "hedging search to %s", nslcd_cfg->uris[uri].uri);
+  return hsearch;
+}
+
+/* abandon the hedged search because the original search won */
+static void hedge_abandon(MYLDAP_SEARCH *hsearch)
+{
+  if ((hsearch->session->ld != NULL) && (hsearch->msgid != -1))
+  {
+    ldap_abandon_ext(hsearch->session->ld, hsearch->msgid, NULL, NULL);
+    hsearch->msgid = -1;
+  }
+  myldap_search_close(hsearch);
+}
+
+/* abandon the original search and continue with the hedged search, the
+   search is moved to the hedge session */
+static void hedge_takeover(MYLDAP_SEARCH *search, MYLDAP_SEARCH *hsearch)
+{
+  MYLDAP_SESSION *hedge = hsearch->session;
+  int i;
+  log_log(LOG_DEBUG, "using hedged search result from %s",
+          nslcd_cfg->uris[hedge->current_uri].uri);
+  /* stop the original search */
+  if (search->conn != NULL)
+    conn_unregister(search);
+  if ((search->session->ld != NULL) && (search->msgid != -1))
+    ldap_abandon_ext(search->session->ld, search->msgid, NULL, NULL);
+  search_done(search);
+  for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
+    if (search->session->searches[i] == search)
+      search->session->searches[i] = NULL;
+  /* take over the hedged search */
+  search->session = hedge;
+  search->msgid = hsearch->msgid;
+  search->uri = hsearch->uri;
+  search->sent = hsearch->sent;
+  hsearch->msgid = -1;
+  hsearch->uri = -1;
+  for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
+    if (hedge->searches[i] == hsearch)
+      hedge->searches[i] = search;
+  myldap_search_close(hsearch);
+}
+
+/* prepare for waiting for results of the search with poll(), the reader
+   thread of a shared connection writes to a pipe when results arrive,
+   returns -1 on errors */
+static int search_pollfd(MYLDAP_SEARCH *search, struct pollfd *pfd)
+{
+  int pipefds[2];
+  int fd;
+  pfd->events = POLLIN;
+  pfd->revents = 0;
+  if (search->conn == NULL)
+  {
+    if (ldap_get_option(search->session->ld, LDAP_OPT_DESC, &fd) != LDAP_SUCCESS)
+      return -1;
+    pfd->fd = fd;
+    return 0;
+  }
+  if (pipe(pipefds) < 0)
+  {
+    log_log(LOG_ERR, "pipe() failed: %s", strerror(errno));
+    return -1;
+  }
+  if ((fcntl(pipefds[0], F_SETFL, O_NONBLOCK) < 0) ||
+      (fcntl(pipefds[1], F_SETFL, O_NONBLOCK) < 0) ||
+      (fcntl(pipefds[0], F_SETFD, FD_CLOEXEC) < 0) ||
+      (fcntl(pipefds[1], F_SETFD, FD_CLOEXEC) < 0))
+  {
+    log_log(LOG_ERR, "fcntl() failed: %s", strerror(errno));
+    (void)close(pipefds[0]);
+    (void)close(pipefds[1]);
+    return -1;
+  }
+  pthread_mutex_lock(&search->conn->mutex);
+  search->wakefd = pipefds[1];
+  pthread_mutex_unlock(&search->conn->mutex);
+  pfd->fd = pipefds[0];
+  return 0;
+}
+
+/* stop waiting for results of the search with poll() */
+static void search_pollfd_close(MYLDAP_SEARCH *search, struct pollfd *pfd)
+{
+  if (search->wakefd < 0)
+    return;
+  if (search->conn != NULL)
+  {
+    pthread_mutex_lock(&search->conn->mutex);
+    (void)close(search->wakefd);
+    search->wakefd = -1;
+    pthread_mutex_unlock(&search->conn->mutex);
+  }
+  else
+  {
+    (void)close(search->wakefd);
+    search->wakefd = -1;
+  }
+  (void)close(pfd->fd);
+}
+
+/* get the next result message of the search, if the server takes longer
+   than usual the search is also sent to another server and the first
+   result is used, this returns the same values as ldap_result() */
+static int search_result_hedged(MYLDAP_SEARCH *search, struct timeval *tvp,
+                                LDAPMessage **msg)
+{
+  MYLDAP_SESSION *hedge;
+  MYLDAP_SEARCH *hsearch;
+  LDAPMessage *hmsg;
+  struct timeval tv, zero;
+  struct timespec now, deadline;
+  struct pollfd fds[2];
+  char buffer[64];
+  long delay, remaining;
+  int rc;
+  delay = hedge_delay(search);
+  if (delay < 0)
+    return search_result(search, tvp, msg);
+  /* wait for the original search for the hedging delay */
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if (tvp != NULL)
+  {
+    deadline.tv_sec += tvp->tv_sec;
+    if ((tvp->tv_sec * 1000000L) <= delay)
+      return search_result(search, tvp, msg);
+  }
+  tv.tv_sec = delay / 1000000L;
+  tv.tv_usec = delay % 1000000L;
+  rc = search_result(search, &tv, msg);
+  if (rc != 0)
+    return rc;
+  hsearch = hedge_start(search);
+  /* wait for both searches with a single poll() */
+  if ((hsearch != NULL) &&
+      (search_pollfd(search, &fds[0]) || search_pollfd(hsearch, &fds[1])))
+  {
+    search_pollfd_close(search, &fds[0]);
+    hedge_abandon(hsearch);
+    hsearch = NULL;
+  }
+  zero.tv_sec = 0;
+  zero.tv_usec = 0;
+  while (1)
+  {
+    /* figure out how long we may still wait */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining = (deadline.tv_sec - now.tv_sec) * 1000000L +
+                (deadline.tv_nsec - now.tv_nsec) / 1000;
+    if ((tvp != NULL) && (remaining <= 0))
+    {
+      if (hsearch != NULL)
+      {
+        search_pollfd_close(search, &fds[0]);
+        hedge_abandon(hsearch);
+      }
+      return 0;
+    }
+    tv.tv_sec = remaining / 1000000L;
+    tv.tv_usec = remaining % 1000000L;
+    if (hsearch == NULL)
+      return search_result(search, (tvp != NULL) ? &tv : NULL, msg);
+    /* check the original search (without waiting) */
+    rc = search_result(search, &zero, msg);
+    if (rc > 0)
+    {
+      search_pollfd_close(search, &fds[0]);
+      hedge_abandon(hsearch);
+      return rc;
+    }
+    else if (rc < 0)
+    {
+      /* the original search failed, continue with the hedged search */
+      search_pollfd_close(search, &fds[0]);
+      hedge_takeover(search, hsearch);
+      return search_result(search, (tvp != NULL) ? &tv : NULL, msg);
+    }
+    /* check whether the hedged search has results */
+    hmsg = NULL;
+    rc = ldap_result(hsearch->session->ld, hsearch->msgid, LDAP_MSG_ONE,
+                     &zero, &hmsg);
+    if (rc > 0)
+    {
+      search_pollfd_close(search, &fds[0]);
+      hedge_takeover(search, hsearch);
+      *msg = hmsg;
+      return rc;
+    }
+    else if (rc < 0)
+    {
+      /* the hedged search failed, continue with the original search */
+      log_log(LOG_DEBUG, "hedged search failed");
+      search_pollfd_close(search, &fds[0]);
+      hedge = hsearch->session;
+      hedge_abandon(hsearch);
+      hsearch = NULL;
+      /* do not return the connection to the pool */
+      do_close(hedge);
+      continue;
+    }
+    /* wait until either connection has data */
+    fds[0].revents = 0;
+    fds[1].revents = 0;
+    if ((poll(fds, 2, (tvp != NULL) ? (int)((remaining + 999) / 1000) : -1) < 0) &&
+        (errno != EINTR))
+    {
+      log_log(LOG_WARNING, "poll() failed: %s", strerror(errno));
+      search_pollfd_close(search, &fds[0]);
+      hedge_abandon(hsearch);
+      hsearch = NULL;
+      continue;
+    }
+    /* empty the pipe that signals results on a shared connection */
+    if ((search->wakefd >= 0) && (fds[0].revents & POLLIN))
+      while (read(fds[0].fd, buffer, sizeof(buffer)) > 0)
+        /* nothing */ ;
+  }
+}
+
 MYLDAP_ENTRY *myldap_get_entry(MYLDAP_SEARCH *search, int *rcp)
 {
   int rc;
@@ -1588,9 +3478,21 @@ MYLDAP_ENTRY *myldap_get_entry(MYLDAP_SEARCH *search, int *rcp)
       ldap_msgfree(search->msg);
       search->msg = NULL;
     }
-    /* get the next result */
-    rc = ldap_result(search->session->ld, search->msgid, LDAP_MSG_ONE, tvp,
-                     &(search->msg));
+    /* get the next result (possibly from a hedged search) */
+    rc = search_result_hedged(search, tvp, &(search->msg));
+    /* time the first response of the server (the reader thread of a
+       shared connection does this when the response arrives) */
+    if ((rc > 0) && (search->conn == NULL))
+    {
+      /* the response may have been read earlier while waiting for
+         another search on the connection */
+      if (session_ispipelined(search))
+      {
+        search->sent.tv_sec = 0;
+        search->sent.tv_nsec = 0;
+      }
+      search_received(search);
+    }
     /* handle result */
     switch (rc)
     {
@@ -1700,8 +3602,10 @@ MYLDAP_ENTRY *myldap_get_entry(MYLDAP_SEARCH *search, int *rcp)
         {
           case -1:
             /* try to get error code */
-            if (ldap_get_option(search->session->ld, LDAP_OPT_ERROR_NUMBER,
-                                &rc) != LDAP_SUCCESS)
+            if (search->conn != NULL)
+              rc = LDAP_SERVER_DOWN;
+            else if (ldap_get_option(search->session->ld, LDAP_OPT_ERROR_NUMBER,
+                                     &rc) != LDAP_SUCCESS)
               rc = LDAP_UNAVAILABLE;
             myldap_err(LOG_ERR, search->session->ld, rc, "ldap_result() failed");
             break;
@@ -1790,61 +3694,242 @@ char *myldap_cpy_dn(MYLDAP_ENTRY *entry, char *buf, size_t buflen)
   return buf;
 }
 
-/* Perform ranged retrieval of attributes.
+/* The state of a loop over the (possibly ranged) values of an attribute
+   as returned by myldap_values_open(). */
+struct myldap_values {
+  /* the entry of which the values are returned */
+  MYLDAP_ENTRY *entry;
+  /* the attribute name */
+  char attr[64];
+  /* whether the values of the entry itself have been returned */
+  int started;
+  /* the start of the next range or -1 if there are no more values */
+  int next;
+  /* the search for the next range (may be NULL) */
+  MYLDAP_SEARCH *search;
+  /* the values that were returned last */
+  char **values;
+};
+
+/* return the number of searches that can still be registered with the
+   session */
+static int session_freesearches(MYLDAP_SESSION *session)
+{
+  int i, num = 0;
+  for (i = 0; i < MAX_SEARCHES_IN_SESSION; i++)
+    if (session->searches[i] == NULL)
+      num++;
+  return num;
+}
+
+/* find the values of the ranged attribute that start at the specified
+   position in the entry, next is set to the start of the following range
+   or -1 if this is the last range
    http://msdn.microsoft.com/en-us/library/aa367017(vs.85).aspx
    http://www.tkk.fi/cc/docs/kerberos/draft-kashi-incremental-00.txt */
-static char **myldap_get_ranged_values(MYLDAP_ENTRY *entry, const char *attr)
+static char **get_range_values(MYLDAP_ENTRY *entry, const char *attr,
+                               int start, int *next)
 {
-  char **values;
+  char attbuf[80];
   char *attn;
-  const char *attrs[2];
-  BerElement *ber;
-  int i;
-  int startat = 0, nxt = 0;
+  char **values = NULL;
+  BerElement *ber = NULL;
+  size_t len;
+  *next = -1;
+  /* build the start of the attribute name to find */
+  if (mysnprintf(attbuf, sizeof(attbuf), "%s;range=%d-", attr, start))
+  {
+    log_log(LOG_ERR, "get_range_values(): attbuf buffer too small (%lu required)",
+            (unsigned long) strlen(attr) + 20);
+    return NULL;
+  }
+  len = strlen(attbuf);
+  /* go over all attributes to find the ranged attribute */
+  attn = ldap_first_attribute(entry->search->session->ld, entry->search->msg, &ber);
+  while (attn != NULL)
+  {
+    if (strncasecmp(attn, attbuf, len) == 0)
+    {
+      log_log(LOG_DEBUG, "found ranged results %s", attn);
+      /* the last range ends with a * */
+      if (attn[len] != '*')
+        *next = atoi(attn + len) + 1;
+      if (*next <= start)
+        *next = -1;
+      values = ldap_get_values(entry->search->session->ld, entry->search->msg, attn);
+      ldap_memfree(attn);
+      break;
+    }
+    /* free old attribute name and get next one */
+    ldap_memfree(attn);
+    attn = ldap_next_attribute(entry->search->session->ld, entry->search->msg, ber);
+  }
+  ber_free(ber, 0);
+  return values;
+}
+
+/* start the search for the next range of values */
+static MYLDAP_SEARCH *values_search(MYLDAP_VALUES *it)
+{
   char attbuf[80];
-  const char *dn = myldap_get_dn(entry);
-  MYLDAP_SESSION *session = entry->search->session;
-  MYLDAP_SEARCH *search = NULL;
-  SET *set = NULL;
-  /* build the attribute name to find */
-  if (mysnprintf(attbuf, sizeof(attbuf), "%s;range=0-*", attr))
+  const char *attrs[2];
+  if (mysnprintf(attbuf, sizeof(attbuf), "%s;range=%d-*", it->attr, it->next))
   {
-    log_log(LOG_ERR, "myldap_get_ranged_values(): attbuf buffer too small (%lu required)",
-            (unsigned long) strlen(attr) + 10);
+    log_log(LOG_ERR, "values_search(): attbuf buffer too small");
     return NULL;
   }
-  /* keep doing lookups untul we can't get any more results */
-  while (1)
+  attrs[0] = attbuf;
+  attrs[1] = NULL;
+  return myldap_search(it->entry->search->session, myldap_get_dn(it->entry),
+                       LDAP_SCOPE_BASE, "(objectClass=*)", attrs, NULL);
+}
+
+MYLDAP_VALUES *myldap_values_open(MYLDAP_ENTRY *entry, const char *attr)
+{
+  MYLDAP_VALUES *it;
+  /* check parameters */
+  if (!is_valid_entry(entry))
+  {
+    log_log(LOG_ERR, "myldap_values_open(): invalid result entry passed");
+    errno = EINVAL;
+    return NULL;
+  }
+  else if ((attr == NULL) || (strlen(attr) >= sizeof(it->attr)))
+  {
+    log_log(LOG_ERR, "myldap_values_open(): invalid attribute name passed");
+    errno = EINVAL;
+    return NULL;
+  }
+  it = (MYLDAP_VALUES *)malloc(sizeof(MYLDAP_VALUES));
+  if (it == NULL)
+  {
+    log_log(LOG_CRIT, "myldap_values_open(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  it->entry = entry;
+  strcpy(it->attr, attr);
+  it->started = 0;
+  it->next = -1;
+  it->search = NULL;
+  it->values = NULL;
+  return it;
+}
+
+const char **myldap_values_next(MYLDAP_VALUES *it)
+{
+  MYLDAP_SESSION *session;
+  MYLDAP_ENTRY *entry;
+  int rc, start;
+  if (it == NULL)
+    return NULL;
+  session = it->entry->search->session;
+  /* free the previously returned values */
+  if (it->values != NULL)
+  {
+    ldap_value_free(it->values);
+    it->values = NULL;
+  }
+  if (!it->started)
   {
-    /* go over all attributes to find the ranged attribute */
-    ber = NULL;
-    attn = ldap_first_attribute(entry->search->session->ld, entry->search->msg, &ber);
-    values = NULL;
-    while (attn != NULL)
+    it->started = 1;
+    if (!it->entry->search->valid)
+      return NULL; /* search has been stopped */
+    /* first try the values in the entry itself */
+    it->values = ldap_get_values(session->ld, it->entry->search->msg, it->attr);
+    if (it->values == NULL)
     {
-      if (strncasecmp(attn, attbuf, strlen(attbuf) - 1) == 0)
+      if (ldap_get_option(session->ld, LDAP_OPT_ERROR_NUMBER, &rc) != LDAP_SUCCESS)
+        rc = LDAP_UNAVAILABLE;
+      /* ignore decoding errors as they are just non-existing attribute values */
+      if (rc == LDAP_DECODING_ERROR)
       {
-        log_log(LOG_DEBUG, "found ranged results %s", attn);
-        nxt = atoi(attn + strlen(attbuf) - 1) + 1;
-        values = ldap_get_values(entry->search->session->ld, entry->search->msg, attn);
-        ldap_memfree(attn);
-        break;
+        rc = LDAP_SUCCESS;
+        if (ldap_set_option(session->ld, LDAP_OPT_ERROR_NUMBER, &rc) != LDAP_SUCCESS)
+          log_log(LOG_WARNING, "failed to clear the error flag");
+        return NULL;
       }
-      /* free old attribute name and get next one */
-      ldap_memfree(attn);
-      attn = ldap_next_attribute(entry->search->session->ld, entry->search->msg, ber);
+      else if (rc != LDAP_SUCCESS)
+      {
+        myldap_err(LOG_WARNING, session->ld, rc,
+                   "ldap_get_values() of attribute \"%s\" on entry \"%s\" returned NULL",
+                   it->attr, myldap_get_dn(it->entry));
+        return NULL;
+      }
+      /* we have a success code but no values, the values may be returned
+         in ranges */
+      it->values = get_range_values(it->entry, it->attr, 0, &it->next);
     }
-    ber_free(ber, 0);
-    /* see if we found any values */
-    if ((values == NULL) || (*values == NULL))
-      break;
+  }
+  else
+  {
+    if (it->next < 0)
+      return NULL;
+    /* the search may not have been started if the session was busy */
+    if (it->search == NULL)
+      it->search = values_search(it);
+    if (it->search == NULL)
+    {
+      it->next = -1;
+      return NULL;
+    }
+    /* get the values from the result (the search is closed when there is
+       no entry) */
+    entry = myldap_get_entry(it->search, NULL);
+    if (entry == NULL)
+    {
+      it->search = NULL;
+      it->next = -1;
+      return NULL;
+    }
+    start = it->next;
+    it->values = get_range_values(entry, it->attr, start, &it->next);
+    myldap_search_close(it->search);
+    it->search = NULL;
+  }
+  if ((it->values == NULL) || (it->values[0] == NULL))
+  {
+    it->next = -1;
+    return NULL;
+  }
+  /* start the search for the next range now so the server can process it
+     while the caller handles these values, leaving a search for the
+     caller */
+  if ((it->next > 0) && (session_freesearches(session) > 1))
+    it->search = values_search(it);
+  return (const char **)it->values;
+}
+
+void myldap_values_close(MYLDAP_VALUES *it)
+{
+  if (it == NULL)
+    return;
+  if (it->search != NULL)
+    myldap_search_close(it->search);
+  if (it->values != NULL)
+    ldap_value_free(it->values);
+  free(it);
+}
+
+/* Get all the values of a ranged attribute as a single list. */
+static char **myldap_get_ranged_values(MYLDAP_ENTRY *entry, const char *attr)
+{
+  MYLDAP_VALUES *it;
+  const char **values;
+  char **result;
+  SET *set = NULL;
+  int i;
+  it = myldap_values_open(entry, attr);
+  if (it == NULL)
+    return NULL;
+  while ((values = myldap_values_next(it)) != NULL)
+  {
     /* allocate memory */
     if (set == NULL)
     {
       set = set_new();
       if (set == NULL)
       {
-        ldap_value_free(values);
+        myldap_values_close(it);
         log_log(LOG_CRIT, "myldap_get_ranged_values(): set_new() failed to allocate memory");
         return NULL;
       }
@@ -1852,42 +3937,16 @@ static char **myldap_get_ranged_values(MYLDAP_ENTRY *entry, const char *attr)
     /* add to the set */
     for (i = 0; values[i] != NULL; i++)
       set_add(set, values[i]);
-    /* free results */
-    ldap_value_free(values);
-    /* check if we should start a new search */
-    if (nxt <= startat)
-      break;
-    startat = nxt;
-    /* build attributes for a new search */
-    if (mysnprintf(attbuf, sizeof(attbuf), "%s;range=%d-*", attr, startat))
-    {
-      log_log(LOG_ERR, "myldap_get_ranged_values(): attbuf buffer too small");
-      break;
-    }
-    attrs[0] = attbuf;
-    attrs[1] = NULL;
-    /* close the previous search, if any */
-    if (search != NULL)
-      myldap_search_close(search);
-    /* start the new search */
-    search = myldap_search(session, dn, LDAP_SCOPE_BASE, "(objectClass=*)", attrs, NULL);
-    if (search == NULL)
-      break;
-    entry = myldap_get_entry(search, NULL);
-    if (entry == NULL)
-      break;
   }
-  /* close any started searches */
-  if (search != NULL)
-    myldap_search_close(search);
+  myldap_values_close(it);
   /* return the contents of the set as a list */
   if (set == NULL)
     return NULL;
-  values = (char **)set_tolist(set);
+  result = (char **)set_tolist(set);
   set_free(set);
-  if (values == NULL)
+  if (result == NULL)
     log_log(LOG_CRIT, "myldap_get_ranged_values(): malloc() failed to allocate memory");
-  return values;
+  return result;
 }
 
 /* Simple wrapper around ldap_get_values(). */
@@ -1963,8 +4022,10 @@ const char **myldap_get_values(MYLDAP_ENTRY *entry, const char *attr)
 }
 
 /* Convert the bervalues to a simple list of strings that can be freed
-   with one call to free(). */
-static const char **bervalues_to_values(struct berval **bvalues)
+   with one call to free(). The lengths of the values are stored in the
+   same memory after the list. */
+static const char **bervalues_to_values(struct berval **bvalues,
+                                        size_t **lengths)
 {
   int num_values;
   int i;
@@ -1973,7 +4034,7 @@ static const char **bervalues_to_values(struct berval **bvalues)
   char **values;
   /* figure out how much memory to allocate */
   num_values = ldap_count_values_len(bvalues);
-  sz = (num_values + 1) * sizeof(char *);
+  sz = (num_values + 1) * sizeof(char *) + num_values * sizeof(size_t);
   for (i = 0; i < num_values; i++)
     sz += bvalues[i]->bv_len + 1;
   /* allocate the needed memory */
@@ -1983,11 +4044,12 @@ static const char **bervalues_to_values(struct berval **bvalues)
     log_log(LOG_CRIT, "bervalues_to_values(): malloc() failed to allocate memory");
     return NULL;
   }
-  buf = (char *)values;
-  buf += (num_values + 1) * sizeof(char *);
+  *lengths = (size_t *)(values + num_values + 1);
+  buf = (char *)(*lengths + num_values);
   /* copy from bvalues */
   for (i = 0; i < num_values; i++)
   {
+    (*lengths)[i] = bvalues[i]->bv_len;
     values[i] = buf;
     memcpy(values[i], bvalues[i]->bv_val, bvalues[i]->bv_len);
     values[i][bvalues[i]->bv_len] = '\0';
@@ -1997,10 +4059,44 @@ static const char **bervalues_to_values(struct berval **bvalues)
   return (const char **)values;
 }
 
-/* Simple wrapper around ldap_get_values(). */
-const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr)
+/* Copy the list of strings (which is freed) to the format returned by
+   bervalues_to_values() to also have the lengths. */
+static const char **strings_to_values(char **strings, size_t **lengths)
+{
+  int num_values;
+  int i;
+  struct berval *bvalues;
+  struct berval **bvalueps;
+  const char **values;
+  for (num_values = 0; strings[num_values] != NULL; num_values++)
+    /* nothing */ ;
+  bvalues = (struct berval *)malloc((num_values + 1) * sizeof(struct berval));
+  bvalueps = (struct berval **)malloc((num_values + 1) * sizeof(struct berval *));
+  if ((bvalues == NULL) || (bvalueps == NULL))
+  {
+    log_log(LOG_CRIT, "strings_to_values(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < num_values; i++)
+  {
+    bvalues[i].bv_val = strings[i];
+    bvalues[i].bv_len = strlen(strings[i]);
+    bvalueps[i] = &bvalues[i];
+  }
+  bvalueps[i] = NULL;
+  values = bervalues_to_values(bvalueps, lengths);
+  free(bvalueps);
+  free(bvalues);
+  free(strings);
+  return values;
+}
+
+/* Simple wrapper around ldap_get_values_len(). */
+const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr,
+                                   const size_t **lengths)
 {
   const char **values;
+  size_t *lens = NULL;
   struct berval **bvalues;
   int rc;
   int i;
@@ -2038,6 +4134,9 @@ const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr)
       /* we have a success code but no values, let's try to get ranged
          values */
       values = (const char **)myldap_get_ranged_values(entry, attr);
+      /* these are strings so the lengths are easily found */
+      if ((values != NULL) && (lengths != NULL))
+        values = strings_to_values((char **)values, &lens);
     }
     else
     {
@@ -2049,7 +4148,7 @@ const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr)
   }
   else
   {
-    values = bervalues_to_values(bvalues);
+    values = bervalues_to_values(bvalues, &lens);
     ldap_value_free_len(bvalues);
   }
   /* check if we got allocated memory */
@@ -2060,6 +4159,8 @@ const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr)
     if (entry->buffers[i] == NULL)
     {
       entry->buffers[i] = (char **)values;
+      if (lengths != NULL)
+        *lengths = lens;
       return values;
     }
   /* we found no room to store the values */
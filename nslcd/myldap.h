@@ -37,6 +37,8 @@
 
 /* for size_t */
 #include <stdlib.h>
+/* for time_t */
+#include <time.h>
 /* for LDAP_SCOPE_* */
 #include <lber.h>
 #include <ldap.h>
@@ -79,19 +81,38 @@ MUST_USE int myldap_bind(MYLDAP_SESSION *session, const char *dn,
    with these searches. This does not close the session. */
 void myldap_session_cleanup(MYLDAP_SESSION *session);
 
+/* Allow searches in the session to be hedged (sent to another server if
+   the server takes longer to respond than usual, see the hedge_percentile
+   option). This should only be enabled for lookups of single entries and
+   is reset by myldap_session_cleanup(). */
+void myldap_session_hedge(MYLDAP_SESSION *session, int enable);
+
 /* This checks the timeout value of the session and closes the connection
    to the LDAP server if the timeout has expired and there are no pending
-   searches. */
-void myldap_session_check(MYLDAP_SESSION *session);
+   searches. This returns the time at which the session should be checked
+   again or 0 if the session does not need to be checked (e.g. because
+   the connection is closed). */
+time_t myldap_session_check(MYLDAP_SESSION *session);
 
 /* Close the session and free all the resources allocated for the session.
    After a call to this function the referenced handle is invalid. */
 void myldap_session_close(MYLDAP_SESSION *session);
 
+/* Close pooled connections that have been idle for longer than
+   idle_timelimit (if connection_pool is set). This returns the time the
+   pool needs to be checked again (0 if there is no need). */
+time_t myldap_pool_check(void);
+
 /* Mark all failing LDAP servers as needing quick retries. This ensures that the
    reconnect_sleeptime and reconnect_retrytime sleeping period is cut short. */
 void myldap_immediate_reconnect(void);
 
+/* Start the thread that opens the minimum number of pooled connections
+   and regularly checks failing LDAP servers and keeps idle shared and
+   pooled connections open (if health_check_interval is set). This
+   returns -1 if the thread could not be started. */
+int myldap_prober_start(void);
+
 /* Do an LDAP search and return a reference to the results (returns NULL on
    error). This function uses paging, and does reconnects to the configured
    URLs transparently. The function returns an LDAP status code in the
@@ -125,8 +146,27 @@ char *myldap_cpy_dn(MYLDAP_ENTRY *entry, char *buf, size_t buflen);
 MUST_USE const char **myldap_get_values(MYLDAP_ENTRY *entry, const char *attr);
 
 /* Get the attribute values from a certain entry as a NULL terminated list.
-   May return NULL or an empty array. */
-MUST_USE const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr);
+   May return NULL or an empty array. If lengths is not NULL it is set to
+   the lengths of the (possibly binary) values. */
+MUST_USE const char **myldap_get_values_len(MYLDAP_ENTRY *entry, const char *attr,
+                                            const size_t **lengths);
+
+/* A loop over the values of an attribute that may be retrieved in ranges
+   (e.g. the member attribute of large groups in Active Directory). */
+typedef struct myldap_values MYLDAP_VALUES;
+
+/* Start a loop over the values of the attribute. The entry should remain
+   valid until myldap_values_close() is called. */
+MUST_USE MYLDAP_VALUES *myldap_values_open(MYLDAP_ENTRY *entry, const char *attr);
+
+/* Get the next part of the values as a NULL terminated list or NULL if all
+   values have been returned. The list is valid until the next call. The
+   search for the following range is started before returning so that it
+   is processed while the caller handles the values. */
+MUST_USE const char **myldap_values_next(MYLDAP_VALUES *values);
+
+/* Stop the loop and free all resources. */
+void myldap_values_close(MYLDAP_VALUES *values);
 
 /* Checks to see if the entry has the specified object class. */
 MUST_USE int myldap_has_objectclass(MYLDAP_ENTRY *entry, const char *objectclass);
@@ -42,6 +42,9 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
 #include <grp.h>
 #ifdef HAVE_NSS_H
 #include <nss.h>
@@ -72,12 +75,25 @@
 #define READ_TIMEOUT 500
 #define WRITE_TIMEOUT 60 * 1000
 
+/* the read timeout while overloaded, a single thread handles all these
+   requests so a slow client should not hold it up */
+#define SHED_READ_TIMEOUT 20
+
 /* buffer sizes for I/O */
 #define READBUFFER_MINSIZE 32
 #define READBUFFER_MAXSIZE 64
 #define WRITEBUFFER_MINSIZE 1024
 #define WRITEBUFFER_MAXSIZE 1 * 1024 * 1024
 
+/* the number of accepted connections that can be waiting for a worker,
+   any further connections remain in the listen backlog */
+#define CONNQUEUE_SIZE 64
+
+/* the maximum number of client connections that are kept open waiting
+   for another request and the number of seconds they are kept */
+#define IDLECLIENTS_MAX 256
+#define IDLECLIENTS_TIMEOUT 10
+
 /* adjust the oom killer score */
 #define OOM_SCORE_ADJ_FILE "/proc/self/oom_score_adj"
 #define OOM_SCORE_ADJ "-1000"
@@ -103,8 +119,97 @@ static volatile int nslcd_receivedsignal = 0;
 /* the server socket used for communication */
 static int nslcd_serversocket = -1;
 
-/* thread ids of all running threads */
-static pthread_t *nslcd_threads;
+#ifdef HAVE_EPOLL_CREATE1
+/* the epoll instance used for waiting on the server socket */
+static int nslcd_epollfd = -1;
+#endif /* HAVE_EPOLL_CREATE1 */
+
+/* information on the worker threads (protected by connqueue_mutex) */
+struct worker_thread {
+  pthread_t thread;
+  int running;
+};
+
+/* list of worker threads (threads_max entries) */
+static struct worker_thread *nslcd_threads;
+
+/* thread id of the thread that accepts connections */
+static pthread_t nslcd_acceptthread;
+
+/* the thread that answers requests while the workers are overloaded */
+static pthread_t nslcd_shedthread;
+static int nslcd_shedding = 0;
+
+/* information on a connection from a client, the connection is kept
+   open after a request to allow the client to send further requests */
+struct nslcd_client {
+  int sock;
+  /* the stream (set up when handling the first request) */
+  TFILE *fp;
+  /* the credentials of the client */
+  uid_t uid;
+  /* the time the last request was handled */
+  time_t lastused;
+  /* whether the socket was added to the epoll instance */
+  int registered;
+  /* a request that was read but delayed because of its class */
+  int delayed;
+  int32_t action;
+  /* the time the connection was put in the queue */
+  time_t queued;
+  /* list of idle connections */
+  struct nslcd_client *prev;
+  struct nslcd_client *next;
+};
+
+#ifdef HAVE_EPOLL_CREATE1
+/* the list of connections that are waiting for another request, least
+   recently used first (protected by idleclients_mutex) */
+static pthread_mutex_t idleclients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct nslcd_client *idleclients_first = NULL;
+static struct nslcd_client *idleclients_last = NULL;
+static int idleclients_len = 0;
+#endif /* HAVE_EPOLL_CREATE1 */
+
+/* queue of accepted connections that should be handled by workers */
+static pthread_mutex_t connqueue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connqueue_notempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t connqueue_notfull = PTHREAD_COND_INITIALIZER;
+static struct nslcd_client *connqueue[CONNQUEUE_SIZE];
+static int connqueue_first = 0;
+static int connqueue_len = 0;
+
+/* connections that were put back by a worker and should be handled before
+   the ones in connqueue, this list is not limited in size so workers never
+   have to wait for space (protected by connqueue_mutex) */
+static struct nslcd_client *connqueue_requeued_first = NULL;
+static struct nslcd_client *connqueue_requeued_last = NULL;
+
+/* connections that are handled without LDAP searches because the workers
+   are overloaded (protected by shedqueue_mutex) */
+static pthread_mutex_t shedqueue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shedqueue_notempty = PTHREAD_COND_INITIALIZER;
+static struct nslcd_client *shedqueue_first = NULL;
+static struct nslcd_client *shedqueue_last = NULL;
+static int shedqueue_len = 0;
+static long shedqueue_total = 0;
+
+/* the number of requests of each class that are being handled and the
+   requests that wait because their class is at its limit (protected by
+   reqclass_mutex) */
+static pthread_mutex_t reqclass_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int reqclass_running[RC_NONE];
+static struct nslcd_client *reqclass_first[RC_NONE];
+static struct nslcd_client *reqclass_last[RC_NONE];
+static int reqclass_waiting = 0;
+
+/* the number of running worker threads and the number of those that are
+   waiting for a connection (protected by connqueue_mutex) */
+static int nslcd_nthreads = 0;
+static int nslcd_idlethreads = 0;
+
+/* flag to indicate that threads should no longer be started or stopped */
+static int nslcd_shuttingdown = 0;
 
 /* if we don't have clearenv() we have to do this the hard way */
 #ifndef HAVE_CLEARENV
@@ -221,6 +326,8 @@ static void sig_handler(int signum)
 /* do some cleaning up before terminating */
 static void exithandler(void)
 {
+  /* stop clients from using the shared cache */
+  cache_shm_close();
   /* remove existing named socket */
   if (unlink(NSLCD_SOCKET) < 0)
   {
@@ -349,8 +456,18 @@ static int read_header(TFILE *fp, int32_t *action)
 {
   int32_t tmpint32;
   int32_t protocol;
-  /* read the protocol version */
-  READ_INT32(fp, protocol);
+  /* read the protocol version (the client may also close the connection
+     instead of sending another request) */
+  if (tio_read(fp, &tmpint32, sizeof(int32_t)))
+  {
+    if (errno == ECONNRESET)
+    {
+      log_log(LOG_DEBUG, "connection closed by client");
+      return -1;
+    }
+    ERROR_OUT_READERROR(fp);
+  }
+  protocol = ntohl(tmpint32);
   if (protocol != (int32_t)NSLCD_VERSION)
   {
     log_log(LOG_DEBUG, "invalid nslcd version id: 0x%08x", (unsigned int)protocol);
@@ -361,18 +478,340 @@ static int read_header(TFILE *fp, int32_t *action)
   return 0;
 }
 
-/* read a request message, returns <0 in case of errors,
-   this function closes the socket */
-static void handleconnection(int sock, MYLDAP_SESSION *session)
+static enum nslcd_request_class request_class(int32_t action);
+
+/* handle a single request of which the header was read and write the
+   response, returns <0 if the connection should be closed */
+static int handlerequest(TFILE *fp, MYLDAP_SESSION *session, uid_t uid,
+                         int32_t action)
+{
+  int rv;
+  /* lookups may be sent to another server if the first one is slow */
+  if (session != NULL)
+    myldap_session_hedge(session,
+                         (request_class(action) == RC_LOOKUP) ||
+                         (request_class(action) == RC_INITGROUPS));
+  /* handle request */
+  switch (action)
+  {
+    case NSLCD_ACTION_CONFIG_GET:       rv = nslcd_config_get(fp, session); break;
+    case NSLCD_ACTION_ALIAS_BYNAME:     rv = nslcd_alias_byname(fp, session); break;
+    case NSLCD_ACTION_ALIAS_ALL:        rv = nslcd_alias_all(fp, session); break;
+    case NSLCD_ACTION_ETHER_BYNAME:     rv = nslcd_ether_byname(fp, session); break;
+    case NSLCD_ACTION_ETHER_BYETHER:    rv = nslcd_ether_byether(fp, session); break;
+    case NSLCD_ACTION_ETHER_ALL:        rv = nslcd_ether_all(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYNAME:     rv = nslcd_group_byname(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYGID:      rv = nslcd_group_bygid(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYNAMES:    rv = nslcd_group_bynames(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYGIDS:     rv = nslcd_group_bygids(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYMEMBER:   rv = nslcd_group_bymember(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYMEMBER_GIDS: rv = nslcd_group_bymember_gids(fp, session); break;
+    case NSLCD_ACTION_GROUP_ALL:
+      if (!nslcd_cfg->nss_disable_enumeration) rv = nslcd_group_all(fp, session);
+      else rv = -1;
+      break;
+    case NSLCD_ACTION_GROUP_BYNAME_CHUNKED: rv = nslcd_group_byname_chunked(fp, session); break;
+    case NSLCD_ACTION_GROUP_BYGID_CHUNKED:  rv = nslcd_group_bygid_chunked(fp, session); break;
+    case NSLCD_ACTION_GROUP_ALL_CHUNKED:
+      if (!nslcd_cfg->nss_disable_enumeration) rv = nslcd_group_all_chunked(fp, session);
+      else rv = -1;
+      break;
+    case NSLCD_ACTION_HOST_BYNAME:      rv = nslcd_host_byname(fp, session); break;
+    case NSLCD_ACTION_HOST_BYADDR:      rv = nslcd_host_byaddr(fp, session); break;
+    case NSLCD_ACTION_HOST_ALL:         rv = nslcd_host_all(fp, session); break;
+    case NSLCD_ACTION_NETGROUP_BYNAME:  rv = nslcd_netgroup_byname(fp, session); break;
+    case NSLCD_ACTION_NETGROUP_ALL:     rv = nslcd_netgroup_all(fp, session); break;
+    case NSLCD_ACTION_NETWORK_BYNAME:   rv = nslcd_network_byname(fp, session); break;
+    case NSLCD_ACTION_NETWORK_BYADDR:   rv = nslcd_network_byaddr(fp, session); break;
+    case NSLCD_ACTION_NETWORK_ALL:      rv = nslcd_network_all(fp, session); break;
+    case NSLCD_ACTION_PASSWD_BYNAME:    rv = nslcd_passwd_byname(fp, session, uid); break;
+    case NSLCD_ACTION_PASSWD_BYUID:     rv = nslcd_passwd_byuid(fp, session, uid); break;
+    case NSLCD_ACTION_PASSWD_BYNAMES:   rv = nslcd_passwd_bynames(fp, session, uid); break;
+    case NSLCD_ACTION_PASSWD_BYUIDS:    rv = nslcd_passwd_byuids(fp, session, uid); break;
+    case NSLCD_ACTION_PASSWD_ALL:
+      if (!nslcd_cfg->nss_disable_enumeration) rv = nslcd_passwd_all(fp, session, uid);
+      else rv = -1;
+      break;
+    case NSLCD_ACTION_PROTOCOL_BYNAME:  rv = nslcd_protocol_byname(fp, session); break;
+    case NSLCD_ACTION_PROTOCOL_BYNUMBER:rv = nslcd_protocol_bynumber(fp, session); break;
+    case NSLCD_ACTION_PROTOCOL_ALL:     rv = nslcd_protocol_all(fp, session); break;
+    case NSLCD_ACTION_RPC_BYNAME:       rv = nslcd_rpc_byname(fp, session); break;
+    case NSLCD_ACTION_RPC_BYNUMBER:     rv = nslcd_rpc_bynumber(fp, session); break;
+    case NSLCD_ACTION_RPC_ALL:          rv = nslcd_rpc_all(fp, session); break;
+    case NSLCD_ACTION_SERVICE_BYNAME:   rv = nslcd_service_byname(fp, session); break;
+    case NSLCD_ACTION_SERVICE_BYNUMBER: rv = nslcd_service_bynumber(fp, session); break;
+    case NSLCD_ACTION_SERVICE_ALL:      rv = nslcd_service_all(fp, session); break;
+    case NSLCD_ACTION_SHADOW_BYNAME:    rv = nslcd_shadow_byname(fp, session, uid); break;
+    case NSLCD_ACTION_SHADOW_ALL:
+      if (!nslcd_cfg->nss_disable_enumeration) rv = nslcd_shadow_all(fp, session, uid);
+      else rv = -1;
+      break;
+    case NSLCD_ACTION_PAM_AUTHC:        rv = nslcd_pam_authc(fp, session, uid); break;
+    case NSLCD_ACTION_PAM_AUTHZ:        rv = nslcd_pam_authz(fp, session); break;
+    case NSLCD_ACTION_PAM_SESS_O:       rv = nslcd_pam_sess_o(fp, session); break;
+    case NSLCD_ACTION_PAM_SESS_C:       rv = nslcd_pam_sess_c(fp, session); break;
+    case NSLCD_ACTION_PAM_PWMOD:        rv = nslcd_pam_pwmod(fp, session, uid); break;
+    case NSLCD_ACTION_USERMOD:          rv = nslcd_usermod(fp, session, uid); break;
+    default:
+      log_log(LOG_WARNING, "invalid request id: 0x%08x", (unsigned int)action);
+      rv = -1;
+      break;
+  }
+  /* we're done with the request */
+  cache_release(fp);
+  if (session != NULL)
+    myldap_session_cleanup(session);
+  return rv;
+}
+
+/* handle the request without doing any LDAP searches, the lookup handlers
+   write a response from the cache (if available) when they are called
+   without a session, otherwise the client is told to try again later if
+   tryagain is set (older clients treat NSLCD_RESULT_TRYAGAIN as not
+   found), returns <0 if the connection should be closed without a
+   response */
+static int handlerequest_overloaded(TFILE *fp, uid_t uid, int32_t action,
+                                    int tryagain)
+{
+  int32_t tmpint32;
+  switch (action)
+  {
+    case NSLCD_ACTION_ALIAS_BYNAME:
+    case NSLCD_ACTION_ETHER_BYNAME:
+    case NSLCD_ACTION_ETHER_BYETHER:
+    case NSLCD_ACTION_GROUP_BYNAME:
+    case NSLCD_ACTION_GROUP_BYGID:
+    case NSLCD_ACTION_GROUP_BYMEMBER:
+    case NSLCD_ACTION_GROUP_BYMEMBER_GIDS:
+    case NSLCD_ACTION_GROUP_BYNAME_CHUNKED:
+    case NSLCD_ACTION_GROUP_BYGID_CHUNKED:
+    case NSLCD_ACTION_HOST_BYNAME:
+    case NSLCD_ACTION_HOST_BYADDR:
+    case NSLCD_ACTION_NETGROUP_BYNAME:
+    case NSLCD_ACTION_NETWORK_BYNAME:
+    case NSLCD_ACTION_NETWORK_BYADDR:
+    case NSLCD_ACTION_PASSWD_BYNAME:
+    case NSLCD_ACTION_PASSWD_BYUID:
+    case NSLCD_ACTION_PROTOCOL_BYNAME:
+    case NSLCD_ACTION_PROTOCOL_BYNUMBER:
+    case NSLCD_ACTION_RPC_BYNAME:
+    case NSLCD_ACTION_RPC_BYNUMBER:
+    case NSLCD_ACTION_SERVICE_BYNAME:
+    case NSLCD_ACTION_SERVICE_BYNUMBER:
+    case NSLCD_ACTION_SHADOW_BYNAME:
+      if (handlerequest(fp, NULL, uid, action) == 0)
+        return 0;
+      break;
+    default:
+      break;
+  }
+  if (!tryagain)
+  {
+    log_log(LOG_DEBUG, "overloaded, connection closed");
+    return -1;
+  }
+  log_log(LOG_DEBUG, "overloaded, request rejected");
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, action);
+  WRITE_INT32(fp, NSLCD_RESULT_TRYAGAIN);
+  return 0;
+}
+
+/* close the connection to the client */
+static void client_close(struct nslcd_client *client)
+{
+  if (client->fp != NULL)
+    (void)tio_close(client->fp);
+  else if (close(client->sock))
+    log_log(LOG_WARNING, "problem closing socket: %s", strerror(errno));
+  free(client);
+}
+
+#ifdef HAVE_EPOLL_CREATE1
+/* remove the client from the list of idle connections, this should be
+   called with idleclients_mutex held */
+static void idleclients_remove(struct nslcd_client *client)
+{
+  if (client->prev != NULL)
+    client->prev->next = client->next;
+  else
+    idleclients_first = client->next;
+  if (client->next != NULL)
+    client->next->prev = client->prev;
+  else
+    idleclients_last = client->prev;
+  client->prev = NULL;
+  client->next = NULL;
+  idleclients_len--;
+}
+
+/* close connections that have not been used for a while */
+static void idleclients_expire(void)
+{
+  struct nslcd_client *expired = NULL;
+  struct nslcd_client *client;
+  time_t t = time(NULL) - IDLECLIENTS_TIMEOUT;
+  pthread_mutex_lock(&idleclients_mutex);
+  while ((idleclients_first != NULL) && (idleclients_first->lastused <= t))
+  {
+    client = idleclients_first;
+    idleclients_remove(client);
+    client->next = expired;
+    expired = client;
+  }
+  pthread_mutex_unlock(&idleclients_mutex);
+  /* close the connections outside of the lock */
+  while (expired != NULL)
+  {
+    client = expired;
+    expired = client->next;
+    client_close(client);
+  }
+}
+#endif /* HAVE_EPOLL_CREATE1 */
+
+/* keep the connection open so the client can send another request (the
+   acceptor thread queues the connection when it does) or close it if
+   that is not possible */
+static void client_park(struct nslcd_client *client)
+{
+#ifdef HAVE_EPOLL_CREATE1
+  struct epoll_event event;
+  pthread_mutex_lock(&idleclients_mutex);
+  if (idleclients_len < IDLECLIENTS_MAX)
+  {
+    /* add to the end of the list before the acceptor can see it */
+    time(&(client->lastused));
+    client->prev = idleclients_last;
+    client->next = NULL;
+    if (idleclients_last != NULL)
+      idleclients_last->next = client;
+    else
+      idleclients_first = client;
+    idleclients_last = client;
+    idleclients_len++;
+    /* wait for a single event on the socket */
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = client;
+    if (epoll_ctl(nslcd_epollfd, client->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                  client->sock, &event) == 0)
+    {
+      client->registered = 1;
+      pthread_mutex_unlock(&idleclients_mutex);
+      return;
+    }
+    log_log(LOG_WARNING, "epoll_ctl() failed: %s", strerror(errno));
+    idleclients_remove(client);
+  }
+  pthread_mutex_unlock(&idleclients_mutex);
+#endif /* HAVE_EPOLL_CREATE1 */
+  client_close(client);
+}
+
+static void connqueue_requeue(struct nslcd_client *client);
+
+/* determine the class of the request for scheduling */
+static enum nslcd_request_class request_class(int32_t action)
+{
+  if (((action >> 16) == (NSLCD_ACTION_PAM_AUTHC >> 16)) ||
+      (action == NSLCD_ACTION_USERMOD))
+    return RC_AUTHENTICATION;
+  else if ((action == NSLCD_ACTION_GROUP_BYMEMBER) ||
+           (action == NSLCD_ACTION_GROUP_BYMEMBER_GIDS))
+    return RC_INITGROUPS;
+  else if (ACTION_IS_ENUMERATION(action))
+    return RC_ENUMERATION;
+  return RC_LOOKUP;
+}
+
+/* check whether a request of the class may be started, this should be
+   called with reqclass_mutex held */
+static int reqclass_canrun(enum nslcd_request_class rclass)
+{
+  int i, running = 0;
+  if ((nslcd_cfg->request_limit[rclass] > 0) &&
+      (reqclass_running[rclass] >= nslcd_cfg->request_limit[rclass]))
+    return 0;
+  /* keep threads available for authentication requests */
+  if ((rclass != RC_AUTHENTICATION) && (nslcd_cfg->pam_reserved_threads > 0))
+  {
+    for (i = 0; i < RC_NONE; i++)
+      if (i != RC_AUTHENTICATION)
+        running += reqclass_running[i];
+    if (running >= nslcd_cfg->threads_max - nslcd_cfg->pam_reserved_threads)
+      return 0;
+  }
+  return 1;
+}
+
+/* register the start of the request, returns 0 if the request should wait
+   in which case the client is queued and handed to a worker again when a
+   running request finishes */
+static int reqclass_enter(struct nslcd_client *client, int32_t action)
+{
+  enum nslcd_request_class rclass = request_class(action);
+  pthread_mutex_lock(&reqclass_mutex);
+  if ((reqclass_first[rclass] == NULL) && (reqclass_canrun(rclass)))
+  {
+    reqclass_running[rclass]++;
+    pthread_mutex_unlock(&reqclass_mutex);
+    return 1;
+  }
+  client->delayed = 1;
+  client->action = action;
+  client->next = NULL;
+  if (reqclass_last[rclass] != NULL)
+    reqclass_last[rclass]->next = client;
+  else
+    reqclass_first[rclass] = client;
+  reqclass_last[rclass] = client;
+  reqclass_waiting++;
+  pthread_mutex_unlock(&reqclass_mutex);
+  log_log(LOG_DEBUG, "request 0x%08x delayed", (int)action);
+  return 0;
+}
+
+/* register the end of the request and start the first waiting request
+   (in order of class priority) that may run now, this is called from a
+   worker so the request is put back without waiting for space in the
+   queue (all workers could be doing this while the queue is full) */
+static void reqclass_leave(int32_t action)
+{
+  struct nslcd_client *client = NULL;
+  int i;
+  pthread_mutex_lock(&reqclass_mutex);
+  reqclass_running[request_class(action)]--;
+  for (i = 0; i < RC_NONE; i++)
+  {
+    if ((reqclass_first[i] != NULL) && (reqclass_canrun(i)))
+    {
+      client = reqclass_first[i];
+      reqclass_first[i] = client->next;
+      if (reqclass_first[i] == NULL)
+        reqclass_last[i] = NULL;
+      client->next = NULL;
+      reqclass_running[i]++;
+      reqclass_waiting--;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&reqclass_mutex);
+  if (client != NULL)
+    connqueue_requeue(client);
+}
+
+/* set up the connection on the first request, returns -1 (after closing
+   the connection) on errors */
+static int client_setup(struct nslcd_client *client)
 {
-  TFILE *fp;
-  int32_t action;
   pid_t pid = (pid_t)-1;
-  uid_t uid = (uid_t)-1;
   gid_t gid = (gid_t)-1;
   char peerinfo[80];
+  if (client->fp != NULL)
+    return 0;
   /* log connection */
-  if (getpeercred(sock, &uid, &gid, &pid))
+  if (getpeercred(client->sock, &(client->uid), &gid, &pid))
     log_log(LOG_DEBUG, "connection from unknown client: %s", strerror(errno));
   else
   {
@@ -380,85 +819,80 @@ static void handleconnection(int sock, MYLDAP_SESSION *session)
     if (pid != (pid_t)-1)
       mysnprintf(peerinfo + strlen(peerinfo), sizeof(peerinfo) - strlen(peerinfo) - 1,
                  " pid=%lu", (unsigned long int)pid);
-    if (uid != (uid_t)-1)
+    if (client->uid != (uid_t)-1)
       mysnprintf(peerinfo + strlen(peerinfo), sizeof(peerinfo) - strlen(peerinfo) - 1,
-                 " uid=%lu", (unsigned long int)uid);
+                 " uid=%lu", (unsigned long int)client->uid);
     if (gid != (gid_t)-1)
       mysnprintf(peerinfo + strlen(peerinfo), sizeof(peerinfo) - strlen(peerinfo) - 1,
                  " gid=%lu", (unsigned long int)gid);
     log_log(LOG_DEBUG, "connection from %s", (peerinfo[0] == '\0') ? "unknown" : peerinfo);
   }
   /* create a stream object */
-  if ((fp = tio_fdopen(sock, READ_TIMEOUT, WRITE_TIMEOUT,
-                       READBUFFER_MINSIZE, READBUFFER_MAXSIZE,
-                       WRITEBUFFER_MINSIZE, WRITEBUFFER_MAXSIZE)) == NULL)
+  if ((client->fp = tio_fdopen(client->sock, READ_TIMEOUT, WRITE_TIMEOUT,
+                               READBUFFER_MINSIZE, READBUFFER_MAXSIZE,
+                               WRITEBUFFER_MINSIZE, WRITEBUFFER_MAXSIZE)) == NULL)
   {
     log_log(LOG_WARNING, "cannot create stream for writing: %s",
             strerror(errno));
-    (void)close(sock);
-    return;
+    client_close(client);
+    return -1;
   }
-  /* read request */
-  if (read_header(fp, &action))
-  {
-    (void)tio_close(fp);
+  return 0;
+}
+
+/* handle requests on the connection, the connection is closed or kept
+   open for further requests */
+static void handleconnection(struct nslcd_client *client, MYLDAP_SESSION *session)
+{
+  int32_t action;
+  int rv;
+  if (client_setup(client))
     return;
-  }
-  /* handle request */
-  switch (action)
+  /* handle requests that are available */
+  do
   {
-    case NSLCD_ACTION_CONFIG_GET:       (void)nslcd_config_get(fp, session); break;
-    case NSLCD_ACTION_ALIAS_BYNAME:     (void)nslcd_alias_byname(fp, session); break;
-    case NSLCD_ACTION_ALIAS_ALL:        (void)nslcd_alias_all(fp, session); break;
-    case NSLCD_ACTION_ETHER_BYNAME:     (void)nslcd_ether_byname(fp, session); break;
-    case NSLCD_ACTION_ETHER_BYETHER:    (void)nslcd_ether_byether(fp, session); break;
-    case NSLCD_ACTION_ETHER_ALL:        (void)nslcd_ether_all(fp, session); break;
-    case NSLCD_ACTION_GROUP_BYNAME:     (void)nslcd_group_byname(fp, session); break;
-    case NSLCD_ACTION_GROUP_BYGID:      (void)nslcd_group_bygid(fp, session); break;
-    case NSLCD_ACTION_GROUP_BYMEMBER:   (void)nslcd_group_bymember(fp, session); break;
-    case NSLCD_ACTION_GROUP_ALL:
-      if (!nslcd_cfg->nss_disable_enumeration) (void)nslcd_group_all(fp, session);
-      break;
-    case NSLCD_ACTION_HOST_BYNAME:      (void)nslcd_host_byname(fp, session); break;
-    case NSLCD_ACTION_HOST_BYADDR:      (void)nslcd_host_byaddr(fp, session); break;
-    case NSLCD_ACTION_HOST_ALL:         (void)nslcd_host_all(fp, session); break;
-    case NSLCD_ACTION_NETGROUP_BYNAME:  (void)nslcd_netgroup_byname(fp, session); break;
-    case NSLCD_ACTION_NETGROUP_ALL:     (void)nslcd_netgroup_all(fp, session); break;
-    case NSLCD_ACTION_NETWORK_BYNAME:   (void)nslcd_network_byname(fp, session); break;
-    case NSLCD_ACTION_NETWORK_BYADDR:   (void)nslcd_network_byaddr(fp, session); break;
-    case NSLCD_ACTION_NETWORK_ALL:      (void)nslcd_network_all(fp, session); break;
-    case NSLCD_ACTION_PASSWD_BYNAME:    (void)nslcd_passwd_byname(fp, session, uid); break;
-    case NSLCD_ACTION_PASSWD_BYUID:     (void)nslcd_passwd_byuid(fp, session, uid); break;
-    case NSLCD_ACTION_PASSWD_ALL:
-      if (!nslcd_cfg->nss_disable_enumeration) (void)nslcd_passwd_all(fp, session, uid);
-      break;
-    case NSLCD_ACTION_PROTOCOL_BYNAME:  (void)nslcd_protocol_byname(fp, session); break;
-    case NSLCD_ACTION_PROTOCOL_BYNUMBER:(void)nslcd_protocol_bynumber(fp, session); break;
-    case NSLCD_ACTION_PROTOCOL_ALL:     (void)nslcd_protocol_all(fp, session); break;
-    case NSLCD_ACTION_RPC_BYNAME:       (void)nslcd_rpc_byname(fp, session); break;
-    case NSLCD_ACTION_RPC_BYNUMBER:     (void)nslcd_rpc_bynumber(fp, session); break;
-    case NSLCD_ACTION_RPC_ALL:          (void)nslcd_rpc_all(fp, session); break;
-    case NSLCD_ACTION_SERVICE_BYNAME:   (void)nslcd_service_byname(fp, session); break;
-    case NSLCD_ACTION_SERVICE_BYNUMBER: (void)nslcd_service_bynumber(fp, session); break;
-    case NSLCD_ACTION_SERVICE_ALL:      (void)nslcd_service_all(fp, session); break;
-    case NSLCD_ACTION_SHADOW_BYNAME:    (void)nslcd_shadow_byname(fp, session, uid); break;
-    case NSLCD_ACTION_SHADOW_ALL:
-      if (!nslcd_cfg->nss_disable_enumeration) (void)nslcd_shadow_all(fp, session, uid);
-      break;
-    case NSLCD_ACTION_PAM_AUTHC:        (void)nslcd_pam_authc(fp, session, uid); break;
-    case NSLCD_ACTION_PAM_AUTHZ:        (void)nslcd_pam_authz(fp, session); break;
-    case NSLCD_ACTION_PAM_SESS_O:       (void)nslcd_pam_sess_o(fp, session); break;
-    case NSLCD_ACTION_PAM_SESS_C:       (void)nslcd_pam_sess_c(fp, session); break;
-    case NSLCD_ACTION_PAM_PWMOD:        (void)nslcd_pam_pwmod(fp, session, uid); break;
-    case NSLCD_ACTION_USERMOD:          (void)nslcd_usermod(fp, session, uid); break;
-    default:
-      log_log(LOG_WARNING, "invalid request id: 0x%08x", (unsigned int)action);
-      break;
+    /* indicate new request to logging module (generates unique id) */
+    log_newsession();
+    if (client->delayed)
+    {
+      /* the request was read earlier and may run now */
+      action = client->action;
+      client->delayed = 0;
+    }
+    else
+    {
+      if (read_header(client->fp, &action))
+      {
+        log_clearsession();
+        client_close(client);
+        return;
+      }
+      /* the request may have to wait for others of the same class */
+      if (!reqclass_enter(client, action))
+      {
+        log_clearsession();
+        return;
+      }
+    }
+    rv = handlerequest(client->fp, session, client->uid, action);
+    /* make sure the complete response is sent */
+    if ((rv == 0) && (tio_flush(client->fp) < 0))
+    {
+      log_log(LOG_DEBUG, "error writing to client: %s", strerror(errno));
+      rv = -1;
+    }
+    reqclass_leave(action);
+    /* indicate end of request in log messages */
+    log_clearsession();
+    if (rv < 0)
+    {
+      client_close(client);
+      return;
+    }
   }
-  /* we're done with the request */
-  myldap_session_cleanup(session);
-  (void)tio_close(fp);
-  return;
+  while (tio_readable(client->fp));
+  /* wait for the next request */
+  client_park(client);
 }
 
 /* test to see if we can lock the specified file */
@@ -546,82 +980,482 @@ static void worker_cleanup(void *arg)
   myldap_session_close(session);
 }
 
-static void *worker(void UNUSED(*arg))
+static void connqueue_cleanup(void UNUSED(*arg))
+{
+  pthread_mutex_unlock(&connqueue_mutex);
+}
+
+static void *worker(void *arg);
+
+/* start a new worker thread, this should be called with connqueue_mutex
+   held, returns 0 on success */
+static int start_worker(void)
+{
+  int i;
+  int rc;
+  if (nslcd_shuttingdown)
+    return -1;
+  /* find a free entry */
+  for (i = 0; i < nslcd_cfg->threads_max; i++)
+    if (!nslcd_threads[i].running)
+      break;
+  if (i >= nslcd_cfg->threads_max)
+    return -1;
+  rc = pthread_create(&nslcd_threads[i].thread, NULL, worker, &nslcd_threads[i]);
+  if (rc != 0)
+  {
+    log_log(LOG_ERR, "unable to start worker thread %d: %s", i, strerror(rc));
+    return -1;
+  }
+  nslcd_threads[i].running = 1;
+  nslcd_nthreads++;
+  return 0;
+}
+
+/* remove the worker thread from the list of running threads if there are
+   more threads running than the configured minimum, returns non-zero if
+   the thread should stop */
+static int stop_worker(struct worker_thread *thread)
+{
+  int stop = 0;
+  int nthreads;
+  pthread_mutex_lock(&connqueue_mutex);
+  if ((!nslcd_shuttingdown) && (connqueue_len == 0) &&
+      (connqueue_requeued_first == NULL) &&
+      (nslcd_nthreads > nslcd_cfg->threads))
+  {
+    thread->running = 0;
+    nslcd_nthreads--;
+    stop = 1;
+  }
+  nthreads = nslcd_nthreads;
+  pthread_mutex_unlock(&connqueue_mutex);
+  if (stop)
+  {
+    log_log(LOG_DEBUG, "stopping idle worker thread (%d threads running)",
+            nthreads);
+    /* nobody will wait for this thread to finish */
+    pthread_detach(pthread_self());
+  }
+  return stop;
+}
+
+/* add the connection to the queue, waiting until space is available */
+static void connqueue_put(struct nslcd_client *client)
+{
+  pthread_mutex_lock(&connqueue_mutex);
+  pthread_cleanup_push(connqueue_cleanup, NULL);
+  while (connqueue_len >= CONNQUEUE_SIZE)
+    pthread_cond_wait(&connqueue_notfull, &connqueue_mutex);
+  time(&(client->queued));
+  connqueue[(connqueue_first + connqueue_len) % CONNQUEUE_SIZE] = client;
+  connqueue_len++;
+  /* start an extra worker if there are not enough idle workers */
+  if ((connqueue_len > nslcd_idlethreads) &&
+      (nslcd_nthreads < nslcd_cfg->threads_max) && (start_worker() == 0))
+    log_log(LOG_DEBUG, "started worker thread (%d threads running)",
+            nslcd_nthreads);
+  pthread_cond_signal(&connqueue_notempty);
+  pthread_cleanup_pop(1);
+}
+
+/* put the connection back in front of the queue, this never waits so
+   it is safe to call from workers (that empty the queue) */
+static void connqueue_requeue(struct nslcd_client *client)
+{
+  pthread_mutex_lock(&connqueue_mutex);
+  time(&(client->queued));
+  client->next = NULL;
+  if (connqueue_requeued_last != NULL)
+    connqueue_requeued_last->next = client;
+  else
+    connqueue_requeued_first = client;
+  connqueue_requeued_last = client;
+  pthread_cond_signal(&connqueue_notempty);
+  pthread_mutex_unlock(&connqueue_mutex);
+}
+
+/* get a connection from the queue, waiting until one becomes available
+   or until the deadline (if non-zero) passes in which case NULL is
+   stored in client */
+static void connqueue_get(time_t deadline, struct nslcd_client **client)
+{
+  struct timespec ts;
+  ts.tv_sec = deadline;
+  ts.tv_nsec = 0;
+  *client = NULL;
+  pthread_mutex_lock(&connqueue_mutex);
+  pthread_cleanup_push(connqueue_cleanup, NULL);
+  nslcd_idlethreads++;
+  while ((connqueue_len == 0) && (connqueue_requeued_first == NULL))
+  {
+    if (deadline == 0)
+      pthread_cond_wait(&connqueue_notempty, &connqueue_mutex);
+    else if (pthread_cond_timedwait(&connqueue_notempty, &connqueue_mutex,
+                                    &ts) == ETIMEDOUT)
+      break;
+  }
+  nslcd_idlethreads--;
+  if (connqueue_requeued_first != NULL)
+  {
+    *client = connqueue_requeued_first;
+    connqueue_requeued_first = (*client)->next;
+    if (connqueue_requeued_first == NULL)
+      connqueue_requeued_last = NULL;
+    (*client)->next = NULL;
+  }
+  else if (connqueue_len > 0)
+  {
+    *client = connqueue[connqueue_first];
+    connqueue_first = (connqueue_first + 1) % CONNQUEUE_SIZE;
+    connqueue_len--;
+    pthread_cond_signal(&connqueue_notfull);
+  }
+  pthread_cleanup_pop(1);
+}
+
+/* check whether the workers are overloaded: all threads are busy and too
+   many connections are queued or have been waiting for too long */
+static int connqueue_overloaded(void)
+{
+  int overloaded = 0;
+  if ((nslcd_cfg->queue_limit <= 0) && (nslcd_cfg->queue_timelimit <= 0))
+    return 0;
+  pthread_mutex_lock(&connqueue_mutex);
+  if ((nslcd_idlethreads == 0) && (nslcd_nthreads >= nslcd_cfg->threads_max) &&
+      (connqueue_len > 0))
+  {
+    if ((nslcd_cfg->queue_limit > 0) &&
+        (connqueue_len >= nslcd_cfg->queue_limit))
+      overloaded = 1;
+    if ((nslcd_cfg->queue_timelimit > 0) &&
+        (connqueue[connqueue_first]->queued + nslcd_cfg->queue_timelimit <=
+         time(NULL)))
+      overloaded = 1;
+  }
+  pthread_mutex_unlock(&connqueue_mutex);
+  return overloaded;
+}
+
+/* pass the connection to the thread that handles requests while the
+   workers are overloaded, if that thread cannot keep up the connection is
+   closed */
+static void shedqueue_put(struct nslcd_client *client)
+{
+  pthread_mutex_lock(&shedqueue_mutex);
+  if (shedqueue_len >= CONNQUEUE_SIZE)
+  {
+    pthread_mutex_unlock(&shedqueue_mutex);
+    log_log(LOG_DEBUG, "overloaded, connection closed");
+    client_close(client);
+    return;
+  }
+  client->next = NULL;
+  if (shedqueue_last != NULL)
+    shedqueue_last->next = client;
+  else
+    shedqueue_first = client;
+  shedqueue_last = client;
+  shedqueue_len++;
+  shedqueue_total++;
+  pthread_cond_signal(&shedqueue_notempty);
+  pthread_mutex_unlock(&shedqueue_mutex);
+}
+
+/* queue the connection for the workers or, when they are overloaded, for
+   the thread that responds without doing LDAP searches */
+static void client_dispatch(struct nslcd_client *client)
+{
+  if (nslcd_shedding && connqueue_overloaded())
+    shedqueue_put(client);
+  else
+    connqueue_put(client);
+}
+
+static void shedqueue_cleanup(void UNUSED(*arg))
+{
+  pthread_mutex_unlock(&shedqueue_mutex);
+}
+
+/* the thread that answers requests from the cache or tells clients to
+   try again later while the workers are overloaded, the connection is
+   always closed afterwards, authentication requests are handed back to
+   the workers (in front of the queue) instead, only clients that kept
+   the connection open for another request (which older clients do not
+   do) are expected to understand NSLCD_RESULT_TRYAGAIN */
+static void *shedder(void UNUSED(*arg))
+{
+  struct nslcd_client *client;
+  int32_t action;
+  int tryagain;
+  while (1)
+  {
+    pthread_mutex_lock(&shedqueue_mutex);
+    pthread_cleanup_push(shedqueue_cleanup, NULL);
+    while (shedqueue_first == NULL)
+      pthread_cond_wait(&shedqueue_notempty, &shedqueue_mutex);
+    client = shedqueue_first;
+    shedqueue_first = client->next;
+    if (shedqueue_first == NULL)
+      shedqueue_last = NULL;
+    client->next = NULL;
+    shedqueue_len--;
+    pthread_cleanup_pop(1);
+    tryagain = (client->fp != NULL);
+    if (client_setup(client))
+      continue;
+    log_newsession();
+    /* do not wait long for the request */
+    tio_setreadtimeout(client->fp, SHED_READ_TIMEOUT);
+    if (read_header(client->fp, &action))
+    {
+      log_clearsession();
+      client_close(client);
+      continue;
+    }
+    if (request_class(action) == RC_AUTHENTICATION)
+    {
+      log_log(LOG_DEBUG, "overloaded, request 0x%08x passed to workers",
+              (int)action);
+      log_clearsession();
+      tio_setreadtimeout(client->fp, READ_TIMEOUT);
+      /* the header was read so the worker continues with the request */
+      if (reqclass_enter(client, action))
+      {
+        client->delayed = 1;
+        client->action = action;
+        connqueue_requeue(client);
+      }
+      continue;
+    }
+    if (handlerequest_overloaded(client->fp, client->uid, action,
+                                 tryagain) == 0)
+    {
+      if (tio_flush(client->fp) < 0)
+        log_log(LOG_DEBUG, "error writing to client: %s", strerror(errno));
+      log_clearsession();
+      client_close(client);
+      continue;
+    }
+    /* close the connection without writing anything that was buffered */
+    log_clearsession();
+    tio_free(client->fp);
+    client->fp = NULL;
+    client_close(client);
+  }
+  return NULL;
+}
+
+/* accept a single connection on the server socket, returns -1 if no
+   connection is available (or an error occurred) */
+static int accept_connection(void)
 {
-  MYLDAP_SESSION *session;
   int csock;
-  int j;
   struct sockaddr_storage addr;
   socklen_t alen;
+#ifndef HAVE_ACCEPT4
+  int j;
+#endif /* not HAVE_ACCEPT4 */
+  alen = (socklen_t)sizeof(struct sockaddr_storage);
+#ifdef HAVE_ACCEPT4
+  /* the new socket is blocking and not inherited by child processes */
+  csock = accept4(nslcd_serversocket, (struct sockaddr *)&addr, &alen,
+                  SOCK_CLOEXEC);
+#else /* not HAVE_ACCEPT4 */
+  csock = accept(nslcd_serversocket, (struct sockaddr *)&addr, &alen);
+#endif /* not HAVE_ACCEPT4 */
+  if (csock < 0)
+  {
+    if (errno == EINTR)
+      log_log(LOG_DEBUG, "accept() failed (ignored): %s", strerror(errno));
+    else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      log_log(LOG_ERR, "accept() failed: %s", strerror(errno));
+    return -1;
+  }
+#ifndef HAVE_ACCEPT4
+  /* make sure O_NONBLOCK is not inherited */
+  if ((j = fcntl(csock, F_GETFL, 0)) < 0)
+  {
+    log_log(LOG_ERR, "fctnl(F_GETFL) failed: %s", strerror(errno));
+    if (close(csock))
+      log_log(LOG_WARNING, "problem closing socket: %s", strerror(errno));
+    return -1;
+  }
+  if (fcntl(csock, F_SETFL, j & ~O_NONBLOCK) < 0)
+  {
+    log_log(LOG_ERR, "fctnl(F_SETFL,~O_NONBLOCK) failed: %s", strerror(errno));
+    if (close(csock))
+      log_log(LOG_WARNING, "problem closing socket: %s", strerror(errno));
+    return -1;
+  }
+  /* close the file descriptor on exec */
+  if (fcntl(csock, F_SETFD, FD_CLOEXEC) < 0)
+    log_log(LOG_WARNING, "fctnl(F_SETFD,FD_CLOEXEC) failed (ignored): %s",
+            strerror(errno));
+#endif /* not HAVE_ACCEPT4 */
+  return csock;
+}
+
+/* accept all pending connections and queue them for the workers */
+static void accept_connections(void)
+{
+  struct nslcd_client *client;
+  int csock;
+  while ((csock = accept_connection()) >= 0)
+  {
+    client = (struct nslcd_client *)malloc(sizeof(struct nslcd_client));
+    if (client == NULL)
+    {
+      log_log(LOG_CRIT, "accept_connections(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    client->sock = csock;
+    client->fp = NULL;
+    client->uid = (uid_t)-1;
+    client->lastused = 0;
+    client->registered = 0;
+    client->delayed = 0;
+    client->action = 0;
+    client->queued = 0;
+    client->prev = NULL;
+    client->next = NULL;
+    client_dispatch(client);
+  }
+}
+
+/* the single thread that waits for incoming connections, accepts them and
+   passes them on to the worker threads (this avoids waking all idle
+   workers for every connection), this also waits for further requests
+   on connections that are kept open */
+static void *acceptor(void UNUSED(*arg))
+{
+  int j;
+#ifdef HAVE_EPOLL_CREATE1
+  struct epoll_event events[16];
+  struct nslcd_client *client;
+  int i;
+#else /* not HAVE_EPOLL_CREATE1 */
   fd_set fds;
-  struct timeval tv;
-  /* create a new LDAP session */
-  session = myldap_create_session();
-  /* clean up the session if we're done */
-  pthread_cleanup_push(worker_cleanup, session);
-  /* start waiting for incoming connections */
+#endif /* not HAVE_EPOLL_CREATE1 */
   while (1)
   {
-    /* time out connection to LDAP server if needed */
-    myldap_session_check(session);
-    /* set up the set of fds to wait on */
+    /* wait for a new connection */
+#ifdef HAVE_EPOLL_CREATE1
+    /* wake up every second to close idle connections */
+    j = epoll_wait(nslcd_epollfd, events, 16, 1000);
+#else /* not HAVE_EPOLL_CREATE1 */
     FD_ZERO(&fds);
     FD_SET(nslcd_serversocket, &fds);
-    /* set up our timeout value */
-    tv.tv_sec = nslcd_cfg->idle_timelimit;
-    tv.tv_usec = 0;
-    /* wait for a new connection */
-    j = select(nslcd_serversocket + 1, &fds, NULL, NULL,
-               nslcd_cfg->idle_timelimit > 0 ? &tv : NULL);
-    /* check result of select() */
+    j = select(nslcd_serversocket + 1, &fds, NULL, NULL, NULL);
+#endif /* not HAVE_EPOLL_CREATE1 */
     if (j < 0)
     {
       if (errno == EINTR)
-        log_log(LOG_DEBUG, "select() failed (ignored): %s", strerror(errno));
+        log_log(LOG_DEBUG, "waiting for connections failed (ignored): %s",
+                strerror(errno));
       else
-        log_log(LOG_ERR, "select() failed: %s", strerror(errno));
+        log_log(LOG_ERR, "waiting for connections failed: %s",
+                strerror(errno));
       continue;
     }
-    /* see if our file descriptor is actually ready */
-    if (!FD_ISSET(nslcd_serversocket, &fds))
-      continue;
-    /* wait for a new connection */
-    alen = (socklen_t)sizeof(struct sockaddr_storage);
-    csock = accept(nslcd_serversocket, (struct sockaddr *)&addr, &alen);
-    if (csock < 0)
+#ifdef HAVE_EPOLL_CREATE1
+    for (i = 0; i < j; i++)
     {
-      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
-        log_log(LOG_DEBUG, "accept() failed (ignored): %s", strerror(errno));
+      client = (struct nslcd_client *)events[i].data.ptr;
+      if (client == NULL)
+      {
+        accept_connections();
+        continue;
+      }
+      pthread_mutex_lock(&idleclients_mutex);
+      idleclients_remove(client);
+      pthread_mutex_unlock(&idleclients_mutex);
+      /* close the connection if the client did, otherwise handle the
+         next request */
+      if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        client_close(client);
       else
-        log_log(LOG_ERR, "accept() failed: %s", strerror(errno));
-      continue;
+        client_dispatch(client);
     }
-    /* make sure O_NONBLOCK is not inherited */
-    if ((j = fcntl(csock, F_GETFL, 0)) < 0)
+    idleclients_expire();
+#else /* not HAVE_EPOLL_CREATE1 */
+    if (j > 0)
+      accept_connections();
+#endif /* not HAVE_EPOLL_CREATE1 */
+  }
+  return NULL;
+}
+
+static void *worker(void *arg)
+{
+  struct worker_thread *thread = (struct worker_thread *)arg;
+  MYLDAP_SESSION *session;
+  struct nslcd_client *client;
+  time_t deadline, pooldeadline;
+  time_t lastused, stoptime;
+  /* create a new LDAP session */
+  session = myldap_create_session();
+  /* clean up the session if we're done */
+  pthread_cleanup_push(worker_cleanup, session);
+  time(&lastused);
+  /* start waiting for incoming connections */
+  while (1)
+  {
+    /* time out connection to LDAP server if needed, this also tells us
+       when the session needs to be checked again */
+    deadline = myldap_session_check(session);
+    /* pooled connections are also closed when idle for too long */
+    pooldeadline = myldap_pool_check();
+    if ((pooldeadline != 0) && ((deadline == 0) || (pooldeadline < deadline)))
+      deadline = pooldeadline;
+    /* threads above the minimum are stopped when idle for too long */
+    stoptime = 0;
+    if ((nslcd_cfg->threads_max > nslcd_cfg->threads) &&
+        (nslcd_cfg->thread_idle_timelimit > 0))
     {
-      log_log(LOG_ERR, "fctnl(F_GETFL) failed: %s", strerror(errno));
-      if (close(csock))
-        log_log(LOG_WARNING, "problem closing socket: %s", strerror(errno));
-      continue;
+      stoptime = lastused + nslcd_cfg->thread_idle_timelimit;
+      if ((deadline == 0) || (stoptime < deadline))
+        deadline = stoptime;
     }
-    if (fcntl(csock, F_SETFL, j & ~O_NONBLOCK) < 0)
+    /* wait for a connection from the acceptor thread */
+    connqueue_get(deadline, &client);
+    if (client == NULL)
     {
-      log_log(LOG_ERR, "fctnl(F_SETFL,~O_NONBLOCK) failed: %s", strerror(errno));
-      if (close(csock))
-        log_log(LOG_WARNING, "problem closing socket: %s", strerror(errno));
+      if ((stoptime != 0) && (time(NULL) >= stoptime) && stop_worker(thread))
+        break;
       continue;
     }
-    /* indicate new connection to logging module (generates unique id) */
-    log_newsession();
-    /* handle the connection */
-    handleconnection(csock, session);
-    /* indicate end of session in log messages */
-    log_clearsession();
+    /* handle the request(s) on the connection */
+    handleconnection(client, session);
+    time(&lastused);
   }
   pthread_cleanup_pop(1);
   return NULL;
 }
 
+/* log information about the state of the daemon */
+static void log_statistics(void)
+{
+  int nthreads, idlethreads, queued, delayed;
+  long shed;
+  pthread_mutex_lock(&connqueue_mutex);
+  nthreads = nslcd_nthreads;
+  idlethreads = nslcd_idlethreads;
+  queued = connqueue_len;
+  pthread_mutex_unlock(&connqueue_mutex);
+  pthread_mutex_lock(&reqclass_mutex);
+  delayed = reqclass_waiting;
+  pthread_mutex_unlock(&reqclass_mutex);
+  pthread_mutex_lock(&shedqueue_mutex);
+  shed = shedqueue_total;
+  pthread_mutex_unlock(&shedqueue_mutex);
+  log_log(LOG_INFO, "worker threads: %d running (%d idle, minimum %d, maximum %d), "
+          "%d connections queued, %d requests delayed, "
+          "%ld connections handled while overloaded", nthreads, idlethreads,
+          nslcd_cfg->threads, nslcd_cfg->threads_max, queued, delayed, shed);
+  dn2uid_log_statistics();
+}
+
 /* function to disable lookups through the nss_ldap module to avoid lookup
    loops */
 static void disable_nss_ldap(void)
@@ -702,6 +1536,9 @@ int main(int argc, char *argv[])
 #ifdef HAVE_PTHREAD_TIMEDJOIN_NP
   struct timespec ts;
 #endif /* HAVE_PTHREAD_TIMEDJOIN_NP */
+#ifdef HAVE_EPOLL_CREATE1
+  struct epoll_event event;
+#endif /* HAVE_EPOLL_CREATE1 */
   /* block all these signals so our worker threads won't handle them */
   sigemptyset(&signalmask);
   sigaddset(&signalmask, SIGHUP);
@@ -857,25 +1694,72 @@ int main(int argc, char *argv[])
   }
   /* create socket */
   nslcd_serversocket = create_socket(NSLCD_SOCKET);
+  /* set up the cache that is shared with the NSS module */
+  if (cache_shm_open())
+    log_log(LOG_WARNING, "shared cache not available (ignored)");
+#ifdef HAVE_EPOLL_CREATE1
+  /* set up epoll to wait for incoming connections */
+  if ((nslcd_epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+  {
+    log_log(LOG_ERR, "epoll_create1() failed: %s", strerror(errno));
+    daemonize_ready(EXIT_FAILURE, "epoll_create1() failed\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl(nslcd_epollfd, EPOLL_CTL_ADD, nslcd_serversocket, &event) < 0)
+  {
+    log_log(LOG_ERR, "epoll_ctl() failed: %s", strerror(errno));
+    daemonize_ready(EXIT_FAILURE, "epoll_ctl() failed\n");
+    exit(EXIT_FAILURE);
+  }
+#endif /* HAVE_EPOLL_CREATE1 */
   /* start worker threads */
   log_log(LOG_INFO, "accepting connections");
-  nslcd_threads = (pthread_t *)malloc(nslcd_cfg->threads * sizeof(pthread_t));
+  nslcd_threads = (struct worker_thread *)malloc(nslcd_cfg->threads_max * sizeof(struct worker_thread));
   if (nslcd_threads == NULL)
   {
     log_log(LOG_CRIT, "main(): malloc() failed to allocate memory");
     daemonize_ready(EXIT_FAILURE, "malloc() failed to allocate memory\n");
     exit(EXIT_FAILURE);
   }
+  for (i = 0; i < nslcd_cfg->threads_max; i++)
+    nslcd_threads[i].running = 0;
+  pthread_mutex_lock(&connqueue_mutex);
   for (i = 0; i < nslcd_cfg->threads; i++)
   {
-    if (pthread_create(&nslcd_threads[i], NULL, worker, NULL))
+    if (start_worker())
     {
-      log_log(LOG_ERR, "unable to start worker thread %d: %s",
-              i, strerror(errno));
       daemonize_ready(EXIT_FAILURE, "unable to start worker thread\n");
       exit(EXIT_FAILURE);
     }
   }
+  pthread_mutex_unlock(&connqueue_mutex);
+  /* start the thread that checks failing LDAP servers */
+  if (myldap_prober_start())
+  {
+    daemonize_ready(EXIT_FAILURE, "unable to start prober thread\n");
+    exit(EXIT_FAILURE);
+  }
+  /* start the thread that handles requests while the workers are busy */
+  if ((nslcd_cfg->queue_limit > 0) || (nslcd_cfg->queue_timelimit > 0))
+  {
+    if (pthread_create(&nslcd_shedthread, NULL, shedder, NULL))
+    {
+      log_log(LOG_ERR, "unable to start overload thread: %s", strerror(errno));
+      daemonize_ready(EXIT_FAILURE, "unable to start overload thread\n");
+      exit(EXIT_FAILURE);
+    }
+    nslcd_shedding = 1;
+  }
+  /* start the thread that accepts connections */
+  if (pthread_create(&nslcd_acceptthread, NULL, acceptor, NULL))
+  {
+    log_log(LOG_ERR, "unable to start acceptor thread: %s", strerror(errno));
+    daemonize_ready(EXIT_FAILURE, "unable to start acceptor thread\n");
+    exit(EXIT_FAILURE);
+  }
   /* install signal handlers for some signals */
   install_sighandler(SIGHUP, sig_handler);
   install_sighandler(SIGINT, sig_handler);
@@ -884,13 +1768,14 @@ int main(int argc, char *argv[])
   install_sighandler(SIGPIPE, SIG_IGN);
   install_sighandler(SIGTERM, sig_handler);
   install_sighandler(SIGUSR1, sig_handler);
-  install_sighandler(SIGUSR2, SIG_IGN);
+  install_sighandler(SIGUSR2, sig_handler);
   /* signal the starting process to exit because we can provide services now */
   daemonize_ready(EXIT_SUCCESS, NULL);
   /* enable receiving of signals */
   pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
   /* wait until we received a signal */
-  while ((nslcd_receivedsignal == 0) || (nslcd_receivedsignal == SIGUSR1))
+  while ((nslcd_receivedsignal == 0) || (nslcd_receivedsignal == SIGUSR1) ||
+         (nslcd_receivedsignal == SIGUSR2))
   {
     sleep(INT_MAX); /* sleep as long as we can or until we receive a signal */
     if (nslcd_receivedsignal == SIGUSR1)
@@ -900,15 +1785,31 @@ int main(int argc, char *argv[])
       myldap_immediate_reconnect();
       nslcd_receivedsignal = 0;
     }
+    else if (nslcd_receivedsignal == SIGUSR2)
+    {
+      log_log(LOG_INFO, "caught signal %s (%d), logging statistics",
+              signame(nslcd_receivedsignal), nslcd_receivedsignal);
+      log_statistics();
+      nslcd_receivedsignal = 0;
+    }
   }
   /* print something about received signal */
   log_log(LOG_INFO, "caught signal %s (%d), shutting down",
           signame(nslcd_receivedsignal), nslcd_receivedsignal);
   /* cancel all running threads */
-  for (i = 0; i < nslcd_cfg->threads; i++)
-    if (pthread_cancel(nslcd_threads[i]))
+  pthread_mutex_lock(&connqueue_mutex);
+  nslcd_shuttingdown = 1;
+  if (pthread_cancel(nslcd_acceptthread))
+    log_log(LOG_WARNING, "failed to stop acceptor thread (ignored): %s",
+            strerror(errno));
+  if (nslcd_shedding && pthread_cancel(nslcd_shedthread))
+    log_log(LOG_WARNING, "failed to stop overload thread (ignored): %s",
+            strerror(errno));
+  for (i = 0; i < nslcd_cfg->threads_max; i++)
+    if (nslcd_threads[i].running && pthread_cancel(nslcd_threads[i].thread))
       log_log(LOG_WARNING, "failed to stop thread %d (ignored): %s",
               i, strerror(errno));
+  pthread_mutex_unlock(&connqueue_mutex);
   /* close server socket to trigger failures in threads waiting on accept() */
   close(nslcd_serversocket);
   /* if we can, wait a few seconds for the threads to finish */
@@ -916,17 +1817,19 @@ int main(int argc, char *argv[])
   ts.tv_sec = time(NULL) + 3;
   ts.tv_nsec = 0;
 #endif /* HAVE_PTHREAD_TIMEDJOIN_NP */
-  for (i = 0; i < nslcd_cfg->threads; i++)
+  for (i = 0; i < nslcd_cfg->threads_max; i++)
   {
+    if (!nslcd_threads[i].running)
+      continue;
 #ifdef HAVE_PTHREAD_TIMEDJOIN_NP
-    if (pthread_timedjoin_np(nslcd_threads[i], NULL, &ts) == -1) {
+    if (pthread_timedjoin_np(nslcd_threads[i].thread, NULL, &ts) == -1) {
       if (errno != EBUSY)
         log_log(LOG_ERR, "thread %d cannot be joined (ignoring): %s", i,
                 strerror(errno));
       log_log(LOG_ERR, "thread %d is still running, shutting down anyway", i);
     }
 #else
-    if (pthread_kill(nslcd_threads[i], 0) == 0)
+    if (pthread_kill(nslcd_threads[i].thread, 0) == 0)
       log_log(LOG_ERR, "thread %d is still running, shutting down anyway", i);
 #endif /* HAVE_PTHREAD_TIMEDJOIN_NP */
   }
@@ -30,14 +30,20 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
 #include <pthread.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif /* HAVE_STDINT_H */
 
 #include "common.h"
 #include "log.h"
 #include "myldap.h"
 #include "cfg.h"
 #include "attmap.h"
-#include "common/dict.h"
+#include "common/set.h"
 #include "compat/strndup.h"
 
 /* ( nisSchema.2.0 NAME 'posixAccount' SUP top AUXILIARY
@@ -63,6 +69,8 @@ const char *attmap_passwd_gidNumber     = "gidNumber";
 const char *attmap_passwd_gecos         = "\"${gecos:-$cn}\"";
 const char *attmap_passwd_homeDirectory = "homeDirectory";
 const char *attmap_passwd_loginShell    = "loginShell";
+const char *attmap_passwd_memberOf      = "\"\"";
+const char *attmap_passwd_tokenGroups   = "\"\"";
 
 /* special properties for objectSid-based searches
    (these are already LDAP-escaped strings) */
@@ -99,23 +107,95 @@ static int mkfilter_passwd_byname(const char *name,
                     passwd_filter, attmap_passwd_uid, safename);
 }
 
-/* create a search filter for searching a passwd entry
-   by uid, return -1 on errors */
-static int mkfilter_passwd_byuid(uid_t uid, char *buffer, size_t buflen)
+/* create a filter term that matches the uidNumber attribute with
+   the specified uid, return -1 on errors */
+static int mkterm_passwd_byuid(uid_t uid, char *buffer, size_t buflen)
 {
   uid -= nslcd_cfg->nss_uid_offset;
   if (uidSid != NULL)
   {
-    return mysnprintf(buffer, buflen, "(&%s(%s=%s\\%02x\\%02x\\%02x\\%02x))",
-                      passwd_filter, attmap_passwd_uidNumber, uidSid,
+    return mysnprintf(buffer, buflen, "(%s=%s\\%02x\\%02x\\%02x\\%02x)",
+                      attmap_passwd_uidNumber, uidSid,
                       (int)(uid & 0xff), (int)((uid >> 8) & 0xff),
                       (int)((uid >> 16) & 0xff), (int)((uid >> 24) & 0xff));
   }
   else
   {
-    return mysnprintf(buffer, buflen, "(&%s(%s=%lu))",
-                      passwd_filter, attmap_passwd_uidNumber, (unsigned long int)uid);
+    return mysnprintf(buffer, buflen, "(%s=%lu)",
+                      attmap_passwd_uidNumber, (unsigned long int)uid);
+  }
+}
+
+/* create a search filter for searching a passwd entry
+   by uid, return -1 on errors */
+static int mkfilter_passwd_byuid(uid_t uid, char *buffer, size_t buflen)
+{
+  char term[BUFLEN_SAFENAME];
+  if (mkterm_passwd_byuid(uid, term, sizeof(term)))
+    return -1;
+  return mysnprintf(buffer, buflen, "(&%s%s)", passwd_filter, term);
+}
+
+/* create a search filter for searching a number of passwd entries
+   by name, return the number of names that fit in the filter or
+   -1 on errors */
+static int mkfilter_passwd_bynames(const char **names,
+                                   char *buffer, size_t buflen)
+{
+  char safename[BUFLEN_SAFENAME];
+  size_t len;
+  int i;
+  if (mysnprintf(buffer, buflen, "(&%s(|", passwd_filter))
+    return -1;
+  for (i = 0; names[i] != NULL; i++)
+  {
+    /* escape attribute */
+    if (myldap_escape(names[i], safename, sizeof(safename)))
+    {
+      log_log(LOG_ERR, "mkfilter_passwd_bynames(): safename buffer too small");
+      return -1;
+    }
+    /* add the term while leaving room for closing the filter */
+    len = strlen(buffer);
+    if ((len + 3 > buflen) ||
+        mysnprintf(buffer + len, buflen - len - 2, "(%s=%s)",
+                   attmap_passwd_uid, safename))
+    {
+      buffer[len] = '\0';
+      break;
+    }
   }
+  if (i == 0)
+    return -1;
+  strcat(buffer, "))");
+  return i;
+}
+
+/* create a search filter for searching a number of passwd entries
+   by uid, return the number of uids that fit in the filter or -1 on
+   errors */
+static int mkfilter_passwd_byuids(const uid_t *uids, int numuids,
+                                  char *buffer, size_t buflen)
+{
+  size_t len;
+  int i;
+  if (mysnprintf(buffer, buflen, "(&%s(|", passwd_filter))
+    return -1;
+  for (i = 0; i < numuids; i++)
+  {
+    /* add the term while leaving room for closing the filter */
+    len = strlen(buffer);
+    if ((len + 3 > buflen) ||
+        mkterm_passwd_byuid(uids[i], buffer + len, buflen - len - 2))
+    {
+      buffer[len] = '\0';
+      break;
+    }
+  }
+  if (i == 0)
+    return -1;
+  strcat(buffer, "))");
+  return i;
 }
 
 void passwd_init(void)
@@ -159,14 +239,192 @@ void passwd_init(void)
   set_free(set);
 }
 
-/* the cache that is used in dn2uid() */
-static pthread_mutex_t dn2uid_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
-static DICT *dn2uid_cache = NULL;
+/* the cache that is used in dn2uid(), it is split into shards with their
+   own lock and each shard holds a fixed number of entries that are
+   replaced using the CLOCK algorithm */
+#define DN2UID_CACHE_SHARDS 16
+
 struct dn2uid_cache_entry {
+  struct dn2uid_cache_entry *next;  /* next entry in the hash chain */
+  uint32_t hash;
   time_t timestamp;
-  char *uid;
+  int referenced;  /* set on use, cleared when the clock hand passes */
+  char *uid;       /* NULL for negative entries */
+  char dn[1];      /* the key, allocated with the entry */
 };
 
+struct dn2uid_cache_shard {
+  pthread_mutex_t mutex;
+  struct dn2uid_cache_entry **table;  /* hash chains */
+  struct dn2uid_cache_entry **slots;  /* all entries in clock order */
+  int size;   /* the number of slots (and hash chains) */
+  int num;    /* the number of slots in use */
+  int hand;   /* the next slot to consider for replacement */
+  unsigned long hits, misses, evictions;
+};
+
+static struct dn2uid_cache_shard dn2uid_cache[DN2UID_CACHE_SHARDS];
+static pthread_once_t dn2uid_cache_once = PTHREAD_ONCE_INIT;
+
+static void dn2uid_cache_init(void)
+{
+  struct dn2uid_cache_shard *shard;
+  int i, size;
+  size = (nslcd_cfg->cache_dn2uid_size + DN2UID_CACHE_SHARDS - 1) /
+         DN2UID_CACHE_SHARDS;
+  for (i = 0; i < DN2UID_CACHE_SHARDS; i++)
+  {
+    shard = &dn2uid_cache[i];
+    pthread_mutex_init(&shard->mutex, NULL);
+    shard->table = (struct dn2uid_cache_entry **)
+                   calloc(size, sizeof(struct dn2uid_cache_entry *));
+    shard->slots = (struct dn2uid_cache_entry **)
+                   calloc(size, sizeof(struct dn2uid_cache_entry *));
+    if ((shard->table == NULL) || (shard->slots == NULL))
+    {
+      log_log(LOG_CRIT, "dn2uid_cache_init(): malloc() failed to allocate memory");
+      exit(EXIT_FAILURE);
+    }
+    shard->size = size;
+    shard->num = 0;
+    shard->hand = 0;
+    shard->hits = shard->misses = shard->evictions = 0;
+  }
+}
+
+/* calculate the hash of the DN (FNV-1a) */
+static uint32_t dn2uid_cache_hash(const char *dn)
+{
+  uint32_t hash = 2166136261U;
+  while (*dn != '\0')
+    hash = (hash ^ (uint8_t)*dn++) * 16777619U;
+  return hash;
+}
+
+/* find the entry for the DN in the shard, the caller should hold the lock */
+static struct dn2uid_cache_entry *dn2uid_cache_find(
+          struct dn2uid_cache_shard *shard, uint32_t hash, const char *dn)
+{
+  struct dn2uid_cache_entry *entry;
+  for (entry = shard->table[(hash / DN2UID_CACHE_SHARDS) % shard->size];
+       entry != NULL; entry = entry->next)
+    if ((entry->hash == hash) && (strcmp(entry->dn, dn) == 0))
+      return entry;
+  return NULL;
+}
+
+/* remove the entry from the hash chain and free it, the caller should hold
+   the lock */
+static void dn2uid_cache_remove(struct dn2uid_cache_shard *shard,
+                                struct dn2uid_cache_entry *entry)
+{
+  struct dn2uid_cache_entry **prev;
+  for (prev = &shard->table[(entry->hash / DN2UID_CACHE_SHARDS) % shard->size];
+       *prev != NULL; prev = &(*prev)->next)
+  {
+    if (*prev == entry)
+    {
+      *prev = entry->next;
+      break;
+    }
+  }
+  if (entry->uid != NULL)
+    free(entry->uid);
+  free(entry);
+}
+
+/* return a free slot in the shard, evicting the first entry that the
+   clock hand finds that was not used since the hand last passed, the
+   caller should hold the lock */
+static int dn2uid_cache_slot(struct dn2uid_cache_shard *shard)
+{
+  struct dn2uid_cache_entry *entry;
+  int slot;
+  if (shard->num < shard->size)
+    return shard->num++;
+  while (1)
+  {
+    slot = shard->hand;
+    shard->hand = (shard->hand + 1) % shard->size;
+    entry = shard->slots[slot];
+    if (!entry->referenced)
+      break;
+    entry->referenced = 0;
+  }
+  dn2uid_cache_remove(shard, entry);
+  shard->slots[slot] = NULL;
+  shard->evictions++;
+  return slot;
+}
+
+/* store the result of the lookup in the cache */
+static void dn2uid_cache_put(struct dn2uid_cache_shard *shard, uint32_t hash,
+                             const char *dn, const char *uid, time_t now)
+{
+  struct dn2uid_cache_entry *entry;
+  size_t len;
+  int slot;
+  char *tmp = NULL;
+  if ((uid != NULL) && ((tmp = strdup(uid)) == NULL))
+  {
+    log_log(LOG_CRIT, "dn2uid_cache_put(): strdup() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&shard->mutex);
+  /* the entry could have been added in the meantime */
+  entry = dn2uid_cache_find(shard, hash, dn);
+  if (entry != NULL)
+  {
+    if (entry->uid != NULL)
+      free(entry->uid);
+    entry->uid = tmp;
+    entry->timestamp = now;
+    pthread_mutex_unlock(&shard->mutex);
+    return;
+  }
+  len = strlen(dn);
+  entry = (struct dn2uid_cache_entry *)malloc(sizeof(struct dn2uid_cache_entry) + len);
+  if (entry == NULL)
+  {
+    log_log(LOG_CRIT, "dn2uid_cache_put(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(entry->dn, dn, len + 1);
+  entry->hash = hash;
+  entry->timestamp = now;
+  entry->referenced = 0;
+  entry->uid = tmp;
+  slot = dn2uid_cache_slot(shard);
+  shard->slots[slot] = entry;
+  entry->next = shard->table[(hash / DN2UID_CACHE_SHARDS) % shard->size];
+  shard->table[(hash / DN2UID_CACHE_SHARDS) % shard->size] = entry;
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+void dn2uid_log_statistics(void)
+{
+  struct dn2uid_cache_shard *shard;
+  unsigned long hits = 0, misses = 0, evictions = 0;
+  int i, num = 0;
+  if ((nslcd_cfg->cache_dn2uid_positive == 0) &&
+      (nslcd_cfg->cache_dn2uid_negative == 0))
+    return;
+  pthread_once(&dn2uid_cache_once, dn2uid_cache_init);
+  for (i = 0; i < DN2UID_CACHE_SHARDS; i++)
+  {
+    shard = &dn2uid_cache[i];
+    pthread_mutex_lock(&shard->mutex);
+    num += shard->num;
+    hits += shard->hits;
+    misses += shard->misses;
+    evictions += shard->evictions;
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  log_log(LOG_INFO, "dn2uid cache: %d entries (maximum %d), %lu hits, "
+          "%lu misses, %lu evictions", num,
+          dn2uid_cache[0].size * DN2UID_CACHE_SHARDS, hits, misses, evictions);
+}
+
 /* checks whether the entry has a valid uidNumber attribute
    (>= nss_min_uid) */
 static int entry_has_valid_uid(MYLDAP_ENTRY *entry)
@@ -179,7 +437,7 @@ static int entry_has_valid_uid(MYLDAP_ENTRY *entry)
   if (nslcd_cfg->nss_min_uid == 0)
     return 1;
   /* get all uidNumber attributes */
-  values = myldap_get_values_len(entry, attmap_passwd_uidNumber);
+  values = myldap_get_values_len(entry, attmap_passwd_uidNumber, NULL);
   if ((values == NULL) || (values[0] == NULL))
   {
     log_log(LOG_WARNING, "%s: %s: missing",
@@ -268,98 +526,343 @@ char *lookup_dn2uid(MYLDAP_SESSION *session, const char *dn, int *rcp,
   return uid;
 }
 
-/* Translate the DN into a user name. This function tries several approaches
-   at getting the user name, including looking in the DN for a uid attribute,
-   looking in the cache and falling back to looking up a uid attribute in a
-   LDAP query. */
-char *dn2uid(MYLDAP_SESSION *session, const char *dn, char *buf, size_t buflen)
+/* try to translate the DN into a user name without doing an LDAP search
+   by looking in the DN for a uid attribute or looking in the cache,
+   returns 0 if an LDAP search is needed and otherwise stores the result
+   (buf or NULL) in uid */
+static int dn2uid_nosearch(const char *dn, char *buf, size_t buflen,
+                           char **uid)
 {
-  struct dn2uid_cache_entry *cacheentry = NULL;
-  char *uid;
-  /* check for empty string */
-  if ((dn == NULL) || (*dn == '\0'))
-    return NULL;
+  struct dn2uid_cache_shard *shard;
+  struct dn2uid_cache_entry *cacheentry;
+  uint32_t hash;
+  time_t now;
   /* try to look up uid within DN string */
   if (myldap_cpy_rdn_value(dn, attmap_passwd_uid, buf, buflen) != NULL)
   {
     /* check if it is valid */
-    if (!isvalidname(buf))
-      return NULL;
-    return buf;
+    *uid = isvalidname(buf) ? buf : NULL;
+    return 1;
   }
-  /* if we don't use the cache, just lookup and return */
+  /* check whether we use the cache */
   if ((nslcd_cfg->cache_dn2uid_positive == 0) && (nslcd_cfg->cache_dn2uid_negative == 0))
-    return lookup_dn2uid(session, dn, NULL, buf, buflen);
+    return 0;
   /* see if we have a cached entry */
-  pthread_mutex_lock(&dn2uid_cache_mutex);
-  if (dn2uid_cache == NULL)
-  {
-    dn2uid_cache = dict_new();
-    if (dn2uid_cache == NULL)
-    {
-      log_log(LOG_ERR, "dict_new() failed to allocate memory");
-      pthread_mutex_unlock(&dn2uid_cache_mutex);
-      return NULL;
-    }
-  }
-  if ((cacheentry = dict_get(dn2uid_cache, dn)) != NULL)
+  pthread_once(&dn2uid_cache_once, dn2uid_cache_init);
+  hash = dn2uid_cache_hash(dn);
+  shard = &dn2uid_cache[hash % DN2UID_CACHE_SHARDS];
+  now = time(NULL);
+  pthread_mutex_lock(&shard->mutex);
+  if ((cacheentry = dn2uid_cache_find(shard, hash, dn)) != NULL)
   {
     if ((cacheentry->uid != NULL) && (strlen(cacheentry->uid) < buflen))
     {
       /* positive hit: if the cached entry is still valid, return that */
       if ((nslcd_cfg->cache_dn2uid_positive > 0) &&
-          (time(NULL) < (cacheentry->timestamp + nslcd_cfg->cache_dn2uid_positive)))
+          (now < (cacheentry->timestamp + nslcd_cfg->cache_dn2uid_positive)))
       {
         strcpy(buf, cacheentry->uid);
-        pthread_mutex_unlock(&dn2uid_cache_mutex);
-        return buf;
+        *uid = buf;
+        cacheentry->referenced = 1;
+        shard->hits++;
+        pthread_mutex_unlock(&shard->mutex);
+        return 1;
       }
     }
-    else
+    else if (cacheentry->uid == NULL)
     {
       /* negative hit: if the cached entry is still valid, return that */
       if ((nslcd_cfg->cache_dn2uid_negative > 0) &&
-           (time(NULL) < (cacheentry->timestamp + nslcd_cfg->cache_dn2uid_negative)))
+           (now < (cacheentry->timestamp + nslcd_cfg->cache_dn2uid_negative)))
       {
-        pthread_mutex_unlock(&dn2uid_cache_mutex);
-        return NULL;
+        *uid = NULL;
+        cacheentry->referenced = 1;
+        shard->hits++;
+        pthread_mutex_unlock(&shard->mutex);
+        return 1;
       }
     }
   }
-  pthread_mutex_unlock(&dn2uid_cache_mutex);
+  shard->misses++;
+  pthread_mutex_unlock(&shard->mutex);
+  return 0;
+}
+
+/* store the result of an LDAP lookup of the DN in the cache */
+static void dn2uid_store(const char *dn, const char *uid)
+{
+  uint32_t hash;
+  if ((nslcd_cfg->cache_dn2uid_positive == 0) && (nslcd_cfg->cache_dn2uid_negative == 0))
+    return;
+  pthread_once(&dn2uid_cache_once, dn2uid_cache_init);
+  hash = dn2uid_cache_hash(dn);
+  dn2uid_cache_put(&dn2uid_cache[hash % DN2UID_CACHE_SHARDS], hash, dn, uid,
+                   time(NULL));
+}
+
+/* Translate the DN into a user name. This function tries several approaches
+   at getting the user name, including looking in the DN for a uid attribute,
+   looking in the cache and falling back to looking up a uid attribute in a
+   LDAP query. */
+char *dn2uid(MYLDAP_SESSION *session, const char *dn, char *buf, size_t buflen)
+{
+  char *uid;
+  /* check for empty string */
+  if ((dn == NULL) || (*dn == '\0'))
+    return NULL;
+  if (dn2uid_nosearch(dn, buf, buflen, &uid))
+    return uid;
   /* look up the uid using an LDAP query */
   uid = lookup_dn2uid(session, dn, NULL, buf, buflen);
   /* store the result in the cache */
-  pthread_mutex_lock(&dn2uid_cache_mutex);
-  /* try to get the entry from the cache here again because it could have
-     changed in the meantime */
-  cacheentry = dict_get(dn2uid_cache, dn);
-  if (cacheentry == NULL)
-  {
-    /* allocate a new entry in the cache */
-    cacheentry = (struct dn2uid_cache_entry *)malloc(sizeof(struct dn2uid_cache_entry));
-    if (cacheentry != NULL)
+  dn2uid_store(dn, uid);
+  return uid;
+}
+
+/* split the first RDN of the DN into an attribute name and value, only
+   simple RDNs (single-valued without escaped characters) are supported,
+   returns non-zero if that is not possible */
+static int dn2rdn(const char *dn, char *attr, size_t attrlen,
+                  char *value, size_t valuelen)
+{
+  size_t i, j;
+  for (i = 0; (dn[i] != '=') && (dn[i] != '\0'); i++)
+    if ((!isalnum((unsigned char)dn[i])) && (dn[i] != '-') && (dn[i] != ';'))
+      return -1;
+  if ((i == 0) || (dn[i] != '=') || (i >= attrlen))
+    return -1;
+  for (j = i + 1; (dn[j] != ',') && (dn[j] != '\0'); j++)
+    if ((dn[j] == '\\') || (dn[j] == '+') || (dn[j] == '"'))
+      return -1;
+  if ((j == i + 1) || (j - i - 1 >= valuelen))
+    return -1;
+  memcpy(attr, dn, i);
+  attr[i] = '\0';
+  memcpy(value, dn + i + 1, j - i - 1);
+  value[j - i - 1] = '\0';
+  return 0;
+}
+
+/* create a search filter for searching the passwd entries with the DNs by
+   their RDN, return the number of DNs that fit in the filter (stopping
+   at the first DN with an unsupported RDN) */
+static int mkfilter_passwd_bydns(const char **dns, int numdns,
+                                 char *buffer, size_t buflen)
+{
+  char attr[64];
+  char value[BUFLEN_DN];
+  char safevalue[BUFLEN_SAFEDN];
+  size_t len;
+  int i;
+  if (mysnprintf(buffer, buflen, "(&%s(|", passwd_filter))
+    return 0;
+  for (i = 0; i < numdns; i++)
+  {
+    if (dn2rdn(dns[i], attr, sizeof(attr), value, sizeof(value)) ||
+        myldap_escape(value, safevalue, sizeof(safevalue)))
+      break;
+    /* add the term while leaving room for closing the filter */
+    len = strlen(buffer);
+    if ((len + 3 > buflen) ||
+        mysnprintf(buffer + len, buflen - len - 2, "(%s=%s)", attr, safevalue))
     {
-      cacheentry->uid = NULL;
-      dict_put(dn2uid_cache, dn, cacheentry);
+      buffer[len] = '\0';
+      break;
     }
   }
-  /* update the cache entry */
-  if (cacheentry != NULL)
+  if (i > 0)
+    strcat(buffer, "))");
+  return i;
+}
+
+/* search for the passwd entries that match the filter and add the user
+   names of entries with one of the DNs to uids (entries that are not valid
+   users are added to others), the resolved DNs are marked in found */
+static void dn2uids_search(MYLDAP_SESSION *session, const char *filter,
+                           const char **dns, int numdns, int *found,
+                           SET *uids, SET *others)
+{
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  const char *attrs[3];
+  const char **values;
+  const char *dn, *uid;
+  const char *base;
+  int i, j, rc;
+  attrs[0] = attmap_passwd_uid;
+  attrs[1] = attmap_passwd_uidNumber;
+  attrs[2] = NULL;
+  for (i = 0; (base = passwd_bases[i]) != NULL; i++)
   {
-    cacheentry->timestamp = time(NULL);
-    /* copy the uid if needed */
-    if (cacheentry->uid == NULL)
-      cacheentry->uid = uid != NULL ? strdup(uid) : NULL;
-    else if ((uid == NULL) || (strcmp(cacheentry->uid, uid) != 0))
+    search = myldap_search(session, base, passwd_scope, filter, attrs, &rc);
+    if (search == NULL)
+      return;
+    while ((entry = myldap_get_entry(search, &rc)) != NULL)
     {
-      free(cacheentry->uid);
-      cacheentry->uid = uid != NULL ? strdup(uid) : NULL;
+      dn = myldap_get_dn(entry);
+      for (j = 0; j < numdns; j++)
+        if ((!found[j]) && (strcasecmp(dns[j], dn) == 0))
+          break;
+      if (j >= numdns)
+        continue;
+      found[j] = 1;
+      /* the same checks as in lookup_dn2uid() */
+      uid = NULL;
+      if (entry_has_valid_uid(entry))
+      {
+        values = myldap_get_values(entry, attmap_passwd_uid);
+        if ((values != NULL) && (values[0] != NULL) &&
+            isvalidname(values[0]) && (strlen(values[0]) < BUFLEN_NAME))
+          uid = values[0];
+      }
+      if (uid != NULL)
+        set_add(uids, uid);
+      else if (others != NULL)
+        set_add(others, dns[j]);
+      dn2uid_store(dns[j], uid);
     }
   }
-  pthread_mutex_unlock(&dn2uid_cache_mutex);
-  /* copy the result into the buffer */
-  return uid;
+}
+
+void dn2uids(MYLDAP_SESSION *session, const char **dns, int numdns,
+             SET *uids, SET *others, DICT *usermap)
+{
+  char buf[BUFLEN_NAME];
+  char key[BUFLEN_DN];
+  char filter[BUFLEN_FILTER];
+  const char **pending;
+  int *found;
+  int i, j, n, numpending = 0;
+  char *uid;
+  if (numdns <= 0)
+    return;
+  pending = (const char **)malloc(numdns * sizeof(const char *));
+  found = (int *)malloc(numdns * sizeof(int));
+  if ((pending == NULL) || (found == NULL))
+  {
+    log_log(LOG_CRIT, "dn2uids(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  /* handle the DNs that do not need an LDAP search */
+  for (i = 0; i < numdns; i++)
+  {
+    if ((dns[i] == NULL) || (*dns[i] == '\0'))
+      continue;
+    /* the map contains the users that were found with the passwd search
+       bases and scope, other DNs (e.g. spelled differently) are looked up
+       as usual */
+    if ((usermap != NULL) && (dn2key(dns[i], key, sizeof(key)) == 0) &&
+        ((uid = dict_get(usermap, key)) != NULL))
+      set_add(uids, uid);
+    else if (!dn2uid_nosearch(dns[i], buf, sizeof(buf), &uid))
+      pending[numpending++] = dns[i];
+    else if (uid != NULL)
+      set_add(uids, uid);
+    else if (others != NULL)
+      set_add(others, dns[i]);
+  }
+  /* search for the remaining DNs in batches */
+  for (i = 0; i < numpending; i += n)
+  {
+    n = mkfilter_passwd_bydns(pending + i, numpending - i, filter, sizeof(filter));
+    /* DNs that could not be found with the filter (e.g. because they are
+       not below a passwd search base or are not users) are looked up
+       separately */
+    if (n > 1)
+    {
+      memset(found, 0, n * sizeof(int));
+      dn2uids_search(session, filter, pending + i, n, found, uids, others);
+    }
+    else
+    {
+      n = 1;
+      found[0] = 0;
+    }
+    for (j = 0; j < n; j++)
+    {
+      if (found[j])
+        continue;
+      if (dn2uid(session, pending[i + j], buf, sizeof(buf)) != NULL)
+        set_add(uids, buf);
+      else if (others != NULL)
+        set_add(others, pending[i + j]);
+    }
+  }
+  free(pending);
+  free(found);
+}
+
+DICT *dn2uid_sweep(MYLDAP_SESSION *session)
+{
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  DICT *usermap;
+  const char *attrs[3];
+  const char **values;
+  const char *base;
+  char key[BUFLEN_DN];
+  char *uid;
+  int i, rc = LDAP_SUCCESS, num = 0;
+  attrs[0] = attmap_passwd_uid;
+  attrs[1] = attmap_passwd_uidNumber;
+  attrs[2] = NULL;
+  usermap = dict_new();
+  if (usermap == NULL)
+  {
+    log_log(LOG_CRIT, "dn2uid_sweep(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; (base = passwd_bases[i]) != NULL; i++)
+  {
+    search = myldap_search(session, base, passwd_scope, passwd_filter, attrs, &rc);
+    if (search == NULL)
+    {
+      dn2uid_sweep_free(usermap);
+      return NULL;
+    }
+    while ((entry = myldap_get_entry(search, &rc)) != NULL)
+    {
+      /* the same checks as in lookup_dn2uid() */
+      if ((!entry_has_valid_uid(entry)) ||
+          (dn2key(myldap_get_dn(entry), key, sizeof(key)) != 0) ||
+          (dict_get(usermap, key) != NULL))
+        continue;
+      values = myldap_get_values(entry, attmap_passwd_uid);
+      if ((values == NULL) || (values[0] == NULL) ||
+          (!isvalidname(values[0])) || (strlen(values[0]) >= BUFLEN_NAME))
+        continue;
+      uid = strdup(values[0]);
+      if ((uid == NULL) || dict_put(usermap, key, uid))
+      {
+        log_log(LOG_CRIT, "dn2uid_sweep(): malloc() failed to allocate memory");
+        exit(EXIT_FAILURE);
+      }
+      num++;
+    }
+    if (rc != LDAP_SUCCESS)
+    {
+      dn2uid_sweep_free(usermap);
+      return NULL;
+    }
+  }
+  log_log(LOG_DEBUG, "dn2uid_sweep(): %d users found", num);
+  return usermap;
+}
+
+void dn2uid_sweep_free(DICT *usermap)
+{
+  const char **keys;
+  int i;
+  keys = dict_keys(usermap);
+  if (keys == NULL)
+  {
+    log_log(LOG_CRIT, "dn2uid_sweep_free(): malloc() failed to allocate memory");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; keys[i] != NULL; i++)
+    free(dict_get(usermap, keys[i]));
+  free(keys);
+  dict_free(usermap);
 }
 
 MYLDAP_ENTRY *uid2entry(MYLDAP_SESSION *session, const char *uid, int *rcp)
@@ -368,7 +871,7 @@ MYLDAP_ENTRY *uid2entry(MYLDAP_SESSION *session, const char *uid, int *rcp)
   MYLDAP_ENTRY *entry = NULL;
   const char *base;
   int i;
-  static const char *attrs[3];
+  static const char *attrs[4];
   char filter[BUFLEN_FILTER];
   /* if it isn't a valid username, just bail out now */
   if (!isvalidname(uid))
@@ -381,6 +884,10 @@ MYLDAP_ENTRY *uid2entry(MYLDAP_SESSION *session, const char *uid, int *rcp)
   attrs[0] = attmap_passwd_uid;
   attrs[1] = attmap_passwd_uidNumber;
   attrs[2] = NULL;
+  /* the group memberships are used to find the groups of the user */
+  if (strcmp(attmap_passwd_memberOf, "\"\"") != 0)
+    attrs[2] = attmap_passwd_memberOf;
+  attrs[3] = NULL;
   /* we have to look up the entry */
   mkfilter_passwd_byname(uid, filter, sizeof(filter));
   for (i = 0; (i < NSS_LDAP_CONFIG_MAX_BASES) && ((base = passwd_bases[i]) != NULL); i++)
@@ -467,7 +974,7 @@ static int write_passwd(TFILE *fp, MYLDAP_ENTRY *entry, const char *requser,
   }
   else
   {
-    tmpvalues = myldap_get_values_len(entry, attmap_passwd_uidNumber);
+    tmpvalues = myldap_get_values_len(entry, attmap_passwd_uidNumber, NULL);
     if ((tmpvalues == NULL) || (tmpvalues[0] == NULL))
     {
       log_log(LOG_WARNING, "%s: %s: missing",
@@ -506,7 +1013,7 @@ static int write_passwd(TFILE *fp, MYLDAP_ENTRY *entry, const char *requser,
   /* get the gid for this entry */
   if (gidSid != NULL)
   {
-    tmpvalues = myldap_get_values_len(entry, attmap_passwd_gidNumber);
+    tmpvalues = myldap_get_values_len(entry, attmap_passwd_gidNumber, NULL);
     if ((tmpvalues == NULL) || (tmpvalues[0] == NULL))
     {
       log_log(LOG_WARNING, "%s: %s: missing",
@@ -592,6 +1099,8 @@ NSLCD_HANDLE_UID(
     log_log(LOG_WARNING, "request denied by validnames option");
     return -1;
   }
+  shmkey = name;
+  shmkeylen = strlen(name);
   nsswitch_check_reload();,
   mkfilter_passwd_byname(name, filter, sizeof(filter)),
   write_passwd(fp, entry, name, NULL, calleruid)
@@ -612,6 +1121,8 @@ NSLCD_HANDLE_UID(
     WRITE_INT32(fp, NSLCD_RESULT_END);
     return 0;
   }
+  shmkey = &uid;
+  shmkeylen = sizeof(uid_t);
   nsswitch_check_reload();,
   mkfilter_passwd_byuid(uid, filter, sizeof(filter)),
   write_passwd(fp, entry, NULL, &uid, calleruid)
@@ -625,3 +1136,126 @@ NSLCD_HANDLE_UID(
   (filter = passwd_filter, 0),
   write_passwd(fp, entry, NULL, NULL, calleruid)
 )
+
+/* perform the searches for a single batch filter and write all entries,
+   if names is not NULL only entries for the listed names are written */
+static int passwd_batch_search(TFILE *fp, MYLDAP_SESSION *session,
+                               const char *filter, const char **names,
+                               int numnames, uid_t calleruid)
+{
+  MYLDAP_SEARCH *search;
+  MYLDAP_ENTRY *entry;
+  const char *base;
+  const char **usernames;
+  int rc = LDAP_SUCCESS, i, j, k;
+  for (i = 0; (base = passwd_bases[i]) != NULL; i++)
+  {
+    search = myldap_search(session, base, passwd_scope, filter,
+                           passwd_attrs, NULL);
+    if (search == NULL)
+      return -1;
+    while ((entry = myldap_get_entry(search, &rc)) != NULL)
+    {
+      if (names == NULL)
+      {
+        if (write_passwd(fp, entry, NULL, NULL, calleruid))
+          return -1;
+        continue;
+      }
+      /* only write the user names that were requested */
+      usernames = myldap_get_values(entry, attmap_passwd_uid);
+      if (usernames == NULL)
+        continue;
+      for (j = 0; usernames[j] != NULL; j++)
+      {
+        for (k = 0; (k < numnames) && (STR_CMP(names[k], usernames[j]) != 0); k++)
+          /* nothing */ ;
+        if ((k < numnames) &&
+            write_passwd(fp, entry, usernames[j], NULL, calleruid))
+          return -1;
+      }
+    }
+  }
+  return (rc == LDAP_SUCCESS) ? 0 : -1;
+}
+
+static int do_passwd_bynames(TFILE *fp, MYLDAP_SESSION *session,
+                             const char **names, uid_t calleruid)
+{
+  int32_t tmpint32;
+  char filter[BUFLEN_FILTER];
+  int i, num;
+  /* write the response header */
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, NSLCD_ACTION_PASSWD_BYNAMES);
+  /* do one search per base for as many names as fit in a filter */
+  for (i = 0; names[i] != NULL; i += num)
+  {
+    num = mkfilter_passwd_bynames(names + i, filter, sizeof(filter));
+    if (num <= 0)
+    {
+      log_log(LOG_ERR, "nslcd_passwd_bynames(): filter buffer too small");
+      return -1;
+    }
+    if (passwd_batch_search(fp, session, filter, names + i, num, calleruid))
+      return -1;
+  }
+  /* write the final result code */
+  WRITE_INT32(fp, NSLCD_RESULT_END);
+  return 0;
+}
+
+int nslcd_passwd_bynames(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid)
+{
+  const char **names;
+  int num, rc;
+  /* read request parameters */
+  if (read_batch_names(fp, &names))
+    return -1;
+  for (num = 0; names[num] != NULL; num++)
+    /* nothing */ ;
+  log_setrequest("passwd(%d names)", num);
+  nsswitch_check_reload();
+  rc = do_passwd_bynames(fp, session, names, calleruid);
+  free(names);
+  return rc;
+}
+
+int nslcd_passwd_byuids(TFILE *fp, MYLDAP_SESSION *session, uid_t calleruid)
+{
+  int32_t tmpint32;
+  unsigned long int ids[NSLCD_BATCH_MAXKEYS];
+  uid_t uids[NSLCD_BATCH_MAXKEYS];
+  char filter[BUFLEN_FILTER];
+  int i, num, numuids = 0;
+  /* read request parameters */
+  if (read_batch_ids(fp, ids, &num))
+    return -1;
+  log_setrequest("passwd(%d uids)", num);
+  for (i = 0; i < num; i++)
+  {
+    if ((uid_t)ids[i] < nslcd_cfg->nss_min_uid)
+      log_log(LOG_DEBUG, "uid %lu ignored by nss_min_uid option", ids[i]);
+    else
+      uids[numuids++] = (uid_t)ids[i];
+  }
+  nsswitch_check_reload();
+  /* write the response header */
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, NSLCD_ACTION_PASSWD_BYUIDS);
+  /* do one search per base for as many uids as fit in a filter */
+  for (i = 0; i < numuids; i += num)
+  {
+    num = mkfilter_passwd_byuids(uids + i, numuids - i, filter, sizeof(filter));
+    if (num <= 0)
+    {
+      log_log(LOG_ERR, "nslcd_passwd_byuids(): filter buffer too small");
+      return -1;
+    }
+    if (passwd_batch_search(fp, session, filter, NULL, 0, calleruid))
+      return -1;
+  }
+  /* write the final result code */
+  WRITE_INT32(fp, NSLCD_RESULT_END);
+  return 0;
+}
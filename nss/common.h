@@ -71,9 +71,14 @@
   return NSS_STATUS_TRYAGAIN;
 
 /* This macro is called if there was a problem with a write
-   operation. */
+   operation. If the server closed the socket the request is not aborted
+   here but when flushing or reading the response fails so that
+   NSS_GETONE_REQUEST() can retry the request if the socket was kept. */
 #define ERROR_OUT_WRITEERROR(fp)                                            \
-  ERROR_OUT_READERROR(fp)
+  if ((errno != EPIPE) && (errno != ECONNRESET))                            \
+  {                                                                         \
+    ERROR_OUT_READERROR(fp);                                                \
+  }
 
 /* This macro is called if the read status code is not
    NSLCD_RESULT_BEGIN. */
@@ -82,6 +87,13 @@
   fp = NULL;                                                                \
   return NSS_STATUS_NOTFOUND;
 
+/* This macro is called if nslcd is too busy to handle the request. */
+#define ERROR_OUT_TRYAGAIN(fp)                                              \
+  (void)tio_close(fp);                                                      \
+  fp = NULL;                                                                \
+  *errnop = EAGAIN;                                                         \
+  return NSS_STATUS_TRYAGAIN;
+
 /* These are some general macros that are used to build parts of the
    general macros below. */
 
@@ -122,26 +134,149 @@
    to have result, buffer, buflen and errnop parameters that define
    the result structure, the user buffer with length and the
    errno to return. This macro should be called through some of
-   the customized ones below. */
+   the customized ones below. The socket is kept for the next
+   request if the complete response was read. */
 #define NSS_GETONE(action, writefn, readfn)                                 \
+  NSS_GETONE_REQUEST(action, /* no cache lookup */ ;, writefn);             \
+  NSS_GETONE_RESPONSE(readfn)
+
+/* This is like NSS_GETONE() but the shared memory cache that is maintained
+   by nslcd is checked first for a response to the request. The key and
+   keylen identify the request parameter (the name or the numeric id). */
+#define NSS_GETONE_CACHED(action, key, keylen, writefn, readfn)            \
+  NSS_GETONE_REQUEST(action, NSS_CACHED(action, key, keylen, readfn),       \
+                     writefn);                                              \
+  NSS_GETONE_RESPONSE(readfn)
+
+/* This reads the response to the NSS_GETONE() request. */
+#define NSS_GETONE_RESPONSE(readfn)                                         \
+  retv = readfn;                                                            \
+  /* keep the socket if the response ends here, otherwise close it */       \
+  if ((retv == NSS_STATUS_SUCCESS) &&                                       \
+      (tio_read(fp, &tmpint32, sizeof(int32_t)) == 0) &&                    \
+      ((int32_t)ntohl(tmpint32) == (int32_t)NSLCD_RESULT_END))              \
+    nslcd_client_keep(fp);                                                  \
+  else if ((retv == NSS_STATUS_SUCCESS) || (retv == NSS_STATUS_TRYAGAIN))   \
+  {                                                                         \
+    (void)tio_skipall(fp, SKIP_TIMEOUT);                                    \
+    (void)tio_close(fp);                                                    \
+  }                                                                         \
+  return retv;
+
+/* This is like NSS_GETONE() but readfn is expected to read all results
+   up to and including the NSLCD_RESULT_END marker. */
+#define NSS_GETLIST(action, writefn, readfn)                                \
+  NSS_GETONE_REQUEST(action, /* no cache lookup */ ;, writefn);             \
+  NSS_GETLIST_RESPONSE(readfn)
+
+/* This is like NSS_GETONE_CACHED() for NSS_GETLIST(). */
+#define NSS_GETLIST_CACHED(action, key, keylen, writefn, readfn)           \
+  NSS_GETONE_REQUEST(action, NSS_CACHED(action, key, keylen, readfn),       \
+                     writefn);                                              \
+  NSS_GETLIST_RESPONSE(readfn)
+
+/* This reads the response to the NSS_GETLIST() request. */
+#define NSS_GETLIST_RESPONSE(readfn)                                        \
+  retv = readfn;                                                            \
+  /* keep the socket if the response was read completely */                 \
+  if (retv == NSS_STATUS_SUCCESS)                                           \
+    nslcd_client_keep(fp);                                                  \
+  else if (retv == NSS_STATUS_TRYAGAIN)                                     \
+  {                                                                         \
+    (void)tio_skipall(fp, SKIP_TIMEOUT);                                    \
+    (void)tio_close(fp);                                                    \
+  }                                                                         \
+  return retv;
+
+/* This looks up the response in the shared memory cache and returns the
+   result of readfn if it was found. */
+#define NSS_CACHED(action, key, keylen, readfn)                             \
+  if ((fp = nslcd_client_cached(action, key, keylen)) != NULL)              \
+  {                                                                         \
+    READ(fp, &tmpint32, sizeof(int32_t));                                   \
+    if ((int32_t)ntohl(tmpint32) != (int32_t)NSLCD_RESULT_BEGIN)            \
+    {                                                                       \
+      ERROR_OUT_NOSUCCESS(fp);                                              \
+    }                                                                       \
+    retv = readfn;                                                          \
+    if ((retv == NSS_STATUS_SUCCESS) || (retv == NSS_STATUS_TRYAGAIN))      \
+      (void)tio_close(fp);                                                  \
+    return retv;                                                            \
+  }
+
+/* This is called by NSS_GETONE_REQUEST() before giving up when the server
+   closed a new socket without responding. Older versions of nslcd do
+   this for requests they do not know (but nslcd also does this for
+   invalid requests) so a module may redefine this to check whether the
+   server handles the request and remember to use an older request. */
+#define NSS_NORESPONSE(fp, action) ;
+
+/* This writes the request for NSS_GETONE() and NSS_GETLIST() over a
+   (possibly reused) socket and reads the first response code. The lookup
+   is done before connecting to nslcd (see NSS_CACHED()). The server may
+   close a kept socket at any time so if that happens before the response
+   arrives (or while the request is written) the request is sent once more
+   over a new socket. */
+#define NSS_GETONE_REQUEST(action, lookup, writefn)                         \
   TFILE *fp;                                                                \
   int32_t tmpint32;                                                         \
   nss_status_t retv;                                                        \
+  int reused;                                                               \
   NSS_EXTRA_DEFS;                                                           \
   NSS_AVAILCHECK;                                                           \
   NSS_BUFCHECK;                                                             \
-  /* open socket and write request */                                       \
-  NSLCD_REQUEST(fp, action, writefn);                                       \
-  /* read response */                                                       \
-  READ_RESPONSE_CODE(fp);                                                   \
-  retv = readfn;                                                            \
-  /* close socket and we're done */                                         \
-  if ((retv == NSS_STATUS_SUCCESS) || (retv == NSS_STATUS_TRYAGAIN))        \
+  lookup;                                                                   \
+  /* get a socket, write the request and read the response code */          \
+  fp = nslcd_client_kept();                                                 \
+  reused = (fp != NULL);                                                    \
+  while (1)                                                                 \
   {                                                                         \
-    (void)tio_skipall(fp, SKIP_TIMEOUT);                                    \
+    if ((fp == NULL) && ((fp = nslcd_client_open()) == NULL))               \
+    {                                                                       \
+      ERROR_OUT_OPENERROR;                                                  \
+    }                                                                       \
+    WRITE_INT32(fp, (int32_t)NSLCD_VERSION)                                 \
+    WRITE_INT32(fp, (int32_t)action)                                        \
+    writefn;                                                                \
+    if ((tio_flush(fp) == 0) &&                                             \
+        (tio_read(fp, &tmpint32, sizeof(int32_t)) == 0))                    \
+      break;                                                                \
+    if (!reused)                                                            \
+    {                                                                       \
+      NSS_NORESPONSE(fp, action);                                           \
+      ERROR_OUT_READERROR(fp);                                              \
+    }                                                                       \
+    /* the server closed the kept socket, retry with a new one */           \
     (void)tio_close(fp);                                                    \
+    fp = NULL;                                                              \
+    reused = 0;                                                             \
   }                                                                         \
-  return retv;
+  /* check the response version number and request number */               \
+  if ((int32_t)ntohl(tmpint32) != (int32_t)NSLCD_VERSION)                   \
+  {                                                                         \
+    ERROR_OUT_READERROR(fp);                                                \
+  }                                                                         \
+  READ(fp, &tmpint32, sizeof(int32_t));                                     \
+  if ((int32_t)ntohl(tmpint32) != (int32_t)(action))                        \
+  {                                                                         \
+    ERROR_OUT_READERROR(fp);                                                \
+  }                                                                         \
+  /* the socket can be kept if nothing was found */                         \
+  READ(fp, &tmpint32, sizeof(int32_t));                                     \
+  tmpint32 = ntohl(tmpint32);                                               \
+  if (tmpint32 == (int32_t)NSLCD_RESULT_END)                                \
+  {                                                                         \
+    nslcd_client_keep(fp);                                                  \
+    return NSS_STATUS_NOTFOUND;                                             \
+  }                                                                         \
+  if (tmpint32 == (int32_t)NSLCD_RESULT_TRYAGAIN)                           \
+  {                                                                         \
+    ERROR_OUT_TRYAGAIN(fp);                                                 \
+  }                                                                         \
+  if (tmpint32 != (int32_t)NSLCD_RESULT_BEGIN)                              \
+  {                                                                         \
+    ERROR_OUT_NOSUCCESS(fp);                                                \
+  }
 
 /* This macro generates a simple setent() function body. This closes any
    open streams so that NSS_GETENT() can open a new file. */
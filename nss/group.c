@@ -31,9 +31,105 @@
 #include "common.h"
 #include "compat/attrs.h"
 
-/* read a single group entry from the stream */
+/* set when nslcd does not handle the chunked group requests (older
+   versions of nslcd do not know these), the classic requests are used
+   from then on */
+static int group_classic = 0;
+
+/* set when nslcd does not handle the gid-only group by member request,
+   the classic request is used from then on */
+static int group_classic_gids = 0;
+
+/* this is called when nslcd closed the connection without responding to
+   the request, nslcd is asked whether it handles the request and if it
+   does not the callers retry the request with the classic request */
+static void group_noresponse(int32_t action)
+{
+  int *classic;
+  switch (action)
+  {
+    case NSLCD_ACTION_GROUP_BYNAME_CHUNKED:
+    case NSLCD_ACTION_GROUP_BYGID_CHUNKED:
+    case NSLCD_ACTION_GROUP_ALL_CHUNKED:
+      classic = &group_classic;
+      break;
+    case NSLCD_ACTION_GROUP_BYMEMBER_GIDS:
+      classic = &group_classic_gids;
+      break;
+    default:
+      return;
+  }
+  if ((!*classic) && (nslcd_client_handles(action) == 0))
+    *classic = 1;
+}
+
+#undef NSS_NORESPONSE
+#define NSS_NORESPONSE(fp, action)                                          \
+  group_noresponse(action);
+
+/* read the members of a group that are sent as STRINGCHUNKS, because the
+   number of members is not known in advance the strings are stored in the
+   buffer first and the array of pointers is placed after them, if the
+   buffer is too small the remaining members are skipped so that the
+   complete entry has been read when ERANGE is returned */
+static nss_status_t read_members(TFILE *fp, struct group *result,
+                                 char *buffer, size_t buflen, size_t bufptr,
+                                 int *errnop)
+{
+  int32_t tmpint32, tmp2int32;
+  int32_t num, len, count = 0, i;
+  size_t start = bufptr;
+  int toosmall = 0;
+  char *str;
+  /* read all parts of the list */
+  READ_INT32(fp, num);
+  while (num != 0)
+  {
+    if ((num < 0) || (num > NSLCD_CHUNK_MAXSTRINGS))
+    {
+      ERROR_OUT_READERROR(fp);
+    }
+    for (i = 0; i < num; i++)
+    {
+      READ_INT32(fp, len);
+      if ((!toosmall) && ((bufptr + (size_t)len + 1) <= buflen))
+      {
+        if (len > 0)
+        {
+          READ(fp, BUF_CUR, (size_t)len);
+        }
+        BUF_CUR[len] = '\0';
+        BUF_SKIP(len + 1);
+        count++;
+      }
+      else
+      {
+        toosmall = 1;
+        SKIP(fp, len);
+      }
+    }
+    READ_INT32(fp, num);
+  }
+  if (toosmall)
+  {
+    ERROR_OUT_BUFERROR(fp);
+  }
+  /* allocate room for *char[num + 1] and point to the strings */
+  BUF_ALLOC(fp, result->gr_mem, char *, count + 1);
+  for (i = 0, str = buffer + start; i < count; i++)
+  {
+    result->gr_mem[i] = str;
+    str += strlen(str) + 1;
+  }
+  result->gr_mem[count] = NULL;
+  return NSS_STATUS_SUCCESS;
+}
+
+/* read a single group entry from the stream, the members are sent as a
+   STRINGLIST in response to the classic requests */
 static nss_status_t read_group(TFILE *fp, struct group *result,
-                               char *buffer, size_t buflen, int *errnop)
+                               char *buffer, size_t buflen, int *errnop,
+                               int classic)
 {
   int32_t tmpint32, tmp2int32, tmp3int32;
   size_t bufptr = 0;
@@ -41,15 +137,18 @@ static nss_status_t read_group(TFILE *fp, struct group *result,
   READ_BUF_STRING(fp, result->gr_name);
   READ_BUF_STRING(fp, result->gr_passwd);
   READ_INT32(fp, result->gr_gid);
+  if (!classic)
+    return read_members(fp, result, buffer, buflen, bufptr, errnop);
   READ_BUF_STRINGLIST(fp, result->gr_mem);
   return NSS_STATUS_SUCCESS;
 }
 
 /* read all group entries from the stream and add
-   gids of these groups to the list */
+   gids of these groups to the list, the response to the classic request
+   has complete group entries */
 static nss_status_t read_gids(TFILE *fp, gid_t skipgroup, long int *start,
                               long int *size, gid_t **groupsp,
-                              long int limit, int *errnop)
+                              long int limit, int *errnop, int classic)
 {
   int32_t res = (int32_t)NSLCD_RESULT_BEGIN;
   int32_t tmpint32, tmp2int32, tmp3int32;
@@ -61,14 +160,20 @@ static nss_status_t read_gids(TFILE *fp, gid_t skipgroup, long int *start,
   /* loop over results */
   while (res == (int32_t)NSLCD_RESULT_BEGIN)
   {
-    /* skip group name */
-    SKIP_STRING(fp);
-    /* skip passwd entry */
-    SKIP_STRING(fp);
-    /* read gid */
+    if (classic)
+    {
+      /* skip group name and passwd entry */
+      SKIP_STRING(fp);
+      SKIP_STRING(fp);
+    }
+    /* read gid (the only value that is returned for the gid-only
+       request) */
     READ_INT32(fp, gid);
-    /* skip members */
-    SKIP_STRINGLIST(fp);
+    if (classic)
+    {
+      /* skip members */
+      SKIP_STRINGLIST(fp);
+    }
     /* only add the group to the list if it is not the specified group */
     if (gid != skipgroup)
     {
@@ -112,46 +217,185 @@ static nss_status_t read_gids(TFILE *fp, gid_t skipgroup, long int *start,
   return NSS_STATUS_SUCCESS;
 }
 
+/* open a stream and write the request to read all groups, returns
+   NSS_STATUS_UNAVAIL (with group_classic set) if nslcd does not know the
+   chunked request */
+static nss_status_t group_request_all(TFILE **fpp, int classic, int *errnop)
+{
+  int32_t tmpint32;
+  int32_t action = classic ? NSLCD_ACTION_GROUP_ALL :
+                             NSLCD_ACTION_GROUP_ALL_CHUNKED;
+  TFILE *fp;
+  if ((fp = nslcd_client_open()) == NULL)
+  {
+    ERROR_OUT_OPENERROR;
+  }
+  WRITE_INT32(fp, NSLCD_VERSION);
+  WRITE_INT32(fp, action);
+  if ((tio_flush(fp) < 0) || (tio_read(fp, &tmpint32, sizeof(int32_t)) != 0))
+  {
+    NSS_NORESPONSE(fp, action);
+    ERROR_OUT_READERROR(fp);
+  }
+  /* check the response version number and request number */
+  if ((int32_t)ntohl(tmpint32) != (int32_t)NSLCD_VERSION)
+  {
+    ERROR_OUT_READERROR(fp);
+  }
+  READ(fp, &tmpint32, sizeof(int32_t));
+  if ((int32_t)ntohl(tmpint32) != action)
+  {
+    ERROR_OUT_READERROR(fp);
+  }
+  *fpp = fp;
+  return NSS_STATUS_SUCCESS;
+}
+
 #ifdef NSS_FLAVOUR_GLIBC
 
+static nss_status_t getgrnam_chunked(const char *name, struct group *result,
+                                     char *buffer, size_t buflen, int *errnop)
+{
+  NSS_GETONE_CACHED(NSLCD_ACTION_GROUP_BYNAME_CHUNKED, name, strlen(name),
+                    WRITE_STRING(fp, name),
+             read_group(fp, result, buffer, buflen, errnop, 0));
+}
+
+static nss_status_t getgrnam_classic(const char *name, struct group *result,
+                                     char *buffer, size_t buflen, int *errnop)
+{
+  NSS_GETONE(NSLCD_ACTION_GROUP_BYNAME,
+             WRITE_STRING(fp, name),
+             read_group(fp, result, buffer, buflen, errnop, 1));
+}
+
 /* get a group entry by name */
 nss_status_t NSS_NAME(getgrnam_r)(const char *name, struct group *result,
                                   char *buffer, size_t buflen, int *errnop)
 {
-  NSS_GETONE(NSLCD_ACTION_GROUP_BYNAME,
-             WRITE_STRING(fp, name),
-             read_group(fp, result, buffer, buflen, errnop));
+  nss_status_t retv;
+  if (!group_classic)
+  {
+    retv = getgrnam_chunked(name, result, buffer, buflen, errnop);
+    if ((retv != NSS_STATUS_UNAVAIL) || (!group_classic))
+      return retv;
+  }
+  return getgrnam_classic(name, result, buffer, buflen, errnop);
+}
+
+static nss_status_t getgrgid_chunked(gid_t gid, struct group *result,
+                                     char *buffer, size_t buflen, int *errnop)
+{
+  NSS_GETONE_CACHED(NSLCD_ACTION_GROUP_BYGID_CHUNKED, &gid, sizeof(gid_t),
+                    WRITE_INT32(fp, gid),
+             read_group(fp, result, buffer, buflen, errnop, 0));
+}
+
+static nss_status_t getgrgid_classic(gid_t gid, struct group *result,
+                                     char *buffer, size_t buflen, int *errnop)
+{
+  NSS_GETONE(NSLCD_ACTION_GROUP_BYGID,
+             WRITE_INT32(fp, gid),
+             read_group(fp, result, buffer, buflen, errnop, 1));
 }
 
 /* get a group entry by numeric gid */
 nss_status_t NSS_NAME(getgrgid_r)(gid_t gid, struct group *result,
                                   char *buffer, size_t buflen, int *errnop)
 {
-  NSS_GETONE(NSLCD_ACTION_GROUP_BYGID,
-             WRITE_INT32(fp, gid),
-             read_group(fp, result, buffer, buflen, errnop));
+  nss_status_t retv;
+  if (!group_classic)
+  {
+    retv = getgrgid_chunked(gid, result, buffer, buflen, errnop);
+    if ((retv != NSS_STATUS_UNAVAIL) || (!group_classic))
+      return retv;
+  }
+  return getgrgid_classic(gid, result, buffer, buflen, errnop);
 }
 
 /* thread-local file pointer to an ongoing request */
 static TLS TFILE *grentfp;
 
+/* thread-local flag to indicate that the classic request was used */
+static TLS int grentclassic;
+
+/* thread-local name of a group that was too large to be read again from
+   the stream after the buffer turned out to be too small (this is not
+   allocated because thread-local storage is not freed when a thread
+   exits) */
+static TLS char grentname[256];
+
 /* start a request to read all groups */
 nss_status_t NSS_NAME(setgrent)(int UNUSED(stayopen))
 {
+  grentname[0] = '\0';
   NSS_SETENT(grentfp);
 }
 
-/* read a single group from the stream */
+/* read a single group from the stream, this is like NSS_GETENT() but a
+   group that does not fit in the buffer and is too large to be kept in the
+   stream buffer is looked up by name when the call is retried */
 nss_status_t NSS_NAME(getgrent_r)(struct group *result,
                                   char *buffer, size_t buflen, int *errnop)
 {
-  NSS_GETENT(grentfp, NSLCD_ACTION_GROUP_ALL,
-             read_group(grentfp, result, buffer, buflen, errnop));
+  int32_t tmpint32;
+  nss_status_t retv;
+  NSS_AVAILCHECK;
+  NSS_BUFCHECK;
+  /* look up the group that was skipped by the previous call */
+  if (grentname[0] != '\0')
+  {
+    retv = NSS_NAME(getgrnam_r)(grentname, result, buffer, buflen, errnop);
+    if ((retv == NSS_STATUS_TRYAGAIN) && (*errnop == ERANGE))
+      return retv;
+    grentname[0] = '\0';
+    if (retv == NSS_STATUS_SUCCESS)
+      return retv;
+  }
+  /* check that we have a valid file descriptor */
+  if (grentfp == NULL)
+  {
+    /* open a new stream and write the request */
+    grentclassic = group_classic;
+    retv = group_request_all(&grentfp, grentclassic, errnop);
+    if ((retv == NSS_STATUS_UNAVAIL) && (!grentclassic) && (group_classic))
+    {
+      grentclassic = 1;
+      retv = group_request_all(&grentfp, grentclassic, errnop);
+    }
+    if (retv != NSS_STATUS_SUCCESS)
+      return retv;
+  }
+  /* prepare for buffer errors */
+  tio_mark(grentfp);
+  /* read a response */
+  READ_RESPONSE_CODE(grentfp);
+  retv = read_group(grentfp, result, buffer, buflen, errnop, grentclassic);
+  /* check read result */
+  if ((retv == NSS_STATUS_TRYAGAIN) && (tio_reset(grentfp)))
+  {
+    /* if the complete entry was read (only the members did not fit) the
+       group is looked up by name on the next call, otherwise we give up
+       (the classic response does not allow skipping the members) */
+    if (grentclassic || (result->gr_passwd == NULL) ||
+        (strlen(result->gr_name) >= sizeof(grentname)))
+    {
+      (void)tio_close(grentfp);
+      grentfp = NULL;
+      *errnop = EINVAL;
+      return NSS_STATUS_UNAVAIL;
+    }
+    strcpy(grentname, result->gr_name);
+  }
+  else if ((retv != NSS_STATUS_SUCCESS) && (retv != NSS_STATUS_TRYAGAIN))
+    grentfp = NULL; /* file should be closed by now */
+  return retv;
 }
 
 /* close the stream opened with setgrent() above */
 nss_status_t NSS_NAME(endgrent)(void)
 {
+  grentname[0] = '\0';
   NSS_ENDENT(grentfp);
 }
 
@@ -167,21 +411,50 @@ nss_status_t NSS_NAME(endgrent)(void)
    limit     IN     - the maxium size of the array
    *errnop   OUT    - for returning errno
 */
-nss_status_t NSS_NAME(initgroups_dyn)(const char *user, gid_t skipgroup,
-                                      long int *start, long int *size,
-                                      gid_t **groupsp, long int limit,
-                                      int *errnop)
-{
 /* temporarily map the buffer and buflen names so the check in NSS_GETONE
    for validity of the buffer works (renaming the parameters may cause
    confusion) */
 #define buffer groupsp
 #define buflen *size
-  NSS_GETONE(NSLCD_ACTION_GROUP_BYMEMBER,
-             WRITE_STRING(fp, user),
-             read_gids(fp, skipgroup, start, size, groupsp, limit, errnop));
+
+static nss_status_t initgroups_gids(const char *user, gid_t skipgroup,
+                                    long int *start, long int *size,
+                                    gid_t **groupsp, long int limit,
+                                    int *errnop)
+{
+  NSS_GETLIST_CACHED(NSLCD_ACTION_GROUP_BYMEMBER_GIDS, user, strlen(user),
+                     WRITE_STRING(fp, user),
+              read_gids(fp, skipgroup, start, size, groupsp, limit, errnop, 0));
+}
+
+static nss_status_t initgroups_classic(const char *user, gid_t skipgroup,
+                                       long int *start, long int *size,
+                                       gid_t **groupsp, long int limit,
+                                       int *errnop)
+{
+  NSS_GETLIST(NSLCD_ACTION_GROUP_BYMEMBER,
+              WRITE_STRING(fp, user),
+              read_gids(fp, skipgroup, start, size, groupsp, limit, errnop, 1));
+}
+
 #undef buffer
 #undef buflen
+
+nss_status_t NSS_NAME(initgroups_dyn)(const char *user, gid_t skipgroup,
+                                      long int *start, long int *size,
+                                      gid_t **groupsp, long int limit,
+                                      int *errnop)
+{
+  nss_status_t retv;
+  if (!group_classic_gids)
+  {
+    retv = initgroups_gids(user, skipgroup, start, size, groupsp, limit,
+                           errnop);
+    if ((retv != NSS_STATUS_UNAVAIL) || (!group_classic_gids))
+      return retv;
+  }
+  return initgroups_classic(user, skipgroup, start, size, groupsp, limit,
+                            errnop);
 }
 
 #endif /* NSS_FLAVOUR_GLIBC */
@@ -210,23 +483,66 @@ static char *group2str(struct group *result, char *buffer, size_t buflen)
 }
 #endif /* HAVE_STRUCT_NSS_XBYY_ARGS_RETURNLEN */
 
-static nss_status_t read_result(TFILE *fp, nss_XbyY_args_t *args)
+static nss_status_t read_result(TFILE *fp, nss_XbyY_args_t *args,
+                                int classic)
 {
-  READ_RESULT(group, &args->erange);
+  READ_RESULT(group, &args->erange, classic);
 }
 
-static nss_status_t group_getgrnam(nss_backend_t UNUSED(*be), void *args)
+static nss_status_t getgrnam_chunked(void *args)
+{
+  NSS_GETONE_CACHED(NSLCD_ACTION_GROUP_BYNAME_CHUNKED,
+                    NSS_ARGS(args)->key.name,
+                    strlen(NSS_ARGS(args)->key.name),
+                    WRITE_STRING(fp, NSS_ARGS(args)->key.name),
+             read_result(fp, args, 0));
+}
+
+static nss_status_t getgrnam_classic(void *args)
 {
   NSS_GETONE(NSLCD_ACTION_GROUP_BYNAME,
              WRITE_STRING(fp, NSS_ARGS(args)->key.name),
-             read_result(fp, args));
+             read_result(fp, args, 1));
 }
 
-static nss_status_t group_getgrgid(nss_backend_t UNUSED(*be), void *args)
+static nss_status_t group_getgrnam(nss_backend_t UNUSED(*be), void *args)
+{
+  nss_status_t retv;
+  if (!group_classic)
+  {
+    retv = getgrnam_chunked(args);
+    if ((retv != NSS_STATUS_UNAVAIL) || (!group_classic))
+      return retv;
+  }
+  return getgrnam_classic(args);
+}
+
+static nss_status_t getgrgid_chunked(void *args)
+{
+  NSS_GETONE_CACHED(NSLCD_ACTION_GROUP_BYGID_CHUNKED,
+                    &NSS_ARGS(args)->key.gid,
+                    sizeof(gid_t),
+                    WRITE_INT32(fp, NSS_ARGS(args)->key.gid),
+             read_result(fp, args, 0));
+}
+
+static nss_status_t getgrgid_classic(void *args)
 {
   NSS_GETONE(NSLCD_ACTION_GROUP_BYGID,
              WRITE_INT32(fp, NSS_ARGS(args)->key.gid),
-             read_result(fp, args));
+             read_result(fp, args, 1));
+}
+
+static nss_status_t group_getgrgid(nss_backend_t UNUSED(*be), void *args)
+{
+  nss_status_t retv;
+  if (!group_classic)
+  {
+    retv = getgrgid_chunked(args);
+    if ((retv != NSS_STATUS_UNAVAIL) || (!group_classic))
+      return retv;
+  }
+  return getgrgid_classic(args);
 }
 
 static nss_status_t group_setgrent(nss_backend_t *be, void UNUSED(*args))
@@ -234,10 +550,50 @@ static nss_status_t group_setgrent(nss_backend_t *be, void UNUSED(*args))
   NSS_SETENT(LDAP_BE(be)->fp);
 }
 
+/* this is like NSS_GETENT() but the classic request is used with older
+   versions of nslcd (the request that was used is not stored in the
+   backend so this is decided again for every entry) */
 static nss_status_t group_getgrent(nss_backend_t *be, void *args)
 {
-  NSS_GETENT(LDAP_BE(be)->fp, NSLCD_ACTION_GROUP_ALL,
-             read_result(LDAP_BE(be)->fp, args));
+  int32_t tmpint32;
+  nss_status_t retv;
+  int classic = group_classic;
+  NSS_EXTRA_DEFS;
+  NSS_AVAILCHECK;
+  NSS_BUFCHECK;
+  /* check that we have a valid file descriptor */
+  if (LDAP_BE(be)->fp == NULL)
+  {
+    /* open a new stream and write the request */
+    retv = group_request_all(&LDAP_BE(be)->fp, classic, errnop);
+    if ((retv == NSS_STATUS_UNAVAIL) && (!classic) && (group_classic))
+    {
+      classic = 1;
+      retv = group_request_all(&LDAP_BE(be)->fp, classic, errnop);
+    }
+    if (retv != NSS_STATUS_SUCCESS)
+      return retv;
+  }
+  /* prepare for buffer errors */
+  tio_mark(LDAP_BE(be)->fp);
+  /* read a response */
+  READ_RESPONSE_CODE(LDAP_BE(be)->fp);
+  retv = read_result(LDAP_BE(be)->fp, args, classic);
+  /* check read result */
+  if (retv == NSS_STATUS_TRYAGAIN)
+  {
+    /* if we have a full buffer try to reset the stream */
+    if (tio_reset(LDAP_BE(be)->fp))
+    {
+      tio_close(LDAP_BE(be)->fp);
+      LDAP_BE(be)->fp = NULL;
+      *errnop = EINVAL;
+      return NSS_STATUS_UNAVAIL;
+    }
+  }
+  else if (retv != NSS_STATUS_SUCCESS)
+    LDAP_BE(be)->fp = NULL; /* file should be closed by now */
+  return retv;
 }
 
 static nss_status_t group_endgrent(nss_backend_t *be, void UNUSED(*args))
@@ -245,16 +601,41 @@ static nss_status_t group_endgrent(nss_backend_t *be, void UNUSED(*args))
   NSS_ENDENT(LDAP_BE(be)->fp);
 }
 
-static nss_status_t group_getgroupsbymember(nss_backend_t UNUSED(*be), void *args)
+static nss_status_t getgroupsbymember_gids(void *args)
 {
   struct nss_groupsbymem *argp = (struct nss_groupsbymem *)args;
   long int start = (long int)argp->numgids;
   gid_t skipgroup = (start > 0) ? argp->gid_array[0] : (gid_t)-1;
-  NSS_GETONE(NSLCD_ACTION_GROUP_BYMEMBER,
-             WRITE_STRING(fp, argp->username),
-             read_gids(fp, skipgroup, &start, NULL, (gid_t **)&argp->gid_array,
-                       argp->maxgids, &NSS_ARGS(args)->erange);
-             argp->numgids = (int)start);
+  NSS_GETLIST_CACHED(NSLCD_ACTION_GROUP_BYMEMBER_GIDS, argp->username,
+                     strlen(argp->username),
+                     WRITE_STRING(fp, argp->username),
+              read_gids(fp, skipgroup, &start, NULL, (gid_t **)&argp->gid_array,
+                        argp->maxgids, &NSS_ARGS(args)->erange, 0);
+              argp->numgids = (int)start);
+}
+
+static nss_status_t getgroupsbymember_classic(void *args)
+{
+  struct nss_groupsbymem *argp = (struct nss_groupsbymem *)args;
+  long int start = (long int)argp->numgids;
+  gid_t skipgroup = (start > 0) ? argp->gid_array[0] : (gid_t)-1;
+  NSS_GETLIST(NSLCD_ACTION_GROUP_BYMEMBER,
+              WRITE_STRING(fp, argp->username),
+              read_gids(fp, skipgroup, &start, NULL, (gid_t **)&argp->gid_array,
+                        argp->maxgids, &NSS_ARGS(args)->erange, 1);
+              argp->numgids = (int)start);
+}
+
+static nss_status_t group_getgroupsbymember(nss_backend_t UNUSED(*be), void *args)
+{
+  nss_status_t retv;
+  if (!group_classic_gids)
+  {
+    retv = getgroupsbymember_gids(args);
+    if ((retv != NSS_STATUS_UNAVAIL) || (!group_classic_gids))
+      return retv;
+  }
+  return getgroupsbymember_classic(args);
 }
 
 static nss_backend_op_t group_ops[] = {
@@ -57,7 +57,10 @@
 
 #undef ERROR_OUT_WRITEERROR
 #define ERROR_OUT_WRITEERROR(fp)                                            \
-  ERROR_OUT_READERROR(fp)
+  if ((errno != EPIPE) && (errno != ECONNRESET))                            \
+  {                                                                         \
+    ERROR_OUT_READERROR(fp);                                                \
+  }
 
 /* read a single host entry from the stream, filtering on the
    specified address family, result is stored in result
@@ -57,7 +57,10 @@
 
 #undef ERROR_OUT_WRITEERROR
 #define ERROR_OUT_WRITEERROR(fp)                                            \
-  ERROR_OUT_READERROR(fp)
+  if ((errno != EPIPE) && (errno != ECONNRESET))                            \
+  {                                                                         \
+    ERROR_OUT_READERROR(fp);                                                \
+  }
 
 /* read a single network entry from the stream, ignoring entries
    that are not AF_INET (IPv4), result is stored in result */
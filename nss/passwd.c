@@ -57,8 +57,8 @@ static nss_status_t read_passwd(TFILE *fp, struct passwd *result,
 nss_status_t NSS_NAME(getpwnam_r)(const char *name, struct passwd *result,
                                   char *buffer, size_t buflen, int *errnop)
 {
-  NSS_GETONE(NSLCD_ACTION_PASSWD_BYNAME,
-             WRITE_STRING(fp, name),
+  NSS_GETONE_CACHED(NSLCD_ACTION_PASSWD_BYNAME, name, strlen(name),
+                    WRITE_STRING(fp, name),
              read_passwd(fp, result, buffer, buflen, errnop));
 }
 
@@ -66,8 +66,8 @@ nss_status_t NSS_NAME(getpwnam_r)(const char *name, struct passwd *result,
 nss_status_t NSS_NAME(getpwuid_r)(uid_t uid, struct passwd *result,
                                   char *buffer, size_t buflen, int *errnop)
 {
-  NSS_GETONE(NSLCD_ACTION_PASSWD_BYUID,
-             WRITE_INT32(fp, uid),
+  NSS_GETONE_CACHED(NSLCD_ACTION_PASSWD_BYUID, &uid, sizeof(uid_t),
+                    WRITE_INT32(fp, uid),
              read_passwd(fp, result, buffer, buflen, errnop));
 }
 
@@ -119,15 +119,17 @@ static nss_status_t read_result(TFILE *fp, nss_XbyY_args_t *args)
 
 static nss_status_t passwd_getpwnam(nss_backend_t UNUSED(*be), void *args)
 {
-  NSS_GETONE(NSLCD_ACTION_PASSWD_BYNAME,
-             WRITE_STRING(fp, NSS_ARGS(args)->key.name),
+  NSS_GETONE_CACHED(NSLCD_ACTION_PASSWD_BYNAME, NSS_ARGS(args)->key.name,
+                    strlen(NSS_ARGS(args)->key.name),
+                    WRITE_STRING(fp, NSS_ARGS(args)->key.name),
              read_result(fp, args));
 }
 
 static nss_status_t passwd_getpwuid(nss_backend_t UNUSED(*be), void *args)
 {
-  NSS_GETONE(NSLCD_ACTION_PASSWD_BYUID,
-             WRITE_INT32(fp, NSS_ARGS(args)->key.uid),
+  NSS_GETONE_CACHED(NSLCD_ACTION_PASSWD_BYUID, &NSS_ARGS(args)->key.uid,
+                    sizeof(uid_t),
+                    WRITE_INT32(fp, NSS_ARGS(args)->key.uid),
              read_result(fp, args));
 }
 
@@ -68,6 +68,12 @@
     pam_syslog(pamh, LOG_DEBUG, "user not handled by nslcd");               \
   return PAM_USER_UNKNOWN;
 
+/* This macro is called if nslcd is too busy to handle the request. */
+#define ERROR_OUT_TRYAGAIN(fp)                                              \
+  pam_syslog(pamh, LOG_ERR, "nslcd is too busy to handle the request");     \
+  (void)tio_close(fp);                                                      \
+  return PAM_AUTHINFO_UNAVAIL;
+
 /* This is a generic PAM request generation macro. The action
    parameter is the NSLCD_ACTION_.. action, the writefn is the
    operation for writing the parameter and readfn is the function
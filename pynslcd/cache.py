@@ -165,6 +165,12 @@ class Cache(object):
             ''' % self.tables[0])
         if parameters:
             for k, v in parameters.items():
+                if isinstance(v, list) and k not in self.retrieve_by:
+                    # batch requests pass a list of values
+                    where = '`%s`.`%s` IN (%s)' % (
+                        self.tables[0], k, ', '.join('?' * len(v)))
+                    query.add_where(where, v)
+                    continue
                 where = self.retrieve_by.get(k, '`%s`.`%s` = ?' % (self.tables[0], k))
                 query.add_where(where, where.count('?') * [v])
         # group by
@@ -23,6 +23,19 @@ import common
 import constants
 
 
+# the requests that older versions of nslcd may not handle
+actions = (
+    constants.NSLCD_ACTION_GROUP_BYNAMES,
+    constants.NSLCD_ACTION_GROUP_BYGIDS,
+    constants.NSLCD_ACTION_GROUP_BYMEMBER_GIDS,
+    constants.NSLCD_ACTION_GROUP_BYNAME_CHUNKED,
+    constants.NSLCD_ACTION_GROUP_BYGID_CHUNKED,
+    constants.NSLCD_ACTION_GROUP_ALL_CHUNKED,
+    constants.NSLCD_ACTION_PASSWD_BYNAMES,
+    constants.NSLCD_ACTION_PASSWD_BYUIDS,
+)
+
+
 class ConfigGetRequest(common.Request):
 
     action = constants.NSLCD_ACTION_CONFIG_GET
@@ -40,6 +53,8 @@ class ConfigGetRequest(common.Request):
         cfgopt = parameters['cfgopt']
         if cfgopt == constants.NSLCD_CONFIG_PAM_PASSWORD_PROHIBIT_MESSAGE:
             self.write(cfg.pam_password_prohibit_message or '')
+        elif cfgopt == constants.NSLCD_CONFIG_ACTIONS:
+            self.write(' '.join('0x%08x' % action for action in actions))
         else:
             # return empty response
             self.fp.write_int32(constants.NSLCD_RESULT_END)
@@ -74,7 +74,10 @@ class Search(search.LDAPSearch):
                     attmap['memberUid'], escape_filter_chars(memberuid),
                     attmap['member'], escape_filter_chars(entry[0]),
                 )
-        if 'gidNumber' in self.parameters:
+        if isinstance(self.parameters.get('gidNumber'), list):
+            self.parameters['gidNumber'] = [
+                x - cfg.nss_gid_offset for x in self.parameters['gidNumber']]
+        elif 'gidNumber' in self.parameters:
             self.parameters['gidNumber'] -= cfg.nss_gid_offset
         return super(Search, self).mk_filter()
 
@@ -120,11 +123,16 @@ class Cache(cache.Cache):
 
 class GroupRequest(common.Request):
 
+    chunked = False
+
     def write(self, name, passwd, gid, members):
         self.fp.write_string(name)
         self.fp.write_string(passwd)
         self.fp.write_int32(gid)
-        self.fp.write_stringlist(members)
+        if self.chunked:
+            self.fp.write_stringchunks(members)
+        else:
+            self.fp.write_stringlist(members)
 
     def get_members(self, attributes, members, subgroups, seen):
         # add the memberUid values
@@ -193,6 +201,49 @@ class GroupByGidRequest(GroupRequest):
         return dict(gidNumber=fp.read_int32())
 
 
+class GroupByNameChunkedRequest(GroupByNameRequest):
+
+    action = constants.NSLCD_ACTION_GROUP_BYNAME_CHUNKED
+    chunked = True
+
+
+class GroupByGidChunkedRequest(GroupByGidRequest):
+
+    action = constants.NSLCD_ACTION_GROUP_BYGID_CHUNKED
+    chunked = True
+
+
+class GroupByNamesRequest(GroupRequest):
+
+    action = constants.NSLCD_ACTION_GROUP_BYNAMES
+
+    def read_parameters(self, fp):
+        names = fp.read_list(fp.read_string, constants.NSLCD_BATCH_MAXKEYS)
+        return dict(cn=sorted(set(
+            name for name in names if common.is_valid_name(name))))
+
+    def handle_request(self, parameters):
+        if parameters['cn']:
+            return super(GroupByNamesRequest, self).handle_request(parameters)
+        # write the final result code to signify empty results
+        self.fp.write_int32(constants.NSLCD_RESULT_END)
+
+
+class GroupByGidsRequest(GroupRequest):
+
+    action = constants.NSLCD_ACTION_GROUP_BYGIDS
+
+    def read_parameters(self, fp):
+        gids = fp.read_list(fp.read_int32, constants.NSLCD_BATCH_MAXKEYS)
+        return dict(gidNumber=sorted(set(gids)))
+
+    def handle_request(self, parameters):
+        if parameters['gidNumber']:
+            return super(GroupByGidsRequest, self).handle_request(parameters)
+        # write the final result code to signify empty results
+        self.fp.write_int32(constants.NSLCD_RESULT_END)
+
+
 class GroupByMemberRequest(GroupRequest):
 
     action = constants.NSLCD_ACTION_GROUP_BYMEMBER
@@ -229,6 +280,22 @@ class GroupByMemberRequest(GroupRequest):
         return super(GroupByMemberRequest, self).handle_request(parameters)
 
 
+class GroupByMemberGidsRequest(GroupByMemberRequest):
+
+    action = constants.NSLCD_ACTION_GROUP_BYMEMBER_GIDS
+
+    def write(self, name, passwd, gid, members):
+        self.fp.write_int32(gid)
+
+    def get_results(self, parameters):
+        seen = set()
+        for name, passwd, gid, members in super(
+                GroupByMemberGidsRequest, self).get_results(parameters):
+            if gid not in seen:
+                seen.add(gid)
+                yield (name, passwd, gid, members)
+
+
 class GroupAllRequest(GroupRequest):
 
     action = constants.NSLCD_ACTION_GROUP_ALL
@@ -236,3 +303,9 @@ class GroupAllRequest(GroupRequest):
     def handle_request(self, parameters):
         if not cfg.nss_disable_enumeration:
             return super(GroupAllRequest, self).handle_request(parameters)
+
+
+class GroupAllChunkedRequest(GroupAllRequest):
+
+    action = constants.NSLCD_ACTION_GROUP_ALL_CHUNKED
+    chunked = True
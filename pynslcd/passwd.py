@@ -48,7 +48,10 @@ class Search(search.LDAPSearch):
         'loginShell')
 
     def mk_filter(self):
-        if 'uidNumber' in self.parameters:
+        if isinstance(self.parameters.get('uidNumber'), list):
+            self.parameters['uidNumber'] = [
+                x - cfg.nss_uid_offset for x in self.parameters['uidNumber']]
+        elif 'uidNumber' in self.parameters:
             self.parameters['uidNumber'] -= cfg.nss_uid_offset
         return super(Search, self).mk_filter()
 
@@ -129,6 +132,38 @@ class PasswdByUidRequest(PasswdRequest):
         self.fp.write_int32(constants.NSLCD_RESULT_END)
 
 
+class PasswdByNamesRequest(PasswdRequest):
+
+    action = constants.NSLCD_ACTION_PASSWD_BYNAMES
+
+    def read_parameters(self, fp):
+        names = fp.read_list(fp.read_string, constants.NSLCD_BATCH_MAXKEYS)
+        return dict(uid=sorted(set(
+            name for name in names if common.is_valid_name(name))))
+
+    def handle_request(self, parameters):
+        if parameters['uid']:
+            return super(PasswdByNamesRequest, self).handle_request(parameters)
+        # write the final result code to signify empty results
+        self.fp.write_int32(constants.NSLCD_RESULT_END)
+
+
+class PasswdByUidsRequest(PasswdRequest):
+
+    action = constants.NSLCD_ACTION_PASSWD_BYUIDS
+
+    def read_parameters(self, fp):
+        uids = fp.read_list(fp.read_int32, constants.NSLCD_BATCH_MAXKEYS)
+        return dict(uidNumber=sorted(set(
+            uid for uid in uids if uid >= cfg.nss_min_uid)))
+
+    def handle_request(self, parameters):
+        if parameters['uidNumber']:
+            return super(PasswdByUidsRequest, self).handle_request(parameters)
+        # write the final result code to signify empty results
+        self.fp.write_int32(constants.NSLCD_RESULT_END)
+
+
 class PasswdAllRequest(PasswdRequest):
 
     action = constants.NSLCD_ACTION_PASSWD_ALL
@@ -81,6 +81,11 @@ class Connection(ldap.ldapobject.ReconnectLDAPObject):
         return res
 
 
+def _values(value):
+    """Return the list of requested values (batch requests use lists)."""
+    return value if isinstance(value, list) else [value]
+
+
 class LDAPSearch(object):
     """Class that performs an LDAP search.
 
@@ -152,10 +157,17 @@ class LDAPSearch(object):
         if self.parameters:
             return '(&%s%s)' % (
                 self.filter,
-                ''.join(self.attmap.mk_filter(attribute, value)
+                ''.join(self._mk_filter(attribute, value)
                         for attribute, value in self.parameters.items()))
         return self.filter
 
+    def _mk_filter(self, attribute, value):
+        """Return the filter for a single (possibly multi-valued) parameter."""
+        if isinstance(value, list):
+            return '(|%s)' % ''.join(
+                self.attmap.mk_filter(attribute, x) for x in value)
+        return self.attmap.mk_filter(attribute, value)
+
     def _transform(self, dn, attributes):
         """Filter and transform search result entry.
 
@@ -185,18 +197,25 @@ class LDAPSearch(object):
         # check that requested attribute is present (case sensitive)
         for attr in self.case_sensitive:
             value = self.parameters.get(attr, None)
-            if value and str(value) not in attributes[attr]:
+            if value and not any(str(x) in attributes[attr]
+                                 for x in _values(value)):
                 logging.debug('%s: %s: does not contain %r value', dn, self.attmap[attr], value)
                 return  # not found, skip entry
         # check that requested attribute is present (case insensitive)
         for attr in self.case_insensitive:
             value = self.parameters.get(attr, None)
-            if value and str(value).lower() not in (x.lower() for x in attributes[attr]):
+            lower = [x.lower() for x in attributes[attr]]
+            if value and not any(str(x).lower() in lower
+                                 for x in _values(value)):
                 logging.debug('%s: %s: does not contain %r value', dn, self.attmap[attr], value)
                 return  # not found, skip entry
         # limit attribute values to requested value
         for attr in self.limit_attributes:
-            if attr in self.parameters:
-                attributes[attr] = [self.parameters[attr]]
+            value = self.parameters.get(attr, None)
+            if isinstance(value, list):
+                attributes[attr] = [
+                    x for x in value if str(x) in attributes[attr]]
+            elif attr in self.parameters:
+                attributes[attr] = [value]
         # return the entry
         return dn, attributes
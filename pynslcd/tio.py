@@ -23,6 +23,8 @@ import socket
 import struct
 import sys
 
+import constants
+
 
 # definition for reading and writing INT32 values
 _int32 = struct.Struct('!i')
@@ -63,6 +65,13 @@ class TIOStream(object):
             value = value.decode('utf-8')
         return value
 
+    def read_list(self, readfn, maxsize=None):
+        """Read a list of values from the stream using readfn."""
+        num = self.read_int32()
+        if num < 0 or (maxsize and num > maxsize):
+            raise TIOStreamError()
+        return [readfn() for x in range(num)]
+
     def read_address(self):
         """Read an address (usually IPv4 or IPv6) from the stream.
 
@@ -93,6 +102,13 @@ class TIOStream(object):
         for string in lst:
             self.write_string(string)
 
+    def write_stringchunks(self, value):
+        """Write the strings in parts terminated by an empty part."""
+        lst = tuple(value)
+        for i in range(0, len(lst), constants.NSLCD_CHUNK_MAXSTRINGS):
+            self.write_stringlist(lst[i:i + constants.NSLCD_CHUNK_MAXSTRINGS])
+        self.write_int32(0)
+
     @staticmethod
     def _to_address(value):
         # try IPv4 first
@@ -49,8 +49,30 @@ static void test_member_map(void)
   assertstreq(res, "\"\"");
 }
 
+static void test_tokengroups_map(void)
+{
+  const char **var;
+  const char *res;
+  var = attmap_get_var(LM_PASSWD, "tokenGroups");
+  assert(var != NULL);
+  /* disabled by default */
+  assertstreq(*var, "\"\"");
+  /* expected mapping */
+  res = attmap_set_mapping(var, "tokenGroups");
+  assert(res != NULL);
+  assertstreq(res, "tokenGroups");
+  /* no support for expressions */
+  res = attmap_set_mapping(var, "\"$fred\"");
+  assert(res == NULL);
+  /* but support empty string */
+  res = attmap_set_mapping(var, "\"\"");
+  assert(res != NULL);
+  assertstreq(res, "\"\"");
+}
+
 int main(int UNUSED(argc), char UNUSED(*argv[]))
 {
   test_member_map();
+  test_tokengroups_map();
   return EXIT_SUCCESS;
 }
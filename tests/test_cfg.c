@@ -199,6 +199,12 @@ static void test_read(void)
   fp = fopen("temp.cfg", "w");
   assert(fp != NULL);
   fprintf(fp, "# a line of comments\n"
+          "threads 2 10\n"
+          "thread_idle_timelimit 2m\n"
+          "request_limit enumeration 2\n"
+          "pam_reserved_threads 1\n"
+          "queue_limit 20\n"
+          "queue_timelimit 5s\n"
           "uri ldap://127.0.0.1/\n"
           "uri ldap:/// ldaps://127.0.0.1/\n"
           "base dc=test, dc=tld\n"
@@ -210,12 +216,39 @@ static void test_read(void)
           "filter group (&(objeclClass=posixGroup)(gid=1*))\n"
           "\n"
           "scope passwd one\n"
-          "cache dn2uid 10m 1s\n");
+          "cache dn2uid 10m 1s\n"
+          "cache_size dn2uid 1000\n"
+          "cache nested_groups 1h\n"
+          "nss_nested_groups_depth 3\n"
+          "nss_getgrent_prefetchusers yes\n"
+          "cache passwd 10m 1m\n"
+          "cache hosts 1h\n"
+          "shared_connections 2\n"
+          "uri_selection least_outstanding\n"
+          "hedge_percentile 95\n"
+          "health_check_interval 30\n"
+          "connect_stagger 250\n"
+          "connection_pool 1 4\n");
   fclose(fp);
   /* parse the file */
   cfg_defaults(&cfg);
   cfg_read("temp.cfg", &cfg);
   /* check results */
+  assert(cfg.threads == 2);
+  assert(cfg.threads_max == 10);
+  assert(cfg.thread_idle_timelimit == 2 * 60);
+  assert(cfg.request_limit[RC_ENUMERATION] == 2);
+  assert(cfg.request_limit[RC_LOOKUP] == 0);
+  assert(cfg.pam_reserved_threads == 1);
+  assert(cfg.queue_limit == 20);
+  assert(cfg.queue_timelimit == 5);
+  assert(cfg.shared_connections == 2);
+  assert(cfg.uri_selection == URI_LEAST_OUTSTANDING);
+  assert(cfg.hedge_percentile == 95);
+  assert(cfg.health_check_interval == 30);
+  assert(cfg.connect_stagger == 250);
+  assert(cfg.pool_min == 1);
+  assert(cfg.pool_max == 4);
   assert(cfg.uris[0].uri != NULL);
   assert(cfg.uris[1].uri != NULL);
   assert(cfg.uris[2].uri != NULL);
@@ -233,6 +266,15 @@ static void test_read(void)
   assert(passwd_scope == LDAP_SCOPE_ONELEVEL);
   assert(cfg.cache_dn2uid_positive == 10 * 60);
   assert(cfg.cache_dn2uid_negative == 1);
+  assert(cfg.cache_dn2uid_size == 1000);
+  assert(cfg.cache_nested_groups == 60 * 60);
+  assert(cfg.nss_nested_groups_depth == 3);
+  assert(cfg.nss_getgrent_prefetchusers == 1);
+  assert(cfg.cache_positive[LM_PASSWD] == 10 * 60);
+  assert(cfg.cache_negative[LM_PASSWD] == 60);
+  assert(cfg.cache_positive[LM_HOSTS] == 60 * 60);
+  assert(cfg.cache_negative[LM_HOSTS] == 60 * 60);
+  assert(cfg.cache_positive[LM_GROUP] == 0);
   /* remove temporary file */
   remove("temp.cfg");
 }
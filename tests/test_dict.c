@@ -157,6 +157,7 @@ static void test_countelements(int num)
   char buf[80];
   int i, r;
   const char **keys;
+  DICT_LOOP loop;
   /* initialize */
   dict = dict_new();
   /* insert a number of entries */
@@ -172,6 +173,12 @@ static void test_countelements(int num)
     /* nothing */ ;
   /* we should have num elements */
   assert(i == num);
+  /* loop over the dictionary without copying the keys */
+  dict_loop_first(dict, &loop);
+  for (i = 0; dict_loop_next(dict, &loop) != NULL; i++)
+    /* nothing */ ;
+  assert(i == num);
+  assert(dict_loop_next(dict, &loop) == NULL);
   /* free stuff */
   dict_free(dict);
   free(keys);
@@ -0,0 +1,357 @@
+/*
+   test_group.c - simple test for the group module
+   This file is part of the nss-pam-ldapd library.
+
+   Copyright (C) 2026 Arthur de Jong
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301 USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+
+/* we include group.c because we want to test the static methods */
+#include "nslcd/group.c"
+
+/* build a binary SID S-1-5-sub[0]-...-sub[num-1] in buffer and return
+   the length */
+static size_t makesid(char *buffer, int num, const unsigned long int *sub)
+{
+  size_t len = 0;
+  int i;
+  buffer[len++] = 1;
+  buffer[len++] = (char)num;
+  memcpy(buffer + len, "\0\0\0\0\0\5", 6);
+  len += 6;
+  for (i = 0; i < num; i++)
+  {
+    buffer[len++] = (char)(sub[i] & 0xff);
+    buffer[len++] = (char)((sub[i] >> 8) & 0xff);
+    buffer[len++] = (char)((sub[i] >> 16) & 0xff);
+    buffer[len++] = (char)((sub[i] >> 24) & 0xff);
+  }
+  return len;
+}
+
+static void test_tokengroup2gid_domain(void)
+{
+  unsigned long int sub[] = { 21, 3623811015UL, 3361044348UL, 30300820, 1234 };
+  char sid[64];
+  size_t len;
+  gid_t gid = 0;
+  nslcd_cfg->nss_gid_offset = 0;
+  /* a group in the domain */
+  len = makesid(sid, 5, sub);
+  assert(len == 28);
+  assert(tokengroup2gid(sid, len, &gid));
+  assert(gid == 1234);
+  /* the offset is added */
+  nslcd_cfg->nss_gid_offset = 1000;
+  assert(tokengroup2gid(sid, len, &gid));
+  assert(gid == 2234);
+  nslcd_cfg->nss_gid_offset = 0;
+  /* a group in another domain */
+  sub[3] = 30300821;
+  len = makesid(sid, 5, sub);
+  assert(!tokengroup2gid(sid, len, &gid));
+  sub[3] = 30300820;
+  /* the domain itself (no RID) and a SID with an extra sub-authority */
+  len = makesid(sid, 4, sub);
+  assert(!tokengroup2gid(sid, len, &gid));
+  sub[4] = 1234;
+  len = makesid(sid, 5, sub);
+  memcpy(sid + len, "\1\0\0\0", 4);
+  sid[1] = 6;
+  assert(!tokengroup2gid(sid, len + 4, &gid));
+}
+
+static void test_tokengroup2gid_builtin(void)
+{
+  unsigned long int sub[] = { 32, 544 };
+  char sid[64];
+  size_t len;
+  gid_t gid = 0;
+  nslcd_cfg->nss_gid_offset = 0;
+  /* the RIDs of the BUILTIN groups that are mapped */
+  len = makesid(sid, 2, sub);
+  assert(len == 16);
+  assert(tokengroup2gid(sid, len, &gid));
+  assert(gid == 544);
+  sub[1] = 552;
+  len = makesid(sid, 2, sub);
+  assert(tokengroup2gid(sid, len, &gid));
+  assert(gid == 552);
+  /* the offset is added */
+  nslcd_cfg->nss_gid_offset = 1000;
+  assert(tokengroup2gid(sid, len, &gid));
+  assert(gid == 1552);
+  nslcd_cfg->nss_gid_offset = 0;
+  /* RIDs outside the range are ignored */
+  sub[1] = 543;
+  len = makesid(sid, 2, sub);
+  assert(!tokengroup2gid(sid, len, &gid));
+  sub[1] = 553;
+  len = makesid(sid, 2, sub);
+  assert(!tokengroup2gid(sid, len, &gid));
+  /* other well-known SIDs are ignored */
+  sub[0] = 18;
+  len = makesid(sid, 1, sub);
+  assert(!tokengroup2gid(sid, len, &gid));
+}
+
+static void test_tokengroup2gid_short(void)
+{
+  unsigned long int sub[] = { 21, 3623811015UL, 3361044348UL, 30300820, 1234 };
+  unsigned long int bsub[] = { 32, 544 };
+  char sid[64];
+  size_t len;
+  gid_t gid = 0;
+  /* values that match the prefix but are too short to hold the RID */
+  len = makesid(sid, 5, sub);
+  assert(!tokengroup2gid(sid, len - 1, &gid));
+  assert(!tokengroup2gid(sid, len - 4, &gid));
+  assert(!tokengroup2gid(sid, 8, &gid));
+  assert(!tokengroup2gid(sid, 1, &gid));
+  assert(!tokengroup2gid(sid, 0, &gid));
+  len = makesid(sid, 2, bsub);
+  assert(!tokengroup2gid(sid, len - 1, &gid));
+  assert(!tokengroup2gid(sid, len - 4, &gid));
+  assert(!tokengroup2gid(sid, 0, &gid));
+}
+
+/* the DN of the user entry that the LDAP stand-in returns */
+#define TEST_USERDN "cn=Test User,ou=people,dc=test,dc=tld"
+
+/* read len bytes from the socket, returns -1 on errors and end of file */
+static int readall(int fd, char *buffer, size_t len)
+{
+  ssize_t rv;
+  while (len > 0)
+  {
+    rv = read(fd, buffer, len);
+    if (rv <= 0)
+      return -1;
+    buffer += rv;
+    len -= rv;
+  }
+  return 0;
+}
+
+/* read a complete LDAP message from the socket, returns the length of
+   the message or -1 on errors and end of file */
+static ssize_t ldapserver_read(int fd, char *buffer, size_t size)
+{
+  size_t hdr = 2, len, i;
+  if (readall(fd, buffer, 2))
+    return -1;
+  len = buffer[1] & 0xff;
+  /* the long form of the length */
+  if (len & 0x80)
+  {
+    hdr += len & 0x7f;
+    if ((hdr > 6) || readall(fd, buffer + 2, hdr - 2))
+      return -1;
+    for (len = 0, i = 2; i < hdr; i++)
+      len = (len << 8) | (buffer[i] & 0xff);
+  }
+  if (((hdr + len) > size) || readall(fd, buffer + hdr, len))
+    return -1;
+  return hdr + len;
+}
+
+/* write the message to the socket and free it */
+static void ldapserver_send(int fd, BerElement *ber)
+{
+  struct berval *bv;
+  assert(ber_flatten(ber, &bv) == 0);
+  assert(write(fd, bv->bv_val, bv->bv_len) == (ssize_t)bv->bv_len);
+  ber_bvfree(bv);
+  ber_free(ber, 1);
+}
+
+/* write the user entry with the tokenGroups attribute, the values that
+   should be ignored are from another domain or are too short */
+static void ldapserver_tokengroups(int fd, ber_int_t msgid)
+{
+  unsigned long int sub[] = { 21, 3623811015UL, 3361044348UL, 30300820, 1234 };
+  unsigned long int bsub[] = { 32, 544 };
+  char sid[64];
+  size_t len;
+  BerElement *ber;
+  ber = ber_alloc_t(LBER_USE_DER);
+  assert(ber != NULL);
+  ber_printf(ber, "{it{s{{s[", msgid, (ber_tag_t)LDAP_RES_SEARCH_ENTRY,
+             TEST_USERDN, "tokenGroups");
+  len = makesid(sid, 5, sub);
+  ber_printf(ber, "o", sid, (ber_len_t)len);
+  ber_printf(ber, "o", sid, (ber_len_t)(len - 1));
+  len = makesid(sid, 2, bsub);
+  ber_printf(ber, "o", sid, (ber_len_t)len);
+  sub[3] = 30300821;
+  len = makesid(sid, 5, sub);
+  ber_printf(ber, "o", sid, (ber_len_t)len);
+  ber_printf(ber, "]}}}}");
+  ldapserver_send(fd, ber);
+}
+
+/* a minimal LDAP server that accepts any bind, returns the user entry
+   for subtree searches and the tokenGroups of the user for base
+   searches */
+static void *ldapserver(void *arg)
+{
+  int sock = *(int *)arg;
+  int csock;
+  char buffer[4096];
+  ssize_t len;
+  struct berval msg, base;
+  BerElement *ber;
+  ber_int_t msgid, scope;
+  ber_tag_t tag;
+  while ((csock = accept(sock, NULL, NULL)) >= 0)
+  {
+    while ((len = ldapserver_read(csock, buffer, sizeof(buffer))) > 0)
+    {
+      msg.bv_val = buffer;
+      msg.bv_len = len;
+      ber = ber_init(&msg);
+      assert(ber != NULL);
+      assert(ber_scanf(ber, "{it", &msgid, &tag) != LBER_ERROR);
+      if (tag == LDAP_REQ_UNBIND)
+      {
+        ber_free(ber, 1);
+        break;
+      }
+      else if (tag == LDAP_REQ_BIND)
+      {
+        ber_free(ber, 1);
+        ber = ber_alloc_t(LBER_USE_DER);
+        ber_printf(ber, "{it{ess}}", msgid, (ber_tag_t)LDAP_RES_BIND,
+                   (ber_int_t)LDAP_SUCCESS, "", "");
+        ldapserver_send(csock, ber);
+      }
+      else if (tag == LDAP_REQ_SEARCH)
+      {
+        assert(ber_scanf(ber, "{mi", &base, &scope) != LBER_ERROR);
+        if (scope != LDAP_SCOPE_BASE)
+        {
+          ber_free(ber, 1);
+          ber = ber_alloc_t(LBER_USE_DER);
+          ber_printf(ber, "{it{s{{s[s]}{s[s]}}}}", msgid,
+                     (ber_tag_t)LDAP_RES_SEARCH_ENTRY, TEST_USERDN,
+                     "uid", "testuser", "uidNumber", "1000");
+          ldapserver_send(csock, ber);
+        }
+        else
+        {
+          assert(strncmp(base.bv_val, TEST_USERDN, base.bv_len) == 0);
+          ber_free(ber, 1);
+          ldapserver_tokengroups(csock, msgid);
+        }
+        ber = ber_alloc_t(LBER_USE_DER);
+        ber_printf(ber, "{it{ess}}", msgid, (ber_tag_t)LDAP_RES_SEARCH_RESULT,
+                   (ber_int_t)LDAP_SUCCESS, "", "");
+        ldapserver_send(csock, ber);
+      }
+      else
+        ber_free(ber, 1);
+    }
+    (void)close(csock);
+  }
+  return NULL;
+}
+
+/* look up the groups of the user from the tokenGroups attribute that is
+   served by the LDAP stand-in */
+static void test_write_groups_bytokengroups(void)
+{
+  int sock, sp[2];
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  pthread_t thread;
+  char uri[64];
+  MYLDAP_SESSION *session;
+  TFILE *fp;
+  int32_t buf[8];
+  /* start the LDAP stand-in on a free port */
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  assert(sock >= 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  assert(listen(sock, 4) == 0);
+  assert(getsockname(sock, (struct sockaddr *)&addr, &addrlen) == 0);
+  assert(pthread_create(&thread, NULL, ldapserver, &sock) == 0);
+  snprintf(uri, sizeof(uri), "ldap://127.0.0.1:%d/", (int)ntohs(addr.sin_port));
+  nslcd_cfg->uris[0].uri = uri;
+  /* the response is written to a socket pair */
+  assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == 0);
+  fp = tio_fdopen(sp[0], 1000, 1000, 1024, 1024, 1024, 1024);
+  assert(fp != NULL);
+  session = myldap_create_session();
+  assert(write_groups_bytokengroups(fp, session, "testuser") == LDAP_SUCCESS);
+  myldap_session_close(session);
+  assert(tio_close(fp) == 0);
+  /* only the group from the domain and the BUILTIN group are returned */
+  assert(read(sp[1], buf, sizeof(buf)) == 4 * sizeof(int32_t));
+  assert(ntohl(buf[0]) == NSLCD_RESULT_BEGIN);
+  assert(ntohl(buf[1]) == 1234);
+  assert(ntohl(buf[2]) == NSLCD_RESULT_BEGIN);
+  assert(ntohl(buf[3]) == 544);
+  (void)close(sp[1]);
+}
+
+/* the main program... */
+int main(int UNUSED(argc), char UNUSED(*argv[]))
+{
+  char *srcdir;
+  char fname[100];
+  /* build the name of the file */
+  srcdir = getenv("srcdir");
+  if (srcdir == NULL)
+    srcdir = ".";
+  snprintf(fname, sizeof(fname), "%s/nslcd-test.conf", srcdir);
+  fname[sizeof(fname) - 1] = '\0';
+  /* ensure that file is not world readable for configuration parsing to
+     succeed */
+  (void)chmod(fname, (mode_t)0660);
+  /* initialize configuration */
+  cfg_init(fname);
+  /* partially initialize logging */
+  log_setdefaultloglevel(LOG_DEBUG);
+  /* map group ids to SIDs in the domain */
+  attmap_group_gidNumber = "objectSid:S-1-5-21-3623811015-3361044348-30300820";
+  attmap_passwd_tokenGroups = "tokenGroups";
+  passwd_init();
+  group_init();
+  /* run the tests */
+  test_tokengroup2gid_domain();
+  test_tokengroup2gid_builtin();
+  test_tokengroup2gid_short();
+  test_write_groups_bytokengroups();
+  return 0;
+}
@@ -0,0 +1,244 @@
+/*
+   test_nssreuse.c - tests for reusing the socket to nslcd in NSS lookups
+   This file is part of the nss-pam-ldapd library.
+
+   Copyright (C) 2026 Arthur de Jong
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+   02110-1301 USA
+*/
+
+/* we include the source to connect to a test socket instead of the
+   compiled-in socket location */
+#define nslcd_client_open nslcd_client_open_default
+#include "common/nslcd-prot.c"
+#undef nslcd_client_open
+
+#include <assert.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+/* the socket in the build directory */
+#define TEST_SOCKET "test_nssreuse.sock"
+
+static TFILE *nslcd_client_open(void)
+{
+  int sock;
+  struct sockaddr_un addr;
+  TFILE *fp;
+  if ((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
+    return NULL;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, TEST_SOCKET, sizeof(addr.sun_path) - 1);
+  if (connect(sock, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0)
+  {
+    (void)close(sock);
+    return NULL;
+  }
+  if ((fp = tio_fdopen(sock, READ_TIMEOUT, WRITE_TIMEOUT,
+                       READBUFFER_MINSIZE, READBUFFER_MAXSIZE,
+                       WRITEBUFFER_MINSIZE, WRITEBUFFER_MAXSIZE)) == NULL)
+    (void)close(sock);
+  return fp;
+}
+
+#include "nss/common.h"
+
+int NSS_NAME(enablelookups) = 1;
+
+/* what the server does with the connections it accepts */
+#define SERVER_KEEP       0  /* answer all requests */
+#define SERVER_CLOSE      1  /* close the connection after answering */
+#define SERVER_DROPSECOND 2  /* close when the second request arrives */
+#define SERVER_SHUTREAD   3  /* stop reading after answering */
+
+static volatile int server_mode;
+static volatile int server_accepted;
+
+/* read a request and write a response with a single value, returns -1 if
+   the connection should be closed and 1 if the server should stop
+   reading from it (the mode is checked when the request arrives because
+   the client may change it as soon as the response was read) */
+static int handle_request(TFILE *fp, int num)
+{
+  int32_t tmpint32;
+  char name[64];
+  int mode;
+  if ((tio_read(fp, &tmpint32, sizeof(int32_t)) != 0) ||
+      (tio_read(fp, &tmpint32, sizeof(int32_t)) != 0) ||
+      (tio_read(fp, &tmpint32, sizeof(int32_t)) != 0))
+    return -1;
+  tmpint32 = ntohl(tmpint32);
+  assert((tmpint32 > 0) && (tmpint32 < (int32_t)sizeof(name)));
+  if (tio_read(fp, name, tmpint32) != 0)
+    return -1;
+  mode = server_mode;
+  if ((mode == SERVER_DROPSECOND) && (num > 0))
+    return -1;
+  tmpint32 = htonl(NSLCD_VERSION);
+  tio_write(fp, &tmpint32, sizeof(int32_t));
+  tmpint32 = htonl(NSLCD_ACTION_PASSWD_BYNAME);
+  tio_write(fp, &tmpint32, sizeof(int32_t));
+  tmpint32 = htonl(NSLCD_RESULT_BEGIN);
+  tio_write(fp, &tmpint32, sizeof(int32_t));
+  tmpint32 = htonl(42);
+  tio_write(fp, &tmpint32, sizeof(int32_t));
+  tmpint32 = htonl(NSLCD_RESULT_END);
+  tio_write(fp, &tmpint32, sizeof(int32_t));
+  if (tio_flush(fp) || (mode == SERVER_CLOSE))
+    return -1;
+  return (mode == SERVER_SHUTREAD) ? 1 : 0;
+}
+
+static void *server(void *arg)
+{
+  int sock = *(int *)arg;
+  int csock, num, rv;
+  TFILE *fp, *lingering = NULL;
+  while ((csock = accept(sock, NULL, NULL)) >= 0)
+  {
+    server_accepted++;
+    /* close the connection that was no longer read from */
+    if (lingering != NULL)
+    {
+      (void)tio_close(lingering);
+      lingering = NULL;
+    }
+    fp = tio_fdopen(csock, 1000, 1000, 1024, 1024, 1024, 1024);
+    assert(fp != NULL);
+    for (num = 0; (rv = handle_request(fp, num)) == 0; num++)
+      /* nothing */ ;
+    if (rv > 0)
+    {
+      /* writes by the client fail but the socket is not closed yet */
+      (void)shutdown(csock, SHUT_RD);
+      lingering = fp;
+    }
+    else
+      (void)tio_close(fp);
+  }
+  return NULL;
+}
+
+static nss_status_t read_value(TFILE *fp, int32_t *value, int *errnop)
+{
+  int32_t tmpint32;
+  READ_INT32(fp, *value);
+  return NSS_STATUS_SUCCESS;
+}
+
+static nss_status_t lookup(const char *name, int32_t *value,
+                           char *buffer, size_t buflen, int *errnop)
+{
+  NSS_GETONE(NSLCD_ACTION_PASSWD_BYNAME,
+             WRITE_STRING(fp, name),
+             read_value(fp, value, errnop));
+}
+
+static void test_lookupname(const char *name)
+{
+  char buffer[64];
+  int32_t value = 0;
+  int errnop = 0;
+  assert(lookup(name, &value, buffer, sizeof(buffer), &errnop) == NSS_STATUS_SUCCESS);
+  assert(value == 42);
+}
+
+static void test_lookup(void)
+{
+  test_lookupname("test");
+}
+
+/* return the file descriptor of the kept socket */
+static int kept_fd(void)
+{
+  int i;
+  for (i = 0; i < KEEP_CONNECTIONS; i++)
+    if (keep_fp[i] != NULL)
+      return tio_fileno(keep_fp[i]);
+  return -1;
+}
+
+/* the application replaces the file descriptor of the kept socket */
+static void test_replaced(void)
+{
+  int fd, fds[2];
+  struct stat st1, st2;
+  test_lookup();
+  fd = kept_fd();
+  assert(fd >= 0);
+  assert(pipe(fds) == 0);
+  assert(dup2(fds[0], fd) == fd);
+  assert(fstat(fds[0], &st1) == 0);
+  /* the replaced descriptor is not used or closed */
+  test_lookup();
+  assert(fstat(fd, &st2) == 0);
+  assert((st1.st_dev == st2.st_dev) && (st1.st_ino == st2.st_ino));
+  (void)close(fd);
+  (void)close(fds[0]);
+  (void)close(fds[1]);
+}
+
+int main(int UNUSED(argc), char UNUSED(*argv[]))
+{
+#ifdef HAVE___SYNC_LOCK_TEST_AND_SET
+  int sock;
+  struct sockaddr_un addr;
+  pthread_t thread;
+  /* set up the listening socket */
+  (void)unlink(TEST_SOCKET);
+  sock = socket(PF_UNIX, SOCK_STREAM, 0);
+  assert(sock >= 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, TEST_SOCKET, sizeof(addr.sun_path) - 1);
+  assert(bind(sock, (struct sockaddr *)&addr, SUN_LEN(&addr)) == 0);
+  assert(listen(sock, 4) == 0);
+  assert(pthread_create(&thread, NULL, server, &sock) == 0);
+  /* the socket is reused by the second request */
+  server_mode = SERVER_KEEP;
+  test_lookup();
+  test_lookup();
+  assert(server_accepted == 1);
+  /* a socket that was closed after the response is not reused */
+  server_mode = SERVER_CLOSE;
+  test_lookup();
+  sleep(1);
+  test_lookup();
+  assert(server_accepted == 2);
+  /* the server closes the kept socket when the request arrives, the
+     request is retried over a new socket */
+  server_mode = SERVER_DROPSECOND;
+  test_lookup();
+  test_lookup();
+  assert(server_accepted == 4);
+  /* a kept socket that was replaced by the application is left alone */
+  server_mode = SERVER_KEEP;
+  test_replaced();
+  assert(server_accepted == 5);
+  /* writing a request that does not fit in the write buffer fails on the
+     kept socket, the request is retried over a new socket */
+  server_mode = SERVER_SHUTREAD;
+  test_lookup();
+  test_lookupname("a-name-that-does-not-fit-in-the-write-buffer");
+  assert(server_accepted == 6);
+  (void)unlink(TEST_SOCKET);
+  return 0;
+#else /* not HAVE___SYNC_LOCK_TEST_AND_SET */
+  /* sockets are never kept */
+  return 77;
+#endif /* not HAVE___SYNC_LOCK_TEST_AND_SET */
+}
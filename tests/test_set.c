@@ -41,6 +41,7 @@ static int isknownvalue(const char *value)
 int main(int UNUSED(argc), char UNUSED(*argv[]))
 {
   SET *set;
+  SET_LOOP loop;
   const char **list;
   int i;
   const char *v;
@@ -67,6 +68,16 @@ int main(int UNUSED(argc), char UNUSED(*argv[]))
   {
     assert(isknownvalue(list[i]));
   }
+  assert(i == 3);
+
+  /* loop over set contents without a copy */
+  set_loop_first(set, &loop);
+  for (i = 0; (v = set_loop_next(set, &loop)) != NULL; i++)
+  {
+    assert(isknownvalue(v));
+    assert(strcmp(v, list[i]) == 0);
+  }
+  assert(i == 3);
 
   /* remove keys from the set */
   assert(isknownvalue(v = set_pop(set)));
@@ -273,6 +273,91 @@ static void test_reset(void)
   assertok(pthread_join(wthread, NULL) == 0);
 }
 
+/* this test checks whether tio_readable() reports pending data */
+static void test_readable(void)
+{
+  int sp[2];
+  TFILE *fp;
+  uint8_t buf[4] = {1, 2, 3, 4};
+  /* set up the socket pair */
+  assertok(socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == 0);
+  assertok((fp = tio_fdopen(sp[1], 100, 100, 2 * 1024, 4 * 1024, 2 * 1024, 4 * 1024)) != NULL);
+  /* nothing was written yet */
+  assert(!tio_readable(fp));
+  /* data is available on the file descriptor */
+  assertok(write(sp[0], buf, sizeof(buf)) == sizeof(buf));
+  assert(tio_readable(fp));
+  /* data is still available in the buffer */
+  assertok(tio_read(fp, buf, 2) == 0);
+  assert(tio_readable(fp));
+  assertok(tio_read(fp, buf, 2) == 0);
+  assert(!tio_readable(fp));
+  /* the other end closed the connection */
+  assertok(close(sp[0]) == 0);
+  assert(tio_readable(fp));
+  assertok(tio_close(fp) == 0);
+}
+
+static void test_record(void)
+{
+  int sp[2];
+  TFILE *fp;
+  uint8_t buf[1000];
+  uint8_t *rec;
+  size_t len;
+  int i;
+  for (i = 0; i < (int)sizeof(buf); i++)
+    buf[i] = (uint8_t)i;
+  /* set up the socket pair */
+  assertok(socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == 0);
+  assertok((fp = tio_fdopen(sp[1], 100, 100, 2 * 1024, 4 * 1024, 2 * 1024, 4 * 1024)) != NULL);
+  /* data before recording is not kept */
+  assertok(tio_write(fp, buf, 10) == 0);
+  tio_record(fp, 1024);
+  assertok(tio_write(fp, buf, 100) == 0);
+  assertok(tio_write(fp, buf + 100, 900) == 0);
+  rec = tio_record_stop(fp, &len);
+  assert(rec != NULL);
+  assert(len == 1000);
+  assert(memcmp(rec, buf, len) == 0);
+  free(rec);
+  /* recording is stopped */
+  rec = tio_record_stop(fp, &len);
+  assert(rec == NULL);
+  /* too much data is written */
+  tio_record(fp, 512);
+  assertok(tio_write(fp, buf, 500) == 0);
+  assertok(tio_write(fp, buf, 500) == 0);
+  rec = tio_record_stop(fp, &len);
+  assert(rec == NULL);
+  /* clean up */
+  assertok(tio_close(fp) == 0);
+  assertok(close(sp[0]) == 0);
+}
+
+static void test_memopen(void)
+{
+  TFILE *fp;
+  uint8_t *data;
+  uint8_t buf[100];
+  int i;
+  assertok((data = (uint8_t *)malloc(50)) != NULL);
+  for (i = 0; i < 50; i++)
+    data[i] = (uint8_t)i;
+  assertok((fp = tio_memopen(data, 50)) != NULL);
+  /* the data can be read in parts */
+  assertok(tio_read(fp, buf, 20) == 0);
+  assert(memcmp(buf, data, 20) == 0);
+  assertok(tio_skip(fp, 10) == 0);
+  assertok(tio_read(fp, buf, 20) == 0);
+  assert(buf[0] == 30);
+  assert(buf[19] == 49);
+  /* reading past the end fails */
+  assert(tio_read(fp, buf, 1) != 0);
+  /* clean up (this also frees data) */
+  assertok(tio_close(fp) == 0);
+}
+
 /* this test starts a reader and writer and does not write for a while */
 static void test_timeout_reader(void)
 {
@@ -366,6 +451,10 @@ int main(int UNUSED(argc), char UNUSED(*argv[]))
 /*  test_blocks(10, 9, 10, 10); */
   /* set tio_mark() and tio_reset() functions */
   test_reset();
+  /* test tio_readable() */
+  test_readable();
+  test_record();
+  test_memopen();
   /* test timeout functionality */
   test_timeout_reader();
   test_timeout_writer();
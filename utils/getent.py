@@ -53,6 +53,14 @@ parser.add_argument('keys', metavar='KEY', nargs='*',
                     help='filter returned database values by key')
 
 
+def _batches(keys):
+    """Split the keys in lists that can be passed in batch requests."""
+    keys = list(keys)
+    while keys:
+        yield keys[:constants.NSLCD_BATCH_MAXKEYS]
+        keys = keys[constants.NSLCD_BATCH_MAXKEYS:]
+
+
 def write_aliases(con):
     while con.get_response() == constants.NSLCD_RESULT_BEGIN:
         print('%-16s%s' % (
@@ -104,6 +112,19 @@ def getent_group(database, keys=None):
     if not keys:
         write_group(NslcdClient(constants.NSLCD_ACTION_GROUP_ALL))
         return
+    if database != 'group.bymember' and len(keys) > 1:
+        # look up multiple keys with as few requests as possible
+        gids = [int(key) for key in keys if re.match(r'^\d+$', key)]
+        names = [key for key in keys if not re.match(r'^\d+$', key)]
+        for batch in _batches(gids):
+            con = NslcdClient(constants.NSLCD_ACTION_GROUP_BYGIDS)
+            con.write_int32list(batch)
+            write_group(con)
+        for batch in _batches(names):
+            con = NslcdClient(constants.NSLCD_ACTION_GROUP_BYNAMES)
+            con.write_stringlist(batch)
+            write_group(con)
+        return
     for key in keys:
         if database == 'group.bymember':
             con = NslcdClient(constants.NSLCD_ACTION_GROUP_BYMEMBER)
@@ -269,6 +290,19 @@ def getent_passwd(database, keys=None):
     if not keys:
         write_passwd(NslcdClient(constants.NSLCD_ACTION_PASSWD_ALL))
         return
+    if len(keys) > 1:
+        # look up multiple keys with as few requests as possible
+        uids = [int(key) for key in keys if re.match(r'^\d+$', key)]
+        names = [key for key in keys if not re.match(r'^\d+$', key)]
+        for batch in _batches(uids):
+            con = NslcdClient(constants.NSLCD_ACTION_PASSWD_BYUIDS)
+            con.write_int32list(batch)
+            write_passwd(con)
+        for batch in _batches(names):
+            con = NslcdClient(constants.NSLCD_ACTION_PASSWD_BYNAMES)
+            con.write_stringlist(batch)
+            write_passwd(con)
+        return
     for key in keys:
         if re.match(r'^\d+$', key):
             con = NslcdClient(constants.NSLCD_ACTION_PASSWD_BYUID)
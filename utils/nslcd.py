@@ -63,6 +63,16 @@ class NslcdClient(object):
             value = value.encode('utf-8')
         self.write_bytes(value)
 
+    def write_stringlist(self, value):
+        self.write_int32(len(value))
+        for x in value:
+            self.write_string(x)
+
+    def write_int32list(self, value):
+        self.write_int32(len(value))
+        for x in value:
+            self.write_int32(x)
+
     def write_ether(self, value):
         value = struct.pack('BBBBBB', *(int(x, 16) for x in value.split(':')))
         self.write(value)
@@ -121,7 +131,10 @@ class NslcdClient(object):
             # reset action to ensure that it is only the first time
             self.action = None
         # get the NSLCD_RESULT_* marker and return it
-        return self.read_int32()
+        result = self.read_int32()
+        if result == constants.NSLCD_RESULT_TRYAGAIN:
+            raise IOError('nslcd is too busy, try again later')
+        return result
 
     def close(self):
         if hasattr(self, 'fp'):